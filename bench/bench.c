@@ -0,0 +1,370 @@
+/* bench.c
+ *
+ * Times the drawing functions in surface.h across surface sizes and alpha
+ * cases. A summary table goes to stderr and the full results to a JSON
+ * file (or stdout), so runs can be compared over time.
+ *
+ * Usage: bench [-o results.json] [-f name-filter] [-q]
+ */
+
+#include "surface.h"
+#include "convert.h"
+#include "jobs.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#endif
+
+#define MAX_SAMPLES 31
+#define MIN_SAMPLES 5
+#define SAMPLE_NS 2000000.        /* Aim for at least 2ms per sample */
+#define CASE_BUDGET_NS 400000000. /* Stop sampling a case after 0.4s */
+#define WARMUP_NS 20000000.
+
+static double now_ns(void) {
+#if defined(_WIN32)
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER t;
+    if (!freq.QuadPart)
+        QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&t);
+    return (double)t.QuadPart * 1e9 / (double)freq.QuadPart;
+#else
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)t.tv_sec * 1e9 + (double)t.tv_nsec;
+#endif
+}
+
+typedef struct {
+    Surface dst, src;
+    int col;
+    BlendMode mode;
+    int flip;
+} Bench;
+
+typedef struct {
+    const char *name;
+    void (*run)(Bench *b);
+    /* Calls made and pixels touched by one run, for a w x h destination */
+    double (*calls)(int w, int h);
+    double (*pixels)(int w, int h);
+    bool alpha, modes;
+} Case;
+
+static double one(int w, int h) {
+    (void)w;
+    (void)h;
+    return 1.;
+}
+
+static double area(int w, int h) {
+    return (double)w * h;
+}
+
+/* Scaling writes a 2w x 2h output */
+static double scaled_area(int w, int h) {
+    return 4. * w * h;
+}
+
+#define LINES 64
+static double lines(int w, int h) {
+    (void)w;
+    (void)h;
+    return LINES;
+}
+
+static double line_pixels(int w, int h) {
+    return (double)LINES * (w > h ? w : h);
+}
+
+static double circle_pixels(int w, int h) {
+    int r = (w < h ? w : h) / 2 - 1;
+    return 3.14159265 * r * r;
+}
+
+static double tri_pixels(int w, int h) {
+    return (double)w * h / 2.;
+}
+
+static void run_fill(Bench *b) {
+    FillSurface(&b->dst, b->col ^ (b->flip++ & 1));
+}
+
+static void run_clear(Bench *b) {
+    ClearSurface(&b->dst);
+}
+
+static void run_flood(Bench *b) {
+    FloodSurface(&b->dst, b->dst.w / 2, b->dst.h / 2, b->flip++ & 1 ? b->col : ~b->col);
+}
+
+static void run_blend(Bench *b) {
+    for (int y = 0; y < b->dst.h; ++y)
+        for (int x = 0; x < b->dst.w; ++x)
+            BlendPixel(&b->dst, x, y, b->col);
+}
+
+static void run_paste(Bench *b) {
+    PasteSurface(&b->dst, &b->src, 0, 0, b->mode);
+}
+
+static void run_scale(Bench *b) {
+    Surface out;
+    if (ScaleSurface(&b->src, b->dst.w * 2, b->dst.h * 2, &out))
+        DestroySurface(&out);
+}
+
+static void run_rotate(Bench *b) {
+    Surface out;
+    if (RotateSurface(&b->src, 30.f, &out))
+        DestroySurface(&out);
+}
+
+static void run_line(Bench *b) {
+    int w = b->dst.w, h = b->dst.h;
+    for (int i = 0; i < LINES; ++i)
+        DrawLine(&b->dst, i * w / LINES, 0, w - 1 - i * w / LINES, h - 1, b->col, b->mode);
+}
+
+static void run_circle(Bench *b) {
+    int r = (b->dst.w < b->dst.h ? b->dst.w : b->dst.h) / 2 - 1;
+    DrawCircle(&b->dst, b->dst.w / 2, b->dst.h / 2, r, b->col, true, b->mode);
+}
+
+static void run_rect(Bench *b) {
+    DrawRect(&b->dst, 0, 0, b->dst.w, b->dst.h, b->col, true, b->mode);
+}
+
+static void run_tri(Bench *b) {
+    DrawTri(&b->dst, 0, 0, b->dst.w - 1, b->dst.h / 2, 0, b->dst.h - 1, b->col, true, b->mode);
+}
+
+static int passthru_fn(int x, int y, int col) {
+    return col ^ ((x + y) & 1);
+}
+
+static void run_passthru(Bench *b) {
+    PassthruSurface(&b->dst, passthru_fn);
+}
+
+static const Case cases[] = {
+    { "fill", run_fill, one, area, false, false },
+    { "clear", run_clear, one, area, false, false },
+    { "flood", run_flood, one, area, false, false },
+    { "blend", run_blend, area, area, true, false },
+    { "paste", run_paste, one, area, true, true },
+    { "scale", run_scale, one, scaled_area, false, false },
+    { "rotate", run_rotate, one, area, true, false },
+    { "line", run_line, lines, line_pixels, true, true },
+    { "circle", run_circle, one, circle_pixels, true, true },
+    { "rect", run_rect, one, area, true, true },
+    { "tri", run_tri, one, tri_pixels, true, true },
+    { "passthru", run_passthru, one, area, false, false }
+};
+
+static const struct {
+    int w, h;
+} sizes[] = {
+    { 64, 64 },
+    { 512, 512 },
+    { 1920, 1080 }
+};
+
+static const struct {
+    const char *name;
+    unsigned int alpha;
+} alphas[] = {
+    { "opaque", 0xFF },
+    { "translucent", 0x80 }
+};
+
+static const struct {
+    const char *name;
+    BlendMode mode;
+} modes[] = {
+    { "over", BLEND_OVER },
+    { "add", BLEND_ADD },
+    { "multiply", BLEND_MULTIPLY }
+};
+
+typedef struct {
+    const char *name, *alpha, *mode;
+    int w, h, samples;
+    double calls, pixels, min, p50, p90, p99, mean;
+} Result;
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(const double *sorted, int n, double p) {
+    int i = (int)(p / 100. * n + .999999) - 1;
+    return sorted[i < 0 ? 0 : i >= n ? n - 1 : i];
+}
+
+static void fill_random(Surface *s, unsigned int alpha, unsigned int *seed) {
+    for (int i = 0; i < s->w * s->h; ++i) {
+        *seed = *seed * 1664525u + 1013904223u;
+        s->buf[i] = (int)((*seed >> 8 & 0x00FFFFFF) | alpha << 24);
+    }
+}
+
+static bool measure(const Case *c, int w, int h, unsigned int alpha, BlendMode mode, bool quick, Result *r) {
+    Bench b;
+    unsigned int seed = 1;
+    memset(&b, 0, sizeof(Bench));
+    if (!NewSurface(&b.dst, w, h))
+        return false;
+    if (!NewSurface(&b.src, w, h)) {
+        DestroySurface(&b.dst);
+        return false;
+    }
+    fill_random(&b.dst, 0xFF, &seed);
+    fill_random(&b.src, alpha, &seed);
+    b.col = (int)(alpha << 24 | 0x3399CC);
+    b.mode = mode;
+    if (c->run == run_flood)
+        FillSurface(&b.dst, b.col);
+
+    /* Warm up, and work out how many runs make a sample long enough to time */
+    double start = now_ns(), elapsed;
+    int runs = 0;
+    do {
+        c->run(&b);
+        ++runs;
+    } while ((elapsed = now_ns() - start) < (quick ? WARMUP_NS / 10 : WARMUP_NS));
+    double per_run = elapsed / runs;
+    int batch = per_run >= SAMPLE_NS ? 1 : (int)(SAMPLE_NS / per_run) + 1;
+
+    double samples[MAX_SAMPLES], budget = quick ? CASE_BUDGET_NS / 10 : CASE_BUDGET_NS;
+    int n = 0;
+    start = now_ns();
+    while (n < (quick ? MIN_SAMPLES : MAX_SAMPLES) && (n < MIN_SAMPLES || now_ns() - start < budget)) {
+        double t0 = now_ns();
+        for (int i = 0; i < batch; ++i)
+            c->run(&b);
+        samples[n++] = (now_ns() - t0) / batch;
+    }
+    DestroySurface(&b.dst);
+    DestroySurface(&b.src);
+
+    qsort(samples, n, sizeof(double), compare_doubles);
+    double sum = 0.;
+    for (int i = 0; i < n; ++i)
+        sum += samples[i];
+    /* Times are per run, reported per call */
+    double calls = c->calls(w, h);
+    r->name = c->name;
+    r->w = w;
+    r->h = h;
+    r->samples = n;
+    r->calls = calls;
+    r->pixels = c->pixels(w, h);
+    r->min = samples[0] / calls;
+    r->p50 = percentile(samples, n, 50) / calls;
+    r->p90 = percentile(samples, n, 90) / calls;
+    r->p99 = percentile(samples, n, 99) / calls;
+    r->mean = sum / n / calls;
+    return true;
+}
+
+static double mpix(const Result *r) {
+    return r->pixels / (r->p50 * r->calls) * 1e3;
+}
+
+/* Cases without an alpha or mode dimension report null */
+static const char *json_string(const char *str, char *buf, size_t size) {
+    if (!strcmp(str, "-"))
+        return "null";
+    snprintf(buf, size, "\"%s\"", str);
+    return buf;
+}
+
+static void write_json(FILE *fh, const Result *results, int count) {
+    char stamp[32];
+    time_t t = time(NULL);
+    strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%SZ", gmtime(&t));
+    fprintf(fh, "{\n  \"version\": 1,\n  \"timestamp\": \"%s\",\n", stamp);
+    fprintf(fh, "  \"host\": {\"threads\": %d, \"converter\": \"%s\", \"compiler\": \"%s\"},\n", JobThreadCount(), ConverterBackend(),
+#if defined(__VERSION__)
+            __VERSION__
+#else
+            "unknown"
+#endif
+            );
+    fprintf(fh, "  \"results\": [\n");
+    for (int i = 0; i < count; ++i) {
+        const Result *r = &results[i];
+        char alpha[32], mode[32];
+        fprintf(fh, "    {\"name\": \"%s\", \"width\": %d, \"height\": %d, \"alpha\": %s, \"mode\": %s, "
+                "\"samples\": %d, \"calls_per_run\": %.0f, \"pixels_per_run\": %.0f, "
+                "\"ns_per_call\": {\"min\": %.1f, \"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, \"mean\": %.1f}, "
+                "\"mpix_per_s\": %.2f}%s\n",
+                r->name, r->w, r->h, json_string(r->alpha, alpha, sizeof(alpha)), json_string(r->mode, mode, sizeof(mode)), r->samples, r->calls, r->pixels,
+                r->min, r->p50, r->p90, r->p99, r->mean, mpix(r), i + 1 < count ? "," : "");
+    }
+    fprintf(fh, "  ]\n}\n");
+}
+
+int main(int argc, const char *argv[]) {
+    const char *out = NULL, *filter = NULL;
+    bool quick = false;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "-o") && i + 1 < argc)
+            out = argv[++i];
+        else if (!strcmp(argv[i], "-f") && i + 1 < argc)
+            filter = argv[++i];
+        else if (!strcmp(argv[i], "-q"))
+            quick = true;
+        else {
+            fprintf(stderr, "usage: %s [-o results.json] [-f name-filter] [-q]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    int max = (int)(sizeof(cases) / sizeof(cases[0]) * (sizeof(sizes) / sizeof(sizes[0])) *
+                    (sizeof(alphas) / sizeof(alphas[0])) * (sizeof(modes) / sizeof(modes[0])));
+    Result *results = malloc(max * sizeof(Result));
+    if (!results)
+        return 1;
+    int count = 0;
+    fprintf(stderr, "%-10s %-10s %-12s %-9s %14s %14s %14s %12s\n", "name", "size", "alpha", "mode", "p50 ns/call", "p90 ns/call", "p99 ns/call", "Mpix/s");
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); ++c) {
+        if (filter && !strstr(cases[c].name, filter))
+            continue;
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s)
+            for (size_t a = 0; a < (cases[c].alpha ? sizeof(alphas) / sizeof(alphas[0]) : 1); ++a)
+                for (size_t m = 0; m < (cases[c].modes ? sizeof(modes) / sizeof(modes[0]) : 1); ++m) {
+                    Result *r = &results[count];
+                    if (!measure(&cases[c], sizes[s].w, sizes[s].h, alphas[a].alpha, modes[m].mode, quick, r)) {
+                        fprintf(stderr, "%s: failed to create %dx%d surfaces\n", cases[c].name, sizes[s].w, sizes[s].h);
+                        continue;
+                    }
+                    r->alpha = cases[c].alpha ? alphas[a].name : "-";
+                    r->mode = cases[c].modes ? modes[m].name : "-";
+                    char size[24];
+                    snprintf(size, sizeof(size), "%dx%d", r->w, r->h);
+                    fprintf(stderr, "%-10s %-10s %-12s %-9s %14.1f %14.1f %14.1f %12.2f\n", r->name, size, r->alpha, r->mode, r->p50, r->p90, r->p99, mpix(r));
+                    ++count;
+                }
+    }
+
+    FILE *fh = out ? fopen(out, "w") : stdout;
+    if (!fh) {
+        fprintf(stderr, "can't open %s\n", out);
+        free(results);
+        return 1;
+    }
+    write_json(fh, results, count);
+    if (out)
+        fclose(fh);
+    free(results);
+    return 0;
+}
@@ -3,24 +3,26 @@
 #include <stdio.h> // printf()
 #include <stdlib.h> // abort()
 
-void error_cb(enum window_error e, const char *file, const char *func, const char *msg, int line) {
+void error_cb(WindowError e, const char *msg, const char *file, const char *func, int line) {
     printf("ERROR! (%s, %s:%d) %s\n", file, func, line, msg);
     abort();
 }
 
 int main(int argc, const char *argv[]) {
-    struct window_t w;
-    window(&w, "soft example", 640, 480, NONE);
-    window_error_callback(error_cb);
+    Window w;
+    SetWindowErrorCallback(error_cb);
+    NewWindow(&w, "soft example", 640, 480, DEFAULT_FLAGS);
     
-    struct surface_t s;
-    surface_create(&s, 640, 480);
-    surface_fill(&s, RED);
+    Surface s;
+    NewSurface(&s, 640, 480);
+    FillSurface(&s, rgb(255, 0, 0));
     
-    while (!closed(&w)) {
-        events();
-        flush(&w, &s);
+    // Nothing changes between frames, so sleep until there are events instead of spinning
+    while (!IsWindowClosed(&w)) {
+        Flush(&w, &s);
+        WaitEvents();
     }
-    release();
+    DestroySurface(&s);
+    CloseAllWindows();
     return 0;
 }
@@ -0,0 +1,108 @@
+/* convert.h
+ *
+ * Created by George Watson on 26/11/2017.
+ * Copyright © 2013-2021 George Watson. All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * *   Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * *   Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * *   Neither the name of the <organization> nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GEORGE WATSON BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef convert_h
+#define convert_h
+#if defined(__cplusplus)
+extern "C" {
+#endif
+#include "surface.h"
+#include <stddef.h>
+
+/*!
+ * @typedef PixelFormat
+ * @brief A list of pixel layouts the converters understand. Byte formats are named in memory order
+ * @constant PIXEL_ARGB32 Native packed int, the layout of SURFACE_ARGB
+ * @constant PIXEL_BGRA8888 Bytes B, G, R, A
+ * @constant PIXEL_RGBA8888 Bytes R, G, B, A
+ * @constant PIXEL_ARGB8888 Bytes A, R, G, B
+ * @constant PIXEL_RGBX8888 Bytes R, G, B, X. Alpha is written as 255 and read as opaque
+ * @constant PIXEL_RGB888 Bytes R, G, B
+ * @constant PIXEL_BGR888 Bytes B, G, R
+ * @constant PIXEL_RGB565 Native packed short, the layout of SURFACE_RGB565
+ */
+typedef enum {
+    PIXEL_ARGB32 = 0,
+    PIXEL_BGRA8888,
+    PIXEL_RGBA8888,
+    PIXEL_ARGB8888,
+    PIXEL_RGBX8888,
+    PIXEL_RGB888,
+    PIXEL_BGR888,
+    PIXEL_RGB565,
+    PIXEL_FORMAT_COUNT
+} PixelFormat;
+
+/*!
+ * @discussion Number of bytes a single pixel takes for a layout
+ * @param format Pixel layout
+ * @return Bytes per pixel
+ */
+int PixelFormatSize(PixelFormat format);
+/*!
+ * @discussion Convert a run of pixels from one layout to another. The fastest kernel the CPU supports is picked on first use
+ * @param src Source pixels
+ * @param sf Source layout
+ * @param dst Destination pixels (must not overlap src unless the layouts are the same size)
+ * @param df Destination layout
+ * @param n Number of pixels
+ */
+void ConvertPixels(const void *src, PixelFormat sf, void *dst, PixelFormat df, size_t n);
+/*!
+ * @discussion Convert a block of pixel rows from one layout to another
+ * @param src Source pixels
+ * @param src_pitch Bytes between source rows
+ * @param sf Source layout
+ * @param dst Destination pixels
+ * @param dst_pitch Bytes between destination rows
+ * @param df Destination layout
+ * @param w Pixels per row
+ * @param h Number of rows
+ */
+void ConvertPixelRows(const void *src, size_t src_pitch, PixelFormat sf, void *dst, size_t dst_pitch, PixelFormat df, int w, int h);
+/*!
+ * @discussion Multiply the colour channels of ARGB pixels by their alpha, in place
+ * @param buf ARGB pixels
+ * @param n Number of pixels
+ */
+void PremultiplyPixels(int *buf, size_t n);
+/*!
+ * @discussion Divide the colour channels of premultiplied ARGB pixels by their alpha, in place
+ * @param buf Premultiplied ARGB pixels
+ * @param n Number of pixels
+ */
+void UnpremultiplyPixels(int *buf, size_t n);
+/*!
+ * @discussion Name of the instruction set the converters dispatched to, for logging
+ * @return "avx2", "ssse3", "neon" or "scalar"
+ */
+const char *ConverterBackend(void);
+
+#if defined(__cplusplus)
+}
+#endif
+#endif // convert_h
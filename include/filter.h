@@ -0,0 +1,184 @@
+/* filter.h
+ *
+ * Created by George Watson on 26/11/2017.
+ * Copyright © 2013-2021 George Watson. All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * *   Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * *   Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * *   Neither the name of the <organization> nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GEORGE WATSON BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef filter_h
+#define filter_h
+#if defined(__cplusplus)
+extern "C" {
+#endif
+#include "surface.h"
+#include <stdint.h>
+
+/*!
+ * @typedef BlurMode
+ * @brief Blur algorithms for BlurSurface
+ * @constant BLUR_BOX Single box filter, constant time per pixel
+ * @constant BLUR_TRIPLE_BOX Three box passes sized to approximate a Gaussian, constant time per pixel
+ * @constant BLUR_GAUSSIAN True separable Gaussian, cost grows with the radius
+ */
+typedef enum {
+    BLUR_BOX = 0,
+    BLUR_TRIPLE_BOX,
+    BLUR_GAUSSIAN
+} BlurMode;
+
+/*!
+ * @discussion Blur a surface in place. Edges are extended, and colours are weighted by alpha so transparent pixels don't bleed dark fringes. Rows and columns are spread across the worker threads (see jobs.h)
+ * @param s Surface to blur
+ * @param radius Blur radius in pixels. For the Gaussian modes the kernel reaches out to the radius, with a standard deviation of a third of it
+ * @param mode Blur algorithm
+ * @return Boolean for success
+ */
+bool BlurSurface(Surface *s, int radius, BlurMode mode);
+
+/*!
+ * @typedef Kernel
+ * @brief A square convolution kernel
+ * @constant size Width and height of the kernel, odd and at most 63
+ * @constant weights size * size weights, row by row
+ * @constant divisor Each sum is divided by this (0 is treated as 1)
+ * @constant bias Added to each sum after dividing
+ * @constant alpha Convolve the alpha channel as well, otherwise it's copied from the source
+ */
+typedef struct {
+    int size;
+    const float *weights;
+    float divisor, bias;
+    bool alpha;
+} Kernel;
+
+/*!
+ * @typedef KernelPreset
+ * @brief Common kernels for PresetKernel
+ * @constant KERNEL_SHARPEN 3x3 sharpen
+ * @constant KERNEL_EDGE 3x3 Laplacian edge detect
+ * @constant KERNEL_EMBOSS 3x3 emboss
+ * @constant KERNEL_SOBEL_X 3x3 horizontal Sobel, biased to mid gray
+ * @constant KERNEL_SOBEL_Y 3x3 vertical Sobel, biased to mid gray
+ * @constant KERNEL_GAUSSIAN3 3x3 binomial blur
+ * @constant KERNEL_GAUSSIAN5 5x5 binomial blur
+ */
+typedef enum {
+    KERNEL_SHARPEN = 0,
+    KERNEL_EDGE,
+    KERNEL_EMBOSS,
+    KERNEL_SOBEL_X,
+    KERNEL_SOBEL_Y,
+    KERNEL_GAUSSIAN3,
+    KERNEL_GAUSSIAN5
+} KernelPreset;
+
+/*!
+ * @discussion Fill in one of the built in kernels
+ * @param preset Which kernel
+ * @param k Kernel to fill in
+ * @return Boolean for success
+ */
+bool PresetKernel(KernelPreset preset, Kernel *k);
+/*!
+ * @discussion Convolve a surface with a kernel in place. Integer 3x3 and 5x5 kernels, and larger kernels that split into a row and a column, get their own faster paths. The image is worked through in cache sized tiles across the worker threads, and edges are extended
+ * @param s Surface object
+ * @param k Kernel to apply
+ * @return Boolean for success
+ */
+bool ConvolveSurface(Surface *s, const Kernel *k);
+/*!
+ * @discussion Convolve one view into another. Pixels outside the source view are treated as copies of its edge
+ * @param dst View to write to, the same size as src and not overlapping it
+ * @param src View to read from
+ * @param k Kernel to apply
+ * @return Boolean for success
+ */
+bool ConvolveView(SurfaceView *dst, const SurfaceView *src, const Kernel *k);
+
+/*!
+ * @typedef SummedAreaTable
+ * @brief Per channel running sums of a surface, for constant time sums over any rectangle
+ * @constant w Width of the source surface
+ * @constant h Height of the source surface
+ * @constant wide True if the sums are 64-bit, picked when 32-bit could overflow
+ * @constant sums (w + 1) * (h + 1) sums of the four channels
+ * @constant squares Sums of the squared channels, or NULL if they weren't built
+ */
+typedef struct {
+    int w, h;
+    bool wide;
+    void *sums, *squares;
+} SummedAreaTable;
+
+/*!
+ * @discussion Build a summed area table from a surface. Sums are kept in 32-bit integers when the whole image can't overflow them, otherwise 64-bit
+ * @param t Table to build
+ * @param s Surface to sum
+ * @param squares Also sum the squared channels, needed for SummedAreaVariance
+ * @return Boolean for success
+ */
+bool NewSummedAreaTable(SummedAreaTable *t, Surface *s, bool squares);
+/*!
+ * @discussion Free a summed area table
+ * @param t Table to free
+ */
+void DestroySummedAreaTable(SummedAreaTable *t);
+/*!
+ * @discussion Sum each channel over a rectangle, clipped to the table
+ * @param t Table to query
+ * @param x X position of rectangle
+ * @param y Y position of rectangle
+ * @param w Width of rectangle
+ * @param h Height of rectangle
+ * @param sum Sums in the order red, green, blue, alpha
+ * @return Number of pixels summed, 0 if the rectangle is outside the table
+ */
+int64_t SummedAreaSum(SummedAreaTable *t, int x, int y, int w, int h, uint64_t sum[4]);
+/*!
+ * @discussion Average colour of a rectangle, clipped to the table
+ * @param t Table to query
+ * @param x X position of rectangle
+ * @param y Y position of rectangle
+ * @param w Width of rectangle
+ * @param h Height of rectangle
+ * @return Rounded mean colour, 0 if the rectangle is outside the table
+ */
+int SummedAreaMean(SummedAreaTable *t, int x, int y, int w, int h);
+/*!
+ * @discussion Mean and variance of each channel over a rectangle, clipped to the table
+ * @param t Table to query, built with squares
+ * @param x X position of rectangle
+ * @param y Y position of rectangle
+ * @param w Width of rectangle
+ * @param h Height of rectangle
+ * @param mean Means in the order red, green, blue, alpha (can be NULL)
+ * @param variance Variances in the same order
+ * @return Boolean for success, false if the table has no squares or the rectangle is outside it
+ */
+bool SummedAreaVariance(SummedAreaTable *t, int x, int y, int w, int h, float mean[4], float variance[4]);
+
+#if defined(__cplusplus)
+}
+#endif
+#endif // filter_h
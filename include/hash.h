@@ -0,0 +1,123 @@
+/* hash.h
+ *
+ * Created by George Watson on 26/11/2017.
+ * Copyright © 2013-2021 George Watson. All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * *   Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * *   Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * *   Neither the name of the <organization> nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GEORGE WATSON BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef hash_h
+#define hash_h
+#if defined(__cplusplus)
+extern "C" {
+#endif
+#include "surface.h"
+#include <stdint.h>
+
+/*!
+ * @typedef TileHashes
+ * @brief A grid of hashes over fixed size tiles of a surface, to find which parts of a frame changed without keeping a copy of it
+ * @constant w Width of the hashed surface
+ * @constant h Height of the hashed surface
+ * @constant tile Width and height of a tile
+ * @constant cols Number of tile columns
+ * @constant rows Number of tile rows
+ * @constant hashes cols * rows tile hashes, row by row
+ */
+typedef struct {
+    int w, h, tile, cols, rows;
+    uint64_t *hashes;
+} TileHashes;
+
+/*!
+ * @typedef SurfaceMetrics
+ * @brief How far apart two surfaces are, over all four channels
+ * @constant max_delta Largest difference of any channel of any pixel
+ * @constant differing Number of pixels that differ at all
+ * @constant mse Mean squared error per channel
+ * @constant psnr Peak signal to noise ratio in decibels, INFINITY when the surfaces match
+ */
+typedef struct {
+    int max_delta;
+    size_t differing;
+    double mse, psnr;
+} SurfaceMetrics;
+
+/*!
+ * @discussion Hash a run of bytes. The SIMD and scalar paths give the same result
+ * @param data Bytes to hash
+ * @param size Number of bytes
+ * @param seed Starting value, pass a previous hash to chain
+ * @return 64-bit hash
+ */
+uint64_t HashBytes(const void *data, size_t size, uint64_t seed);
+/*!
+ * @discussion Hash the pixels, size and format of a surface
+ * @param s Surface object
+ * @return 64-bit hash
+ */
+uint64_t HashSurface(Surface *s);
+/*!
+ * @discussion Hash every tile of a surface into a new grid
+ * @param g Grid to create
+ * @param s Surface to hash
+ * @param tile Width and height of a tile, 0 for the default (64)
+ * @return Boolean for success
+ */
+bool NewTileHashes(TileHashes *g, Surface *s, int tile);
+/*!
+ * @discussion Rehash a surface into a grid and find the tiles that changed. Neighbouring changed tiles are merged into rectangles, and if there are more than max_rects the last one covers all the rest. A grid of a different size counts as fully changed
+ * @param g Grid to update
+ * @param s Surface to hash
+ * @param rects Array for the changed rectangles, clipped to the surface (can be NULL)
+ * @param max_rects Size of rects
+ * @return Number of rectangles (or changed tiles when rects is NULL), 0 when nothing changed, -1 on failure
+ */
+int UpdateTileHashes(TileHashes *g, Surface *s, SurfaceRect *rects, int max_rects);
+/*!
+ * @discussion Free a tile hash grid
+ * @param g Grid to free
+ */
+void DestroyTileHashes(TileHashes *g);
+/*!
+ * @discussion Find the regions where two surfaces of the same size differ. Differing tiles are grouped with their neighbours and each group's rectangle is shrunk to the pixels that actually differ
+ * @param a First surface
+ * @param b Second surface
+ * @param rects Array for the rectangles
+ * @param max_rects Size of rects. Groups beyond it are merged into the last rectangle
+ * @return Number of rectangles, 0 when the surfaces match, -1 if they can't be compared
+ */
+int DiffSurfaces(Surface *a, Surface *b, SurfaceRect *rects, int max_rects);
+/*!
+ * @discussion Measure how far apart two surfaces of the same size are
+ * @param a First surface
+ * @param b Second surface
+ * @param m Metrics to fill in
+ * @return Boolean for success, false if the sizes differ
+ */
+bool CompareSurfaces(Surface *a, Surface *b, SurfaceMetrics *m);
+
+#if defined(__cplusplus)
+}
+#endif
+#endif // hash_h
@@ -0,0 +1,158 @@
+/* headless.h
+ *
+ * Created by George Watson on 26/11/2017.
+ * Copyright © 2013-2021 George Watson. All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * *   Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * *   Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * *   Neither the name of the <organization> nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GEORGE WATSON BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef headless_h
+#define headless_h
+#if defined(__cplusplus)
+extern "C" {
+#endif
+#include "window.h"
+#include "convert.h"
+
+/*
+ * The headless backend (src/window_headless.c) implements window.h against
+ * in-memory framebuffers, for servers and CI. Build it in place of the
+ * platform backend. Input is injected by hand or from a script and is
+ * delivered by PollEvents, and every Flush can be handed to a callback or
+ * streamed as raw pixels to a file descriptor.
+ */
+
+#if !defined(WINDOW_HEADLESS_SCREEN_W)
+#define WINDOW_HEADLESS_SCREEN_W 1920
+#endif
+#if !defined(WINDOW_HEADLESS_SCREEN_H)
+#define WINDOW_HEADLESS_SCREEN_H 1080
+#endif
+
+/*!
+ * @discussion Get the framebuffer a window presents into. It holds the last flushed frame, scaled to the window size. With a presenter thread, switch back to PRESENT_SYNC before reading it
+ * @param s Window object
+ * @return ARGB surface owned by the window, NULL if the window is closed
+ */
+Surface *GetWindowFramebuffer(Window *s);
+/*!
+ * @discussion Number of frames flushed to a window
+ * @param s Window object
+ * @return Frame count
+ */
+unsigned long GetWindowFrameCount(Window *s);
+/*!
+ * @discussion Set a callback to run after every Flush. With a presenter thread (see SetWindowPresenter) it runs on that thread
+ * @param s Window object
+ * @param cb Callback that receives the userdata, the window, the framebuffer and the frame index. NULL to disable
+ * @param userdata Pointer passed to the callback
+ */
+void SetWindowFrameCallback(Window *s, void(*cb)(void *userdata, Window *window, Surface *frame, unsigned long index), void *userdata);
+/*!
+ * @discussion Stream every flushed frame to a file descriptor as tightly packed raw pixels, e.g. a pipe into ffmpeg. Frames are written in full and the stream is dropped on the first write error, so ignore SIGPIPE if the reader may exit early
+ * @param s Window object
+ * @param fd File descriptor, -1 to disable
+ * @param format Pixel layout to write
+ * @return Boolean of success
+ */
+bool SetWindowFrameFd(Window *s, int fd, PixelFormat format);
+
+/*!
+ * @discussion Hold back input injected after this call until a number of frames have been flushed to the window. Frames already reached are delivered on the next PollEvents
+ * @param s Window object
+ * @param frame Frame count to wait for
+ */
+void SetInputFrame(Window *s, unsigned long frame);
+/*!
+ * @discussion Queue a key event
+ * @param s Window object
+ * @param key Key symbol
+ * @param mod Modifiers held
+ * @param down Pressed or released
+ */
+void InjectKeyboard(Window *s, Key key, Mod mod, bool down);
+/*!
+ * @discussion Queue a mouse button event
+ * @param s Window object
+ * @param button Mouse button
+ * @param mod Modifiers held
+ * @param down Pressed or released
+ */
+void InjectMouseButton(Window *s, Button button, Mod mod, bool down);
+/*!
+ * @discussion Queue a cursor move. The delta passed to the callback is worked out when the event is delivered
+ * @param s Window object
+ * @param x X position inside the window
+ * @param y Y position inside the window
+ */
+void InjectMouseMove(Window *s, int x, int y);
+/*!
+ * @discussion Queue a scroll event
+ * @param s Window object
+ * @param mod Modifiers held
+ * @param dx Horizontal scroll
+ * @param dy Vertical scroll
+ */
+void InjectScroll(Window *s, Mod mod, float dx, float dy);
+/*!
+ * @discussion Queue a focus change
+ * @param s Window object
+ * @param focused Gained or lost focus
+ */
+void InjectFocus(Window *s, bool focused);
+/*!
+ * @discussion Queue a resize. The window and its framebuffer change size when the event is delivered
+ * @param s Window object
+ * @param w New width
+ * @param h New height
+ */
+void InjectResize(Window *s, int w, int h);
+/*!
+ * @discussion Queue a close request, as if the user closed the window
+ * @param s Window object
+ */
+void InjectClose(Window *s);
+/*!
+ * @discussion Queue input from a script, one command per line. Blank lines and anything after '#' are ignored
+ *
+ *     frame N                      hold the following input until N frames are flushed
+ *     key NAME down|up [MODS]      NAME is a letter, digit, f1-f25, a name like space,
+ *                                  enter, escape, left or lshift, or a numeric key code
+ *     button left|right|middle|N down|up [MODS]
+ *     move X Y
+ *     scroll DX DY [MODS]
+ *     focus in|out
+ *     resize W H
+ *     close
+ *
+ * MODS is a '+' separated list of shift, ctrl, alt, super, caps and num
+ * @param s Window object
+ * @param script Script text
+ * @return Boolean of success. Nothing is queued if any line fails to parse
+ */
+bool InjectInputScript(Window *s, const char *script);
+
+#if defined(__cplusplus)
+}
+#endif
+#endif // headless_h
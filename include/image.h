@@ -0,0 +1,76 @@
+/* image.h
+ *
+ * Created by George Watson on 26/11/2017.
+ * Copyright © 2013-2021 George Watson. All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * *   Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * *   Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * *   Neither the name of the <organization> nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GEORGE WATSON BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef image_h
+#define image_h
+#if defined(__cplusplus)
+extern "C" {
+#endif
+#include "surface.h"
+#include <stddef.h>
+
+/*!
+ * @discussion Load a BMP, QOI or PNG file into a new ARGB surface. The file is memory mapped where the platform allows it, and pixels are decoded row by row straight into the surface
+ * @param s Surface object to create
+ * @param path Path to the image file
+ * @return Boolean for success
+ */
+bool LoadSurface(Surface *s, const char *path);
+/*!
+ * @discussion Load a BMP, QOI or PNG image from memory into a new ARGB surface. The format is detected from the first few bytes
+ * @param s Surface object to create
+ * @param data Encoded image
+ * @param length Size of the encoded image in bytes
+ * @return Boolean for success
+ */
+bool LoadSurfaceFromMemory(Surface *s, const void *data, size_t length);
+/*!
+ * @discussion Save a surface to a file, picking the encoder from the extension: .qoi, .ppm (alpha is dropped), .pam or .png (deflated at a fast, level 1 equivalent setting)
+ * @param s Surface to save
+ * @param path Path to the file to create
+ * @return Boolean for success
+ */
+bool SaveSurface(Surface *s, const char *path);
+/*!
+ * @typedef SaveCallback
+ * @brief Called from the worker thread once an asynchronous save has finished
+ */
+typedef void(*SaveCallback)(const char *path, bool success, void *userdata);
+/*!
+ * @discussion Copy a surface and save the copy on a background thread, so the caller can keep drawing into the original. The copy comes from the surface pool (see SetSurfacePoolLimit). Use WaitJobs from jobs.h to block until queued saves are done
+ * @param s Surface to save
+ * @param path Path to the file to create
+ * @param cb Callback for when the save finishes (optional)
+ * @param userdata Pointer passed to the callback
+ * @return Boolean for success queueing the save
+ */
+bool SaveSurfaceAsync(Surface *s, const char *path, SaveCallback cb, void *userdata);
+
+#if defined(__cplusplus)
+}
+#endif
+#endif // image_h
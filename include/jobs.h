@@ -0,0 +1,69 @@
+/* jobs.h
+ *
+ * Created by George Watson on 26/11/2017.
+ * Copyright © 2013-2021 George Watson. All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * *   Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * *   Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * *   Neither the name of the <organization> nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GEORGE WATSON BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef jobs_h
+#define jobs_h
+#if defined(__cplusplus)
+extern "C" {
+#endif
+#include <stdbool.h>
+
+/*!
+ * @typedef JobCallback
+ * @brief Work to run on a background thread
+ */
+typedef void(*JobCallback)(void *userdata);
+
+/*!
+ * @discussion Queue a function to run on the shared worker threads. The threads are started on first use, one per core. Without thread support the job runs before this returns
+ * @param fn Function to run
+ * @param userdata Pointer passed to the function
+ * @return Boolean for success
+ */
+bool RunJob(JobCallback fn, void *userdata);
+/*!
+ * @discussion Block until every queued job has finished
+ */
+void WaitJobs(void);
+/*!
+ * @discussion Split the range [0, n) into chunks and run them across the worker threads and the calling thread, returning once every chunk is done
+ * @param n Size of the range
+ * @param fn Function called with each chunk as [begin, end)
+ * @param userdata Pointer passed to the function
+ */
+void ParallelFor(int n, void(*fn)(int begin, int end, void *userdata), void *userdata);
+/*!
+ * @discussion Number of worker threads jobs are spread across
+ * @return Thread count, 1 without thread support
+ */
+int JobThreadCount(void);
+
+#if defined(__cplusplus)
+}
+#endif
+#endif // jobs_h
@@ -0,0 +1,107 @@
+/* lut.h
+ *
+ * Created by George Watson on 26/11/2017.
+ * Copyright © 2013-2021 George Watson. All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * *   Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * *   Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * *   Neither the name of the <organization> nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GEORGE WATSON BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef lut_h
+#define lut_h
+#if defined(__cplusplus)
+extern "C" {
+#endif
+#include "surface.h"
+
+/*!
+ * @typedef LutType
+ * @brief Kinds of lookup table
+ * @constant LUT_1D A curve for each channel, indexed by that channel alone
+ * @constant LUT_3D A colour cube, indexed by all three channels together
+ */
+typedef enum {
+    LUT_1D = 0,
+    LUT_3D
+} LutType;
+
+/*!
+ * @typedef LutInterpolation
+ * @brief How colours between the points of a 3D table are found
+ * @constant LUT_TRILINEAR Blend the 8 corners of the cell the colour falls in
+ * @constant LUT_TETRAHEDRAL Blend the 4 corners of the tetrahedron the colour falls in, which keeps the grey axis neutral
+ */
+typedef enum {
+    LUT_TRILINEAR = 0,
+    LUT_TETRAHEDRAL
+} LutInterpolation;
+
+/*!
+ * @typedef Lut
+ * @brief A colour lookup table. Values are normally 0 to 1
+ * @constant type 1D curves or 3D cube
+ * @constant size Points per channel
+ * @constant min Input values mapped to the first point, per channel
+ * @constant max Input values mapped to the last point, per channel
+ * @constant table Entries of four floats: red, green, blue and an unused pad. A 1D table has size entries, a 3D table has size^3 with red changing fastest, then green, then blue
+ */
+typedef struct {
+    LutType type;
+    int size;
+    float min[3], max[3];
+    float *table;
+} Lut;
+
+/*!
+ * @discussion Create an identity lookup table
+ * @param l Lut object to create
+ * @param type 1D curves or 3D cube
+ * @param size Points per channel, 2 to 4096 for 1D or 2 to 256 for 3D
+ * @return Boolean for success
+ */
+bool NewLut(Lut *l, LutType type, int size);
+/*!
+ * @discussion Load a lookup table from an Adobe/Resolve .cube file. 1D and 3D tables are both supported, along with DOMAIN_MIN, DOMAIN_MAX and LUT_1D_INPUT_RANGE
+ * @param l Lut object to create
+ * @param path Path to the file
+ * @return Boolean for success
+ */
+bool LoadCubeLut(Lut *l, const char *path);
+/*!
+ * @discussion Free a lookup table
+ * @param l Lut object to free
+ */
+void DestroyLut(Lut *l);
+/*!
+ * @discussion Grade a surface in place through a set of curves, a colour cube, or both in one pass. Rows are split across the worker threads and alpha is left alone
+ * @param s Surface object
+ * @param curves 1D table applied first (can be NULL)
+ * @param cube 3D table applied to the result of the curves (can be NULL)
+ * @param interp How colours between points of the cube are found
+ * @return Boolean for success
+ */
+bool ApplyLut(Surface *s, const Lut *curves, const Lut *cube, LutInterpolation interp);
+
+#if defined(__cplusplus)
+}
+#endif
+#endif // lut_h
@@ -45,6 +45,7 @@ extern "C" {
 #include <stdbool.h>
 #endif
 #include <stdarg.h>
+#include <stddef.h>
 
 /*!
  * @discussion Convert RGBA to packed integer
@@ -273,17 +274,213 @@ typedef enum {
     YELLOW_GREEN = -6632142
 } Colour;
 
+/*!
+ * @typedef SurfaceFormat
+ * @brief A list of pixel formats a surface can store
+ * @constant SURFACE_ARGB 32-bit packed ARGB (default)
+ * @constant SURFACE_RGB565 16-bit packed RGB, no alpha
+ * @constant SURFACE_A8 8-bit alpha only, for masks and glyph coverage
+ * @constant SURFACE_L8 8-bit luminance, no alpha
+ * @constant SURFACE_INDEXED8 8-bit index into the surface palette
+ */
+typedef enum {
+    SURFACE_ARGB = 0,
+    SURFACE_RGB565,
+    SURFACE_A8,
+    SURFACE_L8,
+    SURFACE_INDEXED8
+} SurfaceFormat;
+
+/*!
+ * @typedef SurfaceAccess
+ * @brief Access pattern hints for file-backed surfaces
+ * @constant SURFACE_ACCESS_NORMAL No particular pattern (default)
+ * @constant SURFACE_ACCESS_SEQUENTIAL Rows will be read in order, read ahead aggressively and drop pages behind
+ * @constant SURFACE_ACCESS_RANDOM Scattered access, don't read ahead
+ * @constant SURFACE_ACCESS_WILLNEED Start paging the whole image in now
+ * @constant SURFACE_ACCESS_DONTNEED Release resident pages. Shared mappings are written back first, private ones lose their changes
+ */
+typedef enum {
+    SURFACE_ACCESS_NORMAL = 0,
+    SURFACE_ACCESS_SEQUENTIAL,
+    SURFACE_ACCESS_RANDOM,
+    SURFACE_ACCESS_WILLNEED,
+    SURFACE_ACCESS_DONTNEED
+} SurfaceAccess;
+
 /*!
  * @typedef Surface
  * @brief An object to hold image data
- * @constant buf Buffer holding pixel data
+ * @constant buf Buffer holding pixel data (packed as described by format, cast for non-ARGB formats)
  * @constant w Width of image
  * @constant h Height of image
+ * @constant format Pixel format of buf
+ * @constant palette Palette for SURFACE_INDEXED8 (not owned, NULL for a gray ramp)
+ * @constant mapped Size of the file mapping behind buf, 0 when buf is on the heap
+ * @constant access Last access pattern given to AdviseSurface, put back after whole-surface passes
+ * @constant clip Clip mask that blending and drawing are limited to (not owned, NULL for none)
  */
 typedef struct {
     int *buf, w, h;
+    SurfaceFormat format;
+    struct Palette *palette;
+    size_t mapped;
+    SurfaceAccess access;
+    struct ClipMask *clip;
 } Surface;
 
+/*!
+ * @typedef SurfaceView
+ * @brief A rectangle of ARGB pixels inside a larger buffer, so filters can work on part of a surface or on memory the library doesn't own
+ * @constant buf First pixel of the view
+ * @constant w Width of view
+ * @constant h Height of view
+ * @constant stride Pixels between the starts of two rows
+ */
+typedef struct {
+    int *buf, w, h, stride;
+} SurfaceView;
+
+/*!
+ * @typedef SurfaceRect
+ * @brief A rectangle of pixels
+ * @constant x X position
+ * @constant y Y position
+ * @constant w Width
+ * @constant h Height
+ */
+typedef struct {
+    int x, y, w, h;
+} SurfaceRect;
+
+/*!
+ * @typedef BlendMode
+ * @brief How a source colour is combined with the destination
+ * @constant BLEND_OVER Source over destination, the default
+ * @constant BLEND_SRC Replace the destination with the source
+ * @constant BLEND_ADD Add the colours together, saturating
+ * @constant BLEND_MULTIPLY Multiply the colours, darkening
+ * @constant BLEND_SCREEN Inverse multiply, lightening
+ * @constant BLEND_OVERLAY Multiply dark destination colours and screen light ones
+ * @constant BLEND_DARKEN Keep the darker of each channel
+ * @constant BLEND_LIGHTEN Keep the lighter of each channel
+ * @constant BLEND_DIFFERENCE Absolute difference of each channel
+ * @constant BLEND_DST_IN Keep the destination where the source is opaque
+ * @constant BLEND_DST_OUT Keep the destination where the source is transparent
+ * @constant BLEND_XOR Keep the source and destination only where the other is transparent
+ */
+typedef enum {
+    BLEND_OVER = 0,
+    BLEND_SRC,
+    BLEND_ADD,
+    BLEND_MULTIPLY,
+    BLEND_SCREEN,
+    BLEND_OVERLAY,
+    BLEND_DARKEN,
+    BLEND_LIGHTEN,
+    BLEND_DIFFERENCE,
+    BLEND_DST_IN,
+    BLEND_DST_OUT,
+    BLEND_XOR,
+    BLEND_MODE_COUNT
+} BlendMode;
+
+/*!
+ * @typedef Palette
+ * @brief A table of colours for indexed surfaces. Surfaces reference a palette, so changing an entry recolours every surface using it on the next Flush
+ * @constant colours ARGB colour for each index
+ * @constant count Number of entries in use
+ */
+typedef struct Palette {
+    int colours[256];
+    int count;
+} Palette;
+
+/*!
+ * @typedef ClipMask
+ * @brief A shape that drawing onto a surface is limited to. Pixels outside the mask are left alone, and a coverage mask softens the edges
+ * @constant x X position of the mask on the surface it clips
+ * @constant y Y position of the mask on the surface it clips
+ * @constant w Width of mask
+ * @constant h Height of mask
+ * @constant coverage w * h coverage values, NULL for a 1-bit mask
+ * @constant bits Pointer to internal run bitmaps
+ */
+typedef struct ClipMask {
+    int x, y, w, h;
+    unsigned char *coverage;
+    void *bits;
+} ClipMask;
+
+/*!
+ * @discussion Create a clip mask from a surface. The coverage of each pixel is the value of an A8 surface, or the alpha channel otherwise
+ * @param c Clip mask object to create
+ * @param mask Surface to take the shape from
+ * @param x X position of the mask on the surface it clips
+ * @param y Y position of the mask on the surface it clips
+ * @return Boolean for success
+ */
+bool NewClipMask(ClipMask *c, Surface *mask, int x, int y);
+/*!
+ * @discussion Create a clip mask from a 1-bit bitmap, most significant bit first
+ * @param c Clip mask object to create
+ * @param bits Bitmap rows, a set bit lets drawing through
+ * @param pitch Bytes between the starts of two rows
+ * @param w Width of mask
+ * @param h Height of mask
+ * @param x X position of the mask on the surface it clips
+ * @param y Y position of the mask on the surface it clips
+ * @return Boolean for success
+ */
+bool NewClipMaskBits(ClipMask *c, const unsigned char *bits, size_t pitch, int w, int h, int x, int y);
+/*!
+ * @discussion Free a clip mask. Detach it from any surfaces first
+ * @param c Clip mask object
+ */
+void DestroyClipMask(ClipMask *c);
+/*!
+ * @discussion Limit blending and drawing on a surface to a clip mask. BlendPixel, PasteSurface, PasteSurfaceClip, FillMask and the Draw functions are clipped; SetPixel, FillSurface and other whole-surface operations are not
+ * @param s Surface object
+ * @param c Clip mask, or NULL to remove clipping
+ */
+void SetSurfaceClip(Surface *s, ClipMask *c);
+
+/*!
+ * @discussion Initialize a palette. When colours is NULL the palette is filled with the 16 basic colours, a 6x6x6 colour cube and a 24 step gray ramp
+ * @param p Palette object
+ * @param colours Array of colours to copy, or NULL
+ * @param count Number of colours in array
+ */
+void InitPalette(Palette *p, const int *colours, int count);
+/*!
+ * @discussion Set a palette entry
+ * @param p Palette object
+ * @param i Index of entry
+ * @param col New colour
+ */
+void SetPaletteColour(Palette *p, unsigned char i, int col);
+/*!
+ * @discussion Get a palette entry
+ * @param p Palette object
+ * @param i Index of entry
+ * @return Colour of entry
+ */
+int GetPaletteColour(Palette *p, unsigned char i);
+/*!
+ * @discussion Rotate a range of palette entries, for colour cycling animations
+ * @param p Palette object
+ * @param from First index of range
+ * @param to Last index of range (inclusive)
+ * @param n Number of steps to rotate by, negative to rotate backwards
+ */
+void CyclePalette(Palette *p, unsigned char from, unsigned char to, int n);
+
+/*!
+ * @discussion Number of bytes a single pixel takes for a format
+ * @param format Pixel format
+ * @return Bytes per pixel
+ */
+int BytesPerPixel(SurfaceFormat format);
 /*!
  * @discussion Create a new surface
  * @param s Pointer to surface object to create
@@ -292,11 +489,58 @@ typedef struct {
  * @return Boolean for success
  */
 bool NewSurface(Surface* s, unsigned int w, unsigned int h);
+/*!
+ * @discussion Create a new surface with a specific pixel format
+ * @param s Pointer to surface object to create
+ * @param w Width of new surface
+ * @param h Height of new surface
+ * @param format Pixel format of new surface
+ * @return Boolean for success
+ */
+bool NewSurfaceFormat(Surface* s, unsigned int w, unsigned int h, SurfaceFormat format);
+/*!
+ * @discussion Create a new 8-bit indexed surface
+ * @param s Pointer to surface object to create
+ * @param w Width of new surface
+ * @param h Height of new surface
+ * @param p Palette to use (not owned)
+ * @return Boolean for success
+ */
+bool NewIndexedSurface(Surface *s, unsigned int w, unsigned int h, Palette *p);
+/*!
+ * @discussion Create a new surface backed by a memory mapped file, for images larger than memory. The file is created (or truncated) with a small header followed by the raw pixels, and drawing to the surface writes through to it
+ * @param s Pointer to surface object to create
+ * @param path Path to the file to create
+ * @param w Width of new surface
+ * @param h Height of new surface
+ * @param format Pixel format of new surface
+ * @return Boolean for success
+ */
+bool NewMappedSurface(Surface *s, const char *path, unsigned int w, unsigned int h, SurfaceFormat format);
+/*!
+ * @discussion Map a file created by NewMappedSurface back into a surface
+ * @param s Pointer to surface object to create
+ * @param path Path to the file
+ * @param writable When true changes are written back to the file, otherwise they are private to this process and discarded on DestroySurface
+ * @return Boolean for success
+ */
+bool OpenMappedSurface(Surface *s, const char *path, bool writable);
+/*!
+ * @discussion Tell the OS how a file-backed surface is about to be accessed. Does nothing for heap surfaces. NORMAL, SEQUENTIAL and RANDOM are kept and restored after whole-surface operations, WILLNEED and DONTNEED apply once
+ * @param s Surface object
+ * @param access Access pattern
+ */
+void AdviseSurface(Surface *s, SurfaceAccess access);
 /*!
  * @discussion Destroy a surface
  * @param s Pointer to pointer to surface object
  */
 void DestroySurface(Surface* s);
+/*!
+ * @discussion Keep the buffers of destroyed surfaces, up to a number of bytes, so new surfaces of the same size can reuse them without going back to the allocator. 0 (the default) disables pooling and frees anything held
+ * @param bytes Maximum number of bytes to keep
+ */
+void SetSurfacePoolLimit(size_t bytes);
 
 /*!
  * @discussion Fill a surface with a given colour
@@ -347,9 +591,10 @@ int GetPixel(Surface *s, int x, int y);
  * @param src Surface to blit
  * @param x X position
  * @param y Y position
+ * @param mode How the pixels are combined
  * @return Boolean of success
  */
-bool PasteSurface(Surface *dst, Surface *src, int x, int y);
+bool PasteSurface(Surface *dst, Surface *src, int x, int y, BlendMode mode);
 /*!
  * @discussion Blit one surface onto another at point with clipping rect
  * @param dst Surface to blit to
@@ -360,9 +605,10 @@ bool PasteSurface(Surface *dst, Surface *src, int x, int y);
  * @param ry Clip rect Y
  * @param rw Clip rect width
  * @param rh Clip rect height
+ * @param mode How the pixels are combined
  * @return Boolean of success
  */
-bool PasteSurfaceClip(Surface *dst, Surface *src, int x, int y, int rx, int ry, int rw, int rh);
+bool PasteSurfaceClip(Surface *dst, Surface *src, int x, int y, int rx, int ry, int rw, int rh, BlendMode mode);
 /*!
  * @discussion Reallocate a surface
  * @param s Surface object
@@ -378,6 +624,42 @@ bool ReuseSurface(Surface *s, int nw, int nh);
  * @return Boolean of success
  */
 bool CopySurface(Surface *a, Surface *b);
+/*!
+ * @discussion Create a copy of a surface converted to another pixel format
+ * @param a Original surface object
+ * @param format Pixel format of the new surface
+ * @param b New surface object to be allocated
+ * @return Boolean of success
+ */
+bool ConvertSurface(Surface *a, SurfaceFormat format, Surface *b);
+/*!
+ * @discussion Expand a surface of any format to ARGB. Unlike ConvertSurface, b is reused when it is already an ARGB surface of the right size, so this can run every frame
+ * @param a Original surface object
+ * @param b ARGB surface object to expand into
+ * @return Boolean of success
+ */
+bool ExpandSurface(Surface *a, Surface *b);
+/*!
+ * @discussion Blend a solid colour onto a surface through a mask. The coverage of each mask pixel (the value of an A8 mask, or the alpha channel otherwise) modulates the alpha of the colour. For BLEND_SRC and BLEND_DST_IN, which change the destination even where the source is transparent, the coverage fades between the blended and the original pixel instead
+ * @param dst Surface to blend to
+ * @param mask Mask surface, ideally SURFACE_A8
+ * @param x X position
+ * @param y Y position
+ * @param col Colour to blend
+ * @param mode How the colour is combined
+ */
+void FillMask(Surface *dst, Surface *mask, int x, int y, int col, BlendMode mode);
+/*!
+ * @discussion Get a view of a rectangle of an ARGB surface, clipped to its bounds
+ * @param s Surface object
+ * @param x X position of rectangle
+ * @param y Y position of rectangle
+ * @param w Width of rectangle
+ * @param h Height of rectangle
+ * @param v View to fill in
+ * @return Boolean for success, false if the surface isn't ARGB or the rectangle is empty after clipping
+ */
+bool GetSurfaceView(Surface *s, int x, int y, int w, int h, SurfaceView *v);
 /*!
  * @discussion Loop through each pixel of surface and run position and colour through a callback. Return value of the callback is the new colour at the position
  * @param s Surface object
@@ -410,8 +692,9 @@ bool RotateSurface(Surface *a, float angle, Surface *b);
  * @param x1 Vector B X position
  * @param y1 Vector B Y position
  * @param col Colour of line
+ * @param mode How the colour is combined
  */
-void DrawLine(Surface *s, int x0, int y0, int x1, int y1, int col);
+void DrawLine(Surface *s, int x0, int y0, int x1, int y1, int col, BlendMode mode);
 /*!
  * @discussion Draw a circle
  * @param s Surface object
@@ -420,8 +703,9 @@ void DrawLine(Surface *s, int x0, int y0, int x1, int y1, int col);
  * @param r Circle radius
  * @param col Colour of cricle
  * @param fill Fill circle boolean
+ * @param mode How the colour is combined
  */
-void DrawCircle(Surface *s, int xc, int yc, int r, int col, bool fill);
+void DrawCircle(Surface *s, int xc, int yc, int r, int col, bool fill, BlendMode mode);
 /*!
  * @discussion Draw a rectangle
  * @param x X position
@@ -430,8 +714,9 @@ void DrawCircle(Surface *s, int xc, int yc, int r, int col, bool fill);
  * @param h Rectangle height
  * @param col Colour of rectangle
  * @param fill Fill rectangle boolean
+ * @param mode How the colour is combined
  */
-void DrawRect(Surface *s, int x, int y, int w, int h, int col, bool fill);
+void DrawRect(Surface *s, int x, int y, int w, int h, int col, bool fill, BlendMode mode);
 /*!
  * @discussion Draw a triangle
  * @param s Surface object
@@ -443,8 +728,9 @@ void DrawRect(Surface *s, int x, int y, int w, int h, int col, bool fill);
  * @param y2 Vector C Y position
  * @param col Colour of line
  * @param fill Fill triangle boolean
+ * @param mode How the colour is combined
  */
-void DrawTri(Surface *s, int x0, int y0, int x1, int y1, int x2, int y2, int col, bool fill);
+void DrawTri(Surface *s, int x0, int y0, int x1, int y1, int x2, int y2, int col, bool fill, BlendMode mode);
 
 #if defined(__cplusplus)
 }
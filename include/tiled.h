@@ -0,0 +1,138 @@
+/* tiled.h
+ *
+ * Created by George Watson on 26/11/2017.
+ * Copyright © 2013-2021 George Watson. All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * *   Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * *   Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * *   Neither the name of the <organization> nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GEORGE WATSON BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef tiled_h
+#define tiled_h
+#if defined(__cplusplus)
+extern "C" {
+#endif
+#include "surface.h"
+#include <stddef.h>
+
+/*!
+ * @typedef TiledSurface
+ * @brief An image stored on disk as fixed size ARGB tiles, with a bounded cache of tiles in memory. Tiles are read in when touched and written back when evicted, so images far larger than memory can be worked on. Not thread safe
+ * @constant w Width of image
+ * @constant h Height of image
+ * @constant tile Width and height of a tile
+ * @constant cache Pointer to internal tile cache
+ */
+typedef struct {
+    int w, h, tile;
+    void *cache;
+} TiledSurface;
+
+/*!
+ * @discussion Create a new tiled image file. Tiles start out transparent and take no disk space until written, where the filesystem supports sparse files
+ * @param t Tiled surface object to create
+ * @param path Path to the file to create
+ * @param w Width of image
+ * @param h Height of image
+ * @param tile Width and height of a tile, 0 for the default (256)
+ * @param cache_bytes Memory budget for cached tiles (at least 4 tiles are always kept)
+ * @return Boolean for success
+ */
+bool NewTiledSurface(TiledSurface *t, const char *path, unsigned int w, unsigned int h, unsigned int tile, size_t cache_bytes);
+/*!
+ * @discussion Open a tiled image file created by NewTiledSurface
+ * @param t Tiled surface object to create
+ * @param path Path to the file
+ * @param cache_bytes Memory budget for cached tiles
+ * @return Boolean for success
+ */
+bool OpenTiledSurface(TiledSurface *t, const char *path, size_t cache_bytes);
+/*!
+ * @discussion Write back modified tiles, close the file and free the cache
+ * @param t Tiled surface object
+ */
+void DestroyTiledSurface(TiledSurface *t);
+/*!
+ * @discussion Write every modified tile in the cache back to the file
+ * @param t Tiled surface object
+ * @return Boolean for success
+ */
+bool FlushTiledSurface(TiledSurface *t);
+/*!
+ * @discussion Get a pixel from a tiled image
+ * @param t Tiled surface object
+ * @param x X position
+ * @param y Y position
+ * @return Colour of pixel, 0 if out of bounds
+ */
+int GetTiledPixel(TiledSurface *t, int x, int y);
+/*!
+ * @discussion Set a pixel on a tiled image
+ * @param t Tiled surface object
+ * @param x X position
+ * @param y Y position
+ * @param col Colour to set
+ */
+void SetTiledPixel(TiledSurface *t, int x, int y, int col);
+/*!
+ * @discussion Copy a region of a tiled image into a surface. The region is the size of the surface, parts outside the image are left alone
+ * @param t Tiled surface object
+ * @param x X position of region
+ * @param y Y position of region
+ * @param dst Surface to copy to
+ * @return Boolean for success
+ */
+bool ReadTiledRegion(TiledSurface *t, int x, int y, Surface *dst);
+/*!
+ * @discussion Overwrite a region of a tiled image with a surface
+ * @param t Tiled surface object
+ * @param src Surface to copy from
+ * @param x X position to copy to
+ * @param y Y position to copy to
+ * @return Boolean for success
+ */
+bool WriteTiledRegion(TiledSurface *t, Surface *src, int x, int y);
+/*!
+ * @discussion Blend a surface onto a tiled image, like PasteSurface
+ * @param t Tiled surface object
+ * @param src Surface to paste
+ * @param x X position to paste to
+ * @param y Y position to paste to
+ * @return Boolean for success
+ */
+bool PasteTiledSurface(TiledSurface *t, Surface *src, int x, int y);
+/*!
+ * @discussion Scale a region of a tiled image into a surface (nearest neighbour), like ScaleSurface. Each tile the region touches is read once, and only tiles that are actually sampled are read at all
+ * @param t Tiled surface object
+ * @param x X position of region
+ * @param y Y position of region
+ * @param w Width of region
+ * @param h Height of region
+ * @param dst Surface to scale into, at its current size
+ * @return Boolean for success
+ */
+bool ScaleTiledRegion(TiledSurface *t, int x, int y, int w, int h, Surface *dst);
+
+#if defined(__cplusplus)
+}
+#endif
+#endif // tiled_h
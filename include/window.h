@@ -237,6 +237,7 @@ typedef enum {
  * @constant h Height of window
  * @constant window Pointer to internet platform specific window data
  * @parent parent Pointer to userdata for callbacks
+ * @constant events Event queue, see SetWindowEventQueue
  */
 typedef struct {
   int id, w, h;
@@ -245,7 +246,7 @@ typedef struct {
   XMAP_SCREEN_CB
 #undef X
   
-  void *window, *parent;
+  void *window, *parent, *events;
 } Window;
 
 /*!
@@ -269,6 +270,56 @@ void a##Callback(Window *window, void(*a##_cb)b);
 XMAP_SCREEN_CB
 #undef X
 
+/*!
+ * @typedef EventType
+ * @brief The kind of event in an Event, one for each window callback
+ */
+typedef enum {
+  EVENT_NONE = 0,
+  EVENT_KEYBOARD,
+  EVENT_MOUSE_BUTTON,
+  EVENT_MOUSE_MOVE,
+  EVENT_SCROLL,
+  EVENT_FOCUS,
+  EVENT_RESIZE,
+  EVENT_CLOSED
+} EventType;
+
+/*!
+ * @typedef Event
+ * @brief A window event taken from the event queue, holding the same values as the matching callback
+ * @constant type Which member of data is set
+ * @constant mod Modifier keys for keyboard, mouse button and scroll events
+ * @constant data Event values
+ */
+typedef struct {
+  EventType type;
+  Mod mod;
+  union {
+    struct { Key key; bool down; } keyboard;
+    struct { Button button; bool down; } button;
+    struct { int x, y, dx, dy; } move;
+    struct { float dx, dy; } scroll;
+    struct { bool focused; } focus;
+    struct { int w, h; } resize;
+  } data;
+} Event;
+
+/*!
+ * @discussion Queue a window's events for NextEvent as well as passing them to its callbacks. The queue is a lock-free ring with one producer and one consumer, so one thread can call PollEvents while another drains it. Events that arrive while it's full are dropped. Set it up before those threads start, it's freed by DestroyWindow or by passing 0
+ * @param s Window object
+ * @param capacity Number of events the queue holds, rounded up to a power of two. 0 to remove the queue
+ * @return Boolean of success
+ */
+bool SetWindowEventQueue(Window *s, int capacity);
+/*!
+ * @discussion Take the oldest event from a window's event queue
+ * @param s Window object
+ * @param e Event to fill in
+ * @return False when the queue is empty or there is no queue
+ */
+bool NextEvent(Window *s, Event *e);
+
   /*!
    * @typedef Cursor
    * @brief A list of default cursor icons
@@ -400,12 +451,97 @@ void SetCursorPosition(int x, int y);
  * @discussion Poll for window events
  */
 void PollEvents(void);
+/*!
+ * @discussion Sleep until there are window events, then handle them like PollEvents
+ */
+void WaitEvents(void);
+/*!
+ * @discussion Sleep until there are window events or the timeout passes, then handle any events like PollEvents
+ * @param ms Longest time to wait in milliseconds
+ * @return True if events arrived before the timeout
+ */
+bool WaitEventsTimeout(int ms);
+/*!
+ * @discussion Get a file descriptor that becomes readable when there are events, to wait on in your own poll/epoll loop alongside other descriptors. Call PollEvents once it's readable. On X11 this is the display connection, shared by every window. It can also wake for things that aren't window events, such as replies the library reads itself.
+ * @param s Window object
+ * @return File descriptor, -1 when the backend has none (Windows, macOS and emscripten)
+ */
+int GetEventFd(Window *s);
 /*!
  * @discussion Draw surface object to window
  * @param s Window object
  * @param b Surface object
  */
 void Flush(Window *s, Surface *b);
+/*!
+ * @discussion Draw only the parts of a surface that changed since the last frame. The rects are clipped, merged and uploaded one by one on X11 and headless; if they cover most of the window, the surface is scaled, or a presenter thread is running, the whole frame is flushed instead. Other backends always flush the whole frame. UpdateTileHashes from hash.h finds damage for you
+ * @param s Window object
+ * @param b Surface object, the same size as the window
+ * @param rects Changed rectangles in surface coordinates
+ * @param count Number of rects, nothing is drawn when 0
+ */
+void FlushRects(Window *s, Surface *b, SurfaceRect *rects, int count);
+/*!
+ * @discussion Lock the next buffer of a window's swap chain to draw into, instead of drawing into your own surface and calling Flush. The surface is owned by the window and matches the window size. It still holds what was drawn into it the last time it was used, so redraw all of it. On X11 with MIT-SHM it is the shared memory the server reads from, so presenting it doesn't copy the frame
+ * @param s Window object
+ * @return Surface to draw into, NULL on failure. Only valid until Present
+ */
+Surface* LockBackbuffer(Window *s);
+/*!
+ * @discussion Show the buffer returned by LockBackbuffer and move on to the next buffer in the swap chain
+ * @param s Window object
+ */
+void Present(Window *s);
+/*!
+ * @discussion Set how many buffers are in a window's swap chain. With two (the default) the next frame is drawn while the last one is shown, three stops drawing from waiting on a slow present. Existing buffers are released
+ * @param s Window object
+ * @param n Number of buffers, 1 to 3
+ * @return Boolean of success
+ */
+bool SetBackbufferCount(Window *s, int n);
+
+/*!
+ * @typedef PresentPolicy
+ * @brief How Flush hands frames to the display
+ * @constant PRESENT_SYNC Flush uploads the frame before returning (default)
+ * @constant PRESENT_DROP_OLDEST Flush copies the frame into a queue for a presenter thread and returns. When the queue is full the oldest waiting frame is dropped
+ * @constant PRESENT_BLOCK As PRESENT_DROP_OLDEST, but Flush waits for a free slot instead of dropping frames
+ */
+typedef enum {
+  PRESENT_SYNC = 0,
+  PRESENT_DROP_OLDEST,
+  PRESENT_BLOCK
+} PresentPolicy;
+
+/*!
+ * @discussion Give a window its own presenter thread, so rendering the next frame overlaps uploading the last. Switching back to PRESENT_SYNC waits for queued frames to be shown and stops the thread. Supported by the X11 and headless backends, the others already present without blocking or must present from the UI thread. On X11 the thread opens its own display connection
+ * @param s Window object
+ * @param policy What to do when the queue is full, PRESENT_SYNC to stop the presenter
+ * @param frames Number of frame buffers in the queue, 2 to 8
+ * @return Boolean of success
+ */
+bool SetWindowPresenter(Window *s, PresentPolicy policy, int frames);
+
+/*!
+ * @typedef ScaleMode
+ * @brief How a surface is fitted to a window of a different size
+ * @constant SCALE_STRETCH Fill the whole window, ignoring the aspect ratio (default)
+ * @constant SCALE_INTEGER Scale by the largest whole number that fits, centred with black bars. Falls back to SCALE_LETTERBOX when the window is smaller than the surface
+ * @constant SCALE_LETTERBOX Scale as large as fits while keeping the aspect ratio, centred with black bars
+ */
+typedef enum {
+  SCALE_STRETCH = 0,
+  SCALE_INTEGER,
+  SCALE_LETTERBOX
+} ScaleMode;
+
+/*!
+ * @discussion Set how Flush fits surfaces that aren't the size of the window. Scaling is nearest neighbour everywhere
+ * @param s Window object
+ * @param mode Scale mode
+ * @return Boolean of success, false on emscripten for anything but SCALE_STRETCH
+ */
+bool SetWindowScaleMode(Window *s, ScaleMode mode);
 /*!
  * @discussion Release anything allocated by this library
  */
@@ -0,0 +1,546 @@
+/* convert.c
+ *
+ * Created by George Watson on 26/11/2017.
+ * Copyright © 2013-2021 George Watson. All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * *   Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * *   Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * *   Neither the name of the <organization> nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GEORGE WATSON BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "convert.h"
+
+#include <stdlib.h>
+#include <string.h>
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#elif !defined(__EMSCRIPTEN__) || defined(__EMSCRIPTEN_PTHREADS__)
+#include <pthread.h>
+#endif
+
+#if defined(__EMSCRIPTEN__)
+#include "emscripten.h"
+#define EXPORT EMSCRIPTEN_KEEPALIVE
+#else
+#define EXPORT
+#endif
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define CONVERT_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define TARGET(x)
+#else
+#define TARGET(x) __attribute__((target(x)))
+#endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define CONVERT_NEON
+#include <arm_neon.h>
+#endif
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define CONVERT_BIG_ENDIAN
+#endif
+
+/* Byte offsets of the B, G, R and A channels inside one pixel, -1 for no alpha */
+typedef struct {
+    int size;
+    signed char off[4];
+    bool opaque;
+    unsigned char pack[16], unpack[16], pack_or[16], unpack_or[16];
+} Layout;
+
+static Layout layouts[PIXEL_FORMAT_COUNT] = {
+    [PIXEL_ARGB32]   = { 4, { 0, 1, 2, 3 }, false },
+    [PIXEL_BGRA8888] = { 4, { 0, 1, 2, 3 }, false },
+    [PIXEL_RGBA8888] = { 4, { 2, 1, 0, 3 }, false },
+    [PIXEL_ARGB8888] = { 4, { 3, 2, 1, 0 }, false },
+    [PIXEL_RGBX8888] = { 4, { 2, 1, 0, 3 }, true },
+    [PIXEL_RGB888]   = { 3, { 2, 1, 0, -1 }, true },
+    [PIXEL_BGR888]   = { 3, { 0, 1, 2, -1 }, true },
+    [PIXEL_RGB565]   = { 2, { -1, -1, -1, -1 }, true }
+};
+
+/* Build the pshufb/tbl style masks to move four ARGB32 pixels to and from each layout */
+static void build_masks(Layout *l) {
+    memset(l->pack, 0x80, 16);
+    memset(l->unpack, 0x80, 16);
+    memset(l->pack_or, 0, 16);
+    memset(l->unpack_or, 0, 16);
+    for (int p = 0; p < 4; ++p)
+        for (int c = 0; c < 4; ++c) {
+            if (l->off[c] < 0) {
+                l->unpack_or[p * 4 + c] = 0xFF;
+                continue;
+            }
+            l->pack[p * l->size + l->off[c]] = p * 4 + c;
+            l->unpack[p * 4 + c] = p * l->size + l->off[c];
+            if (c == 3 && l->opaque) {
+                l->pack[p * l->size + l->off[c]] = 0x80;
+                l->pack_or[p * l->size + l->off[c]] = 0xFF;
+                l->unpack[p * 4 + c] = 0x80;
+                l->unpack_or[p * 4 + c] = 0xFF;
+            }
+        }
+}
+
+static void pack_scalar(const int *src, unsigned char *dst, size_t n, const Layout *l) {
+    for (size_t i = 0; i < n; ++i, dst += l->size) {
+        unsigned int c = (unsigned int)src[i];
+        dst[l->off[0]] = c & 0xFF;
+        dst[l->off[1]] = (c >> 8) & 0xFF;
+        dst[l->off[2]] = (c >> 16) & 0xFF;
+        if (l->off[3] >= 0)
+            dst[l->off[3]] = l->opaque ? 0xFF : c >> 24;
+    }
+}
+
+static void unpack_scalar(const unsigned char *src, int *dst, size_t n, const Layout *l) {
+    for (size_t i = 0; i < n; ++i, src += l->size) {
+        unsigned int a = l->off[3] >= 0 && !l->opaque ? src[l->off[3]] : 0xFF;
+        dst[i] = (int)((a << 24) | ((unsigned int)src[l->off[2]] << 16) | ((unsigned int)src[l->off[1]] << 8) | src[l->off[0]]);
+    }
+}
+
+static void to565_scalar(const int *src, unsigned short *dst, size_t n) {
+    for (size_t i = 0; i < n; ++i)
+        dst[i] = (unsigned short)(((src[i] >> 8) & 0xF800) | ((src[i] >> 5) & 0x07E0) | ((src[i] >> 3) & 0x001F));
+}
+
+static void from565_scalar(const unsigned short *src, int *dst, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        unsigned int r = (src[i] >> 11) & 0x1F, g = (src[i] >> 5) & 0x3F, b = src[i] & 0x1F;
+        dst[i] = (int)(0xFF000000 | (((r << 3) | (r >> 2)) << 16) | (((g << 2) | (g >> 4)) << 8) | ((b << 3) | (b >> 2)));
+    }
+}
+
+#define DIV255(x) (((x) + 128 + (((x) + 128) >> 8)) >> 8)
+
+static void premultiply_scalar(int *buf, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        unsigned int c = (unsigned int)buf[i], a = c >> 24;
+        if (a == 255)
+            continue;
+        unsigned int r = (c >> 16) & 0xFF, g = (c >> 8) & 0xFF, b = c & 0xFF;
+        buf[i] = (int)((a << 24) | (DIV255(r * a) << 16) | (DIV255(g * a) << 8) | DIV255(b * a));
+    }
+}
+
+#if defined(CONVERT_X86)
+TARGET("ssse3") static void pack_ssse3(const int *src, unsigned char *dst, size_t n, const Layout *l) {
+    size_t i = 0;
+    __m128i mask = _mm_loadu_si128((const __m128i*)l->pack);
+    __m128i bits = _mm_loadu_si128((const __m128i*)l->pack_or);
+    /* 3 byte layouts write 16 bytes for 12, so stop while the overhang still lands inside dst */
+    size_t stop = l->size == 4 ? 4 : 6;
+    for (; i + stop <= n; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+        _mm_storeu_si128((__m128i*)(dst + i * l->size), _mm_or_si128(_mm_shuffle_epi8(v, mask), bits));
+    }
+    pack_scalar(src + i, dst + i * l->size, n - i, l);
+}
+
+TARGET("ssse3") static void unpack_ssse3(const unsigned char *src, int *dst, size_t n, const Layout *l) {
+    size_t i = 0;
+    __m128i mask = _mm_loadu_si128((const __m128i*)l->unpack);
+    __m128i bits = _mm_loadu_si128((const __m128i*)l->unpack_or);
+    size_t stop = l->size == 4 ? 4 : 6;
+    for (; i + stop <= n; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + i * l->size));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_or_si128(_mm_shuffle_epi8(v, mask), bits));
+    }
+    unpack_scalar(src + i * l->size, dst + i, n - i, l);
+}
+
+TARGET("avx2") static void pack_avx2(const int *src, unsigned char *dst, size_t n, const Layout *l) {
+    if (l->size != 4) {
+        pack_ssse3(src, dst, n, l);
+        return;
+    }
+    size_t i = 0;
+    __m256i mask = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)l->pack));
+    __m256i bits = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)l->pack_or));
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(src + i));
+        _mm256_storeu_si256((__m256i*)(dst + i * 4), _mm256_or_si256(_mm256_shuffle_epi8(v, mask), bits));
+    }
+    pack_ssse3(src + i, dst + i * 4, n - i, l);
+}
+
+TARGET("avx2") static void unpack_avx2(const unsigned char *src, int *dst, size_t n, const Layout *l) {
+    if (l->size != 4) {
+        unpack_ssse3(src, dst, n, l);
+        return;
+    }
+    size_t i = 0;
+    __m256i mask = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)l->unpack));
+    __m256i bits = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)l->unpack_or));
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(src + i * 4));
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_or_si256(_mm256_shuffle_epi8(v, mask), bits));
+    }
+    unpack_ssse3(src + i * 4, dst + i, n - i, l);
+}
+
+static void to565_sse2(const int *src, unsigned short *dst, size_t n) {
+    size_t i = 0;
+    const __m128i mr = _mm_set1_epi32(0xF800), mg = _mm_set1_epi32(0x07E0), mb = _mm_set1_epi32(0x001F);
+    const __m128i bias32 = _mm_set1_epi32(0x8000), bias16 = _mm_set1_epi16((short)0x8000);
+    for (; i + 8 <= n; i += 8) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(src + i + 4));
+        a = _mm_or_si128(_mm_or_si128(_mm_and_si128(_mm_srli_epi32(a, 8), mr), _mm_and_si128(_mm_srli_epi32(a, 5), mg)), _mm_and_si128(_mm_srli_epi32(a, 3), mb));
+        b = _mm_or_si128(_mm_or_si128(_mm_and_si128(_mm_srli_epi32(b, 8), mr), _mm_and_si128(_mm_srli_epi32(b, 5), mg)), _mm_and_si128(_mm_srli_epi32(b, 3), mb));
+        /* packs is signed, so bias into range and flip back */
+        __m128i v = _mm_packs_epi32(_mm_sub_epi32(a, bias32), _mm_sub_epi32(b, bias32));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_xor_si128(v, bias16));
+    }
+    to565_scalar(src + i, dst + i, n - i);
+}
+
+static inline __m128i expand565_sse2(__m128i v) {
+    const __m128i m5 = _mm_set1_epi32(0x1F), m6 = _mm_set1_epi32(0x3F);
+    __m128i r = _mm_and_si128(_mm_srli_epi32(v, 11), m5);
+    __m128i g = _mm_and_si128(_mm_srli_epi32(v, 5), m6);
+    __m128i b = _mm_and_si128(v, m5);
+    r = _mm_or_si128(_mm_slli_epi32(r, 3), _mm_srli_epi32(r, 2));
+    g = _mm_or_si128(_mm_slli_epi32(g, 2), _mm_srli_epi32(g, 4));
+    b = _mm_or_si128(_mm_slli_epi32(b, 3), _mm_srli_epi32(b, 2));
+    return _mm_or_si128(_mm_or_si128(_mm_set1_epi32((int)0xFF000000), _mm_slli_epi32(r, 16)), _mm_or_si128(_mm_slli_epi32(g, 8), b));
+}
+
+static void from565_sse2(const unsigned short *src, int *dst, size_t n) {
+    size_t i = 0;
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+        _mm_storeu_si128((__m128i*)(dst + i), expand565_sse2(_mm_unpacklo_epi16(v, zero)));
+        _mm_storeu_si128((__m128i*)(dst + i + 4), expand565_sse2(_mm_unpackhi_epi16(v, zero)));
+    }
+    from565_scalar(src + i, dst + i, n - i);
+}
+
+/* Multiply 16-bit channels by their pixel's alpha and divide by 255 */
+static inline __m128i premultiply_half_sse2(__m128i v) {
+    __m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0xFF), 0xFF);
+    v = _mm_add_epi16(_mm_mullo_epi16(v, a), _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(v, _mm_srli_epi16(v, 8)), 8);
+}
+
+static void premultiply_sse2(int *buf, size_t n) {
+    size_t i = 0;
+    const __m128i zero = _mm_setzero_si128(), amask = _mm_set1_epi32((int)0xFF000000);
+    for (; i + 4 <= n; i += 4) {
+        __m128i c = _mm_loadu_si128((const __m128i*)(buf + i));
+        __m128i p = _mm_packus_epi16(premultiply_half_sse2(_mm_unpacklo_epi8(c, zero)),
+                                     premultiply_half_sse2(_mm_unpackhi_epi8(c, zero)));
+        _mm_storeu_si128((__m128i*)(buf + i), _mm_or_si128(_mm_andnot_si128(amask, p), _mm_and_si128(amask, c)));
+    }
+    premultiply_scalar(buf + i, n - i);
+}
+
+TARGET("avx2") static inline __m256i premultiply_half_avx2(__m256i v) {
+    __m256i a = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(v, 0xFF), 0xFF);
+    v = _mm256_add_epi16(_mm256_mullo_epi16(v, a), _mm256_set1_epi16(128));
+    return _mm256_srli_epi16(_mm256_add_epi16(v, _mm256_srli_epi16(v, 8)), 8);
+}
+
+TARGET("avx2") static void premultiply_avx2(int *buf, size_t n) {
+    size_t i = 0;
+    const __m256i zero = _mm256_setzero_si256(), amask = _mm256_set1_epi32((int)0xFF000000);
+    for (; i + 8 <= n; i += 8) {
+        __m256i c = _mm256_loadu_si256((const __m256i*)(buf + i));
+        __m256i p = _mm256_packus_epi16(premultiply_half_avx2(_mm256_unpacklo_epi8(c, zero)),
+                                        premultiply_half_avx2(_mm256_unpackhi_epi8(c, zero)));
+        _mm256_storeu_si256((__m256i*)(buf + i), _mm256_or_si256(_mm256_andnot_si256(amask, p), _mm256_and_si256(amask, c)));
+    }
+    premultiply_sse2(buf + i, n - i);
+}
+
+static bool cpu_has(int leaf, int reg, int bit) {
+#if defined(_MSC_VER)
+    int r[4];
+    __cpuidex(r, leaf, 0);
+    return (r[reg] >> bit) & 1;
+#else
+    unsigned int r[4];
+    __asm__ __volatile__("cpuid" : "=a"(r[0]), "=b"(r[1]), "=c"(r[2]), "=d"(r[3]) : "a"(leaf), "c"(0));
+    return (r[reg] >> bit) & 1;
+#endif
+}
+
+static bool os_saves_ymm(void) {
+    if (!cpu_has(1, 2, 27)) /* OSXSAVE */
+        return false;
+#if defined(_MSC_VER)
+    return (_xgetbv(0) & 6) == 6;
+#else
+    unsigned int lo, hi;
+    __asm__ __volatile__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return (lo & 6) == 6;
+#endif
+}
+#endif
+
+#if defined(CONVERT_NEON)
+static void pack_neon(const int *src, unsigned char *dst, size_t n, const Layout *l) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        uint8x16x4_t v = vld4q_u8((const uint8_t*)(src + i));
+        if (l->size == 3) {
+            uint8x16x3_t o;
+            o.val[l->off[0]] = v.val[0];
+            o.val[l->off[1]] = v.val[1];
+            o.val[l->off[2]] = v.val[2];
+            vst3q_u8(dst + i * 3, o);
+        } else {
+            uint8x16x4_t o;
+            o.val[l->off[0]] = v.val[0];
+            o.val[l->off[1]] = v.val[1];
+            o.val[l->off[2]] = v.val[2];
+            o.val[l->off[3]] = l->opaque ? vdupq_n_u8(0xFF) : v.val[3];
+            vst4q_u8(dst + i * 4, o);
+        }
+    }
+    pack_scalar(src + i, dst + i * l->size, n - i, l);
+}
+
+static void unpack_neon(const unsigned char *src, int *dst, size_t n, const Layout *l) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        uint8x16x4_t o;
+        if (l->size == 3) {
+            uint8x16x3_t v = vld3q_u8(src + i * 3);
+            o.val[0] = v.val[l->off[0]];
+            o.val[1] = v.val[l->off[1]];
+            o.val[2] = v.val[l->off[2]];
+            o.val[3] = vdupq_n_u8(0xFF);
+        } else {
+            uint8x16x4_t v = vld4q_u8(src + i * 4);
+            o.val[0] = v.val[l->off[0]];
+            o.val[1] = v.val[l->off[1]];
+            o.val[2] = v.val[l->off[2]];
+            o.val[3] = l->opaque ? vdupq_n_u8(0xFF) : v.val[l->off[3]];
+        }
+        vst4q_u8((uint8_t*)(dst + i), o);
+    }
+    unpack_scalar(src + i * l->size, dst + i, n - i, l);
+}
+
+static void premultiply_neon(int *buf, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint8x8x4_t v = vld4_u8((const uint8_t*)(buf + i));
+        for (int c = 0; c < 3; ++c) {
+            uint16x8_t t = vmull_u8(v.val[c], v.val[3]);
+            v.val[c] = vraddhn_u16(t, vrshrq_n_u16(t, 8));
+        }
+        vst4_u8((uint8_t*)(buf + i), v);
+    }
+    premultiply_scalar(buf + i, n - i);
+}
+#endif
+
+static struct {
+    const char *name;
+    void(*pack)(const int*, unsigned char*, size_t, const Layout*);
+    void(*unpack)(const unsigned char*, int*, size_t, const Layout*);
+    void(*to565)(const int*, unsigned short*, size_t);
+    void(*from565)(const unsigned short*, int*, size_t);
+    void(*premultiply)(int*, size_t);
+} dispatch;
+
+static void init_dispatch(void) {
+    for (int i = 0; i < PIXEL_FORMAT_COUNT; ++i)
+        if (layouts[i].size > 2)
+            build_masks(&layouts[i]);
+    dispatch.name = "scalar";
+    dispatch.pack = pack_scalar;
+    dispatch.unpack = unpack_scalar;
+    dispatch.to565 = to565_scalar;
+    dispatch.from565 = from565_scalar;
+    dispatch.premultiply = premultiply_scalar;
+#if defined(CONVERT_X86) && !defined(CONVERT_BIG_ENDIAN)
+    /* SSE2 is part of every x86-64 CPU, everything above it is checked */
+    dispatch.to565 = to565_sse2;
+    dispatch.from565 = from565_sse2;
+    dispatch.premultiply = premultiply_sse2;
+    if (cpu_has(1, 2, 9)) {
+        dispatch.name = "ssse3";
+        dispatch.pack = pack_ssse3;
+        dispatch.unpack = unpack_ssse3;
+    }
+    if (cpu_has(7, 1, 5) && os_saves_ymm()) {
+        dispatch.name = "avx2";
+        dispatch.pack = pack_avx2;
+        dispatch.unpack = unpack_avx2;
+        dispatch.premultiply = premultiply_avx2;
+    }
+#elif defined(CONVERT_NEON) && !defined(CONVERT_BIG_ENDIAN)
+    dispatch.name = "neon";
+    dispatch.pack = pack_neon;
+    dispatch.unpack = unpack_neon;
+    dispatch.premultiply = premultiply_neon;
+#endif
+}
+
+/* Conversions run on presenter, job and filter threads, so the masks and table are built exactly once */
+#if defined(_WIN32)
+static INIT_ONCE dispatch_once = INIT_ONCE_STATIC_INIT;
+
+static BOOL CALLBACK dispatch_init(PINIT_ONCE once, PVOID arg, PVOID *ctx) {
+    (void)once; (void)arg; (void)ctx;
+    init_dispatch();
+    return TRUE;
+}
+
+#define CHECK_DISPATCH InitOnceExecuteOnce(&dispatch_once, dispatch_init, NULL, NULL)
+#elif !defined(__EMSCRIPTEN__) || defined(__EMSCRIPTEN_PTHREADS__)
+static pthread_once_t dispatch_once = PTHREAD_ONCE_INIT;
+#define CHECK_DISPATCH pthread_once(&dispatch_once, init_dispatch)
+#else
+static bool dispatch_ready = false;
+#define CHECK_DISPATCH \
+    do { \
+        if (!dispatch_ready) { \
+            init_dispatch(); \
+            dispatch_ready = true; \
+        } \
+    } while (0)
+#endif
+
+/* ARGB32 is the same bytes as BGRA8888 (or ARGB8888 on big endian), so treat them as one */
+static inline PixelFormat canonical(PixelFormat f) {
+#if defined(CONVERT_BIG_ENDIAN)
+    return f == PIXEL_ARGB8888 ? PIXEL_ARGB32 : f;
+#else
+    return f == PIXEL_BGRA8888 ? PIXEL_ARGB32 : f;
+#endif
+}
+
+EXPORT int PixelFormatSize(PixelFormat format) {
+    return format < PIXEL_FORMAT_COUNT ? layouts[format].size : 0;
+}
+
+static void from_argb(const int *src, void *dst, PixelFormat df, size_t n) {
+    if (df == PIXEL_RGB565)
+        dispatch.to565(src, (unsigned short*)dst, n);
+    else
+        dispatch.pack(src, (unsigned char*)dst, n, &layouts[df]);
+}
+
+static void to_argb(const void *src, PixelFormat sf, int *dst, size_t n) {
+    if (sf == PIXEL_RGB565)
+        dispatch.from565((const unsigned short*)src, dst, n);
+    else
+        dispatch.unpack((const unsigned char*)src, dst, n, &layouts[sf]);
+}
+
+EXPORT void ConvertPixels(const void *src, PixelFormat sf, void *dst, PixelFormat df, size_t n) {
+    CHECK_DISPATCH;
+    sf = canonical(sf);
+    df = canonical(df);
+    if (sf == df) {
+        if (src != dst)
+            memmove(dst, src, n * layouts[sf].size);
+    } else if (sf == PIXEL_ARGB32)
+        from_argb((const int*)src, dst, df, n);
+    else if (df == PIXEL_ARGB32)
+        to_argb(src, sf, (int*)dst, n);
+    else {
+        int tmp[256];
+        const unsigned char *s = (const unsigned char*)src;
+        unsigned char *d = (unsigned char*)dst;
+        while (n) {
+            size_t k = n < 256 ? n : 256;
+            to_argb(s, sf, tmp, k);
+            from_argb(tmp, d, df, k);
+            s += k * layouts[sf].size;
+            d += k * layouts[df].size;
+            n -= k;
+        }
+    }
+}
+
+EXPORT void ConvertPixelRows(const void *src, size_t src_pitch, PixelFormat sf, void *dst, size_t dst_pitch, PixelFormat df, int w, int h) {
+    for (int y = 0; y < h; ++y)
+        ConvertPixels((const unsigned char*)src + y * src_pitch, sf, (unsigned char*)dst + y * dst_pitch, df, w);
+}
+
+EXPORT void PremultiplyPixels(int *buf, size_t n) {
+    CHECK_DISPATCH;
+    dispatch.premultiply(buf, n);
+}
+
+/* (255 * 65536 + a / 2) / a, so a channel is unpremultiplied with a multiply and a shift */
+static const unsigned int unpremultiply_recip[256] = {
+    0, 16711680, 8355840, 5570560, 4177920, 3342336, 2785280, 2387383,
+    2088960, 1856853, 1671168, 1519244, 1392640, 1285514, 1193691, 1114112,
+    1044480, 983040, 928427, 879562, 835584, 795794, 759622, 726595,
+    696320, 668467, 642757, 618951, 596846, 576265, 557056, 539086,
+    522240, 506415, 491520, 477477, 464213, 451667, 439781, 428505,
+    417792, 407602, 397897, 388644, 379811, 371371, 363297, 355568,
+    348160, 341055, 334234, 327680, 321378, 315315, 309476, 303849,
+    298423, 293187, 288132, 283249, 278528, 273962, 269543, 265265,
+    261120, 257103, 253207, 249428, 245760, 242198, 238738, 235376,
+    232107, 228927, 225834, 222822, 219891, 217035, 214252, 211540,
+    208896, 206317, 203801, 201346, 198949, 196608, 194322, 192088,
+    189905, 187772, 185685, 183645, 181649, 179695, 177784, 175912,
+    174080, 172285, 170527, 168805, 167117, 165462, 163840, 162249,
+    160689, 159159, 157657, 156184, 154738, 153318, 151924, 150556,
+    149211, 147891, 146594, 145319, 144066, 142835, 141624, 140434,
+    139264, 138113, 136981, 135867, 134772, 133693, 132632, 131588,
+    130560, 129548, 128551, 127570, 126604, 125652, 124714, 123790,
+    122880, 121983, 121099, 120228, 119369, 118523, 117688, 116865,
+    116053, 115253, 114464, 113685, 112917, 112159, 111411, 110673,
+    109945, 109227, 108517, 107817, 107126, 106444, 105770, 105105,
+    104448, 103799, 103159, 102526, 101900, 101283, 100673, 100070,
+    99474, 98886, 98304, 97729, 97161, 96599, 96044, 95495,
+    94953, 94416, 93886, 93361, 92843, 92330, 91822, 91321,
+    90824, 90333, 89848, 89367, 88892, 88422, 87956, 87496,
+    87040, 86589, 86143, 85701, 85264, 84831, 84402, 83978,
+    83558, 83143, 82731, 82324, 81920, 81520, 81125, 80733,
+    80345, 79960, 79579, 79202, 78829, 78459, 78092, 77729,
+    77369, 77012, 76659, 76309, 75962, 75618, 75278, 74940,
+    74606, 74274, 73945, 73620, 73297, 72977, 72659, 72345,
+    72033, 71724, 71417, 71114, 70812, 70513, 70217, 69923,
+    69632, 69343, 69057, 68772, 68490, 68211, 67934, 67659,
+    67386, 67115, 66847, 66580, 66316, 66054, 65794, 65536
+};
+
+EXPORT void UnpremultiplyPixels(int *buf, size_t n) {
+    const unsigned int *recip = unpremultiply_recip;
+    for (size_t i = 0; i < n; ++i) {
+        unsigned int c = (unsigned int)buf[i], a = c >> 24;
+        if (a == 255 || !a)
+            continue;
+        unsigned int r = (((c >> 16) & 0xFF) * recip[a] + 0x8000) >> 16;
+        unsigned int g = (((c >> 8) & 0xFF) * recip[a] + 0x8000) >> 16;
+        unsigned int b = ((c & 0xFF) * recip[a] + 0x8000) >> 16;
+        buf[i] = (int)((a << 24) | ((r > 255 ? 255 : r) << 16) | ((g > 255 ? 255 : g) << 8) | (b > 255 ? 255 : b));
+    }
+}
+
+EXPORT const char *ConverterBackend(void) {
+    CHECK_DISPATCH;
+    return dispatch.name;
+}
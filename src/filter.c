@@ -0,0 +1,914 @@
+/* filter.c
+ *
+ * Created by George Watson on 26/11/2017.
+ * Copyright © 2013-2021 George Watson. All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * *   Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * *   Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * *   Neither the name of the <organization> nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GEORGE WATSON BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "filter.h"
+#include "convert.h"
+#include "jobs.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FILTER_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define FILTER_NEON
+#include <arm_neon.h>
+#endif
+
+#if defined(__EMSCRIPTEN__)
+#include "emscripten.h"
+#define EXPORT EMSCRIPTEN_KEEPALIVE
+#else
+#define EXPORT
+#endif
+
+#define __MIN(a, b) (((a) < (b)) ? (a) : (b))
+#define __MAX(a, b) (((a) > (b)) ? (a) : (b))
+#define __CLAMP(x, low, high) (((x) > (high)) ? (high) : (((x) < (low)) ? (low) : (x)))
+
+/* Columns are processed in strips up to this many pixels wide. Each thread
+ * keeps a strip's accumulators in cache while it walks down the image, and
+ * wider strips give the prefetcher longer runs to work with */
+#define STRIP_MIN 64
+#define STRIP_MAX 512
+
+/* One pixel as four float lanes, one per channel */
+#if defined(FILTER_SSE2)
+typedef __m128 vec4;
+
+static inline vec4 px_load(int c) {
+    __m128i z = _mm_setzero_si128();
+    return _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(c), z), z));
+}
+
+static inline int px_store(vec4 v) {
+    __m128i i = _mm_cvtps_epi32(v);
+    i = _mm_packs_epi32(i, i);
+    return _mm_cvtsi128_si32(_mm_packus_epi16(i, i));
+}
+
+#define v_set1 _mm_set1_ps
+#define v_load _mm_loadu_ps
+#define v_store _mm_storeu_ps
+#define v_add _mm_add_ps
+#define v_sub _mm_sub_ps
+#define v_mul _mm_mul_ps
+#elif defined(FILTER_NEON)
+typedef float32x4_t vec4;
+
+static inline vec4 px_load(int c) {
+    uint8x8_t b = vreinterpret_u8_u32(vdup_n_u32((unsigned int)c));
+    return vcvtq_f32_u32(vmovl_u16(vget_low_u16(vmovl_u8(b))));
+}
+
+static inline int px_store(vec4 v) {
+    uint16x4_t h = vqmovn_u32(vcvtq_u32_f32(vaddq_f32(vmaxq_f32(v, vdupq_n_f32(0.f)), vdupq_n_f32(.5f))));
+    uint8x8_t b = vqmovn_u16(vcombine_u16(h, h));
+    return (int)vget_lane_u32(vreinterpret_u32_u8(b), 0);
+}
+
+#define v_set1 vdupq_n_f32
+#define v_load vld1q_f32
+#define v_store vst1q_f32
+#define v_add vaddq_f32
+#define v_sub vsubq_f32
+#define v_mul vmulq_f32
+#else
+typedef struct {
+    float v[4];
+} vec4;
+
+static inline vec4 px_load(int c) {
+    vec4 r = {{ (float)(c & 0xFF), (float)((c >> 8) & 0xFF), (float)((c >> 16) & 0xFF), (float)((c >> 24) & 0xFF) }};
+    return r;
+}
+
+static inline int px_store(vec4 v) {
+    unsigned int r = 0;
+    for (int i = 0; i < 4; ++i)
+        r |= (unsigned int)__CLAMP((int)(v.v[i] + .5f), 0, 255) << (i * 8);
+    return (int)r;
+}
+
+static inline vec4 v_set1(float f) {
+    vec4 r = {{ f, f, f, f }};
+    return r;
+}
+
+static inline vec4 v_load(const float *p) {
+    vec4 r;
+    memcpy(r.v, p, sizeof(r.v));
+    return r;
+}
+
+static inline void v_store(float *p, vec4 v) {
+    memcpy(p, v.v, sizeof(v.v));
+}
+
+#define VEC4_OP(name, op) \
+    static inline vec4 name(vec4 a, vec4 b) { \
+        vec4 r; \
+        for (int i = 0; i < 4; ++i) \
+            r.v[i] = a.v[i] op b.v[i]; \
+        return r; \
+    }
+VEC4_OP(v_add, +)
+VEC4_OP(v_sub, -)
+VEC4_OP(v_mul, *)
+#endif
+
+typedef struct {
+    const int *src;
+    int *dst;
+    int w, h, r, strip;
+    const float *kernel;
+} Pass;
+
+/* Horizontal box: slide a running sum along each row */
+static void box_rows(int begin, int end, void *userdata) {
+    Pass *p = userdata;
+    int w = p->w, r = p->r;
+    vec4 scale = v_set1(1.f / (2 * r + 1));
+    for (int y = begin; y < end; ++y) {
+        const int *in = p->src + (size_t)y * w;
+        int *out = p->dst + (size_t)y * w;
+        vec4 acc = v_mul(px_load(in[0]), v_set1((float)(r + 1)));
+        for (int i = 1; i <= r; ++i)
+            acc = v_add(acc, px_load(in[__MIN(i, w - 1)]));
+        for (int x = 0; x < w; ++x) {
+            out[x] = px_store(v_mul(acc, scale));
+            acc = v_add(acc, v_sub(px_load(in[__MIN(x + r + 1, w - 1)]), px_load(in[__MAX(x - r, 0)])));
+        }
+    }
+}
+
+#if defined(FILTER_SSE2)
+/* Widen 16 bytes into four vectors of 32-bit lanes */
+static inline void widen_bytes(__m128i b, __m128i *o) {
+    __m128i z = _mm_setzero_si128(), lo = _mm_unpacklo_epi8(b, z), hi = _mm_unpackhi_epi8(b, z);
+    o[0] = _mm_unpacklo_epi16(lo, z);
+    o[1] = _mm_unpackhi_epi16(lo, z);
+    o[2] = _mm_unpacklo_epi16(hi, z);
+    o[3] = _mm_unpackhi_epi16(hi, z);
+}
+
+/* Round four vectors of float lanes back into 16 bytes */
+static inline __m128i narrow_floats(const __m128 *f) {
+    __m128i lo = _mm_packs_epi32(_mm_cvtps_epi32(f[0]), _mm_cvtps_epi32(f[1]));
+    __m128i hi = _mm_packs_epi32(_mm_cvtps_epi32(f[2]), _mm_cvtps_epi32(f[3]));
+    return _mm_packus_epi16(lo, hi);
+}
+#endif
+
+/* Vertical box: one running sum per byte across a strip of columns, walking down the rows */
+static void box_columns(int begin, int end, void *userdata) {
+    Pass *p = userdata;
+    int w = p->w, h = p->h, r = p->r;
+    float scale = 1.f / (2 * r + 1);
+    int acc[STRIP_MAX * 4];
+    size_t pitch = (size_t)w * 4;
+    for (int strip = begin; strip < end; ++strip) {
+        int x0 = strip * p->strip, n = __MIN(p->strip, w - x0) * 4, i;
+        const unsigned char *in = (const unsigned char*)(p->src + x0);
+        unsigned char *out = (unsigned char*)(p->dst + x0);
+        for (i = 0; i < n; ++i)
+            acc[i] = in[i] * (r + 1);
+        for (int k = 1; k <= r; ++k) {
+            const unsigned char *row = in + __MIN(k, h - 1) * pitch;
+            for (i = 0; i < n; ++i)
+                acc[i] += row[i];
+        }
+        for (int y = 0; y < h; ++y) {
+            unsigned char *o = out + y * pitch;
+            const unsigned char *add = in + __MIN(y + r + 1, h - 1) * pitch, *sub = in + __MAX(y - r, 0) * pitch;
+            i = 0;
+#if defined(FILTER_SSE2)
+            __m128 vs = _mm_set1_ps(scale);
+            for (; i + 16 <= n; i += 16) {
+                __m128i *a = (__m128i*)(acc + i), va[4], vb[4];
+                __m128 f[4];
+                for (int j = 0; j < 4; ++j)
+                    f[j] = _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128(a + j)), vs);
+                _mm_storeu_si128((__m128i*)(o + i), narrow_floats(f));
+                widen_bytes(_mm_loadu_si128((const __m128i*)(add + i)), va);
+                widen_bytes(_mm_loadu_si128((const __m128i*)(sub + i)), vb);
+                for (int j = 0; j < 4; ++j)
+                    _mm_storeu_si128(a + j, _mm_add_epi32(_mm_loadu_si128(a + j), _mm_sub_epi32(va[j], vb[j])));
+            }
+#endif
+            for (; i < n; ++i) {
+                o[i] = (unsigned char)(acc[i] * scale + .5f);
+                acc[i] += add[i] - sub[i];
+            }
+        }
+    }
+}
+
+/* Horizontal Gaussian, folding the symmetric taps together */
+static void gauss_rows(int begin, int end, void *userdata) {
+    Pass *p = userdata;
+    int w = p->w, r = p->r;
+    const float *k = p->kernel;
+    for (int y = begin; y < end; ++y) {
+        const int *in = p->src + (size_t)y * w;
+        int *out = p->dst + (size_t)y * w;
+        for (int x = 0; x < w; ++x) {
+            vec4 acc = v_mul(px_load(in[x]), v_set1(k[0]));
+            if (x >= r && x + r < w)
+                for (int i = 1; i <= r; ++i)
+                    acc = v_add(acc, v_mul(v_add(px_load(in[x - i]), px_load(in[x + i])), v_set1(k[i])));
+            else
+                for (int i = 1; i <= r; ++i)
+                    acc = v_add(acc, v_mul(v_add(px_load(in[__MAX(x - i, 0)]), px_load(in[__MIN(x + i, w - 1)])), v_set1(k[i])));
+            out[x] = px_store(acc);
+        }
+    }
+}
+
+static void gauss_columns(int begin, int end, void *userdata) {
+    Pass *p = userdata;
+    int w = p->w, h = p->h, r = p->r;
+    const float *k = p->kernel;
+    float acc[STRIP_MAX * 4];
+    size_t pitch = (size_t)w * 4;
+    for (int strip = begin; strip < end; ++strip) {
+        int x0 = strip * p->strip, n = __MIN(p->strip, w - x0) * 4, i;
+        const unsigned char *in = (const unsigned char*)(p->src + x0);
+        unsigned char *out = (unsigned char*)(p->dst + x0);
+        for (int y = 0; y < h; ++y) {
+            const unsigned char *row = in + y * pitch;
+            for (i = 0; i < n; ++i)
+                acc[i] = row[i] * k[0];
+            for (int j = 1; j <= r; ++j) {
+                const unsigned char *a = in + __MAX(y - j, 0) * pitch, *b = in + __MIN(y + j, h - 1) * pitch;
+                float kj = k[j];
+                i = 0;
+#if defined(FILTER_SSE2)
+                __m128 vk = _mm_set1_ps(kj);
+                __m128i z = _mm_setzero_si128();
+                for (; i + 16 <= n; i += 16) {
+                    __m128i va = _mm_loadu_si128((const __m128i*)(a + i)), vb = _mm_loadu_si128((const __m128i*)(b + i));
+                    __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(va, z), _mm_unpacklo_epi8(vb, z));
+                    __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(va, z), _mm_unpackhi_epi8(vb, z));
+                    __m128i sums[4] = { _mm_unpacklo_epi16(lo, z), _mm_unpackhi_epi16(lo, z), _mm_unpacklo_epi16(hi, z), _mm_unpackhi_epi16(hi, z) };
+                    for (int q = 0; q < 4; ++q)
+                        _mm_storeu_ps(acc + i + q * 4, _mm_add_ps(_mm_loadu_ps(acc + i + q * 4), _mm_mul_ps(_mm_cvtepi32_ps(sums[q]), vk)));
+                }
+#endif
+                for (; i < n; ++i)
+                    acc[i] += (float)(a[i] + b[i]) * kj;
+            }
+            unsigned char *o = out + y * pitch;
+            i = 0;
+#if defined(FILTER_SSE2)
+            for (; i + 16 <= n; i += 16) {
+                __m128 f[4] = { _mm_loadu_ps(acc + i), _mm_loadu_ps(acc + i + 4), _mm_loadu_ps(acc + i + 8), _mm_loadu_ps(acc + i + 12) };
+                _mm_storeu_si128((__m128i*)(o + i), narrow_floats(f));
+            }
+#endif
+            for (; i < n; ++i)
+                o[i] = (unsigned char)(acc[i] + .5f);
+        }
+    }
+}
+
+static void separable(Surface *s, Surface *tmp, int r, const float *kernel) {
+    int strip = __CLAMP(s->w / JobThreadCount(), STRIP_MIN, STRIP_MAX) & ~15;
+    Pass p = { s->buf, tmp->buf, s->w, s->h, r, strip, kernel };
+    ParallelFor(s->h, kernel ? gauss_rows : box_rows, &p);
+    p.src = tmp->buf;
+    p.dst = s->buf;
+    ParallelFor((s->w + strip - 1) / strip, kernel ? gauss_columns : box_columns, &p);
+}
+
+/* Box radii whose three passes best match a Gaussian of the given sigma */
+static void triple_box_radii(float sigma, int *radii) {
+    float ideal = sqrtf(12.f * sigma * sigma / 3.f + 1.f);
+    int wl = (int)floorf(ideal);
+    if (!(wl % 2))
+        wl--;
+    int wu = wl + 2;
+    int m = (int)roundf((12.f * sigma * sigma - 3 * wl * wl - 12 * wl - 9) / (-4.f * wl - 4));
+    for (int i = 0; i < 3; ++i)
+        radii[i] = ((i < m ? wl : wu) - 1) / 2;
+}
+
+static bool opaque(Surface *s) {
+    int all = 0xFF000000, *p = s->buf, *end = s->buf + (size_t)s->w * s->h;
+    while (p < end)
+        all &= *p++;
+    return (all & 0xFF000000) == 0xFF000000;
+}
+
+static bool blur_argb(Surface *s, int radius, BlurMode mode) {
+    Surface tmp;
+    if (!NewSurface(&tmp, s->w, s->h))
+        return false;
+    size_t n = (size_t)s->w * s->h;
+    bool premultiply = !opaque(s);
+    if (premultiply)
+        PremultiplyPixels(s->buf, n);
+
+    switch (mode) {
+        case BLUR_BOX:
+            separable(s, &tmp, radius, NULL);
+            break;
+        case BLUR_TRIPLE_BOX: {
+            int radii[3];
+            triple_box_radii(radius / 3.f, radii);
+            for (int i = 0; i < 3; ++i)
+                if (radii[i] > 0)
+                    separable(s, &tmp, radii[i], NULL);
+            break;
+        }
+        case BLUR_GAUSSIAN: {
+            float *kernel = malloc((radius + 1) * sizeof(float)), sigma = radius / 3.f, sum = 0.f;
+            if (!kernel) {
+                DestroySurface(&tmp);
+                return false;
+            }
+            for (int i = 0; i <= radius; ++i) {
+                kernel[i] = expf(-(float)(i * i) / (2.f * sigma * sigma));
+                sum += i ? 2.f * kernel[i] : kernel[i];
+            }
+            for (int i = 0; i <= radius; ++i)
+                kernel[i] /= sum;
+            separable(s, &tmp, radius, kernel);
+            free(kernel);
+            break;
+        }
+    }
+
+    if (premultiply)
+        UnpremultiplyPixels(s->buf, n);
+    DestroySurface(&tmp);
+    return true;
+}
+
+/* Run an ARGB-only filter on any surface, going through an ARGB copy for the other formats */
+static bool with_argb(Surface *s, bool (*fn)(Surface*, const void*), const void *userdata) {
+    if (s->format == SURFACE_ARGB)
+        return fn(s, userdata);
+    Surface tmp;
+    memset(&tmp, 0, sizeof(Surface));
+    if (!ExpandSurface(s, &tmp))
+        return false;
+    bool ret = fn(&tmp, userdata);
+    if (ret)
+        for (int y = 0; y < s->h; ++y)
+            for (int x = 0; x < s->w; ++x)
+                SetPixel(s, x, y, tmp.buf[(size_t)y * tmp.w + x]);
+    DestroySurface(&tmp);
+    return ret;
+}
+
+typedef struct {
+    int radius;
+    BlurMode mode;
+} BlurArgs;
+
+static bool blur_fn(Surface *s, const void *userdata) {
+    const BlurArgs *args = userdata;
+    return blur_argb(s, args->radius, args->mode);
+}
+
+EXPORT bool BlurSurface(Surface *s, int radius, BlurMode mode) {
+    if (!s->buf || s->w <= 0 || s->h <= 0 || mode > BLUR_GAUSSIAN)
+        return false;
+    if (radius <= 0)
+        return true;
+    BlurArgs args = { radius, mode };
+    return with_argb(s, blur_fn, &args);
+}
+
+/* Convolution
+ *
+ * The output is cut into tiles. Each tile gathers its input plus a halo of
+ * the kernel radius into a padded buffer, clamping at the edges, so the
+ * inner loops never have to check bounds. */
+
+#define KERNEL_MAX 63
+#define CONV_TILE 64
+
+typedef enum {
+    CONV_INT3,
+    CONV_INT5,
+    CONV_SEPARABLE,
+    CONV_GENERAL
+} ConvPath;
+
+typedef struct {
+    SurfaceView *dst;
+    const SurfaceView *src;
+    ConvPath path;
+    int size, r, tiles_x;
+    bool alpha;
+    float scale, bias;
+    const float *weights;
+    float row[KERNEL_MAX], col[KERNEL_MAX];
+    short iw[25];
+    volatile long failed;
+} Conv;
+
+/* Set by any worker that couldn't get its scratch buffers, its tiles are left unwritten */
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define CONV_FAIL(c) _InterlockedExchange(&(c)->failed, 1)
+#else
+#define CONV_FAIL(c) __sync_lock_test_and_set(&(c)->failed, 1)
+#endif
+
+static void gather(const SurfaceView *src, int x0, int y0, int w, int h, int r, int *pad) {
+    int pw = w + 2 * r, lo = x0 - r, hi = x0 + w + r;
+    int left = __CLAMP(-lo, 0, pw), right = __CLAMP(hi - src->w, 0, pw - left);
+    for (int yy = 0; yy < h + 2 * r; ++yy) {
+        const int *row = src->buf + (size_t)__CLAMP(y0 + yy - r, 0, src->h - 1) * src->stride;
+        int *o = pad + (size_t)yy * pw, i;
+        for (i = 0; i < left; ++i)
+            o[i] = row[0];
+        memcpy(o + left, row + lo + left, (pw - left - right) * sizeof(int));
+        for (i = pw - right; i < pw; ++i)
+            o[i] = row[src->w - 1];
+    }
+}
+
+static inline int conv_finish(vec4 acc, int center, const Conv *c) {
+    int px = px_store(v_add(v_mul(acc, v_set1(c->scale)), v_set1(c->bias)));
+    return c->alpha ? px : (int)(((unsigned int)px & 0x00FFFFFF) | ((unsigned int)center & 0xFF000000));
+}
+
+/* Integer kernels with the size fixed at compile time so the tap loops unroll.
+ * With SSE2 two taps go through each multiply-add */
+#if defined(FILTER_SSE2)
+#define DEFINE_CONV_INT(N) \
+    static void conv_int##N(const Conv *c, const int *pad, int pw, int w, int h, int *out, int stride) { \
+        int off[N * N + 1]; \
+        __m128i wp[(N * N + 1) / 2], z = _mm_setzero_si128(); \
+        for (int t = 0; t < N * N; ++t) \
+            off[t] = (t / N) * pw + t % N; \
+        off[N * N] = off[N * N - 1]; \
+        for (int t = 0; t < N * N; t += 2) \
+            wp[t / 2] = _mm_set1_epi32((int)(((unsigned int)(t + 1 < N * N ? c->iw[t + 1] : 0) << 16) | (unsigned short)c->iw[t])); \
+        for (int y = 0; y < h; ++y) \
+            for (int x = 0; x < w; ++x) { \
+                const int *p = pad + (size_t)y * pw + x; \
+                __m128i acc = z; \
+                for (int t = 0; t < N * N; t += 2) { \
+                    __m128i a = _mm_unpacklo_epi8(_mm_cvtsi32_si128(p[off[t]]), z); \
+                    __m128i b = _mm_unpacklo_epi8(_mm_cvtsi32_si128(p[off[t + 1]]), z); \
+                    acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), wp[t / 2])); \
+                } \
+                out[(size_t)y * stride + x] = conv_finish(_mm_cvtepi32_ps(acc), p[(N / 2) * pw + N / 2], c); \
+            } \
+    }
+#else
+#define DEFINE_CONV_INT(N) \
+    static void conv_int##N(const Conv *c, const int *pad, int pw, int w, int h, int *out, int stride) { \
+        for (int y = 0; y < h; ++y) \
+            for (int x = 0; x < w; ++x) { \
+                const int *p = pad + (size_t)y * pw + x; \
+                int acc[4] = { 0, 0, 0, 0 }; \
+                for (int ky = 0; ky < N; ++ky) \
+                    for (int kx = 0; kx < N; ++kx) { \
+                        int v = p[ky * pw + kx], wt = c->iw[ky * N + kx]; \
+                        for (int i = 0; i < 4; ++i) \
+                            acc[i] += ((v >> (i * 8)) & 0xFF) * wt; \
+                    } \
+                float lanes[4] = { (float)acc[0], (float)acc[1], (float)acc[2], (float)acc[3] }; \
+                vec4 f = v_load(lanes); \
+                out[(size_t)y * stride + x] = conv_finish(f, p[(N / 2) * pw + N / 2], c); \
+            } \
+    }
+#endif
+DEFINE_CONV_INT(3)
+DEFINE_CONV_INT(5)
+
+static void conv_separable(const Conv *c, const int *pad, int pw, int w, int h, int *out, int stride, float *tmp) {
+    int n = c->size, ph = h + 2 * c->r;
+    for (int y = 0; y < ph; ++y)
+        for (int x = 0; x < w; ++x) {
+            const int *p = pad + (size_t)y * pw + x;
+            vec4 acc = v_set1(0.f);
+            for (int i = 0; i < n; ++i)
+                acc = v_add(acc, v_mul(px_load(p[i]), v_set1(c->row[i])));
+            v_store(tmp + ((size_t)y * w + x) * 4, acc);
+        }
+    for (int y = 0; y < h; ++y)
+        for (int x = 0; x < w; ++x) {
+            const float *p = tmp + ((size_t)y * w + x) * 4;
+            vec4 acc = v_set1(0.f);
+            for (int i = 0; i < n; ++i)
+                acc = v_add(acc, v_mul(v_load(p + (size_t)i * w * 4), v_set1(c->col[i])));
+            out[(size_t)y * stride + x] = conv_finish(acc, pad[(size_t)(y + c->r) * pw + x + c->r], c);
+        }
+}
+
+static void conv_general(const Conv *c, const int *pad, int pw, int w, int h, int *out, int stride, int *off, float *wt) {
+    int n = 0;
+    for (int t = 0; t < c->size * c->size; ++t)
+        if (c->weights[t] != 0.f) {
+            off[n] = (t / c->size) * pw + t % c->size;
+            wt[n++] = c->weights[t];
+        }
+    for (int y = 0; y < h; ++y)
+        for (int x = 0; x < w; ++x) {
+            const int *p = pad + (size_t)y * pw + x;
+            vec4 acc = v_set1(0.f);
+            for (int t = 0; t < n; ++t)
+                acc = v_add(acc, v_mul(px_load(p[off[t]]), v_set1(wt[t])));
+            out[(size_t)y * stride + x] = conv_finish(acc, p[c->r * pw + c->r], c);
+        }
+}
+
+static void conv_tiles(int begin, int end, void *userdata) {
+    Conv *c = userdata;
+    int r = c->r, pw = CONV_TILE + 2 * r;
+    int *pad = malloc((size_t)pw * pw * sizeof(int));
+    float *tmp = c->path == CONV_SEPARABLE ? malloc((size_t)pw * CONV_TILE * 4 * sizeof(float)) : NULL;
+    int *off = c->path == CONV_GENERAL ? malloc(c->size * c->size * (sizeof(int) + sizeof(float))) : NULL;
+    if (!pad || (c->path == CONV_SEPARABLE && !tmp) || (c->path == CONV_GENERAL && !off)) {
+        CONV_FAIL(c);
+        goto BAIL;
+    }
+    for (int t = begin; t < end; ++t) {
+        int x0 = (t % c->tiles_x) * CONV_TILE, y0 = (t / c->tiles_x) * CONV_TILE;
+        int w = __MIN(CONV_TILE, c->src->w - x0), h = __MIN(CONV_TILE, c->src->h - y0);
+        int *out = c->dst->buf + (size_t)y0 * c->dst->stride + x0;
+        gather(c->src, x0, y0, w, h, r, pad);
+        switch (c->path) {
+            case CONV_INT3:
+                conv_int3(c, pad, w + 2 * r, w, h, out, c->dst->stride);
+                break;
+            case CONV_INT5:
+                conv_int5(c, pad, w + 2 * r, w, h, out, c->dst->stride);
+                break;
+            case CONV_SEPARABLE:
+                conv_separable(c, pad, w + 2 * r, w, h, out, c->dst->stride, tmp);
+                break;
+            case CONV_GENERAL:
+                conv_general(c, pad, w + 2 * r, w, h, out, c->dst->stride, off, (float*)(off + c->size * c->size));
+                break;
+        }
+    }
+BAIL:
+    free(pad);
+    free(tmp);
+    free(off);
+}
+
+/* Split the kernel into a column times a row when it has rank one */
+static bool factor_kernel(Conv *c) {
+    int n = c->size, pi = 0, pj = 0;
+    float max = 0.f;
+    for (int i = 0; i < n * n; ++i)
+        if (fabsf(c->weights[i]) > max) {
+            max = fabsf(c->weights[i]);
+            pi = i / n;
+            pj = i % n;
+        }
+    if (max == 0.f)
+        return false;
+    float pivot = c->weights[pi * n + pj];
+    for (int i = 0; i < n; ++i) {
+        c->col[i] = c->weights[i * n + pj];
+        c->row[i] = c->weights[pi * n + i] / pivot;
+    }
+    for (int i = 0; i < n; ++i)
+        for (int j = 0; j < n; ++j)
+            if (fabsf(c->weights[i * n + j] - c->col[i] * c->row[j]) > max * 1e-5f)
+                return false;
+    return true;
+}
+
+EXPORT bool ConvolveView(SurfaceView *dst, const SurfaceView *src, const Kernel *k) {
+    if (!k || !k->weights || k->size < 1 || k->size > KERNEL_MAX || !(k->size & 1) ||
+        src->w <= 0 || src->h <= 0 || dst->w != src->w || dst->h != src->h)
+        return false;
+    Conv c;
+    c.dst = dst;
+    c.src = src;
+    c.size = k->size;
+    c.r = k->size / 2;
+    c.alpha = k->alpha;
+    c.scale = k->divisor != 0.f ? 1.f / k->divisor : 1.f;
+    c.bias = k->bias;
+    c.weights = k->weights;
+    c.tiles_x = (src->w + CONV_TILE - 1) / CONV_TILE;
+    c.failed = 0;
+
+    bool integral = k->size == 3 || k->size == 5;
+    for (int i = 0; integral && i < k->size * k->size; ++i)
+        integral = k->weights[i] == floorf(k->weights[i]) && fabsf(k->weights[i]) <= 32767.f;
+    if (integral) {
+        c.path = k->size == 3 ? CONV_INT3 : CONV_INT5;
+        for (int i = 0; i < k->size * k->size; ++i)
+            c.iw[i] = (short)k->weights[i];
+    } else if (k->size > 3 && factor_kernel(&c))
+        c.path = CONV_SEPARABLE;
+    else
+        c.path = CONV_GENERAL;
+
+    ParallelFor(c.tiles_x * ((src->h + CONV_TILE - 1) / CONV_TILE), conv_tiles, &c);
+    return !c.failed;
+}
+
+static bool convolve_fn(Surface *s, const void *userdata) {
+    Surface copy;
+    SurfaceView src, dst;
+    if (!CopySurface(s, &copy))
+        return false;
+    GetSurfaceView(&copy, 0, 0, copy.w, copy.h, &src);
+    GetSurfaceView(s, 0, 0, s->w, s->h, &dst);
+    bool ret = ConvolveView(&dst, &src, userdata);
+    DestroySurface(&copy);
+    return ret;
+}
+
+EXPORT bool ConvolveSurface(Surface *s, const Kernel *k) {
+    if (!s->buf || s->w <= 0 || s->h <= 0 || !k)
+        return false;
+    return with_argb(s, convolve_fn, k);
+}
+
+EXPORT bool PresetKernel(KernelPreset preset, Kernel *k) {
+    static const float sharpen[9] = { 0, -1, 0, -1, 5, -1, 0, -1, 0 };
+    static const float edge[9] = { -1, -1, -1, -1, 8, -1, -1, -1, -1 };
+    static const float emboss[9] = { -2, -1, 0, -1, 1, 1, 0, 1, 2 };
+    static const float sobel_x[9] = { -1, 0, 1, -2, 0, 2, -1, 0, 1 };
+    static const float sobel_y[9] = { -1, -2, -1, 0, 0, 0, 1, 2, 1 };
+    static const float gaussian3[9] = { 1, 2, 1, 2, 4, 2, 1, 2, 1 };
+    static const float gaussian5[25] = {
+        1,  4,  6,  4, 1,
+        4, 16, 24, 16, 4,
+        6, 24, 36, 24, 6,
+        4, 16, 24, 16, 4,
+        1,  4,  6,  4, 1
+    };
+    memset(k, 0, sizeof(Kernel));
+    k->size = 3;
+    k->divisor = 1.f;
+    switch (preset) {
+        case KERNEL_SHARPEN:
+            k->weights = sharpen;
+            break;
+        case KERNEL_EDGE:
+            k->weights = edge;
+            break;
+        case KERNEL_EMBOSS:
+            k->weights = emboss;
+            break;
+        case KERNEL_SOBEL_X:
+            k->weights = sobel_x;
+            k->bias = 128.f;
+            break;
+        case KERNEL_SOBEL_Y:
+            k->weights = sobel_y;
+            k->bias = 128.f;
+            break;
+        case KERNEL_GAUSSIAN3:
+            k->weights = gaussian3;
+            k->divisor = 16.f;
+            k->alpha = true;
+            break;
+        case KERNEL_GAUSSIAN5:
+            k->weights = gaussian5;
+            k->size = 5;
+            k->divisor = 256.f;
+            k->alpha = true;
+            break;
+        default:
+            return false;
+    }
+    return true;
+}
+
+/* Summed area tables
+ *
+ * Each row is a running sum along the row with all four channels in one
+ * vector, added to the row above. The sums and squares are stored as
+ * four lanes per entry in byte order (blue, green, red, alpha) */
+
+#define SAT_NARROW_SUMS 16843009    /* UINT32_MAX / 255 */
+#define SAT_NARROW_SQUARES 66051    /* UINT32_MAX / 255^2 */
+
+static const int *sat_source(Surface *s, int y, int *row) {
+    if (s->format == SURFACE_ARGB)
+        return s->buf + (size_t)y * s->w;
+    for (int x = 0; x < s->w; ++x)
+        row[x] = GetPixel(s, x, y);
+    return row;
+}
+
+#if defined(FILTER_SSE2)
+static void sat_row32(const int *in, int w, uint32_t *row, uint32_t *sq) {
+    const __m128i z = _mm_setzero_si128();
+    __m128i acc = z, acc2 = z;
+    for (int x = 0; x < w; ++x) {
+        __m128i p = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(in[x]), z), z);
+        uint32_t *o = row + 4 * x;
+        acc = _mm_add_epi32(acc, p);
+        _mm_storeu_si128((__m128i*)o, _mm_add_epi32(acc, _mm_loadu_si128((const __m128i*)(o - 4 * (w + 1)))));
+        if (sq) {
+            uint32_t *o2 = sq + 4 * x;
+            acc2 = _mm_add_epi32(acc2, _mm_madd_epi16(p, p));
+            _mm_storeu_si128((__m128i*)o2, _mm_add_epi32(acc2, _mm_loadu_si128((const __m128i*)(o2 - 4 * (w + 1)))));
+        }
+    }
+}
+
+static inline void sat_add64(uint64_t *o, __m128i *acc, __m128i p, size_t up) {
+    const __m128i z = _mm_setzero_si128();
+    acc[0] = _mm_add_epi64(acc[0], _mm_unpacklo_epi32(p, z));
+    acc[1] = _mm_add_epi64(acc[1], _mm_unpackhi_epi32(p, z));
+    _mm_storeu_si128((__m128i*)o, _mm_add_epi64(acc[0], _mm_loadu_si128((const __m128i*)(o - up))));
+    _mm_storeu_si128((__m128i*)(o + 2), _mm_add_epi64(acc[1], _mm_loadu_si128((const __m128i*)(o + 2 - up))));
+}
+
+static void sat_row64(const int *in, int w, uint64_t *row, uint64_t *sq) {
+    const __m128i z = _mm_setzero_si128();
+    __m128i acc[2] = { z, z }, acc2[2] = { z, z };
+    size_t up = 4 * ((size_t)w + 1);
+    for (int x = 0; x < w; ++x) {
+        __m128i p = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(in[x]), z), z);
+        sat_add64(row + 4 * x, acc, p, up);
+        if (sq)
+            sat_add64(sq + 4 * x, acc2, _mm_madd_epi16(p, p), up);
+    }
+}
+#elif defined(FILTER_NEON)
+static void sat_row32(const int *in, int w, uint32_t *row, uint32_t *sq) {
+    uint32x4_t acc = vdupq_n_u32(0), acc2 = acc;
+    for (int x = 0; x < w; ++x) {
+        uint16x4_t p = vget_low_u16(vmovl_u8(vreinterpret_u8_u32(vdup_n_u32((uint32_t)in[x]))));
+        uint32_t *o = row + 4 * x;
+        acc = vaddw_u16(acc, p);
+        vst1q_u32(o, vaddq_u32(acc, vld1q_u32(o - 4 * (w + 1))));
+        if (sq) {
+            uint32_t *o2 = sq + 4 * x;
+            acc2 = vmlal_u16(acc2, p, p);
+            vst1q_u32(o2, vaddq_u32(acc2, vld1q_u32(o2 - 4 * (w + 1))));
+        }
+    }
+}
+
+static inline void sat_add64(uint64_t *o, uint64x2_t *acc, uint32x4_t p, size_t up) {
+    acc[0] = vaddw_u32(acc[0], vget_low_u32(p));
+    acc[1] = vaddw_u32(acc[1], vget_high_u32(p));
+    vst1q_u64(o, vaddq_u64(acc[0], vld1q_u64(o - up)));
+    vst1q_u64(o + 2, vaddq_u64(acc[1], vld1q_u64(o + 2 - up)));
+}
+
+static void sat_row64(const int *in, int w, uint64_t *row, uint64_t *sq) {
+    uint64x2_t acc[2] = { vdupq_n_u64(0), vdupq_n_u64(0) }, acc2[2] = { acc[0], acc[0] };
+    size_t up = 4 * ((size_t)w + 1);
+    for (int x = 0; x < w; ++x) {
+        uint16x4_t p = vget_low_u16(vmovl_u8(vreinterpret_u8_u32(vdup_n_u32((uint32_t)in[x]))));
+        sat_add64(row + 4 * x, acc, vmovl_u16(p), up);
+        if (sq)
+            sat_add64(sq + 4 * x, acc2, vmull_u16(p, p), up);
+    }
+}
+#else
+#define DEFINE_SAT_ROW(BITS) \
+    static void sat_row##BITS(const int *in, int w, uint##BITS##_t *row, uint##BITS##_t *sq) { \
+        uint##BITS##_t acc[4] = { 0, 0, 0, 0 }, acc2[4] = { 0, 0, 0, 0 }; \
+        size_t up = 4 * ((size_t)w + 1); \
+        for (int x = 0; x < w; ++x) \
+            for (int i = 0; i < 4; ++i) { \
+                uint##BITS##_t v = ((uint32_t)in[x] >> (i * 8)) & 0xFF; \
+                acc[i] += v; \
+                row[4 * x + i] = acc[i] + row[4 * x + i - up]; \
+                if (sq) { \
+                    acc2[i] += v * v; \
+                    sq[4 * x + i] = acc2[i] + sq[4 * x + i - up]; \
+                } \
+            } \
+    }
+DEFINE_SAT_ROW(32)
+DEFINE_SAT_ROW(64)
+#endif
+
+EXPORT bool NewSummedAreaTable(SummedAreaTable *t, Surface *s, bool squares) {
+    memset(t, 0, sizeof(SummedAreaTable));
+    if (!s->buf || s->w <= 0 || s->h <= 0)
+        return false;
+    t->w = s->w;
+    t->h = s->h;
+    t->wide = (int64_t)s->w * s->h > (squares ? SAT_NARROW_SQUARES : SAT_NARROW_SUMS);
+    size_t stride = 4 * ((size_t)s->w + 1), bytes = stride * ((size_t)s->h + 1) * (t->wide ? 8 : 4);
+    int *row = s->format == SURFACE_ARGB ? NULL : malloc(s->w * sizeof(int));
+    if (!(t->sums = calloc(1, bytes)) || (squares && !(t->squares = calloc(1, bytes))) || (s->format != SURFACE_ARGB && !row)) {
+        free(row);
+        DestroySummedAreaTable(t);
+        return false;
+    }
+    /* Row 0 and column 0 stay zero, so each row starts one entry in and reads the row above without checks */
+    for (int y = 0; y < s->h; ++y) {
+        const int *in = sat_source(s, y, row);
+        size_t at = stride * (y + 1) + 4;
+        if (t->wide)
+            sat_row64(in, s->w, (uint64_t*)t->sums + at, t->squares ? (uint64_t*)t->squares + at : NULL);
+        else
+            sat_row32(in, s->w, (uint32_t*)t->sums + at, t->squares ? (uint32_t*)t->squares + at : NULL);
+    }
+    free(row);
+    return true;
+}
+
+EXPORT void DestroySummedAreaTable(SummedAreaTable *t) {
+    free(t->sums);
+    free(t->squares);
+    memset(t, 0, sizeof(SummedAreaTable));
+}
+
+/* Corners a, b, c, d are top left, top right, bottom left, bottom right.
+ * 32-bit tables wrap, but the difference is still exact because the whole
+ * image is known to fit */
+static void sat_query(SummedAreaTable *t, void *table, int x0, int y0, int x1, int y1, uint64_t out[4]) {
+    size_t stride = 4 * ((size_t)t->w + 1);
+    size_t a = y0 * stride + 4 * x0, b = y0 * stride + 4 * x1, c = y1 * stride + 4 * x0, d = y1 * stride + 4 * x1;
+    static const int order[4] = { 2, 1, 0, 3 };
+    for (int i = 0; i < 4; ++i) {
+        int j = order[i];
+        if (t->wide) {
+            const uint64_t *p = table;
+            out[i] = p[d + j] - p[b + j] - p[c + j] + p[a + j];
+        } else {
+            const uint32_t *p = table;
+            out[i] = (uint32_t)(p[d + j] - p[b + j] - p[c + j] + p[a + j]);
+        }
+    }
+}
+
+static int64_t sat_clip(SummedAreaTable *t, int *x, int *y, int *w, int *h) {
+    int x0 = __MAX(*x, 0), y0 = __MAX(*y, 0);
+    int x1 = (int)__MIN((int64_t)*x + *w, t->w), y1 = (int)__MIN((int64_t)*y + *h, t->h);
+    if (!t->sums || x0 >= x1 || y0 >= y1)
+        return 0;
+    *x = x0;
+    *y = y0;
+    *w = x1;
+    *h = y1;
+    return (int64_t)(x1 - x0) * (y1 - y0);
+}
+
+EXPORT int64_t SummedAreaSum(SummedAreaTable *t, int x, int y, int w, int h, uint64_t sum[4]) {
+    int64_t n = sat_clip(t, &x, &y, &w, &h);
+    if (n)
+        sat_query(t, t->sums, x, y, w, h, sum);
+    return n;
+}
+
+EXPORT int SummedAreaMean(SummedAreaTable *t, int x, int y, int w, int h) {
+    uint64_t sum[4];
+    int64_t n = SummedAreaSum(t, x, y, w, h, sum);
+    if (!n)
+        return 0;
+    int c[4];
+    for (int i = 0; i < 4; ++i)
+        c[i] = (int)((sum[i] + n / 2) / n);
+    return rgba(c[0], c[1], c[2], c[3]);
+}
+
+EXPORT bool SummedAreaVariance(SummedAreaTable *t, int x, int y, int w, int h, float mean[4], float variance[4]) {
+    uint64_t sum[4], sq[4];
+    int64_t n = t->squares ? sat_clip(t, &x, &y, &w, &h) : 0;
+    if (!n)
+        return false;
+    sat_query(t, t->sums, x, y, w, h, sum);
+    sat_query(t, t->squares, x, y, w, h, sq);
+    for (int i = 0; i < 4; ++i) {
+        double m = (double)sum[i] / n;
+        if (mean)
+            mean[i] = (float)m;
+        variance[i] = (float)__MAX((double)sq[i] / n - m * m, 0.);
+    }
+    return true;
+}
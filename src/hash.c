@@ -0,0 +1,523 @@
+/* hash.c
+ *
+ * Created by George Watson on 26/11/2017.
+ * Copyright © 2013-2021 George Watson. All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * *   Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * *   Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * *   Neither the name of the <organization> nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GEORGE WATSON BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+#include "hash.h"
+#include "jobs.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define HASH_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define HASH_NEON
+#include <arm_neon.h>
+#endif
+
+#if defined(__EMSCRIPTEN__)
+#include "emscripten.h"
+#define EXPORT EMSCRIPTEN_KEEPALIVE
+#else
+#define EXPORT
+#endif
+
+#define __MIN(a, b) (((a) < (b)) ? (a) : (b))
+#define __MAX(a, b) (((a) > (b)) ? (a) : (b))
+
+#define DEFAULT_TILE 64
+
+/* Hashing
+ *
+ * The bulk of the input goes through eight 64-bit accumulators, 64 bytes
+ * at a time, in the style of xxHash3: each lane adds the product of the
+ * two halves of its keyed input, plus the raw input of its neighbour.
+ * Every 1K the accumulators are scrambled so the products can't cancel
+ * out. That shape maps directly onto SSE2 and NEON 32x32 -> 64 multiplies,
+ * and the scalar version gives the same result. The accumulators and the
+ * tail are then folded together the xxHash64 way */
+
+#define P32_1 0x9E3779B1U
+#define P64_1 0x9E3779B185EBCA87ULL
+#define P64_2 0xC2B2AE3D27D4EB4FULL
+#define P64_3 0x165667B19E3779F9ULL
+#define P64_4 0x85EBCA77C2B2AE63ULL
+#define P64_5 0x27D4EB2F165667C5ULL
+
+#define STRIPE 64
+#define STRIPES_PER_BLOCK 16
+
+static const uint64_t keys[16] = {
+    0x09F1FD9D03F0A9B4ULL, 0x553274161BBF8475ULL, 0x5D5BCA4696B343B3ULL, 0x70D29B6C7D22528DULL,
+    0x0BF2B716F9915475ULL, 0x5EB7F92B95387CCAULL, 0x296CD0F2C21D7F90ULL, 0x1289A69805C125B1ULL,
+    /* Scramble keys */
+    0xDAA27FB8DACB9E73ULL, 0x3ED08D59CB3F4727ULL, 0x58A5F17B6C15C659ULL, 0x651AC042FA7B481AULL,
+    0x22AF6AEAA88E8DCCULL, 0x2D2BAE64640ABFB9ULL, 0xAD0E83A710231B07ULL, 0x9D30FF2169D91F12ULL
+};
+
+static inline uint64_t read64(const unsigned char *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t rotl64(uint64_t v, int r) {
+    return (v << r) | (v >> (64 - r));
+}
+
+static inline uint64_t avalanche(uint64_t h) {
+    h ^= h >> 33;
+    h *= P64_2;
+    h ^= h >> 29;
+    h *= P64_3;
+    return h ^ (h >> 32);
+}
+
+#if defined(HASH_SSE2)
+static void accumulate(uint64_t *out, const unsigned char *p, size_t stripes) {
+    __m128i acc[4], prime = _mm_set1_epi32((int)P32_1);
+    for (int i = 0; i < 4; ++i)
+        acc[i] = _mm_loadu_si128((const __m128i*)(out + 2 * i));
+    for (size_t s = 0; s < stripes; ++s, p += STRIPE) {
+        for (int i = 0; i < 4; ++i) {
+            __m128i d = _mm_loadu_si128((const __m128i*)(p + 16 * i));
+            __m128i k = _mm_xor_si128(d, _mm_loadu_si128((const __m128i*)(keys + 2 * i)));
+            __m128i product = _mm_mul_epu32(k, _mm_shuffle_epi32(k, _MM_SHUFFLE(0, 3, 0, 1)));
+            acc[i] = _mm_add_epi64(acc[i], _mm_add_epi64(product, _mm_shuffle_epi32(d, _MM_SHUFFLE(1, 0, 3, 2))));
+        }
+        if (s % STRIPES_PER_BLOCK == STRIPES_PER_BLOCK - 1)
+            for (int i = 0; i < 4; ++i) {
+                __m128i a = _mm_xor_si128(acc[i], _mm_srli_epi64(acc[i], 47));
+                a = _mm_xor_si128(a, _mm_loadu_si128((const __m128i*)(keys + 8 + 2 * i)));
+                acc[i] = _mm_add_epi64(_mm_mul_epu32(a, prime), _mm_slli_epi64(_mm_mul_epu32(_mm_srli_epi64(a, 32), prime), 32));
+            }
+    }
+    for (int i = 0; i < 4; ++i)
+        _mm_storeu_si128((__m128i*)(out + 2 * i), acc[i]);
+}
+#elif defined(HASH_NEON)
+static void accumulate(uint64_t *out, const unsigned char *p, size_t stripes) {
+    uint64x2_t acc[4];
+    uint32x2_t prime = vdup_n_u32(P32_1);
+    for (int i = 0; i < 4; ++i)
+        acc[i] = vld1q_u64(out + 2 * i);
+    for (size_t s = 0; s < stripes; ++s, p += STRIPE) {
+        for (int i = 0; i < 4; ++i) {
+            uint64x2_t d = vreinterpretq_u64_u8(vld1q_u8(p + 16 * i));
+            uint64x2_t k = veorq_u64(d, vld1q_u64(keys + 2 * i));
+            uint64x2_t product = vmull_u32(vmovn_u64(k), vshrn_n_u64(k, 32));
+            acc[i] = vaddq_u64(acc[i], vaddq_u64(product, vextq_u64(d, d, 1)));
+        }
+        if (s % STRIPES_PER_BLOCK == STRIPES_PER_BLOCK - 1)
+            for (int i = 0; i < 4; ++i) {
+                uint64x2_t a = veorq_u64(acc[i], vshrq_n_u64(acc[i], 47));
+                a = veorq_u64(a, vld1q_u64(keys + 8 + 2 * i));
+                acc[i] = vaddq_u64(vmull_u32(vmovn_u64(a), prime), vshlq_n_u64(vmull_u32(vshrn_n_u64(a, 32), prime), 32));
+            }
+    }
+    for (int i = 0; i < 4; ++i)
+        vst1q_u64(out + 2 * i, acc[i]);
+}
+#else
+static void accumulate(uint64_t *acc, const unsigned char *p, size_t stripes) {
+    for (size_t s = 0; s < stripes; ++s, p += STRIPE) {
+        for (int i = 0; i < 8; ++i) {
+            uint64_t d = read64(p + 8 * i), k = d ^ keys[i];
+            acc[i ^ 1] += d;
+            acc[i] += (k & 0xFFFFFFFF) * (k >> 32);
+        }
+        if (s % STRIPES_PER_BLOCK == STRIPES_PER_BLOCK - 1)
+            for (int i = 0; i < 8; ++i) {
+                uint64_t a = acc[i] ^ (acc[i] >> 47) ^ keys[8 + i];
+                acc[i] = a * P32_1;
+            }
+    }
+}
+#endif
+
+EXPORT uint64_t HashBytes(const void *data, size_t size, uint64_t seed) {
+    const unsigned char *p = data;
+    uint64_t h = seed + P64_5 + size;
+    size_t stripes = size / STRIPE;
+    if (stripes) {
+        uint64_t acc[8] = { P32_1, P64_1, P64_2, P64_3, P64_4, P64_5, P64_1 ^ P64_4, P64_2 ^ P64_5 };
+        for (int i = 0; i < 8; ++i)
+            acc[i] ^= seed;
+        accumulate(acc, p, stripes);
+        p += stripes * STRIPE;
+        for (int i = 0; i < 8; ++i)
+            h = rotl64(h ^ avalanche(acc[i]), 27) * P64_1 + P64_4;
+    }
+    size_t rest = size % STRIPE;
+    for (; rest >= 8; rest -= 8, p += 8)
+        h = rotl64(h ^ (rotl64(read64(p) * P64_2, 31) * P64_1), 27) * P64_1 + P64_4;
+    for (; rest; --rest, ++p)
+        h = rotl64(h ^ (*p * P64_5), 11) * P64_1;
+    return avalanche(h);
+}
+
+static inline unsigned char *row_ptr(Surface *s, int x, int y) {
+    return (unsigned char*)s->buf + ((size_t)y * s->w + x) * BytesPerPixel(s->format);
+}
+
+EXPORT uint64_t HashSurface(Surface *s) {
+    uint64_t seed = ((uint64_t)(unsigned int)s->w << 32 | (unsigned int)s->h) ^ ((uint64_t)s->format * P64_3);
+    if (!s->buf || s->w <= 0 || s->h <= 0)
+        return avalanche(seed);
+    return HashBytes(s->buf, (size_t)s->w * s->h * BytesPerPixel(s->format), seed);
+}
+
+/* Tile hash grids */
+
+typedef struct {
+    TileHashes *g;
+    Surface *s;
+    unsigned char *changed;
+} TileJob;
+
+static uint64_t hash_tile(Surface *s, int x, int y, int w, int h) {
+    uint64_t v = (uint64_t)(unsigned int)x << 32 | (unsigned int)y;
+    size_t bytes = (size_t)w * BytesPerPixel(s->format);
+    for (int j = 0; j < h; ++j)
+        v = HashBytes(row_ptr(s, x, y + j), bytes, v);
+    return v;
+}
+
+static void hash_tile_rows(int begin, int end, void *userdata) {
+    TileJob *job = userdata;
+    TileHashes *g = job->g;
+    for (int ty = begin; ty < end; ++ty)
+        for (int tx = 0; tx < g->cols; ++tx) {
+            int x = tx * g->tile, y = ty * g->tile, i = ty * g->cols + tx;
+            uint64_t v = hash_tile(job->s, x, y, __MIN(g->tile, g->w - x), __MIN(g->tile, g->h - y));
+            if (job->changed)
+                job->changed[i] = v != g->hashes[i];
+            g->hashes[i] = v;
+        }
+}
+
+EXPORT bool NewTileHashes(TileHashes *g, Surface *s, int tile) {
+    memset(g, 0, sizeof(TileHashes));
+    if (!s->buf || s->w <= 0 || s->h <= 0 || tile < 0)
+        return false;
+    g->w = s->w;
+    g->h = s->h;
+    g->tile = tile ? tile : DEFAULT_TILE;
+    g->cols = (s->w + g->tile - 1) / g->tile;
+    g->rows = (s->h + g->tile - 1) / g->tile;
+    if (!(g->hashes = malloc((size_t)g->cols * g->rows * sizeof(uint64_t))))
+        return false;
+    TileJob job = { g, s, NULL };
+    ParallelFor(g->rows, hash_tile_rows, &job);
+    return true;
+}
+
+EXPORT void DestroyTileHashes(TileHashes *g) {
+    free(g->hashes);
+    memset(g, 0, sizeof(TileHashes));
+}
+
+static inline SurfaceRect tile_rect(int tile, int w, int h, int c0, int r0, int c1, int r1) {
+    SurfaceRect r;
+    r.x = c0 * tile;
+    r.y = r0 * tile;
+    r.w = __MIN(c1 * tile, w) - r.x;
+    r.h = __MIN(r1 * tile, h) - r.y;
+    return r;
+}
+
+static void add_rect(SurfaceRect *rects, int max_rects, int *count, SurfaceRect r) {
+    if (*count < max_rects) {
+        rects[(*count)++] = r;
+        return;
+    }
+    SurfaceRect *last = &rects[max_rects - 1];
+    int x0 = __MIN(last->x, r.x), y0 = __MIN(last->y, r.y);
+    int x1 = __MAX(last->x + last->w, r.x + r.w), y1 = __MAX(last->y + last->h, r.y + r.h);
+    last->x = x0;
+    last->y = y0;
+    last->w = x1 - x0;
+    last->h = y1 - y0;
+}
+
+/* Merge changed tiles into rectangles: runs along each tile row, and runs
+ * spanning the same columns as one in the row above extend it downwards */
+static int merge_tiles(const unsigned char *changed, int cols, int rows, int tile, int w, int h, SurfaceRect *rects, int max_rects) {
+    int count = 0, *open = malloc((size_t)cols * 2 * sizeof(int));
+    if (!open)
+        return -1;
+    int *above = open, *below = open + cols;
+    for (int c = 0; c < cols; ++c)
+        above[c] = -1;
+    for (int r = 0; r < rows; ++r) {
+        const unsigned char *row = changed + (size_t)r * cols;
+        for (int c = 0; c < cols; ++c)
+            below[c] = -1;
+        for (int c = 0; c < cols;) {
+            if (!row[c]) {
+                ++c;
+                continue;
+            }
+            int c0 = c;
+            while (c < cols && row[c])
+                ++c;
+            SurfaceRect t = tile_rect(tile, w, h, c0, r, c, r + 1);
+            int i = above[c0];
+            if (i >= 0 && i < max_rects - 1 && rects[i].x == t.x && rects[i].w == t.w && rects[i].y + rects[i].h == t.y)
+                rects[i].h += t.h;
+            else {
+                i = count < max_rects ? count : max_rects - 1;
+                add_rect(rects, max_rects, &count, t);
+            }
+            below[c0] = i;
+        }
+        int *swap = above;
+        above = below;
+        below = swap;
+    }
+    free(open);
+    return count;
+}
+
+EXPORT int UpdateTileHashes(TileHashes *g, Surface *s, SurfaceRect *rects, int max_rects) {
+    if (!g->hashes || !s->buf || s->w != g->w || s->h != g->h) {
+        int tile = g->tile;
+        DestroyTileHashes(g);
+        if (!NewTileHashes(g, s, tile))
+            return -1;
+        if (rects && max_rects > 0) {
+            SurfaceRect all = { 0, 0, s->w, s->h };
+            rects[0] = all;
+            return 1;
+        }
+        return g->cols * g->rows;
+    }
+    size_t n = (size_t)g->cols * g->rows;
+    unsigned char *changed = malloc(n);
+    if (!changed)
+        return -1;
+    TileJob job = { g, s, changed };
+    ParallelFor(g->rows, hash_tile_rows, &job);
+    int count = 0;
+    if (rects && max_rects > 0)
+        count = merge_tiles(changed, g->cols, g->rows, g->tile, g->w, g->h, rects, max_rects);
+    else
+        for (size_t i = 0; i < n; ++i)
+            count += changed[i];
+    free(changed);
+    return count;
+}
+
+/* Comparing surfaces
+ *
+ * Rows are compared as raw bytes when both surfaces share a format, and
+ * expanded to ARGB otherwise */
+
+typedef struct {
+    Surface *a, *b;
+    int bpp;
+    int *tmp;
+} RowPair;
+
+static bool row_pair(RowPair *p, Surface *a, Surface *b) {
+    if (!a->buf || !b->buf || a->w != b->w || a->h != b->h || a->w <= 0 || a->h <= 0)
+        return false;
+    p->a = a;
+    p->b = b;
+    p->tmp = NULL;
+    if (a->format == b->format) {
+        p->bpp = BytesPerPixel(a->format);
+        return true;
+    }
+    p->bpp = 4;
+    return !!(p->tmp = malloc((size_t)a->w * 2 * sizeof(int)));
+}
+
+static void get_rows(RowPair *p, int x, int y, int n, const unsigned char **ra, const unsigned char **rb) {
+    if (!p->tmp) {
+        *ra = row_ptr(p->a, x, y);
+        *rb = row_ptr(p->b, x, y);
+        return;
+    }
+    for (int i = 0; i < n; ++i) {
+        p->tmp[i] = GetPixel(p->a, x + i, y);
+        p->tmp[p->a->w + i] = GetPixel(p->b, x + i, y);
+    }
+    *ra = (const unsigned char*)p->tmp;
+    *rb = (const unsigned char*)(p->tmp + p->a->w);
+}
+
+typedef struct {
+    bool differs;
+    int x0, y0, x1, y1;
+} TileDiff;
+
+static void diff_tile(RowPair *p, int x, int y, int w, int h, TileDiff *d) {
+    size_t bytes = (size_t)w * p->bpp;
+    d->differs = false;
+    for (int j = 0; j < h; ++j) {
+        const unsigned char *ra, *rb;
+        get_rows(p, x, y + j, w, &ra, &rb);
+        if (!memcmp(ra, rb, bytes))
+            continue;
+        size_t first = 0, last = bytes - 1;
+        while (ra[first] == rb[first])
+            ++first;
+        while (ra[last] == rb[last])
+            --last;
+        int x0 = x + (int)(first / p->bpp), x1 = x + (int)(last / p->bpp) + 1;
+        if (!d->differs) {
+            d->differs = true;
+            d->x0 = x0;
+            d->x1 = x1;
+            d->y0 = y + j;
+        } else {
+            d->x0 = __MIN(d->x0, x0);
+            d->x1 = __MAX(d->x1, x1);
+        }
+        d->y1 = y + j + 1;
+    }
+}
+
+EXPORT int DiffSurfaces(Surface *a, Surface *b, SurfaceRect *rects, int max_rects) {
+    RowPair p;
+    if (!rects || max_rects <= 0 || !row_pair(&p, a, b))
+        return -1;
+    int T = DEFAULT_TILE, cols = (a->w + T - 1) / T, rows = (a->h + T - 1) / T, count = 0;
+    size_t n = (size_t)cols * rows;
+    TileDiff *tiles = malloc(n * sizeof(TileDiff));
+    int *stack = malloc(n * sizeof(int));
+    if (!tiles || !stack) {
+        count = -1;
+        goto BAIL;
+    }
+    for (int ty = 0; ty < rows; ++ty)
+        for (int tx = 0; tx < cols; ++tx)
+            diff_tile(&p, tx * T, ty * T, __MIN(T, a->w - tx * T), __MIN(T, a->h - ty * T), &tiles[ty * cols + tx]);
+    /* Group differing tiles that touch, including diagonally, and take
+     * the bounds of the differences inside each group */
+    for (size_t i = 0; i < n; ++i) {
+        if (!tiles[i].differs)
+            continue;
+        SurfaceRect r = { tiles[i].x0, tiles[i].y0, 0, 0 };
+        int x1 = tiles[i].x1, y1 = tiles[i].y1, top = 0;
+        tiles[i].differs = false;
+        stack[top++] = (int)i;
+        while (top) {
+            int t = stack[--top], tx = t % cols, ty = t / cols;
+            r.x = __MIN(r.x, tiles[t].x0);
+            r.y = __MIN(r.y, tiles[t].y0);
+            x1 = __MAX(x1, tiles[t].x1);
+            y1 = __MAX(y1, tiles[t].y1);
+            for (int dy = -1; dy <= 1; ++dy)
+                for (int dx = -1; dx <= 1; ++dx) {
+                    int nx = tx + dx, ny = ty + dy;
+                    if (nx < 0 || ny < 0 || nx >= cols || ny >= rows || !tiles[ny * cols + nx].differs)
+                        continue;
+                    tiles[ny * cols + nx].differs = false;
+                    stack[top++] = ny * cols + nx;
+                }
+        }
+        r.w = x1 - r.x;
+        r.h = y1 - r.y;
+        add_rect(rects, max_rects, &count, r);
+    }
+BAIL:
+    free(tiles);
+    free(stack);
+    free(p.tmp);
+    return count;
+}
+
+/* Squared error, largest difference and differing pixels over a row of ARGB pixels */
+static void measure_row(const int *a, const int *b, int n, uint64_t *sq, int *max, size_t *differing) {
+    int i = 0;
+#if defined(HASH_SSE2)
+    const __m128i z = _mm_setzero_si128();
+    __m128i vmax = z;
+    while (i + 4 <= n) {
+        /* Flush the 32-bit sums before they can overflow */
+        __m128i vsq = z;
+        for (int k = 0; k < 4096 && i + 4 <= n; ++k, i += 4) {
+            __m128i va = _mm_loadu_si128((const __m128i*)(a + i)), vb = _mm_loadu_si128((const __m128i*)(b + i));
+            __m128i d = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+            __m128i lo = _mm_unpacklo_epi8(d, z), hi = _mm_unpackhi_epi8(d, z);
+            vmax = _mm_max_epu8(vmax, d);
+            vsq = _mm_add_epi32(vsq, _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi)));
+            int same = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(va, vb)));
+            *differing += 4 - ((same & 1) + (same >> 1 & 1) + (same >> 2 & 1) + (same >> 3 & 1));
+        }
+        uint32_t lanes[4];
+        _mm_storeu_si128((__m128i*)lanes, vsq);
+        *sq += (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    }
+    unsigned char bytes[16];
+    _mm_storeu_si128((__m128i*)bytes, vmax);
+    for (int k = 0; k < 16; ++k)
+        *max = __MAX(*max, bytes[k]);
+#endif
+    for (; i < n; ++i) {
+        if (a[i] == b[i])
+            continue;
+        ++*differing;
+        for (int k = 0; k < 32; k += 8) {
+            int d = abs((int)((unsigned int)a[i] >> k & 0xFF) - (int)((unsigned int)b[i] >> k & 0xFF));
+            *sq += (uint64_t)(d * d);
+            *max = __MAX(*max, d);
+        }
+    }
+}
+
+EXPORT bool CompareSurfaces(Surface *a, Surface *b, SurfaceMetrics *m) {
+    memset(m, 0, sizeof(SurfaceMetrics));
+    if (!a->buf || !b->buf || a->w != b->w || a->h != b->h || a->w <= 0 || a->h <= 0)
+        return false;
+    bool argb = a->format == SURFACE_ARGB && b->format == SURFACE_ARGB;
+    int *tmp = argb ? NULL : malloc((size_t)a->w * 2 * sizeof(int));
+    if (!argb && !tmp)
+        return false;
+    uint64_t sq = 0;
+    for (int y = 0; y < a->h; ++y) {
+        const int *ra = a->buf + (size_t)y * a->w, *rb = b->buf + (size_t)y * b->w;
+        if (!argb) {
+            for (int x = 0; x < a->w; ++x) {
+                tmp[x] = GetPixel(a, x, y);
+                tmp[a->w + x] = GetPixel(b, x, y);
+            }
+            ra = tmp;
+            rb = tmp + a->w;
+        }
+        measure_row(ra, rb, a->w, &sq, &m->max_delta, &m->differing);
+    }
+    free(tmp);
+    m->mse = (double)sq / ((double)a->w * a->h * 4);
+    m->psnr = m->mse > 0 ? 10. * log10(255. * 255. / m->mse) : INFINITY;
+    return true;
+}
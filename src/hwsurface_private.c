@@ -64,9 +64,18 @@ unsigned int NewTexture(Surface *surface) {
     unsigned int result = 0;
     if (!surface || !surface->buf)
         return result;
+    // ARGB ints are already the BGRA/8_8_8_8_REV layout drivers take natively, other formats are expanded first
+    Surface expanded = {0};
+    if (surface->format != SURFACE_ARGB) {
+        if (!ExpandSurface(surface, &expanded))
+            return result;
+        surface = &expanded;
+    }
     glGenTextures(1, &result);
     glBindTexture(GL_TEXTURE_2D, result);
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, surface->w, surface->h, 0, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, (void*)surface->buf);
+    if (expanded.buf)
+        DestroySurface(&expanded);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
     return result;
@@ -0,0 +1,1453 @@
+/* image.c
+ *
+ * Created by George Watson on 26/11/2017.
+ * Copyright © 2013-2021 George Watson. All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * *   Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * *   Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * *   Neither the name of the <organization> nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GEORGE WATSON BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "image.h"
+#include "convert.h"
+#include "jobs.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <limits.h>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#elif !defined(__EMSCRIPTEN__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define IMAGE_MMAP
+#endif
+
+#if defined(__EMSCRIPTEN__)
+#include "emscripten.h"
+#define EXPORT EMSCRIPTEN_KEEPALIVE
+#else
+#define EXPORT
+#endif
+
+/* Shared tables are built once, loads and saves run on the job pool */
+#if defined(_WIN32)
+typedef INIT_ONCE once_t;
+#define ONCE_INIT INIT_ONCE_STATIC_INIT
+static BOOL CALLBACK once_callback(PINIT_ONCE once, PVOID fn, PVOID *ctx) {
+    (void)once; (void)ctx;
+    ((void(*)(void))fn)();
+    return TRUE;
+}
+#define run_once(o, fn) InitOnceExecuteOnce((o), once_callback, (PVOID)(fn), NULL)
+#elif !defined(__EMSCRIPTEN__) || defined(__EMSCRIPTEN_PTHREADS__)
+#include <pthread.h>
+typedef pthread_once_t once_t;
+#define ONCE_INIT PTHREAD_ONCE_INIT
+#define run_once(o, fn) pthread_once((o), (fn))
+#else
+typedef bool once_t;
+#define ONCE_INIT false
+#define run_once(o, fn) \
+    do { \
+        if (!*(o)) { \
+            fn(); \
+            *(o) = true; \
+        } \
+    } while (0)
+#endif
+
+#define MAX_DIMENSION (1 << 24)
+
+static inline unsigned int le16(const unsigned char *p) {
+    return p[0] | (p[1] << 8);
+}
+
+static inline unsigned int le32(const unsigned char *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+static inline unsigned int be32(const unsigned char *p) {
+    return ((unsigned int)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static bool new_image(Surface *s, size_t w, size_t h) {
+    if (!w || !h || w > MAX_DIMENSION || h > MAX_DIMENSION || w * h > SIZE_MAX / 4 - 1)
+        return false;
+    return NewSurface(s, (unsigned int)w, (unsigned int)h);
+}
+
+/* BMP */
+
+static inline int mask_shift(unsigned int m) {
+    int i = 0;
+    if (!m)
+        return 0;
+    while (!(m & 1)) {
+        m >>= 1;
+        i++;
+    }
+    return i;
+}
+
+static inline int mask_bits(unsigned int m) {
+    int i = 0;
+    for (m >>= mask_shift(m); m & 1; m >>= 1)
+        i++;
+    return i;
+}
+
+static inline unsigned int mask_channel(unsigned int v, unsigned int m, int shift, int bits) {
+    if (!bits)
+        return 0;
+    v = (v & m) >> shift;
+    return bits >= 8 ? v >> (bits - 8) : (v * 255 + ((1u << bits) - 1) / 2) / ((1u << bits) - 1);
+}
+
+static bool load_bmp(Surface *s, const unsigned char *data, size_t length) {
+    if (length < 26)
+        return false;
+    size_t offset = le32(data + 10), hsz = le32(data + 14);
+    unsigned int compression = 0, colours = 0;
+    int w, h, bpp;
+    if (hsz > length - 14)
+        return false;
+    if (hsz == 12) {
+        w = (short)le16(data + 18);
+        h = (short)le16(data + 20);
+        bpp = le16(data + 24);
+    } else if (hsz >= 40 && length >= 54) {
+        w = (int)le32(data + 18);
+        h = (int)le32(data + 22);
+        bpp = le16(data + 28);
+        compression = le32(data + 30);
+        colours = le32(data + 46);
+    } else
+        return false;
+
+    bool topdown = h < 0;
+    if (topdown && h != INT_MIN)
+        h = -h;
+    if (w <= 0 || h <= 0 || w > MAX_DIMENSION || h > MAX_DIMENSION)
+        return false;
+
+    unsigned int rm = 0, gm = 0, bm = 0, am = 0;
+    switch (compression) {
+        case 0: // BI_RGB
+            if (bpp == 16) {
+                rm = 0x7C00;
+                gm = 0x03E0;
+                bm = 0x001F;
+            } else if (bpp == 24 || bpp == 32) {
+                rm = 0xFF0000;
+                gm = 0x00FF00;
+                bm = 0x0000FF;
+            }
+            break;
+        case 3: // BI_BITFIELDS
+        case 6: // BI_ALPHABITFIELDS
+            if ((bpp != 16 && bpp != 32) || length < 66)
+                return false;
+            rm = le32(data + 54);
+            gm = le32(data + 58);
+            bm = le32(data + 62);
+            if ((hsz >= 56 || compression == 6) && length >= 70)
+                am = le32(data + 66);
+            break;
+        default: // RLE, JPEG and PNG payloads
+            return false;
+    }
+
+    int palette[256];
+    if (bpp <= 8) {
+        if (bpp != 1 && bpp != 4 && bpp != 8)
+            return false;
+        size_t max = 1u << bpp, esz = hsz == 12 ? 3 : 4;
+        size_t n = colours && colours < max ? colours : max;
+        if (n * esz > length - 14 - hsz)
+            return false;
+        const unsigned char *p = data + 14 + hsz;
+        memset(palette, 0, sizeof(palette));
+        for (size_t i = 0; i < n; ++i, p += esz)
+            palette[i] = rgb(p[2], p[1], p[0]);
+    } else if (bpp != 16 && bpp != 24 && bpp != 32)
+        return false;
+
+    size_t pitch = (((size_t)w * bpp + 31) / 32) * 4;
+    // Checked before new_image so a tiny file can't ask for a huge surface
+    if (offset > length || pitch > (length - offset) / h)
+        return false;
+    if (!new_image(s, w, h))
+        return false;
+
+    int rs = mask_shift(rm), gs = mask_shift(gm), bs = mask_shift(bm), as = mask_shift(am);
+    int rb = mask_bits(rm), gb = mask_bits(gm), bb = mask_bits(bm), ab = mask_bits(am);
+    bool native = bpp == 32 && rm == 0xFF0000 && gm == 0xFF00 && bm == 0xFF && (!am || am == 0xFF000000);
+
+    for (int y = 0; y < h; ++y) {
+        const unsigned char *row = data + offset + pitch * y;
+        int *dst = s->buf + (size_t)(topdown ? y : h - 1 - y) * w;
+        switch (bpp) {
+            case 1:
+            case 4:
+            case 8: {
+                int ppb = 8 / bpp, m = (1 << bpp) - 1;
+                for (int x = 0; x < w; ++x)
+                    dst[x] = palette[(row[x / ppb] >> (8 - bpp - (x % ppb) * bpp)) & m];
+                break;
+            }
+            case 24:
+                ConvertPixels(row, PIXEL_BGR888, dst, PIXEL_ARGB32, w);
+                break;
+            case 32:
+                if (native) {
+                    ConvertPixels(row, PIXEL_BGRA8888, dst, PIXEL_ARGB32, w);
+                    if (!am)
+                        for (int x = 0; x < w; ++x)
+                            dst[x] |= 0xFF000000;
+                    break;
+                }
+                // fallthrough
+            default:
+                for (int x = 0; x < w; ++x) {
+                    unsigned int v = bpp == 16 ? le16(row + x * 2) : le32(row + x * 4);
+                    unsigned int a = am ? mask_channel(v, am, as, ab) : 255;
+                    dst[x] = (a << 24) | (mask_channel(v, rm, rs, rb) << 16) | (mask_channel(v, gm, gs, gb) << 8) | mask_channel(v, bm, bs, bb);
+                }
+                break;
+        }
+    }
+    return true;
+}
+
+/* QOI */
+
+#define QOI_OP_INDEX 0x00
+#define QOI_OP_DIFF  0x40
+#define QOI_OP_LUMA  0x80
+#define QOI_OP_RUN   0xC0
+#define QOI_OP_RGB   0xFE
+#define QOI_OP_RGBA  0xFF
+#define QOI_MASK_2   0xC0
+
+static bool load_qoi(Surface *s, const unsigned char *data, size_t length) {
+    if (length < 14 + 8)
+        return false;
+    unsigned int w = be32(data + 4), h = be32(data + 8);
+    if (data[12] < 3 || data[12] > 4 || !new_image(s, w, h))
+        return false;
+
+    unsigned char index[64][4], px[4] = { 0, 0, 0, 255 };
+    memset(index, 0, sizeof(index));
+    const unsigned char *p = data + 14, *end = data + length - 8;
+    int *dst = s->buf, *last = s->buf + (size_t)w * h;
+    while (dst < last) {
+        if (p >= end)
+            goto BAIL;
+        int b1 = *p++;
+        if (b1 == QOI_OP_RGB) {
+            if (end - p < 3)
+                goto BAIL;
+            px[0] = p[0];
+            px[1] = p[1];
+            px[2] = p[2];
+            p += 3;
+        } else if (b1 == QOI_OP_RGBA) {
+            if (end - p < 4)
+                goto BAIL;
+            memcpy(px, p, 4);
+            p += 4;
+        } else
+            switch (b1 & QOI_MASK_2) {
+                case QOI_OP_INDEX:
+                    memcpy(px, index[b1], 4);
+                    break;
+                case QOI_OP_DIFF:
+                    px[0] += ((b1 >> 4) & 3) - 2;
+                    px[1] += ((b1 >> 2) & 3) - 2;
+                    px[2] += (b1 & 3) - 2;
+                    break;
+                case QOI_OP_LUMA: {
+                    if (p >= end)
+                        goto BAIL;
+                    int b2 = *p++, vg = (b1 & 0x3F) - 32;
+                    px[0] += vg - 8 + ((b2 >> 4) & 0x0F);
+                    px[1] += vg;
+                    px[2] += vg - 8 + (b2 & 0x0F);
+                    break;
+                }
+                case QOI_OP_RUN: {
+                    int c = rgba(px[0], px[1], px[2], px[3]);
+                    for (int run = (b1 & 0x3F) + 1; run > 0 && dst < last; --run)
+                        *dst++ = c;
+                    continue;
+                }
+            }
+        memcpy(index[(px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) % 64], px, 4);
+        *dst++ = rgba(px[0], px[1], px[2], px[3]);
+    }
+    return true;
+
+BAIL:
+    DestroySurface(s);
+    return false;
+}
+
+/* PNG
+ *
+ * The zlib stream is inflated across IDAT chunks into a small ring window and
+ * handed to the row decoder as it goes, so the only allocations besides the
+ * surface are two scanlines. CRCs and the adler checksum are not verified.
+ */
+
+#define WINDOW_SIZE (1 << 16)
+#define WINDOW_MASK (WINDOW_SIZE - 1)
+#define FAST_BITS 10
+#define FAST_MASK ((1 << FAST_BITS) - 1)
+
+typedef struct {
+    unsigned short fast[1 << FAST_BITS];
+    short count[16], symbol[288];
+} Huffman;
+
+typedef struct {
+    Surface *s;
+    int w, h, depth, type, channels, pixel;
+    int pass, pw, ph, row;
+    size_t pitch, fill;
+    unsigned char *cur, *prev;
+    int palette[256];
+    int trns[3];
+    bool has_trns;
+} PngRows;
+
+typedef struct {
+    const unsigned char *p, *chunk_end, *end;
+    uint64_t bits;
+    int count;
+    size_t overrun;
+    unsigned char window[WINDOW_SIZE];
+    size_t pos, flushed;
+    PngRows *rows;
+} Inflater;
+
+static const unsigned char adam7_x[7] = { 0, 4, 0, 2, 0, 1, 0 };
+static const unsigned char adam7_y[7] = { 0, 0, 4, 0, 2, 0, 1 };
+static const unsigned char adam7_dx[7] = { 8, 8, 4, 4, 2, 2, 1 };
+static const unsigned char adam7_dy[7] = { 8, 8, 8, 4, 4, 2, 2 };
+
+static bool png_next_pass(PngRows *r) {
+    r->row = 0;
+    do {
+        if (r->pass < 0 || ++r->pass >= 7)
+            return false;
+        r->pw = (r->w - adam7_x[r->pass] + adam7_dx[r->pass] - 1) / adam7_dx[r->pass];
+        r->ph = (r->h - adam7_y[r->pass] + adam7_dy[r->pass] - 1) / adam7_dy[r->pass];
+    } while (!r->pw || !r->ph);
+    r->pitch = ((size_t)r->pw * r->channels * r->depth + 7) / 8;
+    memset(r->prev, 0, r->pitch + 1);
+    return true;
+}
+
+static inline int png_paeth(int a, int b, int c) {
+    int p = a + b - c, pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+    return pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+}
+
+static bool png_unfilter(PngRows *r) {
+    unsigned char *cur = r->cur + 1, *prev = r->prev + 1;
+    size_t i, n = r->pitch, bpp = r->pixel;
+    switch (r->cur[0]) {
+        case 0:
+            break;
+        case 1:
+            for (i = bpp; i < n; ++i)
+                cur[i] += cur[i - bpp];
+            break;
+        case 2:
+            for (i = 0; i < n; ++i)
+                cur[i] += prev[i];
+            break;
+        case 3:
+            for (i = 0; i < bpp; ++i)
+                cur[i] += prev[i] >> 1;
+            for (; i < n; ++i)
+                cur[i] += (cur[i - bpp] + prev[i]) >> 1;
+            break;
+        case 4:
+            for (i = 0; i < bpp; ++i)
+                cur[i] += prev[i];
+            for (; i < n; ++i)
+                cur[i] += png_paeth(cur[i - bpp], prev[i], prev[i - bpp]);
+            break;
+        default:
+            return false;
+    }
+    return true;
+}
+
+static inline int png_sample(const unsigned char *row, int depth, size_t i) {
+    switch (depth) {
+        case 8:
+            return row[i];
+        case 16:
+            return (row[i * 2] << 8) | row[i * 2 + 1];
+        default: {
+            size_t bit = i * depth;
+            return (row[bit >> 3] >> (8 - depth - (bit & 7))) & ((1 << depth) - 1);
+        }
+    }
+}
+
+static void png_emit(PngRows *r) {
+    const unsigned char *row = r->cur + 1;
+    int *dst, step = 1;
+    if (r->pass < 0)
+        dst = r->s->buf + (size_t)r->row * r->w;
+    else {
+        dst = r->s->buf + (size_t)(adam7_y[r->pass] + r->row * adam7_dy[r->pass]) * r->w + adam7_x[r->pass];
+        step = adam7_dx[r->pass];
+    }
+
+    if (r->depth == 8 && step == 1) {
+        if (r->type == 6) {
+            ConvertPixels(row, PIXEL_RGBA8888, dst, PIXEL_ARGB32, r->pw);
+            return;
+        }
+        if (r->type == 2 && !r->has_trns) {
+            ConvertPixels(row, PIXEL_RGB888, dst, PIXEL_ARGB32, r->pw);
+            return;
+        }
+    }
+
+    int shift = r->depth == 16 ? 8 : 0;
+    int scale = r->depth < 8 ? 255 / ((1 << r->depth) - 1) : 1;
+    size_t i;
+    for (int x = 0; x < r->pw; ++x, dst += step) {
+        i = (size_t)x * r->channels;
+        switch (r->type) {
+            case 0: {
+                int v = png_sample(row, r->depth, i), g = (v >> shift) * scale;
+                *dst = rgba(g, g, g, r->has_trns && v == r->trns[0] ? 0 : 255);
+                break;
+            }
+            case 2: {
+                int rv = png_sample(row, r->depth, i), gv = png_sample(row, r->depth, i + 1), bv = png_sample(row, r->depth, i + 2);
+                bool clear = r->has_trns && rv == r->trns[0] && gv == r->trns[1] && bv == r->trns[2];
+                *dst = rgba(rv >> shift, gv >> shift, bv >> shift, clear ? 0 : 255);
+                break;
+            }
+            case 3:
+                *dst = r->palette[png_sample(row, r->depth, i)];
+                break;
+            case 4: {
+                int g = png_sample(row, r->depth, i) >> shift;
+                *dst = rgba(g, g, g, png_sample(row, r->depth, i + 1) >> shift);
+                break;
+            }
+            case 6:
+                *dst = rgba(png_sample(row, r->depth, i) >> shift, png_sample(row, r->depth, i + 1) >> shift, png_sample(row, r->depth, i + 2) >> shift, png_sample(row, r->depth, i + 3) >> shift);
+                break;
+        }
+    }
+}
+
+/* Returns 1 when every row has been decoded, 0 for more input and -1 for a bad filter */
+static int png_feed(PngRows *r, const unsigned char *data, size_t n) {
+    while (n) {
+        size_t want = r->pitch + 1 - r->fill, take = want < n ? want : n;
+        memcpy(r->cur + r->fill, data, take);
+        r->fill += take;
+        data += take;
+        n -= take;
+        if (r->fill <= r->pitch)
+            continue;
+        if (!png_unfilter(r))
+            return -1;
+        png_emit(r);
+        unsigned char *t = r->prev;
+        r->prev = r->cur;
+        r->cur = t;
+        r->fill = 0;
+        if (++r->row >= r->ph && !png_next_pass(r))
+            return 1;
+    }
+    return 0;
+}
+
+static int inflate_flush(Inflater *z) {
+    int ret = 0;
+    while (!ret && z->flushed < z->pos) {
+        size_t start = z->flushed & WINDOW_MASK, n = z->pos - z->flushed;
+        if (start + n > WINDOW_SIZE)
+            n = WINDOW_SIZE - start;
+        ret = png_feed(z->rows, z->window + start, n);
+        z->flushed += n;
+    }
+    return ret;
+}
+
+static inline int inflate_byte(Inflater *z) {
+    while (z->p >= z->chunk_end) {
+        // Step over the CRC into the next chunk, which has to be another IDAT
+        const unsigned char *next = z->chunk_end + 4;
+        if (next + 8 > z->end || memcmp(next + 4, "IDAT", 4)) {
+            z->overrun++;
+            return 0;
+        }
+        size_t len = be32(next);
+        if (len > (size_t)(z->end - next - 8)) {
+            z->overrun++;
+            return 0;
+        }
+        z->p = next + 8;
+        z->chunk_end = z->p + len;
+    }
+    return *z->p++;
+}
+
+static inline void inflate_refill(Inflater *z) {
+    while (z->count <= 56) {
+        z->bits |= (uint64_t)inflate_byte(z) << z->count;
+        z->count += 8;
+    }
+}
+
+static inline unsigned int inflate_bits(Inflater *z, int n) {
+    if (z->count < n)
+        inflate_refill(z);
+    unsigned int v = (unsigned int)(z->bits & ((1ull << n) - 1));
+    z->bits >>= n;
+    z->count -= n;
+    return v;
+}
+
+static bool huffman_build(Huffman *h, const unsigned char *lengths, int n) {
+    short offsets[16];
+    int i, left = 1;
+    memset(h->count, 0, sizeof(h->count));
+    memset(h->fast, 0, sizeof(h->fast));
+    for (i = 0; i < n; ++i)
+        h->count[lengths[i]]++;
+    h->count[0] = 0;
+    for (i = 1; i < 16; ++i) {
+        left = (left << 1) - h->count[i];
+        if (left < 0)
+            return false;
+    }
+    offsets[1] = 0;
+    for (i = 1; i < 15; ++i)
+        offsets[i + 1] = offsets[i] + h->count[i];
+    for (i = 0; i < n; ++i)
+        if (lengths[i])
+            h->symbol[offsets[lengths[i]]++] = i;
+
+    int code = 0, index = 0;
+    for (int len = 1; len <= FAST_BITS; ++len, code <<= 1)
+        for (i = 0; i < h->count[len]; ++i, ++code, ++index) {
+            int rev = 0;
+            for (int b = 0; b < len; ++b)
+                rev |= ((code >> b) & 1) << (len - 1 - b);
+            for (int j = rev; j < (1 << FAST_BITS); j += 1 << len)
+                h->fast[j] = (unsigned short)((len << 9) | h->symbol[index]);
+        }
+    return true;
+}
+
+static int huffman_decode(Inflater *z, const Huffman *h) {
+    if (z->count < 15)
+        inflate_refill(z);
+    unsigned int e = h->fast[z->bits & FAST_MASK];
+    if (e) {
+        z->bits >>= e >> 9;
+        z->count -= e >> 9;
+        return e & 511;
+    }
+    int code = 0, first = 0, index = 0;
+    for (int len = 1; len < 16; ++len) {
+        code |= (int)((z->bits >> (len - 1)) & 1);
+        int count = h->count[len];
+        if (code - count < first) {
+            z->bits >>= len;
+            z->count -= len;
+            return h->symbol[index + (code - first)];
+        }
+        index += count;
+        first = (first + count) << 1;
+        code <<= 1;
+    }
+    return -1;
+}
+
+static const short length_base[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const short length_extra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const short dist_base[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const short dist_extra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+/* Returns 1 when the rows are complete, 0 at the end of a block and -1 on error */
+static int inflate_codes(Inflater *z, const Huffman *lit, const Huffman *dist) {
+    for (;;) {
+        if (z->overrun * 8 > (size_t)z->count)
+            return -1;
+        int sym = huffman_decode(z, lit);
+        if (sym < 0)
+            return -1;
+        if (sym < 256)
+            z->window[z->pos++ & WINDOW_MASK] = (unsigned char)sym;
+        else if (sym == 256)
+            return 0;
+        else {
+            sym -= 257;
+            if (sym >= 29)
+                return -1;
+            int len = length_base[sym] + inflate_bits(z, length_extra[sym]);
+            int ds = huffman_decode(z, dist);
+            if (ds < 0 || ds >= 30)
+                return -1;
+            size_t d = dist_base[ds] + inflate_bits(z, dist_extra[ds]);
+            if (d > z->pos)
+                return -1;
+            for (; len > 0; --len, ++z->pos)
+                z->window[z->pos & WINDOW_MASK] = z->window[(z->pos - d) & WINDOW_MASK];
+        }
+        if (z->pos - z->flushed >= WINDOW_SIZE / 2) {
+            int r = inflate_flush(z);
+            if (r)
+                return r;
+        }
+    }
+}
+
+static int inflate_stored(Inflater *z) {
+    inflate_bits(z, z->count & 7);
+    size_t len = inflate_bits(z, 16), nlen = inflate_bits(z, 16);
+    if ((len ^ 0xFFFF) != nlen)
+        return -1;
+    while (len) {
+        if (z->count >= 8 || z->p >= z->chunk_end) {
+            // Drain what the bit buffer read ahead, and step between IDATs
+            z->window[z->pos++ & WINDOW_MASK] = (unsigned char)inflate_bits(z, 8);
+            len--;
+            if (z->overrun * 8 > (size_t)z->count)
+                return -1;
+        } else {
+            // Otherwise copy straight out of the chunk
+            size_t n = len, at = z->pos & WINDOW_MASK;
+            if (n > (size_t)(z->chunk_end - z->p))
+                n = z->chunk_end - z->p;
+            if (n > WINDOW_SIZE - at)
+                n = WINDOW_SIZE - at;
+            if (n > WINDOW_SIZE / 2)
+                n = WINDOW_SIZE / 2;
+            memcpy(z->window + at, z->p, n);
+            z->p += n;
+            z->pos += n;
+            len -= n;
+        }
+        if (z->pos - z->flushed >= WINDOW_SIZE / 2) {
+            int r = inflate_flush(z);
+            if (r)
+                return r;
+        }
+    }
+    return 0;
+}
+
+static Huffman fixed_lit, fixed_dist;
+static once_t fixed_once = ONCE_INIT;
+
+static void build_fixed(void) {
+    unsigned char lengths[288];
+    int i;
+    for (i = 0; i < 144; ++i)
+        lengths[i] = 8;
+    for (; i < 256; ++i)
+        lengths[i] = 9;
+    for (; i < 280; ++i)
+        lengths[i] = 7;
+    for (; i < 288; ++i)
+        lengths[i] = 8;
+    huffman_build(&fixed_lit, lengths, 288);
+    memset(lengths, 5, 30);
+    huffman_build(&fixed_dist, lengths, 30);
+}
+
+static int inflate_fixed(Inflater *z) {
+    run_once(&fixed_once, build_fixed);
+    return inflate_codes(z, &fixed_lit, &fixed_dist);
+}
+
+static int inflate_dynamic(Inflater *z) {
+    static const unsigned char order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+    unsigned char lengths[320];
+    Huffman lit, dist;
+    int nlen = inflate_bits(z, 5) + 257, ndist = inflate_bits(z, 5) + 1, ncode = inflate_bits(z, 4) + 4;
+    if (nlen > 286 || ndist > 30)
+        return -1;
+    memset(lengths, 0, 19);
+    for (int i = 0; i < ncode; ++i)
+        lengths[order[i]] = inflate_bits(z, 3);
+    if (!huffman_build(&lit, lengths, 19))
+        return -1;
+
+    for (int i = 0; i < nlen + ndist;) {
+        int sym = huffman_decode(z, &lit);
+        if (sym < 0)
+            return -1;
+        if (sym < 16) {
+            lengths[i++] = sym;
+            continue;
+        }
+        int len = 0, rep;
+        if (sym == 16) {
+            if (!i)
+                return -1;
+            len = lengths[i - 1];
+            rep = 3 + inflate_bits(z, 2);
+        } else if (sym == 17)
+            rep = 3 + inflate_bits(z, 3);
+        else
+            rep = 11 + inflate_bits(z, 7);
+        if (i + rep > nlen + ndist)
+            return -1;
+        while (rep--)
+            lengths[i++] = len;
+    }
+    if (!lengths[256] || !huffman_build(&lit, lengths, nlen) || !huffman_build(&dist, lengths + nlen, ndist))
+        return -1;
+    return inflate_codes(z, &lit, &dist);
+}
+
+static bool png_inflate(Inflater *z) {
+    int cmf = inflate_bits(z, 8), flg = inflate_bits(z, 8);
+    if ((cmf & 0x0F) != 8 || (cmf >> 4) > 7 || ((cmf << 8) | flg) % 31 || (flg & 0x20))
+        return false;
+    for (;;) {
+        int last = inflate_bits(z, 1), r;
+        switch (inflate_bits(z, 2)) {
+            case 0:
+                r = inflate_stored(z);
+                break;
+            case 1:
+                r = inflate_fixed(z);
+                break;
+            case 2:
+                r = inflate_dynamic(z);
+                break;
+            default:
+                return false;
+        }
+        if (!r)
+            r = inflate_flush(z);
+        if (r)
+            return r > 0;
+        if (last)
+            return false;
+    }
+}
+
+static bool load_png(Surface *s, const unsigned char *data, size_t length) {
+    static const int channels[7] = { 1, 0, 3, 1, 2, 0, 4 };
+    const unsigned char *p = data + 8, *end = data + length;
+    PngRows rows;
+    memset(&rows, 0, sizeof(rows));
+    rows.s = s;
+
+    bool header = false;
+    for (;;) {
+        if (end - p < 12)
+            return false;
+        size_t len = be32(p);
+        const unsigned char *type = p + 4, *chunk = p + 8;
+        if (len > (size_t)(end - chunk - 4))
+            return false;
+        if (!memcmp(type, "IHDR", 4)) {
+            if (len < 13)
+                return false;
+            rows.w = be32(chunk);
+            rows.h = be32(chunk + 4);
+            rows.depth = chunk[8];
+            rows.type = chunk[9];
+            if (rows.type > 6 || !(rows.channels = channels[rows.type]) || chunk[10] || chunk[11] || chunk[12] > 1)
+                return false;
+            switch (rows.depth) {
+                case 1:
+                case 2:
+                case 4:
+                    if (rows.type != 0 && rows.type != 3)
+                        return false;
+                    break;
+                case 8:
+                    break;
+                case 16:
+                    if (rows.type == 3)
+                        return false;
+                    break;
+                default:
+                    return false;
+            }
+            if (rows.w <= 0 || rows.h <= 0 || rows.w > MAX_DIMENSION || rows.h > MAX_DIMENSION)
+                return false;
+            rows.pass = chunk[12] ? 0 : -1;
+            header = true;
+        } else if (!memcmp(type, "PLTE", 4)) {
+            if (len % 3 || len > 768)
+                return false;
+            for (size_t i = 0; i < len / 3; ++i)
+                rows.palette[i] = rgb(chunk[i * 3], chunk[i * 3 + 1], chunk[i * 3 + 2]);
+        } else if (!memcmp(type, "tRNS", 4)) {
+            if (rows.type == 3)
+                for (size_t i = 0; i < len && i < 256; ++i)
+                    rows.palette[i] = (rows.palette[i] & 0xFFFFFF) | ((unsigned int)chunk[i] << 24);
+            else if (len >= (size_t)rows.channels * 2) {
+                for (int i = 0; i < rows.channels; ++i)
+                    rows.trns[i] = (chunk[i * 2] << 8) | chunk[i * 2 + 1];
+                rows.has_trns = true;
+            }
+        } else if (!memcmp(type, "IDAT", 4))
+            break;
+        else if (!memcmp(type, "IEND", 4))
+            return false;
+        p = chunk + len + 4;
+    }
+    if (!header)
+        return false;
+
+    rows.pixel = (rows.channels * rows.depth + 7) / 8;
+    size_t scanline = ((size_t)rows.w * rows.channels * rows.depth + 7) / 8 + 1;
+    Inflater *z = malloc(sizeof(Inflater));
+    unsigned char *lines = calloc(2, scanline);
+    if (!z || !lines || !new_image(s, rows.w, rows.h)) {
+        free(z);
+        free(lines);
+        return false;
+    }
+    rows.cur = lines;
+    rows.prev = lines + scanline;
+    if (rows.pass < 0) {
+        rows.pw = rows.w;
+        rows.ph = rows.h;
+        rows.pitch = scanline - 1;
+    } else {
+        rows.pw = (rows.w + 7) / 8;
+        rows.ph = (rows.h + 7) / 8;
+        rows.pitch = ((size_t)rows.pw * rows.channels * rows.depth + 7) / 8;
+    }
+
+    memset(z, 0, offsetof(Inflater, window));
+    z->p = p + 8;
+    z->chunk_end = z->p + be32(p);
+    z->end = end;
+    z->pos = z->flushed = 0;
+    z->rows = &rows;
+    bool ok = png_inflate(z);
+
+    free(z);
+    free(lines);
+    if (!ok)
+        DestroySurface(s);
+    return ok;
+}
+
+EXPORT bool LoadSurfaceFromMemory(Surface *s, const void *data, size_t length) {
+    const unsigned char *p = data;
+    if (!p)
+        return false;
+    if (length >= 2 && p[0] == 'B' && p[1] == 'M')
+        return load_bmp(s, p, length);
+    if (length >= 4 && !memcmp(p, "qoif", 4))
+        return load_qoi(s, p, length);
+    if (length >= 8 && !memcmp(p, "\x89PNG\r\n\x1a\n", 8))
+        return load_png(s, p, length);
+    return false;
+}
+
+EXPORT bool LoadSurface(Surface *s, const char *path) {
+    bool ret = false;
+#if defined(IMAGE_MMAP)
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) || st.st_size <= 0) {
+        close(fd);
+        return false;
+    }
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map != MAP_FAILED) {
+#if defined(MADV_SEQUENTIAL)
+        madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+#endif
+        ret = LoadSurfaceFromMemory(s, map, (size_t)st.st_size);
+        munmap(map, (size_t)st.st_size);
+        return ret;
+    }
+#elif defined(_WIN32)
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+    LARGE_INTEGER size;
+    if (GetFileSizeEx(file, &size) && size.QuadPart > 0 && (unsigned long long)size.QuadPart <= SIZE_MAX) {
+        HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping) {
+            void *map = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            if (map) {
+                ret = LoadSurfaceFromMemory(s, map, (size_t)size.QuadPart);
+                UnmapViewOfFile(map);
+            }
+            CloseHandle(mapping);
+            if (map) {
+                CloseHandle(file);
+                return ret;
+            }
+        }
+    }
+    CloseHandle(file);
+#endif
+
+    // Fall back to reading the whole file when it can't be mapped
+    FILE *fh = fopen(path, "rb");
+    if (!fh)
+        return false;
+    fseek(fh, 0, SEEK_END);
+    long size = ftell(fh);
+    fseek(fh, 0, SEEK_SET);
+    unsigned char *data = size > 0 ? malloc((size_t)size) : NULL;
+    if (data && fread(data, 1, (size_t)size, fh) == (size_t)size)
+        ret = LoadSurfaceFromMemory(s, data, (size_t)size);
+    free(data);
+    fclose(fh);
+    return ret;
+}
+
+/* Encoders */
+
+typedef struct {
+    FILE *fh;
+    size_t n;
+    bool ok;
+    unsigned char buf[1 << 16];
+} Writer;
+
+static void writer_flush(Writer *o) {
+    if (o->n && fwrite(o->buf, 1, o->n, o->fh) != o->n)
+        o->ok = false;
+    o->n = 0;
+}
+
+static void writer_put(Writer *o, const void *data, size_t n) {
+    const unsigned char *p = data;
+    while (n) {
+        size_t take = sizeof(o->buf) - o->n;
+        if (take > n)
+            take = n;
+        memcpy(o->buf + o->n, p, take);
+        o->n += take;
+        p += take;
+        n -= take;
+        if (o->n == sizeof(o->buf))
+            writer_flush(o);
+    }
+}
+
+/* Make room for n bytes at the end of the buffer, the caller bumps o->n for what it used */
+static inline unsigned char *writer_space(Writer *o, size_t n) {
+    if (sizeof(o->buf) - o->n < n)
+        writer_flush(o);
+    return o->buf + o->n;
+}
+
+static inline void writer_be32(Writer *o, unsigned int v) {
+    unsigned char b[4] = { v >> 24, v >> 16, v >> 8, v };
+    writer_put(o, b, 4);
+}
+
+static bool opaque(Surface *s) {
+    int all = 0xFF000000, *p = s->buf, *end = s->buf + (size_t)s->w * s->h;
+    while (p < end)
+        all &= *p++;
+    return (all & 0xFF000000) == 0xFF000000;
+}
+
+static bool save_qoi(Writer *o, Surface *s) {
+    unsigned char header[14] = { 'q', 'o', 'i', 'f' };
+    header[4] = s->w >> 24; header[5] = s->w >> 16; header[6] = s->w >> 8; header[7] = s->w;
+    header[8] = s->h >> 24; header[9] = s->h >> 16; header[10] = s->h >> 8; header[11] = s->h;
+    header[12] = opaque(s) ? 3 : 4;
+    header[13] = 0;
+    writer_put(o, header, 14);
+
+    int index[64], prev = (int)0xFF000000, run = 0;
+    memset(index, 0, sizeof(index));
+    const int *p = s->buf, *end = s->buf + (size_t)s->w * s->h;
+    for (; p < end; ++p) {
+        int c = *p;
+        unsigned char *op = writer_space(o, 6);
+        if (c == prev) {
+            if (++run == 62) {
+                *op = QOI_OP_RUN | (run - 1);
+                o->n++;
+                run = 0;
+            }
+            continue;
+        }
+        if (run) {
+            *op++ = QOI_OP_RUN | (run - 1);
+            o->n++;
+            run = 0;
+        }
+        int r = (c >> 16) & 0xFF, g = (c >> 8) & 0xFF, b = c & 0xFF, a = (c >> 24) & 0xFF;
+        int h = (r * 3 + g * 5 + b * 7 + a * 11) % 64;
+        if (index[h] == c) {
+            op[0] = QOI_OP_INDEX | h;
+            o->n += 1;
+        } else {
+            index[h] = c;
+            if ((c ^ prev) & 0xFF000000) {
+                op[0] = QOI_OP_RGBA;
+                op[1] = r; op[2] = g; op[3] = b; op[4] = a;
+                o->n += 5;
+            } else {
+                signed char vr = r - ((prev >> 16) & 0xFF), vg = g - ((prev >> 8) & 0xFF), vb = b - (prev & 0xFF);
+                signed char vgr = vr - vg, vgb = vb - vg;
+                if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2) {
+                    op[0] = QOI_OP_DIFF | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2);
+                    o->n += 1;
+                } else if (vgr > -9 && vgr < 8 && vg > -33 && vg < 32 && vgb > -9 && vgb < 8) {
+                    op[0] = QOI_OP_LUMA | (vg + 32);
+                    op[1] = (vgr + 8) << 4 | (vgb + 8);
+                    o->n += 2;
+                } else {
+                    op[0] = QOI_OP_RGB;
+                    op[1] = r; op[2] = g; op[3] = b;
+                    o->n += 4;
+                }
+            }
+        }
+        prev = c;
+    }
+    if (run) {
+        *writer_space(o, 1) = QOI_OP_RUN | (run - 1);
+        o->n++;
+    }
+    static const unsigned char padding[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+    writer_put(o, padding, 8);
+    return true;
+}
+
+static bool save_pnm(Writer *o, Surface *s, bool alpha) {
+    char header[128];
+    int n = alpha ? snprintf(header, sizeof(header), "P7\nWIDTH %d\nHEIGHT %d\nDEPTH 4\nMAXVAL 255\nTUPLTYPE RGB_ALPHA\nENDHDR\n", s->w, s->h)
+                  : snprintf(header, sizeof(header), "P6\n%d %d\n255\n", s->w, s->h);
+    writer_put(o, header, n);
+    size_t pitch = (size_t)s->w * (alpha ? 4 : 3);
+    unsigned char *row = malloc(pitch);
+    if (!row)
+        return false;
+    for (int y = 0; y < s->h; ++y) {
+        ConvertPixels(s->buf + (size_t)y * s->w, PIXEL_ARGB32, row, alpha ? PIXEL_RGBA8888 : PIXEL_RGB888, s->w);
+        writer_put(o, row, pitch);
+    }
+    free(row);
+    return true;
+}
+
+/* PNG writer
+ *
+ * Rows are filtered with Sub or Up, whichever leaves smaller residuals, and
+ * compressed as a single fixed-Huffman deflate block using a one-probe hash
+ * of 4 byte sequences, roughly what zlib does at level 1.
+ */
+
+#define DEFLATE_WINDOW (1 << 15)
+#define DEFLATE_BUFFER (DEFLATE_WINDOW * 4)
+#define DEFLATE_HASH_BITS 15
+#define IDAT_SIZE (1 << 16)
+
+typedef struct {
+    Writer *o;
+    unsigned int crc, adler_a, adler_b;
+    uint64_t bits;
+    int count;
+    size_t n, fill, done;
+    unsigned char in[DEFLATE_BUFFER];
+    int hash[1 << DEFLATE_HASH_BITS];
+    unsigned char out[IDAT_SIZE + 16];
+} Deflater;
+
+/* CRC-32 of each byte value, polynomial 0xEDB88320 */
+static const unsigned int crc_table[256] = {
+    0x00000000, 0x77073096, 0xEE0E612C, 0x990951BA, 0x076DC419, 0x706AF48F,
+    0xE963A535, 0x9E6495A3, 0x0EDB8832, 0x79DCB8A4, 0xE0D5E91E, 0x97D2D988,
+    0x09B64C2B, 0x7EB17CBD, 0xE7B82D07, 0x90BF1D91, 0x1DB71064, 0x6AB020F2,
+    0xF3B97148, 0x84BE41DE, 0x1ADAD47D, 0x6DDDE4EB, 0xF4D4B551, 0x83D385C7,
+    0x136C9856, 0x646BA8C0, 0xFD62F97A, 0x8A65C9EC, 0x14015C4F, 0x63066CD9,
+    0xFA0F3D63, 0x8D080DF5, 0x3B6E20C8, 0x4C69105E, 0xD56041E4, 0xA2677172,
+    0x3C03E4D1, 0x4B04D447, 0xD20D85FD, 0xA50AB56B, 0x35B5A8FA, 0x42B2986C,
+    0xDBBBC9D6, 0xACBCF940, 0x32D86CE3, 0x45DF5C75, 0xDCD60DCF, 0xABD13D59,
+    0x26D930AC, 0x51DE003A, 0xC8D75180, 0xBFD06116, 0x21B4F4B5, 0x56B3C423,
+    0xCFBA9599, 0xB8BDA50F, 0x2802B89E, 0x5F058808, 0xC60CD9B2, 0xB10BE924,
+    0x2F6F7C87, 0x58684C11, 0xC1611DAB, 0xB6662D3D, 0x76DC4190, 0x01DB7106,
+    0x98D220BC, 0xEFD5102A, 0x71B18589, 0x06B6B51F, 0x9FBFE4A5, 0xE8B8D433,
+    0x7807C9A2, 0x0F00F934, 0x9609A88E, 0xE10E9818, 0x7F6A0DBB, 0x086D3D2D,
+    0x91646C97, 0xE6635C01, 0x6B6B51F4, 0x1C6C6162, 0x856530D8, 0xF262004E,
+    0x6C0695ED, 0x1B01A57B, 0x8208F4C1, 0xF50FC457, 0x65B0D9C6, 0x12B7E950,
+    0x8BBEB8EA, 0xFCB9887C, 0x62DD1DDF, 0x15DA2D49, 0x8CD37CF3, 0xFBD44C65,
+    0x4DB26158, 0x3AB551CE, 0xA3BC0074, 0xD4BB30E2, 0x4ADFA541, 0x3DD895D7,
+    0xA4D1C46D, 0xD3D6F4FB, 0x4369E96A, 0x346ED9FC, 0xAD678846, 0xDA60B8D0,
+    0x44042D73, 0x33031DE5, 0xAA0A4C5F, 0xDD0D7CC9, 0x5005713C, 0x270241AA,
+    0xBE0B1010, 0xC90C2086, 0x5768B525, 0x206F85B3, 0xB966D409, 0xCE61E49F,
+    0x5EDEF90E, 0x29D9C998, 0xB0D09822, 0xC7D7A8B4, 0x59B33D17, 0x2EB40D81,
+    0xB7BD5C3B, 0xC0BA6CAD, 0xEDB88320, 0x9ABFB3B6, 0x03B6E20C, 0x74B1D29A,
+    0xEAD54739, 0x9DD277AF, 0x04DB2615, 0x73DC1683, 0xE3630B12, 0x94643B84,
+    0x0D6D6A3E, 0x7A6A5AA8, 0xE40ECF0B, 0x9309FF9D, 0x0A00AE27, 0x7D079EB1,
+    0xF00F9344, 0x8708A3D2, 0x1E01F268, 0x6906C2FE, 0xF762575D, 0x806567CB,
+    0x196C3671, 0x6E6B06E7, 0xFED41B76, 0x89D32BE0, 0x10DA7A5A, 0x67DD4ACC,
+    0xF9B9DF6F, 0x8EBEEFF9, 0x17B7BE43, 0x60B08ED5, 0xD6D6A3E8, 0xA1D1937E,
+    0x38D8C2C4, 0x4FDFF252, 0xD1BB67F1, 0xA6BC5767, 0x3FB506DD, 0x48B2364B,
+    0xD80D2BDA, 0xAF0A1B4C, 0x36034AF6, 0x41047A60, 0xDF60EFC3, 0xA867DF55,
+    0x316E8EEF, 0x4669BE79, 0xCB61B38C, 0xBC66831A, 0x256FD2A0, 0x5268E236,
+    0xCC0C7795, 0xBB0B4703, 0x220216B9, 0x5505262F, 0xC5BA3BBE, 0xB2BD0B28,
+    0x2BB45A92, 0x5CB36A04, 0xC2D7FFA7, 0xB5D0CF31, 0x2CD99E8B, 0x5BDEAE1D,
+    0x9B64C2B0, 0xEC63F226, 0x756AA39C, 0x026D930A, 0x9C0906A9, 0xEB0E363F,
+    0x72076785, 0x05005713, 0x95BF4A82, 0xE2B87A14, 0x7BB12BAE, 0x0CB61B38,
+    0x92D28E9B, 0xE5D5BE0D, 0x7CDCEFB7, 0x0BDBDF21, 0x86D3D2D4, 0xF1D4E242,
+    0x68DDB3F8, 0x1FDA836E, 0x81BE16CD, 0xF6B9265B, 0x6FB077E1, 0x18B74777,
+    0x88085AE6, 0xFF0F6A70, 0x66063BCA, 0x11010B5C, 0x8F659EFF, 0xF862AE69,
+    0x616BFFD3, 0x166CCF45, 0xA00AE278, 0xD70DD2EE, 0x4E048354, 0x3903B3C2,
+    0xA7672661, 0xD06016F7, 0x4969474D, 0x3E6E77DB, 0xAED16A4A, 0xD9D65ADC,
+    0x40DF0B66, 0x37D83BF0, 0xA9BCAE53, 0xDEBB9EC5, 0x47B2CF7F, 0x30B5FFE9,
+    0xBDBDF21C, 0xCABAC28A, 0x53B39330, 0x24B4A3A6, 0xBAD03605, 0xCDD70693,
+    0x54DE5729, 0x23D967BF, 0xB3667A2E, 0xC4614AB8, 0x5D681B02, 0x2A6F2B94,
+    0xB40BBE37, 0xC30C8EA1, 0x5A05DF1B, 0x2D02EF8D
+};
+
+static unsigned int crc_update(unsigned int crc, const unsigned char *p, size_t n) {
+    while (n--)
+        crc = crc_table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    return crc;
+}
+
+static void png_chunk(Writer *o, const char *type, const unsigned char *data, size_t n) {
+    writer_be32(o, (unsigned int)n);
+    writer_put(o, type, 4);
+    writer_put(o, data, n);
+    writer_be32(o, ~crc_update(crc_update(0xFFFFFFFF, (const unsigned char*)type, 4), data, n));
+}
+
+static void deflate_idat(Deflater *d) {
+    if (d->n) {
+        png_chunk(d->o, "IDAT", d->out, d->n);
+        d->n = 0;
+    }
+}
+
+static inline void deflate_bits(Deflater *d, unsigned int v, int n) {
+    d->bits |= (uint64_t)v << d->count;
+    d->count += n;
+    while (d->count >= 8) {
+        d->out[d->n++] = (unsigned char)d->bits;
+        d->bits >>= 8;
+        d->count -= 8;
+    }
+    if (d->n >= IDAT_SIZE)
+        deflate_idat(d);
+}
+
+static inline unsigned int reverse_bits(unsigned int v, int n) {
+    unsigned int r = 0;
+    while (n--) {
+        r = (r << 1) | (v & 1);
+        v >>= 1;
+    }
+    return r;
+}
+
+static inline void deflate_literal(Deflater *d, int v) {
+    if (v < 144)
+        deflate_bits(d, reverse_bits(0x30 + v, 8), 8);
+    else if (v < 256)
+        deflate_bits(d, reverse_bits(0x190 + v - 144, 9), 9);
+    else if (v < 280)
+        deflate_bits(d, reverse_bits(v - 256, 7), 7);
+    else
+        deflate_bits(d, reverse_bits(0xC0 + v - 280, 8), 8);
+}
+
+static inline int log2i(unsigned int v) {
+    int n = 0;
+    while (v >>= 1)
+        n++;
+    return n;
+}
+
+static void deflate_match(Deflater *d, int len, int dist) {
+    int v = len - 3;
+    if (len == 258)
+        deflate_literal(d, 285);
+    else if (v < 8)
+        deflate_literal(d, 257 + v);
+    else {
+        int nb = log2i(v);
+        deflate_literal(d, 257 + 4 * (nb - 1) + ((v >> (nb - 2)) & 3));
+        deflate_bits(d, v & ((1 << (nb - 2)) - 1), nb - 2);
+    }
+    v = dist - 1;
+    if (v < 4)
+        deflate_bits(d, reverse_bits(v, 5), 5);
+    else {
+        int nb = log2i(v);
+        deflate_bits(d, reverse_bits(2 * nb + ((v >> (nb - 1)) & 1), 5), 5);
+        deflate_bits(d, v & ((1 << (nb - 1)) - 1), nb - 1);
+    }
+}
+
+static inline unsigned int deflate_hash(const unsigned char *p) {
+    unsigned int v;
+    memcpy(&v, p, 4);
+    return (v * 2654435761u) >> (32 - DEFLATE_HASH_BITS);
+}
+
+/* Compress d->in[d->done, d->fill), leaving the tail alone until more input arrives unless final */
+static void deflate_run(Deflater *d, bool final) {
+    size_t end = d->fill, limit = final ? end : end > 258 ? end - 258 : 0;
+    size_t i = d->done;
+    while (i < limit) {
+        int best = 0;
+        if (i + 4 <= end) {
+            unsigned int h = deflate_hash(d->in + i);
+            int cand = d->hash[h];
+            d->hash[h] = (int)i;
+            if (cand >= 0 && i - cand <= DEFLATE_WINDOW && !memcmp(d->in + cand, d->in + i, 4)) {
+                size_t max = end - i < 258 ? end - i : 258;
+                best = 4;
+                while ((size_t)best < max && d->in[cand + best] == d->in[i + best])
+                    best++;
+                deflate_match(d, best, (int)(i - cand));
+                // Index the last position of the match as well so runs keep chaining
+                if (i + best + 3 <= end)
+                    d->hash[deflate_hash(d->in + i + best - 1)] = (int)(i + best - 1);
+                i += best;
+                continue;
+            }
+        }
+        deflate_literal(d, d->in[i++]);
+    }
+    d->done = i;
+    if (final || d->fill < DEFLATE_BUFFER - DEFLATE_WINDOW)
+        return;
+
+    // Slide the last window's worth of input down to the front of the buffer
+    size_t shift = d->done - DEFLATE_WINDOW;
+    memmove(d->in, d->in + shift, d->fill - shift);
+    d->fill -= shift;
+    d->done -= shift;
+    for (int k = 0; k < (1 << DEFLATE_HASH_BITS); ++k)
+        d->hash[k] = d->hash[k] >= (int)shift ? d->hash[k] - (int)shift : -1;
+}
+
+static void deflate_put(Deflater *d, const unsigned char *p, size_t n) {
+    unsigned int a = d->adler_a, b = d->adler_b;
+    for (size_t i = 0; i < n;) {
+        size_t take = n - i < 5552 ? n - i : 5552;
+        for (size_t k = 0; k < take; ++k) {
+            a += p[i + k];
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+        i += take;
+    }
+    d->adler_a = a;
+    d->adler_b = b;
+
+    while (n) {
+        size_t take = DEFLATE_BUFFER - d->fill;
+        if (take > n)
+            take = n;
+        memcpy(d->in + d->fill, p, take);
+        d->fill += take;
+        p += take;
+        n -= take;
+        if (d->fill >= DEFLATE_BUFFER - 258 - 1)
+            deflate_run(d, false);
+    }
+}
+
+static bool save_png(Writer *o, Surface *s) {
+    bool alpha = !opaque(s);
+    int channels = alpha ? 4 : 3;
+    size_t pitch = (size_t)s->w * channels;
+    Deflater *d = malloc(sizeof(Deflater));
+    unsigned char *rows = malloc(pitch * 2 + (pitch + 1) * 2);
+    if (!d || !rows) {
+        free(d);
+        free(rows);
+        return false;
+    }
+    unsigned char *cur = rows, *prev = rows + pitch, *sub = prev + pitch, *up = sub + pitch + 1;
+    memset(prev, 0, pitch);
+
+    static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    unsigned char ihdr[13] = {
+        s->w >> 24, s->w >> 16, s->w >> 8, s->w,
+        s->h >> 24, s->h >> 16, s->h >> 8, s->h,
+        8, alpha ? 6 : 2, 0, 0, 0
+    };
+    writer_put(o, signature, 8);
+    png_chunk(o, "IHDR", ihdr, 13);
+
+    d->o = o;
+    d->adler_a = 1;
+    d->adler_b = 0;
+    d->bits = 0;
+    d->count = 0;
+    d->n = d->fill = d->done = 0;
+    memset(d->hash, 0xFF, sizeof(d->hash));
+    deflate_bits(d, 0x78, 8);
+    deflate_bits(d, 0x01, 8);
+    deflate_bits(d, 1 | (1 << 1), 3); // final block, fixed codes
+
+    for (int y = 0; y < s->h; ++y) {
+        ConvertPixels(s->buf + (size_t)y * s->w, PIXEL_ARGB32, cur, alpha ? PIXEL_RGBA8888 : PIXEL_RGB888, s->w);
+        unsigned int sum_sub = 0, sum_up = 0;
+        sub[0] = 1;
+        up[0] = 2;
+        for (size_t i = 0; i < pitch; ++i) {
+            unsigned char vs = cur[i] - (i >= (size_t)channels ? cur[i - channels] : 0), vu = cur[i] - prev[i];
+            sub[i + 1] = vs;
+            up[i + 1] = vu;
+            sum_sub += vs < 128 ? vs : 256 - vs;
+            sum_up += vu < 128 ? vu : 256 - vu;
+        }
+        deflate_put(d, sum_up < sum_sub ? up : sub, pitch + 1);
+        unsigned char *t = prev;
+        prev = cur;
+        cur = t;
+    }
+    deflate_run(d, true);
+    deflate_literal(d, 256);
+    deflate_bits(d, 0, (8 - d->count) & 7);
+    unsigned int adler = (d->adler_b << 16) | d->adler_a;
+    deflate_bits(d, adler >> 24, 8);
+    deflate_bits(d, (adler >> 16) & 0xFF, 8);
+    deflate_bits(d, (adler >> 8) & 0xFF, 8);
+    deflate_bits(d, adler & 0xFF, 8);
+    deflate_idat(d);
+    png_chunk(o, "IEND", NULL, 0);
+
+    free(d);
+    free(rows);
+    return true;
+}
+
+static const char *extension(const char *path) {
+    const char *dot = strrchr(path, '.');
+    return dot ? dot + 1 : "";
+}
+
+static bool same_text(const char *a, const char *b) {
+    for (; *a && *b; ++a, ++b)
+        if ((*a | 0x20) != (*b | 0x20))
+            return false;
+    return !*a && !*b;
+}
+
+EXPORT bool SaveSurface(Surface *s, const char *path) {
+    const char *ext = extension(path);
+    bool (*encode)(Writer*, Surface*) = NULL;
+    int pnm = -1;
+    if (same_text(ext, "qoi"))
+        encode = save_qoi;
+    else if (same_text(ext, "png"))
+        encode = save_png;
+    else if (same_text(ext, "ppm"))
+        pnm = 0;
+    else if (same_text(ext, "pam"))
+        pnm = 1;
+    else
+        return false;
+    if (!s->buf || s->w <= 0 || s->h <= 0)
+        return false;
+
+    Surface expanded;
+    memset(&expanded, 0, sizeof(Surface));
+    Surface *src = s;
+    if (s->format != SURFACE_ARGB) {
+        if (!ExpandSurface(s, &expanded))
+            return false;
+        src = &expanded;
+    }
+
+    Writer *o = malloc(sizeof(Writer));
+    bool ret = false;
+    if (o && (o->fh = fopen(path, "wb"))) {
+        o->n = 0;
+        o->ok = true;
+        ret = encode ? encode(o, src) : save_pnm(o, src, pnm);
+        writer_flush(o);
+        ret = ret && o->ok;
+        if (fclose(o->fh))
+            ret = false;
+    }
+    free(o);
+    DestroySurface(&expanded);
+    return ret;
+}
+
+typedef struct {
+    Surface copy;
+    SaveCallback cb;
+    void *userdata;
+    char path[];
+} SaveJob;
+
+static void save_job(void *userdata) {
+    SaveJob *job = userdata;
+    bool ret = SaveSurface(&job->copy, job->path);
+    DestroySurface(&job->copy);
+    if (job->cb)
+        job->cb(job->path, ret, job->userdata);
+    free(job);
+}
+
+EXPORT bool SaveSurfaceAsync(Surface *s, const char *path, SaveCallback cb, void *userdata) {
+    size_t len = strlen(path) + 1;
+    SaveJob *job = malloc(sizeof(SaveJob) + len);
+    if (!job)
+        return false;
+    memcpy(job->path, path, len);
+    job->cb = cb;
+    job->userdata = userdata;
+    if (!CopySurface(s, &job->copy) || !RunJob(save_job, job)) {
+        DestroySurface(&job->copy);
+        free(job);
+        return false;
+    }
+    return true;
+}
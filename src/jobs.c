@@ -0,0 +1,294 @@
+/* jobs.c
+ *
+ * Created by George Watson on 26/11/2017.
+ * Copyright © 2013-2021 George Watson. All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * *   Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * *   Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * *   Neither the name of the <organization> nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GEORGE WATSON BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "jobs.h"
+
+#include <stdlib.h>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#define JOBS_THREADS
+typedef CRITICAL_SECTION mutex_t;
+typedef CONDITION_VARIABLE cond_t;
+#define mutex_lock(m) EnterCriticalSection(m)
+#define mutex_unlock(m) LeaveCriticalSection(m)
+#define cond_wait(c, m) SleepConditionVariableCS(c, m, INFINITE)
+#define cond_signal(c) WakeConditionVariable(c)
+#define cond_broadcast(c) WakeAllConditionVariable(c)
+#elif !defined(__EMSCRIPTEN__) || defined(__EMSCRIPTEN_PTHREADS__)
+#include <pthread.h>
+#include <unistd.h>
+#define JOBS_THREADS
+typedef pthread_mutex_t mutex_t;
+typedef pthread_cond_t cond_t;
+#define mutex_lock(m) pthread_mutex_lock(m)
+#define mutex_unlock(m) pthread_mutex_unlock(m)
+#define cond_wait(c, m) pthread_cond_wait(c, m)
+#define cond_signal(c) pthread_cond_signal(c)
+#define cond_broadcast(c) pthread_cond_broadcast(c)
+#endif
+
+#if defined(__EMSCRIPTEN__)
+#include "emscripten.h"
+#define EXPORT EMSCRIPTEN_KEEPALIVE
+#else
+#define EXPORT
+#endif
+
+#define MAX_THREADS 64
+
+#if defined(JOBS_THREADS)
+typedef struct Job {
+    JobCallback fn;
+    void *userdata;
+    struct Job *next;
+} Job;
+
+static struct {
+    mutex_t lock;
+    cond_t work, idle;
+    Job *head, *tail, *spare;
+    int pending, threads;
+} jobs;
+
+#if defined(_WIN32)
+static INIT_ONCE jobs_once = INIT_ONCE_STATIC_INIT;
+#else
+static pthread_once_t jobs_once = PTHREAD_ONCE_INIT;
+#endif
+
+static void job_worker(void) {
+    mutex_lock(&jobs.lock);
+    for (;;) {
+        while (!jobs.head)
+            cond_wait(&jobs.work, &jobs.lock);
+        Job *job = jobs.head;
+        if (!(jobs.head = job->next))
+            jobs.tail = NULL;
+        mutex_unlock(&jobs.lock);
+
+        job->fn(job->userdata);
+
+        mutex_lock(&jobs.lock);
+        job->next = jobs.spare;
+        jobs.spare = job;
+        if (!--jobs.pending)
+            cond_broadcast(&jobs.idle);
+    }
+}
+
+#if defined(_WIN32)
+static DWORD WINAPI job_thread(LPVOID arg) {
+    (void)arg;
+    job_worker();
+    return 0;
+}
+
+static BOOL CALLBACK jobs_init(PINIT_ONCE once, PVOID arg, PVOID *ctx) {
+    (void)once; (void)arg; (void)ctx;
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    int n = (int)info.dwNumberOfProcessors;
+    InitializeCriticalSection(&jobs.lock);
+    InitializeConditionVariable(&jobs.work);
+    InitializeConditionVariable(&jobs.idle);
+    for (int i = 0; i < (n < 1 ? 1 : n > MAX_THREADS ? MAX_THREADS : n); ++i) {
+        HANDLE t = CreateThread(NULL, 0, job_thread, NULL, 0, NULL);
+        if (!t)
+            break;
+        CloseHandle(t);
+        jobs.threads++;
+    }
+    return TRUE;
+}
+#else
+static void *job_thread(void *arg) {
+    (void)arg;
+    job_worker();
+    return NULL;
+}
+
+static void jobs_init(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    pthread_mutex_init(&jobs.lock, NULL);
+    pthread_cond_init(&jobs.work, NULL);
+    pthread_cond_init(&jobs.idle, NULL);
+    for (int i = 0; i < (n < 1 ? 1 : n > MAX_THREADS ? MAX_THREADS : n); ++i) {
+        pthread_t t;
+        if (pthread_create(&t, NULL, job_thread, NULL))
+            break;
+        pthread_detach(t);
+        jobs.threads++;
+    }
+}
+#endif
+
+static bool jobs_start(void) {
+#if defined(_WIN32)
+    InitOnceExecuteOnce(&jobs_once, jobs_init, NULL, NULL);
+#else
+    pthread_once(&jobs_once, jobs_init);
+#endif
+    return jobs.threads > 0;
+}
+
+EXPORT bool RunJob(JobCallback fn, void *userdata) {
+    if (!jobs_start()) {
+        fn(userdata);
+        return true;
+    }
+    mutex_lock(&jobs.lock);
+    Job *job = jobs.spare;
+    if (job)
+        jobs.spare = job->next;
+    else if (!(job = malloc(sizeof(Job)))) {
+        mutex_unlock(&jobs.lock);
+        return false;
+    }
+    job->fn = fn;
+    job->userdata = userdata;
+    job->next = NULL;
+    if (jobs.tail)
+        jobs.tail->next = job;
+    else
+        jobs.head = job;
+    jobs.tail = job;
+    jobs.pending++;
+    cond_signal(&jobs.work);
+    mutex_unlock(&jobs.lock);
+    return true;
+}
+
+EXPORT void WaitJobs(void) {
+    if (!jobs_start())
+        return;
+    mutex_lock(&jobs.lock);
+    while (jobs.pending)
+        cond_wait(&jobs.idle, &jobs.lock);
+    mutex_unlock(&jobs.lock);
+}
+
+EXPORT int JobThreadCount(void) {
+    return jobs_start() ? jobs.threads : 1;
+}
+
+/* Shared by the caller and its helper jobs. Helpers that start after every
+ * chunk is taken just drop their reference, so the caller only ever waits
+ * on work that is actually running and nested calls can't deadlock */
+typedef struct {
+    void(*fn)(int, int, void*);
+    void *userdata;
+    int n, chunk, done, refs;
+    volatile long next;
+} ParallelTask;
+
+#if defined(_WIN32)
+#define FETCH_ADD(p, v) InterlockedExchangeAdd((p), (v))
+#else
+#define FETCH_ADD(p, v) __sync_fetch_and_add((p), (v))
+#endif
+
+/* Take chunks until there are none left, returning how many items were done */
+static int parallel_chunks(ParallelTask *t) {
+    int done = 0;
+    for (;;) {
+        long begin = FETCH_ADD(&t->next, t->chunk);
+        if (begin >= t->n)
+            return done;
+        int end = begin + t->chunk < t->n ? (int)begin + t->chunk : t->n;
+        t->fn((int)begin, end, t->userdata);
+        done += end - (int)begin;
+    }
+}
+
+static void parallel_job(void *userdata) {
+    ParallelTask *t = userdata;
+    int done = parallel_chunks(t);
+    mutex_lock(&jobs.lock);
+    t->done += done;
+    bool last = !--t->refs;
+    if (done)
+        cond_broadcast(&jobs.idle);
+    mutex_unlock(&jobs.lock);
+    if (last)
+        free(t);
+}
+
+EXPORT void ParallelFor(int n, void(*fn)(int begin, int end, void *userdata), void *userdata) {
+    if (n <= 0)
+        return;
+    int threads = JobThreadCount();
+    ParallelTask *t = NULL;
+    if (threads < 2 || n < 2 || !(t = malloc(sizeof(ParallelTask)))) {
+        fn(0, n, userdata);
+        return;
+    }
+    int helpers = threads < n ? threads : n - 1;
+    t->fn = fn;
+    t->userdata = userdata;
+    t->n = n;
+    t->chunk = n / (threads * 4) > 0 ? n / (threads * 4) : 1;
+    t->next = 0;
+    t->done = 0;
+    t->refs = helpers + 1;
+    for (int i = 0; i < helpers; ++i)
+        if (!RunJob(parallel_job, t)) {
+            mutex_lock(&jobs.lock);
+            t->refs--;
+            mutex_unlock(&jobs.lock);
+        }
+
+    int done = parallel_chunks(t);
+    mutex_lock(&jobs.lock);
+    t->done += done;
+    while (t->done < n)
+        cond_wait(&jobs.idle, &jobs.lock);
+    bool last = !--t->refs;
+    mutex_unlock(&jobs.lock);
+    if (last)
+        free(t);
+}
+#else
+EXPORT bool RunJob(JobCallback fn, void *userdata) {
+    fn(userdata);
+    return true;
+}
+
+EXPORT void WaitJobs(void) {
+}
+
+EXPORT int JobThreadCount(void) {
+    return 1;
+}
+
+EXPORT void ParallelFor(int n, void(*fn)(int begin, int end, void *userdata), void *userdata) {
+    if (n > 0)
+        fn(0, n, userdata);
+}
+#endif
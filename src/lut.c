@@ -0,0 +1,348 @@
+/* lut.c
+ *
+ * Created by George Watson on 26/11/2017.
+ * Copyright © 2013-2021 George Watson. All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * *   Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * *   Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * *   Neither the name of the <organization> nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GEORGE WATSON BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+#include "lut.h"
+#include "jobs.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define LUT_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define LUT_NEON
+#include <arm_neon.h>
+#endif
+
+#if defined(__EMSCRIPTEN__)
+#include "emscripten.h"
+#define EXPORT EMSCRIPTEN_KEEPALIVE
+#else
+#define EXPORT
+#endif
+
+#define __MIN(a, b) (((a) < (b)) ? (a) : (b))
+#define __MAX(a, b) (((a) > (b)) ? (a) : (b))
+#define __CLAMP(x, low, high) (((x) > (high)) ? (high) : (((x) < (low)) ? (low) : (x)))
+
+#define LUT_1D_MAX 4096
+#define LUT_3D_MAX 256
+
+EXPORT bool NewLut(Lut *l, LutType type, int size) {
+    memset(l, 0, sizeof(Lut));
+    if (type > LUT_3D || size < 2 || size > (type == LUT_1D ? LUT_1D_MAX : LUT_3D_MAX))
+        return false;
+    size_t n = type == LUT_1D ? (size_t)size : (size_t)size * size * size;
+    if (!(l->table = malloc(n * 4 * sizeof(float))))
+        return false;
+    l->type = type;
+    l->size = size;
+    for (int i = 0; i < 3; ++i) {
+        l->min[i] = 0.f;
+        l->max[i] = 1.f;
+    }
+    float *o = l->table;
+    for (size_t i = 0; i < n; ++i, o += 4) {
+        if (type == LUT_1D)
+            o[0] = o[1] = o[2] = (float)i / (size - 1);
+        else {
+            o[0] = (float)(i % size) / (size - 1);
+            o[1] = (float)(i / size % size) / (size - 1);
+            o[2] = (float)(i / size / size) / (size - 1);
+        }
+        o[3] = 0.f;
+    }
+    return true;
+}
+
+EXPORT void DestroyLut(Lut *l) {
+    free(l->table);
+    memset(l, 0, sizeof(Lut));
+}
+
+static bool keyword(char **p, const char *word) {
+    size_t n = strlen(word);
+    if (strncmp(*p, word, n) || !isspace((unsigned char)(*p)[n]))
+        return false;
+    *p += n;
+    return true;
+}
+
+static bool floats(char *p, float *out, int n) {
+    for (int i = 0; i < n; ++i) {
+        char *end;
+        out[i] = strtof(p, &end);
+        if (end == p)
+            return false;
+        p = end;
+    }
+    return true;
+}
+
+EXPORT bool LoadCubeLut(Lut *l, const char *path) {
+    memset(l, 0, sizeof(Lut));
+    FILE *fh = fopen(path, "r");
+    if (!fh)
+        return false;
+    char line[512];
+    float min[3] = { 0.f, 0.f, 0.f }, max[3] = { 1.f, 1.f, 1.f };
+    size_t count = 0, total = 0;
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), fh)) {
+        char *p = line;
+        bool one;
+        while (isspace((unsigned char)*p))
+            ++p;
+        if (!*p || *p == '#' || keyword(&p, "TITLE"))
+            continue;
+        if ((one = keyword(&p, "LUT_1D_SIZE")) || keyword(&p, "LUT_3D_SIZE")) {
+            LutType type = one ? LUT_1D : LUT_3D;
+            ok = !l->table && NewLut(l, type, atoi(p));
+            total = type == LUT_1D ? (size_t)l->size : (size_t)l->size * l->size * l->size;
+        } else if (keyword(&p, "DOMAIN_MIN"))
+            ok = floats(p, min, 3);
+        else if (keyword(&p, "DOMAIN_MAX"))
+            ok = floats(p, max, 3);
+        else if (keyword(&p, "LUT_1D_INPUT_RANGE") || keyword(&p, "LUT_3D_INPUT_RANGE")) {
+            float range[2];
+            if ((ok = floats(p, range, 2)))
+                for (int i = 0; i < 3; ++i) {
+                    min[i] = range[0];
+                    max[i] = range[1];
+                }
+        } else if (isalpha((unsigned char)*p))
+            continue; // Unknown keywords are skipped, as the spec asks
+        else
+            ok = l->table && count < total && floats(p, l->table + 4 * count++, 3);
+    }
+    fclose(fh);
+    for (int i = 0; i < 3; ++i)
+        ok = ok && max[i] > min[i];
+    if (!ok || !l->table || count != total) {
+        DestroyLut(l);
+        return false;
+    }
+    memcpy(l->min, min, sizeof(min));
+    memcpy(l->max, max, sizeof(max));
+    return true;
+}
+
+/* Applying a table
+ *
+ * Input channels only have 256 values, so everything that depends on a
+ * single channel is worked out once per call: curves become byte tables,
+ * and for a cube each channel value becomes an offset into the table, the
+ * distance to the next point along that axis, and a blend fraction. The
+ * per pixel work is then just the loads and the blend */
+
+typedef struct {
+    int offset, step;
+    float frac;
+} LutAxis;
+
+typedef struct {
+    Surface *s;
+    const float *cube;
+    LutInterpolation interp;
+    unsigned char curve[3][256];
+    LutAxis axis[3][256];
+} Grade;
+
+static void locate(const Lut *l, int channel, float v, int *i, float *f) {
+    float t = __CLAMP((v - l->min[channel]) / (l->max[channel] - l->min[channel]), 0.f, 1.f) * (l->size - 1);
+    *i = __MIN((int)t, l->size - 2);
+    *f = t - *i;
+}
+
+static float curve_value(const Lut *l, int channel, int c) {
+    int i;
+    float f;
+    locate(l, channel, c / 255.f, &i, &f);
+    float a = l->table[i * 4 + channel], b = l->table[(i + 1) * 4 + channel];
+    return a + (b - a) * f;
+}
+
+#if defined(LUT_SSE2)
+typedef __m128 vec4;
+#define v_load _mm_loadu_ps
+#define v_set1 _mm_set1_ps
+#define v_add _mm_add_ps
+#define v_sub _mm_sub_ps
+#define v_mul _mm_mul_ps
+
+/* Table entries are red, green, blue, pad but pixels are blue, green, red, alpha in memory */
+static inline int v_pixel(vec4 v) {
+    __m128i i = _mm_cvtps_epi32(_mm_mul_ps(_mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 0, 1, 2)), _mm_set1_ps(255.f)));
+    i = _mm_packs_epi32(i, i);
+    return _mm_cvtsi128_si32(_mm_packus_epi16(i, i)) & 0x00FFFFFF;
+}
+#elif defined(LUT_NEON)
+typedef float32x4_t vec4;
+#define v_load vld1q_f32
+#define v_set1 vdupq_n_f32
+#define v_add vaddq_f32
+#define v_sub vsubq_f32
+#define v_mul vmulq_f32
+
+static inline int v_pixel(vec4 v) {
+    v = vminq_f32(vmaxq_f32(v, vdupq_n_f32(0.f)), vdupq_n_f32(1.f));
+    uint32x4_t u = vcvtq_u32_f32(vmlaq_f32(vdupq_n_f32(.5f), v, vdupq_n_f32(255.f)));
+    return (int)(vgetq_lane_u32(u, 0) << 16 | vgetq_lane_u32(u, 1) << 8 | vgetq_lane_u32(u, 2));
+}
+#else
+typedef struct {
+    float v[4];
+} vec4;
+
+static inline vec4 v_load(const float *p) {
+    vec4 r;
+    memcpy(r.v, p, sizeof(r.v));
+    return r;
+}
+
+static inline vec4 v_set1(float f) {
+    vec4 r = {{ f, f, f, f }};
+    return r;
+}
+
+#define VEC4_OP(name, op) \
+    static inline vec4 name(vec4 a, vec4 b) { \
+        vec4 r; \
+        for (int i = 0; i < 4; ++i) \
+            r.v[i] = a.v[i] op b.v[i]; \
+        return r; \
+    }
+VEC4_OP(v_add, +)
+VEC4_OP(v_sub, -)
+VEC4_OP(v_mul, *)
+
+static inline int v_pixel(vec4 v) {
+    int c[3];
+    for (int i = 0; i < 3; ++i)
+        c[i] = (int)(__CLAMP(v.v[i], 0.f, 1.f) * 255.f + .5f);
+    return c[0] << 16 | c[1] << 8 | c[2];
+}
+#endif
+
+static inline vec4 v_lerp(vec4 a, vec4 b, float f) {
+    return v_add(a, v_mul(v_sub(b, a), v_set1(f)));
+}
+
+static inline int trilinear(const float *p, const LutAxis *r, const LutAxis *g, const LutAxis *b) {
+    const float *q = p + b->step;
+    vec4 c00 = v_lerp(v_load(p), v_load(p + r->step), r->frac);
+    vec4 c10 = v_lerp(v_load(p + g->step), v_load(p + g->step + r->step), r->frac);
+    vec4 c01 = v_lerp(v_load(q), v_load(q + r->step), r->frac);
+    vec4 c11 = v_lerp(v_load(q + g->step), v_load(q + g->step + r->step), r->frac);
+    return v_pixel(v_lerp(v_lerp(c00, c10, g->frac), v_lerp(c01, c11, g->frac), b->frac));
+}
+
+/* Walk from the near corner to the far one along the axes in order of
+ * largest fraction first, picking one of six tetrahedra */
+static inline int tetrahedral(const float *p, const LutAxis *r, const LutAxis *g, const LutAxis *b) {
+    const LutAxis *a0 = r, *a1 = g, *a2 = b, *t;
+    if (a0->frac < a1->frac) { t = a0; a0 = a1; a1 = t; }
+    if (a1->frac < a2->frac) { t = a1; a1 = a2; a2 = t; }
+    if (a0->frac < a1->frac) { t = a0; a0 = a1; a1 = t; }
+    vec4 c0 = v_load(p);
+    vec4 c1 = v_load(p + a0->step);
+    vec4 c2 = v_load(p + a0->step + a1->step);
+    vec4 c3 = v_load(p + r->step + g->step + b->step);
+    vec4 v = v_add(c0, v_mul(v_sub(c1, c0), v_set1(a0->frac)));
+    v = v_add(v, v_mul(v_sub(c2, c1), v_set1(a1->frac)));
+    return v_pixel(v_add(v, v_mul(v_sub(c3, c2), v_set1(a2->frac))));
+}
+
+static void grade_row(const Grade *g, int *row, int w) {
+    for (int x = 0; x < w; ++x) {
+        unsigned int c = (unsigned int)row[x];
+        int r = (c >> 16) & 0xFF, gr = (c >> 8) & 0xFF, b = c & 0xFF;
+        if (!g->cube) {
+            row[x] = (int)((c & 0xFF000000) | (unsigned int)g->curve[0][r] << 16 | (unsigned int)g->curve[1][gr] << 8 | g->curve[2][b]);
+            continue;
+        }
+        const LutAxis *ar = &g->axis[0][r], *ag = &g->axis[1][gr], *ab = &g->axis[2][b];
+        const float *p = g->cube + ar->offset + ag->offset + ab->offset;
+        int px = g->interp == LUT_TETRAHEDRAL ? tetrahedral(p, ar, ag, ab) : trilinear(p, ar, ag, ab);
+        row[x] = (int)((c & 0xFF000000) | (unsigned int)px);
+    }
+}
+
+static void grade_rows(int begin, int end, void *userdata) {
+    const Grade *g = userdata;
+    Surface *s = g->s;
+    if (s->format == SURFACE_ARGB) {
+        for (int y = begin; y < end; ++y)
+            grade_row(g, s->buf + (size_t)y * s->w, s->w);
+        return;
+    }
+    int *row = malloc(s->w * sizeof(int));
+    if (!row)
+        return;
+    for (int y = begin; y < end; ++y) {
+        for (int x = 0; x < s->w; ++x)
+            row[x] = GetPixel(s, x, y);
+        grade_row(g, row, s->w);
+        for (int x = 0; x < s->w; ++x)
+            SetPixel(s, x, y, row[x]);
+    }
+    free(row);
+}
+
+EXPORT bool ApplyLut(Surface *s, const Lut *curves, const Lut *cube, LutInterpolation interp) {
+    if (!s->buf || s->w <= 0 || s->h <= 0 || (!curves && !cube) || interp > LUT_TETRAHEDRAL ||
+        (curves && (curves->type != LUT_1D || !curves->table)) || (cube && (cube->type != LUT_3D || !cube->table)))
+        return false;
+    Grade *g = malloc(sizeof(Grade));
+    if (!g)
+        return false;
+    g->s = s;
+    g->cube = cube ? cube->table : NULL;
+    g->interp = interp;
+    int n = cube ? cube->size : 0, strides[3] = { 4, 4 * n, 4 * n * n };
+    for (int k = 0; k < 3; ++k) {
+        for (int c = 0; c < 256; ++c) {
+            float v = curves ? curve_value(curves, k, c) : c / 255.f;
+            g->curve[k][c] = (unsigned char)(__CLAMP(v, 0.f, 1.f) * 255.f + .5f);
+            if (cube) {
+                LutAxis *a = &g->axis[k][c];
+                int i;
+                locate(cube, k, v, &i, &a->frac);
+                a->offset = i * strides[k];
+                a->step = strides[k];
+            }
+        }
+    }
+    ParallelFor(s->h, grade_rows, g);
+    free(g);
+    return true;
+}
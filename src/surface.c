@@ -26,6 +26,7 @@
  */
 
 #include "surface.h"
+#include "convert.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -34,6 +35,22 @@
 #include <math.h>
 #include <time.h>
 #include <ctype.h>
+#include <limits.h>
+#include <stdint.h>
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#define SURFACE_MMAP
+#elif !defined(__EMSCRIPTEN__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define SURFACE_MMAP
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
 
 #if defined(__EMSCRIPTEN__)
 #include "emscripten.h"
@@ -42,6 +59,10 @@
 #define EXPORT
 #endif
 
+#define __MIN(a, b) (((a) < (b)) ? (a) : (b))
+#define __MAX(a, b) (((a) > (b)) ? (a) : (b))
+#define __CLAMP(x, low, high) (((x) > (high)) ? (high) : (((x) < (low)) ? (low) : (x)))
+
 EXPORT int rgba(unsigned char r, unsigned char g, unsigned char b, unsigned char a) {
     return ((unsigned int)a << 24) | ((unsigned int)r << 16) | ((unsigned int)g << 8) | b;
 }
@@ -90,24 +111,447 @@ EXPORT int rgba_a(int c, unsigned char a) {
     return (c & ~0x00FF0000) | (a << 24);
 }
 
+EXPORT void InitPalette(Palette *p, const int *colours, int count) {
+    memset(p, 0, sizeof(Palette));
+    if (colours) {
+        p->count = __CLAMP(count, 0, 256);
+        memcpy(p->colours, colours, p->count * sizeof(int));
+        return;
+    }
+    static const int basic[16] = {
+        BLACK, MAROON, GREEN, 0, NAVY, PURPLE, TEAL, 0,
+        GRAY, RED, LIME, YELLOW, BLUE, MAGENTA, CYAN, WHITE
+    };
+    static const unsigned char levels[6] = { 0, 95, 135, 175, 215, 255 };
+    memcpy(p->colours, basic, sizeof(basic));
+    p->colours[3] = rgb(128, 128, 0);
+    p->colours[7] = rgb(192, 192, 192);
+    for (int i = 0; i < 216; ++i)
+        p->colours[16 + i] = rgb(levels[i / 36], levels[(i / 6) % 6], levels[i % 6]);
+    for (int i = 0; i < 24; ++i)
+        p->colours[232 + i] = rgb1(8 + i * 10);
+    p->count = 256;
+}
+
+EXPORT void SetPaletteColour(Palette *p, unsigned char i, int col) {
+    p->colours[i] = col;
+    if (i >= p->count)
+        p->count = i + 1;
+}
+
+EXPORT int GetPaletteColour(Palette *p, unsigned char i) {
+    return p->colours[i];
+}
+
+EXPORT void CyclePalette(Palette *p, unsigned char from, unsigned char to, int n) {
+    if (to <= from)
+        return;
+    int len = to - from + 1, tmp[256];
+    n %= len;
+    if (n < 0)
+        n += len;
+    if (!n)
+        return;
+    for (int i = 0; i < len; ++i)
+        tmp[(i + n) % len] = p->colours[from + i];
+    memcpy(p->colours + from, tmp, len * sizeof(int));
+}
+
+EXPORT int BytesPerPixel(SurfaceFormat format) {
+    switch (format) {
+        case SURFACE_RGB565:
+            return 2;
+        case SURFACE_A8:
+        case SURFACE_L8:
+        case SURFACE_INDEXED8:
+            return 1;
+        case SURFACE_ARGB:
+        default:
+            return 4;
+    }
+}
+
+static inline unsigned char to_luma(int c) {
+    return (unsigned char)((r_channel(c) * 77 + g_channel(c) * 150 + b_channel(c) * 29) >> 8);
+}
+
+/* Opaque gray ramp, rgb1(i) for every i. Const so presenter and filter threads can share it */
+#define GRAY(i) (int)(0xFF000000u | (i) * 0x010101u)
+#define GRAY4(i) GRAY(i), GRAY(i + 1), GRAY(i + 2), GRAY(i + 3)
+#define GRAY16(i) GRAY4(i), GRAY4(i + 4), GRAY4(i + 8), GRAY4(i + 12)
+#define GRAY64(i) GRAY16(i), GRAY16(i + 16), GRAY16(i + 32), GRAY16(i + 48)
+static const int gray_table[256] = { GRAY64(0), GRAY64(64), GRAY64(128), GRAY64(192) };
+
+static inline const int *gray_lut(void) {
+    return gray_table;
+}
+
+static inline const int *palette_lut(Surface *s) {
+    return s->palette ? s->palette->colours : gray_lut();
+}
+
+/* Expand 8-bit indices through a 256 entry table */
+static void expand_lut(const unsigned char *src, int *dst, size_t n, const int *lut) {
+    size_t i = 0;
+#if defined(__AVX2__)
+    for (; i + 8 <= n; i += 8) {
+        __m256i idx = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(src + i)));
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_i32gather_epi32(lut, idx, 4));
+    }
+#else
+    for (; i + 4 <= n; i += 4) {
+        dst[i]     = lut[src[i]];
+        dst[i + 1] = lut[src[i + 1]];
+        dst[i + 2] = lut[src[i + 2]];
+        dst[i + 3] = lut[src[i + 3]];
+    }
+#endif
+    for (; i < n; ++i)
+        dst[i] = lut[src[i]];
+}
+
+static unsigned char palette_index(Surface *s, int c) {
+    if (!s->palette)
+        return to_luma(c);
+    int best = 0, best_d = 0x7FFFFFFF;
+    for (int i = 0; i < s->palette->count; ++i) {
+        int p = s->palette->colours[i];
+        if (p == c)
+            return i;
+        int dr = r_channel(p) - r_channel(c);
+        int dg = g_channel(p) - g_channel(c);
+        int db = b_channel(p) - b_channel(c);
+        int da = a_channel(p) - a_channel(c);
+        int d = dr * dr + dg * dg + db * db + da * da;
+        if (d < best_d) {
+            best_d = d;
+            best = i;
+        }
+    }
+    return best;
+}
+
+static inline unsigned char *pixel_ptr(Surface *s, int x, int y) {
+    return (unsigned char*)s->buf + ((size_t)y * s->w + x) * BytesPerPixel(s->format);
+}
+
+/* Expand n pixels of any format to ARGB */
+static void load_row(Surface *s, const unsigned char *src, int *dst, int n) {
+    int i;
+    switch (s->format) {
+        case SURFACE_ARGB:
+            memcpy(dst, src, n * sizeof(int));
+            break;
+        case SURFACE_RGB565:
+            ConvertPixels(src, PIXEL_RGB565, dst, PIXEL_ARGB32, n);
+            break;
+        case SURFACE_A8:
+            for (i = 0; i < n; ++i)
+                dst[i] = (unsigned int)src[i] << 24;
+            break;
+        case SURFACE_L8:
+            expand_lut(src, dst, n, gray_lut());
+            break;
+        case SURFACE_INDEXED8:
+            expand_lut(src, dst, n, palette_lut(s));
+            break;
+    }
+}
+
+/* Pack n ARGB pixels into the surface's format */
+static void store_row(Surface *s, const int *src, unsigned char *dst, int n) {
+    int i;
+    switch (s->format) {
+        case SURFACE_ARGB:
+            memcpy(dst, src, n * sizeof(int));
+            break;
+        case SURFACE_RGB565:
+            ConvertPixels(src, PIXEL_ARGB32, dst, PIXEL_RGB565, n);
+            break;
+        case SURFACE_A8:
+            for (i = 0; i < n; ++i)
+                dst[i] = a_channel(src[i]);
+            break;
+        case SURFACE_L8:
+            for (i = 0; i < n; ++i)
+                dst[i] = to_luma(src[i]);
+            break;
+        case SURFACE_INDEXED8:
+            for (i = 0; i < n; ++i)
+                dst[i] = palette_index(s, src[i]);
+            break;
+    }
+}
+
+#define POOL_SLOTS 16
+
+static struct {
+    void *buf;
+    size_t size;
+} pool[POOL_SLOTS];
+static size_t pool_limit = 0, pool_used = 0;
+static volatile long pool_busy = 0;
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define POOL_LOCK() while (_InterlockedExchange(&pool_busy, 1))
+#define POOL_UNLOCK() _InterlockedExchange(&pool_busy, 0)
+#else
+#define POOL_LOCK() while (__sync_lock_test_and_set(&pool_busy, 1))
+#define POOL_UNLOCK() __sync_lock_release(&pool_busy)
+#endif
+
+static void *pool_take(size_t size) {
+    void *ret = NULL;
+    POOL_LOCK();
+    for (int i = 0; i < POOL_SLOTS; ++i)
+        if (pool[i].buf && pool[i].size == size) {
+            ret = pool[i].buf;
+            pool[i].buf = NULL;
+            pool_used -= size;
+            break;
+        }
+    POOL_UNLOCK();
+    return ret;
+}
+
+static bool pool_give(void *buf, size_t size) {
+    bool ret = false;
+    POOL_LOCK();
+    if (pool_used + size <= pool_limit)
+        for (int i = 0; i < POOL_SLOTS; ++i)
+            if (!pool[i].buf) {
+                pool[i].buf = buf;
+                pool[i].size = size;
+                pool_used += size;
+                ret = true;
+                break;
+            }
+    POOL_UNLOCK();
+    return ret;
+}
+
+EXPORT void SetSurfacePoolLimit(size_t bytes) {
+    POOL_LOCK();
+    pool_limit = bytes;
+    for (int i = 0; i < POOL_SLOTS && pool_used > pool_limit; ++i)
+        if (pool[i].buf) {
+            free(pool[i].buf);
+            pool[i].buf = NULL;
+            pool_used -= pool[i].size;
+        }
+    POOL_UNLOCK();
+}
+
+static inline size_t surface_size(Surface *s) {
+    return (size_t)s->w * s->h * BytesPerPixel(s->format) + 1;
+}
+
+/* Sizes are checked up front so nothing below has to worry about w * h overflowing */
+static bool valid_size(unsigned int w, unsigned int h, SurfaceFormat format) {
+    if (w > INT_MAX || h > INT_MAX)
+        return false;
+    return !h || (size_t)w <= (SIZE_MAX - 64) / BytesPerPixel(format) / h;
+}
+
+#define MAPPED_MAGIC 0x54464F53 /* "SOFT" */
+#define MAPPED_VERSION 1
+#define MAPPED_HEADER 64
+
+typedef struct {
+    unsigned int magic, version, w, h, format;
+} MappedHeader;
+
+static inline void *mapped_base(Surface *s) {
+    return (unsigned char*)s->buf - MAPPED_HEADER;
+}
+
+#if defined(SURFACE_MMAP)
+static bool map_surface(Surface *s, const char *path, size_t size, bool create, bool writable) {
+    unsigned char *base = NULL;
+#if defined(_WIN32)
+    HANDLE file = CreateFileA(path, GENERIC_READ | (writable ? GENERIC_WRITE : 0), FILE_SHARE_READ, NULL, create ? CREATE_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+    LARGE_INTEGER sz;
+    if (create) {
+        sz.QuadPart = (LONGLONG)size;
+        if (!SetFilePointerEx(file, sz, NULL, FILE_BEGIN) || !SetEndOfFile(file)) {
+            CloseHandle(file);
+            return false;
+        }
+    } else if (!GetFileSizeEx(file, &sz) || (unsigned long long)sz.QuadPart > SIZE_MAX) {
+        CloseHandle(file);
+        return false;
+    } else
+        size = (size_t)sz.QuadPart;
+    HANDLE mapping = CreateFileMappingA(file, NULL, writable ? PAGE_READWRITE : PAGE_WRITECOPY, 0, 0, NULL);
+    CloseHandle(file);
+    if (!mapping)
+        return false;
+    base = MapViewOfFile(mapping, writable ? FILE_MAP_WRITE : FILE_MAP_COPY, 0, 0, 0);
+    CloseHandle(mapping);
+    if (!base)
+        return false;
+#else
+    int fd = open(path, create ? O_RDWR | O_CREAT | O_TRUNC : (writable ? O_RDWR : O_RDONLY), 0644);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (create ? ftruncate(fd, (off_t)size) != 0 : (fstat(fd, &st) || st.st_size < MAPPED_HEADER)) {
+        close(fd);
+        return false;
+    }
+    if (!create)
+        size = (size_t)st.st_size;
+    base = mmap(NULL, size, PROT_READ | PROT_WRITE, writable ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+        return false;
+#endif
+    s->buf = (int*)(base + MAPPED_HEADER);
+    s->mapped = size;
+    return true;
+}
+
+static void unmap_surface(Surface *s) {
+#if defined(_WIN32)
+    UnmapViewOfFile(mapped_base(s));
+#else
+    munmap(mapped_base(s), s->mapped);
+#endif
+}
+#endif
+
+EXPORT bool NewMappedSurface(Surface *s, const char *path, unsigned int w, unsigned int h, SurfaceFormat format) {
+    memset(s, 0, sizeof(Surface));
+#if defined(SURFACE_MMAP)
+    if (!valid_size(w, h, format))
+        return false;
+    s->w = w;
+    s->h = h;
+    s->format = format;
+    if (!map_surface(s, path, surface_size(s) + MAPPED_HEADER, true, true)) {
+        memset(s, 0, sizeof(Surface));
+        return false;
+    }
+    MappedHeader header = { MAPPED_MAGIC, MAPPED_VERSION, w, h, format };
+    memcpy(mapped_base(s), &header, sizeof(header));
+    return true;
+#else
+    (void)path; (void)w; (void)h; (void)format;
+    return false;
+#endif
+}
+
+EXPORT bool OpenMappedSurface(Surface *s, const char *path, bool writable) {
+    memset(s, 0, sizeof(Surface));
+#if defined(SURFACE_MMAP)
+    if (!map_surface(s, path, 0, false, writable))
+        return false;
+    MappedHeader header;
+    memcpy(&header, mapped_base(s), sizeof(header));
+    s->w = header.w;
+    s->h = header.h;
+    s->format = (SurfaceFormat)header.format;
+    if (header.magic != MAPPED_MAGIC || header.version != MAPPED_VERSION || header.format > SURFACE_INDEXED8 ||
+        !valid_size(header.w, header.h, s->format) || surface_size(s) - 1 > s->mapped - MAPPED_HEADER) {
+        unmap_surface(s);
+        memset(s, 0, sizeof(Surface));
+        return false;
+    }
+    return true;
+#else
+    (void)path; (void)writable;
+    return false;
+#endif
+}
+
+static void advise_surface(Surface *s, SurfaceAccess access) {
+#if defined(SURFACE_MMAP) && !defined(_WIN32)
+    static const int advice[] = { MADV_NORMAL, MADV_SEQUENTIAL, MADV_RANDOM, MADV_WILLNEED, MADV_DONTNEED };
+    if (s->mapped && access <= SURFACE_ACCESS_DONTNEED)
+        madvise(mapped_base(s), s->mapped, advice[access]);
+#else
+    (void)s; (void)access;
+#endif
+}
+
+EXPORT void AdviseSurface(Surface *s, SurfaceAccess access) {
+    if (access <= SURFACE_ACCESS_RANDOM)
+        s->access = access;
+    advise_surface(s, access);
+}
+
+/* Hint that a whole-surface pass is about to walk the rows in order, then put back the caller's hint */
+#define STREAM_BEGIN(s) \
+    if ((s)->mapped) \
+        advise_surface((s), SURFACE_ACCESS_SEQUENTIAL)
+#define STREAM_END(s) \
+    if ((s)->mapped) \
+        advise_surface((s), (s)->access)
+
 EXPORT bool NewSurface(Surface *s, unsigned int w, unsigned int h) {
+    return NewSurfaceFormat(s, w, h, SURFACE_ARGB);
+}
+
+EXPORT bool NewSurfaceFormat(Surface *s, unsigned int w, unsigned int h, SurfaceFormat format) {
+    memset(s, 0, sizeof(Surface));
+    if (!valid_size(w, h, format))
+        return false;
     s->w = w;
     s->h = h;
-    size_t sz = w * h * sizeof(unsigned int) + 1;
-    s->buf = malloc(sz);
-    memset(s->buf, 0, sz);
+    s->format = format;
+    s->palette = NULL;
+    size_t sz = surface_size(s);
+    if ((s->buf = pool_take(sz)))
+        memset(s->buf, 0, sz);
+    else
+        s->buf = calloc(1, sz);
+    return !!s->buf;
+}
+
+EXPORT bool NewIndexedSurface(Surface *s, unsigned int w, unsigned int h, Palette *p) {
+    if (!NewSurfaceFormat(s, w, h, SURFACE_INDEXED8))
+        return false;
+    s->palette = p;
     return true;
 }
 
 EXPORT void DestroySurface(Surface *s) {
-    if (s->buf)
+#if defined(SURFACE_MMAP)
+    if (s->buf && s->mapped)
+        unmap_surface(s);
+    else
+#endif
+    if (s->buf && !pool_give(s->buf, surface_size(s)))
         free(s->buf);
     memset(s, 0, sizeof(Surface));
 }
 
 EXPORT void FillSurface(Surface *s, int col) {
-    for (int i = 0; i < s->w * s->h; ++i)
-        s->buf[i] = col;
+    size_t i, n = (size_t)s->w * s->h;
+    STREAM_BEGIN(s);
+    switch (s->format) {
+        case SURFACE_ARGB:
+            for (i = 0; i < n; ++i)
+                s->buf[i] = col;
+            break;
+        case SURFACE_RGB565: {
+            unsigned short c, *p = (unsigned short*)s->buf;
+            ConvertPixels(&col, PIXEL_ARGB32, &c, PIXEL_RGB565, 1);
+            for (i = 0; i < n; ++i)
+                p[i] = c;
+            break;
+        }
+        default: {
+            unsigned char c;
+            store_row(s, &col, &c, 1);
+            memset(s->buf, c, n);
+            break;
+        }
+    }
+    STREAM_END(s);
 }
 
 static inline void flood_fn(Surface *s, int x, int y, int new, int old) {
@@ -162,57 +606,434 @@ EXPORT void FloodSurface(Surface *s, int x, int y, int col) {
 }
 
 EXPORT void ClearSurface(Surface *s) {
-    memset(s->buf, 0, s->w * s->h * sizeof(int));
+    STREAM_BEGIN(s);
+    memset(s->buf, 0, surface_size(s) - 1);
+    STREAM_END(s);
 }
 
 #define BLEND(c0, c1, a0, a1) (c0 * a0 / 255) + (c1 * a1 * (255 - a0) / 65025)
 
-EXPORT void BlendPixel(Surface *s, int x, int y, int c) {
-    unsigned char a = a_channel(c);
-    if (!a || x < 0 || y < 0 || x >= s->w || y >= s->h)
+static inline int blend_argb(int c, int d) {
+    unsigned char a = a_channel(c), b = a_channel(d);
+    return (a == 255 || !b) ? c : rgba(BLEND(r_channel(c), r_channel(d), a, b),
+                                       BLEND(g_channel(c), g_channel(d), a, b),
+                                       BLEND(b_channel(c), b_channel(d), a, b),
+                                       a + (b * (255 - a) >> 8));
+}
+
+/* Blend modes
+ *
+ * Each mode is a function of one source and one destination pixel. They're
+ * expanded into span kernels for every kind of source (a solid colour, a
+ * row of pixels, a colour through a row of coverage) so the inner loops
+ * never switch on the mode. */
+
+#define DIV255(x) (((x) + 128 + (((x) + 128) >> 8)) >> 8)
+
+static inline int blend_over(int c, int d) {
+    return a_channel(c) ? blend_argb(c, d) : d;
+}
+
+static inline int blend_src(int c, int d) {
+    (void)d;
+    return c;
+}
+
+/* Alpha is straight, so the premultiplied sum is divided back out by the new alpha */
+static inline int blend_add(int c, int d) {
+    int as = a_channel(c), ab = a_channel(d), ao = __MIN(as + ab, 255);
+    if (!ao)
+        return d;
+#define ADD(ch) __MIN((ch(c) * as + ch(d) * ab + ao / 2) / ao, 255)
+    return rgba(ADD(r_channel), ADD(g_channel), ADD(b_channel), ao);
+#undef ADD
+}
+
+static inline int blend_dst_in(int c, int d) {
+    return (int)(((unsigned int)d & 0x00FFFFFF) | (unsigned int)DIV255(a_channel(d) * a_channel(c)) << 24);
+}
+
+static inline int blend_dst_out(int c, int d) {
+    return (int)(((unsigned int)d & 0x00FFFFFF) | (unsigned int)DIV255(a_channel(d) * (255 - a_channel(c))) << 24);
+}
+
+static inline int blend_xor(int c, int d) {
+    int as = a_channel(c), ab = a_channel(d);
+    int ws = as * (255 - ab), wb = ab * (255 - as), wo = ws + wb;
+    if (!wo)
+        return 0;
+#define XOR(ch) ((ch(c) * ws + ch(d) * wb + wo / 2) / wo)
+    return rgba(XOR(r_channel), XOR(g_channel), XOR(b_channel), DIV255(wo));
+#undef XOR
+}
+
+#define SEP_MULTIPLY(s, b) DIV255((s) * (b))
+#define SEP_SCREEN(s, b) ((s) + (b) - DIV255((s) * (b)))
+#define SEP_OVERLAY(s, b) ((b) < 128 ? DIV255(2 * (s) * (b)) : 255 - DIV255(2 * (255 - (s)) * (255 - (b))))
+#define SEP_DARKEN(s, b) __MIN(s, b)
+#define SEP_LIGHTEN(s, b) __MAX(s, b)
+#define SEP_DIFFERENCE(s, b) abs((s) - (b))
+
+/* Separable modes mix the source, the destination and the blended colour
+ * by how much each covers the result, the same way as the W3C compositing
+ * spec. Opaque over opaque is just the blended colour */
+#define DEFINE_SEPARABLE(NAME, FN) \
+    static inline int blend_##NAME(int c, int d) { \
+        int as = a_channel(c), ab = a_channel(d); \
+        if (!as) \
+            return d; \
+        if (as == 255 && ab == 255) \
+            return rgba(FN(r_channel(c), r_channel(d)), FN(g_channel(c), g_channel(d)), FN(b_channel(c), b_channel(d)), 255); \
+        int ws = as * (255 - ab), wb = ab * (255 - as), wm = as * ab, wo = ws + wb + wm; \
+        int r = (r_channel(c) * ws + r_channel(d) * wb + FN(r_channel(c), r_channel(d)) * wm + wo / 2) / wo; \
+        int g = (g_channel(c) * ws + g_channel(d) * wb + FN(g_channel(c), g_channel(d)) * wm + wo / 2) / wo; \
+        int b = (b_channel(c) * ws + b_channel(d) * wb + FN(b_channel(c), b_channel(d)) * wm + wo / 2) / wo; \
+        return rgba(r, g, b, DIV255(wo)); \
+    }
+DEFINE_SEPARABLE(multiply, SEP_MULTIPLY)
+DEFINE_SEPARABLE(screen, SEP_SCREEN)
+DEFINE_SEPARABLE(overlay, SEP_OVERLAY)
+DEFINE_SEPARABLE(darken, SEP_DARKEN)
+DEFINE_SEPARABLE(lighten, SEP_LIGHTEN)
+DEFINE_SEPARABLE(difference, SEP_DIFFERENCE)
+
+static inline int with_coverage(int c, int cov) {
+    return (c & 0x00FFFFFF) | ((unsigned int)(a_channel(c) * cov / 255) << 24);
+}
+
+static inline int fade_argb(int d, int c, int cov) {
+#define FADE(ch) (ch(d) + ((ch(c) - ch(d)) * cov + (ch(c) > ch(d) ? 127 : -127)) / 255)
+    return rgba(FADE(r_channel), FADE(g_channel), FADE(b_channel), FADE(a_channel));
+#undef FADE
+}
+
+typedef void(*SpanFn)(int *dst, const int *src, const unsigned char *mask, int col, int n);
+
+enum {
+    SPAN_SOLID = 0,
+    SPAN_SURFACE,
+    SPAN_MASK,
+    SPAN_SURFACE_MASK,
+    SPAN_KINDS
+};
+
+/* Modes that change the destination where the source is transparent
+ * (UNBOUNDED) can't apply coverage to the source alpha, they fade
+ * between the old and new pixel instead */
+#define DEFINE_SPANS(NAME, UNBOUNDED) \
+    static void NAME##_solid(int *d, const int *s, const unsigned char *m, int c, int n) { \
+        (void)s; \
+        (void)m; \
+        for (int i = 0; i < n; ++i) \
+            d[i] = blend_##NAME(c, d[i]); \
+    } \
+    static void NAME##_surface(int *d, const int *s, const unsigned char *m, int c, int n) { \
+        (void)m; \
+        (void)c; \
+        for (int i = 0; i < n; ++i) \
+            d[i] = blend_##NAME(s[i], d[i]); \
+    } \
+    static void NAME##_mask(int *d, const int *s, const unsigned char *m, int c, int n) { \
+        (void)s; \
+        for (int i = 0; i < n; ++i) \
+            if (m[i]) \
+                d[i] = UNBOUNDED ? fade_argb(d[i], blend_##NAME(c, d[i]), m[i]) : blend_##NAME(with_coverage(c, m[i]), d[i]); \
+    } \
+    static void NAME##_surface_mask(int *d, const int *s, const unsigned char *m, int c, int n) { \
+        (void)c; \
+        for (int i = 0; i < n; ++i) \
+            if (m[i]) \
+                d[i] = UNBOUNDED ? fade_argb(d[i], blend_##NAME(s[i], d[i]), m[i]) : blend_##NAME(with_coverage(s[i], m[i]), d[i]); \
+    }
+DEFINE_SPANS(over, 0)
+DEFINE_SPANS(src, 1)
+DEFINE_SPANS(add, 0)
+DEFINE_SPANS(multiply, 0)
+DEFINE_SPANS(screen, 0)
+DEFINE_SPANS(overlay, 0)
+DEFINE_SPANS(darken, 0)
+DEFINE_SPANS(lighten, 0)
+DEFINE_SPANS(difference, 0)
+DEFINE_SPANS(dst_in, 1)
+DEFINE_SPANS(dst_out, 0)
+DEFINE_SPANS(xor, 0)
+
+#define SPANS(NAME) { NAME##_solid, NAME##_surface, NAME##_mask, NAME##_surface_mask }
+static const SpanFn spans[BLEND_MODE_COUNT][SPAN_KINDS] = {
+    SPANS(over),
+    SPANS(src),
+    SPANS(add),
+    SPANS(multiply),
+    SPANS(screen),
+    SPANS(overlay),
+    SPANS(darken),
+    SPANS(lighten),
+    SPANS(difference),
+    SPANS(dst_in),
+    SPANS(dst_out),
+    SPANS(xor)
+};
+
+static inline const SpanFn *span_for(BlendMode mode) {
+    return (unsigned int)mode < BLEND_MODE_COUNT ? spans[mode] : NULL;
+}
+
+#define SPAN_CHUNK 256
+
+/* Run a kernel over n pixels of a row that are already clipped to the
+ * surface. Other formats go through a small ARGB buffer a chunk at a time */
+static void apply_span(Surface *s, int x, int y, int n, SpanFn fn, const int *src, const unsigned char *mask, int col) {
+    if (s->format == SURFACE_ARGB) {
+        fn(s->buf + (size_t)y * s->w + x, src, mask, col, n);
         return;
-    int *p = &s->buf[y * s->w + x];
-    unsigned char b = a_channel(*p);
-    *p = (a == 255 || !b) ? c : rgba(BLEND(r_channel(c), r_channel(*p), a, b),
-                                     BLEND(g_channel(c), g_channel(*p), a, b),
-                                     BLEND(b_channel(c), b_channel(*p), a, b),
-                                     a + (b * (255 - a) >> 8));
+    }
+    int tmp[SPAN_CHUNK];
+    for (int i = 0; i < n; i += SPAN_CHUNK) {
+        int k = __MIN(n - i, SPAN_CHUNK);
+        unsigned char *p = pixel_ptr(s, x + i, y);
+        load_row(s, p, tmp, k);
+        fn(tmp, src ? src + i : NULL, mask ? mask + i : NULL, col, k);
+        store_row(s, tmp, p, k);
+    }
 }
 
-EXPORT void SetPixel(Surface *s, int x, int y, int col) {
-    if (x >= 0 && y >= 0 && x < s->w && y < s->h)
-        s->buf[y * s->w + x] = col;
+/* Clip masks
+ *
+ * Alongside the coverage each row keeps two bitmaps, one bit per pixel:
+ * pixels with any coverage, and pixels with full coverage. Spans are cut
+ * into runs by scanning these a word at a time, so masked out runs are
+ * skipped 64 pixels per step, fully covered runs take the plain kernels,
+ * and only the edges pay for coverage */
+
+#define CLIP_WORDS(w) (((size_t)(w) + 63) / 64)
+
+static inline int ctz64(uint64_t v) {
+#if defined(_MSC_VER)
+    unsigned long i;
+    _BitScanForward64(&i, v);
+    return (int)i;
+#else
+    return __builtin_ctzll(v);
+#endif
 }
 
-EXPORT int GetPixel(Surface *s, int x, int y) {
-    return (x >= 0 && y >= 0 && x < s->w && y < s->h) ? s->buf[y * s->w + x] : 0;
+/* First index in [i, end) whose bit is set (or clear), or end */
+static int scan_bits(const uint64_t *row, int i, int end, bool set) {
+    while (i < end) {
+        uint64_t w = set ? row[i >> 6] : ~row[i >> 6];
+        w &= ~(uint64_t)0 << (i & 63);
+        if (w)
+            return __MIN(end, (i & ~63) + ctz64(w));
+        i = (i & ~63) + 64;
+    }
+    return end;
+}
+
+static bool new_clip(ClipMask *c, int w, int h, int x, int y, bool coverage) {
+    memset(c, 0, sizeof(ClipMask));
+    if (w <= 0 || h <= 0)
+        return false;
+    c->x = x;
+    c->y = y;
+    c->w = w;
+    c->h = h;
+    if (!(c->bits = calloc(CLIP_WORDS(w) * h * 2, sizeof(uint64_t))) ||
+        (coverage && !(c->coverage = malloc((size_t)w * h)))) {
+        DestroyClipMask(c);
+        return false;
+    }
+    return true;
+}
+
+static inline void clip_mark(ClipMask *c, int x, int y, int cov) {
+    uint64_t *any = (uint64_t*)c->bits + CLIP_WORDS(c->w) * y, *full = any + CLIP_WORDS(c->w) * c->h;
+    uint64_t bit = (uint64_t)1 << (x & 63);
+    if (cov)
+        any[x >> 6] |= bit;
+    if (cov == 255)
+        full[x >> 6] |= bit;
+}
+
+EXPORT bool NewClipMask(ClipMask *c, Surface *mask, int x, int y) {
+    if (!mask->buf || !new_clip(c, mask->w, mask->h, x, y, true))
+        return false;
+    for (int j = 0; j < c->h; ++j) {
+        unsigned char *cov = c->coverage + (size_t)j * c->w;
+        if (mask->format == SURFACE_A8)
+            memcpy(cov, pixel_ptr(mask, 0, j), c->w);
+        else
+            for (int i = 0; i < c->w; ++i)
+                cov[i] = a_channel(GetPixel(mask, i, j));
+        for (int i = 0; i < c->w; ++i)
+            clip_mark(c, i, j, cov[i]);
+    }
+    return true;
+}
+
+EXPORT bool NewClipMaskBits(ClipMask *c, const unsigned char *bits, size_t pitch, int w, int h, int x, int y) {
+    if (!bits || !new_clip(c, w, h, x, y, false))
+        return false;
+    for (int j = 0; j < h; ++j)
+        for (int i = 0; i < w; ++i)
+            if (bits[j * pitch + (i >> 3)] & (0x80 >> (i & 7)))
+                clip_mark(c, i, j, 255);
+    return true;
+}
+
+EXPORT void DestroyClipMask(ClipMask *c) {
+    free(c->bits);
+    free(c->coverage);
+    memset(c, 0, sizeof(ClipMask));
+}
+
+EXPORT void SetSurfaceClip(Surface *s, ClipMask *c) {
+    s->clip = c;
+}
+
+/* A run the clip only partly covers: fold its coverage into the kernel */
+static void blend_partial(Surface *s, int x, int y, int n, const SpanFn *set, int kind, const int *src, const unsigned char *mask, const unsigned char *cov, int col) {
+    switch (kind) {
+        case SPAN_SOLID:
+            apply_span(s, x, y, n, set[SPAN_MASK], NULL, cov, col);
+            break;
+        case SPAN_SURFACE:
+            apply_span(s, x, y, n, set[SPAN_SURFACE_MASK], src, cov, col);
+            break;
+        case SPAN_MASK: {
+            unsigned char tmp[SPAN_CHUNK];
+            for (int i = 0; i < n; i += SPAN_CHUNK) {
+                int k = __MIN(n - i, SPAN_CHUNK);
+                for (int j = 0; j < k; ++j)
+                    tmp[j] = DIV255(mask[i + j] * cov[i + j]);
+                apply_span(s, x + i, y, k, set[SPAN_MASK], NULL, tmp, col);
+            }
+            break;
+        }
+    }
 }
 
-EXPORT bool PasteSurface(Surface *dst, Surface *src, int x, int y) {
-    int ox, oy, c;
-    for (ox = 0; ox < src->w; ++ox) {
-        for (oy = 0; oy < src->h; ++oy) {
-            if (oy > dst->h)
+/* Blend a span that's already clipped to the surface, through its clip mask if it has one */
+static void blend_span(Surface *s, int x, int y, int n, const SpanFn *set, int kind, const int *src, const unsigned char *mask, int col) {
+    ClipMask *c = s->clip;
+    if (!c) {
+        apply_span(s, x, y, n, set[kind], src, mask, col);
+        return;
+    }
+    int cy = y - c->y;
+    if (cy < 0 || cy >= c->h)
+        return;
+    int i = (int)__MAX((int64_t)x - c->x, 0), end = (int)__MIN((int64_t)x + n - c->x, c->w);
+    const uint64_t *any = (const uint64_t*)c->bits + CLIP_WORDS(c->w) * cy, *full = any + CLIP_WORDS(c->w) * c->h;
+    const unsigned char *cov = c->coverage ? c->coverage + (size_t)cy * c->w : NULL;
+#define AT(p, k) ((p) ? (p) + (c->x + (k) - x) : NULL)
+    while ((i = scan_bits(any, i, end, true)) < end) {
+        int j = scan_bits(any, i, end, false);
+        for (int k = i; k < j;) {
+            int f = scan_bits(full, k, j, false);
+            if (f > k)
+                apply_span(s, c->x + k, y, f - k, set[kind], AT(src, k), AT(mask, k), col);
+            if (f >= j)
                 break;
-            c = GetPixel(src, ox, oy);
-            BlendPixel(dst, x + ox, y + oy, c);
+            int p = scan_bits(full, f, j, true);
+            blend_partial(s, c->x + f, y, p - f, set, kind, AT(src, f), AT(mask, f), cov + f, col);
+            k = p;
         }
-        if (ox > dst->w)
-            break;
+        i = j;
     }
-    return true;
+#undef AT
+}
+
+static inline void blend_point(Surface *s, int x, int y, const SpanFn *set, int col) {
+    if (x >= 0 && y >= 0 && x < s->w && y < s->h)
+        blend_span(s, x, y, 1, set, SPAN_SOLID, NULL, NULL, col);
+}
+
+EXPORT void BlendPixel(Surface *s, int x, int y, int c) {
+    if (!a_channel(c) || x < 0 || y < 0 || x >= s->w || y >= s->h)
+        return;
+    if (s->clip)
+        blend_point(s, x, y, spans[BLEND_OVER], c);
+    else if (s->format == SURFACE_ARGB) {
+        int *p = &s->buf[(size_t)y * s->w + x];
+        *p = blend_argb(c, *p);
+    } else
+        SetPixel(s, x, y, blend_argb(c, GetPixel(s, x, y)));
+}
+
+EXPORT void SetPixel(Surface *s, int x, int y, int col) {
+    if (x < 0 || y < 0 || x >= s->w || y >= s->h)
+        return;
+    if (s->format == SURFACE_ARGB)
+        s->buf[(size_t)y * s->w + x] = col;
+    else
+        store_row(s, &col, pixel_ptr(s, x, y), 1);
+}
+
+EXPORT int GetPixel(Surface *s, int x, int y) {
+    if (x < 0 || y < 0 || x >= s->w || y >= s->h)
+        return 0;
+    if (s->format == SURFACE_ARGB)
+        return s->buf[(size_t)y * s->w + x];
+    int c;
+    load_row(s, pixel_ptr(s, x, y), &c, 1);
+    return c;
+}
+
+EXPORT bool PasteSurface(Surface *dst, Surface *src, int x, int y, BlendMode mode) {
+    return PasteSurfaceClip(dst, src, x, y, 0, 0, src->w, src->h, mode);
 }
 
-EXPORT bool PasteSurfaceClip(Surface *dst, Surface *src, int x, int y, int rx, int ry, int rw, int rh) {
-    for (int ox = 0; ox < rw; ++ox)
-        for (int oy = 0; oy < rh; ++oy)
-            BlendPixel(dst, ox + x, oy + y, GetPixel(src, ox + rx, oy + ry));
+EXPORT bool PasteSurfaceClip(Surface *dst, Surface *src, int x, int y, int rx, int ry, int rw, int rh, BlendMode mode) {
+    const SpanFn *set = span_for(mode);
+    if (!set)
+        return false;
+    /* Clip the rect to the source, then the destination */
+    if (rx < 0) {
+        x -= rx;
+        rw += rx;
+        rx = 0;
+    }
+    if (ry < 0) {
+        y -= ry;
+        rh += ry;
+        ry = 0;
+    }
+    rw = __MIN(rw, src->w - rx);
+    rh = __MIN(rh, src->h - ry);
+    int x0 = __MAX(x, 0), y0 = __MAX(y, 0);
+    int x1 = (int)__MIN((int64_t)x + rw, dst->w), y1 = (int)__MIN((int64_t)y + rh, dst->h);
+    int tmp[SPAN_CHUNK];
+    for (int dy = y0; dy < y1; ++dy) {
+        int sy = dy - y + ry;
+        for (int dx = x0; dx < x1; dx += SPAN_CHUNK) {
+            int n = __MIN(x1 - dx, SPAN_CHUNK), sx = dx - x + rx;
+            const int *row = tmp;
+            if (src->format == SURFACE_ARGB)
+                row = src->buf + (size_t)sy * src->w + sx;
+            else
+                load_row(src, pixel_ptr(src, sx, sy), tmp, n);
+            blend_span(dst, dx, dy, n, set, SPAN_SURFACE, row, NULL, 0);
+        }
+    }
     return true;
 }
 
 EXPORT bool ReuseSurface(Surface *s, int nw, int nh) {
-    size_t sz = nw * nh * sizeof(unsigned int) + 1;
+    if (nw < 0 || nh < 0 || !valid_size(nw, nh, s->format))
+        return false;
+    if (s->mapped) {
+        SurfaceFormat format = s->format;
+        Palette *palette = s->palette;
+        DestroySurface(s);
+        if (!NewSurfaceFormat(s, nw, nh, format))
+            return false;
+        s->palette = palette;
+        return true;
+    }
+    size_t sz = (size_t)nw * nh * BytesPerPixel(s->format) + 1;
     int *tmp = realloc(s->buf, sz);
+    if (!tmp)
+        return false;
     s->buf = tmp;
     s->w = nw;
     s->h = nh;
@@ -220,45 +1041,133 @@ EXPORT bool ReuseSurface(Surface *s, int nw, int nh) {
     return true;
 }
 
+EXPORT bool GetSurfaceView(Surface *s, int x, int y, int w, int h, SurfaceView *v) {
+    int x0 = __MAX(x, 0), y0 = __MAX(y, 0);
+    int x1 = (int)__MIN((int64_t)x + w, s->w), y1 = (int)__MIN((int64_t)y + h, s->h);
+    if (s->format != SURFACE_ARGB || x0 >= x1 || y0 >= y1)
+        return false;
+    v->buf = s->buf + (size_t)y0 * s->w + x0;
+    v->w = x1 - x0;
+    v->h = y1 - y0;
+    v->stride = s->w;
+    return true;
+}
+
 EXPORT bool CopySurface(Surface *a, Surface *b) {
-    if (!NewSurface(b, a->w, a->h))
+    if (!NewSurfaceFormat(b, a->w, a->h, a->format))
         return false;
-    memcpy(b->buf, a->buf, a->w * a->h * sizeof(unsigned int) + 1);
-    return !!b->buf;
+    b->palette = a->palette;
+    STREAM_BEGIN(a);
+    memcpy(b->buf, a->buf, surface_size(a) - 1);
+    STREAM_END(a);
+    return true;
+}
+
+EXPORT bool ConvertSurface(Surface *a, SurfaceFormat format, Surface *b) {
+    if (a->format == format)
+        return CopySurface(a, b);
+    if (!NewSurfaceFormat(b, a->w, a->h, format))
+        return false;
+    int *row = malloc(a->w * sizeof(int));
+    if (!row) {
+        DestroySurface(b);
+        return false;
+    }
+    STREAM_BEGIN(a);
+    for (int y = 0; y < a->h; ++y) {
+        load_row(a, pixel_ptr(a, 0, y), row, a->w);
+        store_row(b, row, pixel_ptr(b, 0, y), b->w);
+    }
+    STREAM_END(a);
+    free(row);
+    return true;
+}
+
+EXPORT bool ExpandSurface(Surface *a, Surface *b) {
+    if (b->buf && (b->w != a->w || b->h != a->h || b->format != SURFACE_ARGB))
+        DestroySurface(b);
+    if (!b->buf && !NewSurface(b, a->w, a->h))
+        return false;
+    STREAM_BEGIN(a);
+    if (a->format == SURFACE_INDEXED8 || a->format == SURFACE_L8)
+        expand_lut((const unsigned char*)a->buf, b->buf, (size_t)a->w * a->h,
+                   a->format == SURFACE_L8 ? gray_lut() : palette_lut(a));
+    else
+        for (int y = 0; y < a->h; ++y)
+            load_row(a, pixel_ptr(a, 0, y), b->buf + (size_t)y * b->w, a->w);
+    STREAM_END(a);
+    return true;
+}
+
+EXPORT void FillMask(Surface *dst, Surface *mask, int x, int y, int col, BlendMode mode) {
+    const SpanFn *set = span_for(mode);
+    if (!set)
+        return;
+    int x0 = __MAX(x, 0), y0 = __MAX(y, 0);
+    int x1 = (int)__MIN((int64_t)x + mask->w, dst->w), y1 = (int)__MIN((int64_t)y + mask->h, dst->h);
+    unsigned char cov[SPAN_CHUNK];
+    for (int dy = y0; dy < y1; ++dy)
+        for (int dx = x0; dx < x1; dx += SPAN_CHUNK) {
+            int n = __MIN(x1 - dx, SPAN_CHUNK);
+            const unsigned char *m = cov;
+            if (mask->format == SURFACE_A8)
+                m = pixel_ptr(mask, dx - x, dy - y);
+            else
+                for (int i = 0; i < n; ++i)
+                    cov[i] = a_channel(GetPixel(mask, dx - x + i, dy - y));
+            blend_span(dst, dx, dy, n, set, SPAN_MASK, NULL, m, col);
+        }
 }
 
 EXPORT void PassthruSurface(Surface *s, int (*fn)(int x, int y, int col)) {
     int x, y;
-    for (x = 0; x < s->w; ++x)
-        for (y = 0; y < s->h; ++y)
-            s->buf[y * s->w + x] = fn(x, y, GetPixel(s, x, y));
+    STREAM_BEGIN(s);
+    for (y = 0; y < s->h; ++y)
+        for (x = 0; x < s->w; ++x)
+            SetPixel(s, x, y, fn(x, y, GetPixel(s, x, y)));
+    STREAM_END(s);
 }
 
 EXPORT bool ScaleSurface(Surface *a, int nw, int nh, Surface *b) {
-    if (!NewSurface(b, nw, nh))
+    if (!NewSurfaceFormat(b, nw, nh, a->format))
         return false;
+    b->palette = a->palette;
     
-    int x_ratio = (int)((a->w << 16) / b->w) + 1;
-    int y_ratio = (int)((a->h << 16) / b->h) + 1;
-    int x2, y2, i, j;
+    int64_t x_ratio = ((int64_t)a->w << 16) / b->w + 1;
+    int64_t y_ratio = ((int64_t)a->h << 16) / b->h + 1;
+    int x2, y2, i, j, bpp = BytesPerPixel(a->format);
+    STREAM_BEGIN(a);
     for (i = 0; i < b->h; ++i) {
-        int *t = b->buf + i * b->w;
-        y2 = ((i * y_ratio) >> 16);
-        int *p = a->buf + y2 * a->w;
-        int rat = 0;
-        for (j = 0; j < b->w; ++j) {
-            x2 = (rat >> 16);
-            *t++ = p[x2];
-            rat += x_ratio;
+        y2 = (int)((i * y_ratio) >> 16);
+        int64_t rat = 0;
+        if (bpp == 4) {
+            int *t = b->buf + (size_t)i * b->w;
+            int *p = a->buf + (size_t)y2 * a->w;
+            for (j = 0; j < b->w; ++j) {
+                x2 = (int)(rat >> 16);
+                *t++ = p[x2];
+                rat += x_ratio;
+            }
+        } else if (bpp == 2) {
+            unsigned short *t = (unsigned short*)pixel_ptr(b, 0, i);
+            unsigned short *p = (unsigned short*)pixel_ptr(a, 0, y2);
+            for (j = 0; j < b->w; ++j) {
+                *t++ = p[rat >> 16];
+                rat += x_ratio;
+            }
+        } else {
+            unsigned char *t = pixel_ptr(b, 0, i);
+            unsigned char *p = pixel_ptr(a, 0, y2);
+            for (j = 0; j < b->w; ++j) {
+                *t++ = p[rat >> 16];
+                rat += x_ratio;
+            }
         }
     }
+    STREAM_END(a);
     return true;
 }
 
-#define __MIN(a, b) (((a) < (b)) ? (a) : (b))
-#define __MAX(a, b) (((a) > (b)) ? (a) : (b))
-#define __CLAMP(x, low, high) (((x) > (high)) ? (high) : (((x) < (low)) ? (low) : (x)))
-
 #define __PI 3.14159265358979323846264338327950288f
 #define __D2R(a) ((a) * __PI / 180.0)
 #define __R2D(a) ((a) * 180.0 / __PI)
@@ -282,8 +1191,9 @@ EXPORT bool RotateSurface(Surface *a, float angle, Surface *b) {
     
     int dw = (int)ceil(fabsf(mm[1][0]) - mm[0][0]);
     int dh = (int)ceil(fabsf(mm[1][1]) - mm[0][1]);
-    if (!NewSurface(b, dw, dh))
+    if (!NewSurfaceFormat(b, dw, dh, a->format))
         return false;
+    b->palette = a->palette;
     
     int x, y, sx, sy;
     for (x = 0; x < dw; ++x)
@@ -297,7 +1207,7 @@ EXPORT bool RotateSurface(Surface *a, float angle, Surface *b) {
     return true;
 }
 
-static inline void vline(Surface *s, int x, int y0, int y1, int col) {
+static inline void vline(Surface *s, int x, int y0, int y1, const SpanFn *set, int col) {
     if (y1 < y0) {
         y0 += y1;
         y1  = y0 - y1;
@@ -313,17 +1223,17 @@ static inline void vline(Surface *s, int x, int y0, int y1, int col) {
         y1 = s->h - 1;
     
     for(int y = y0; y <= y1; y++)
-        BlendPixel(s, x, y, col);
+        blend_span(s, x, y, 1, set, SPAN_SOLID, NULL, NULL, col);
 }
 
-static inline void hline(Surface *s, int y, int x0, int x1, int col) {
+static inline void hline(Surface *s, int y, int x0, int x1, const SpanFn *set, int col) {
     if (x1 < x0) {
         x0 += x1;
         x1  = x0 - x1;
         x0 -= x1;
     }
     
-    if (y < 0 || y >= s->h || x0 >= s->w)
+    if (y < 0 || y >= s->h || x0 >= s->w || x1 < 0)
         return;
     
     if (x0 < 0)
@@ -331,37 +1241,52 @@ static inline void hline(Surface *s, int y, int x0, int x1, int col) {
     if (x1 >= s->w)
         x1 = s->w - 1;
     
-    for(int x = x0; x <= x1; x++)
-        BlendPixel(s, x, y, col);
+    blend_span(s, x0, y, x1 - x0 + 1, set, SPAN_SOLID, NULL, NULL, col);
 }
 
-EXPORT void DrawLine(Surface *s, int x0, int y0, int x1, int y1, int col) {
-    if (x0 == x1)
-        vline(s, x0, y0, y1, col);
-    if (y0 == y1)
-        hline(s, y0, x0, x1, col);
+EXPORT void DrawLine(Surface *s, int x0, int y0, int x1, int y1, int col, BlendMode mode) {
+    const SpanFn *set = span_for(mode);
+    if (!set)
+        return;
+    if (x0 == x1) {
+        vline(s, x0, y0, y1, set, col);
+        return;
+    }
+    if (y0 == y1) {
+        hline(s, y0, x0, x1, set, col);
+        return;
+    }
     int dx = abs(x1 - x0), sx = x0 < x1 ? 1 : -1;
     int dy = abs(y1 - y0), sy = y0 < y1 ? 1 : -1;
     int err = (dx > dy ? dx : -dy) / 2;
     
-    while (BlendPixel(s, x0, y0, col), x0 != x1 || y0 != y1) {
+    while (blend_point(s, x0, y0, set, col), x0 != x1 || y0 != y1) {
         int e2 = err;
         if (e2 > -dx) { err -= dy; x0 += sx; }
         if (e2 <  dy) { err += dx; y0 += sy; }
     }
 }
 
-EXPORT void DrawCircle(Surface *s, int xc, int yc, int r, int col, bool fill) {
-    int x = -r, y = 0, err = 2 - 2 * r; /* II. Quadrant */
+EXPORT void DrawCircle(Surface *s, int xc, int yc, int r, int col, bool fill, BlendMode mode) {
+    const SpanFn *set = span_for(mode);
+    if (!set || r < 0)
+        return;
+    int x = -r, y = 0, err = 2 - 2 * r, filled = -1; /* II. Quadrant */
     do {
-        BlendPixel(s, xc - x, yc + y, col);    /*   I. Quadrant */
-        BlendPixel(s, xc - y, yc - x, col);    /*  II. Quadrant */
-        BlendPixel(s, xc + x, yc - y, col);    /* III. Quadrant */
-        BlendPixel(s, xc + y, yc + x, col);    /*  IV. Quadrant */
-        
+        /* x only narrows as y grows, so the first step on a row is the widest.
+         * Rows are filled once each so modes like add and xor don't double up */
         if (fill) {
-            hline(s, yc - y, xc - x, xc + x, col);
-            hline(s, yc + y, xc - x, xc + x, col);
+            if (y != filled) {
+                hline(s, yc - y, xc - x, xc + x, set, col);
+                if (y)
+                    hline(s, yc + y, xc - x, xc + x, set, col);
+                filled = y;
+            }
+        } else {
+            blend_point(s, xc - x, yc + y, set, col);    /*   I. Quadrant */
+            blend_point(s, xc - y, yc - x, set, col);    /*  II. Quadrant */
+            blend_point(s, xc + x, yc - y, set, col);    /* III. Quadrant */
+            blend_point(s, xc + y, yc + x, set, col);    /*  IV. Quadrant */
         }
         
         r = err;
@@ -372,7 +1297,10 @@ EXPORT void DrawCircle(Surface *s, int xc, int yc, int r, int col, bool fill) {
     } while (x < 0);
 }
 
-EXPORT void DrawRect(Surface *s, int x, int y, int w, int h, int col, bool fill) {
+EXPORT void DrawRect(Surface *s, int x, int y, int w, int h, int col, bool fill, BlendMode mode) {
+    const SpanFn *set = span_for(mode);
+    if (!set)
+        return;
     if (x < 0) {
         w += x;
         x  = 0;
@@ -394,12 +1322,17 @@ EXPORT void DrawRect(Surface *s, int x, int y, int w, int h, int col, bool fill)
     
     if (fill) {
         for (; y < h; ++y)
-            hline(s, y, x, w, col);
+            hline(s, y, x, w, set, col);
     } else {
-        hline(s, y, x, w, col);
-        hline(s, h, x, w, col);
-        vline(s, x, y, h, col);
-        vline(s, w, y, h, col);
+        /* The sides skip the corners so no pixel is blended twice */
+        hline(s, y, x, w, set, col);
+        if (h != y)
+            hline(s, h, x, w, set, col);
+        if (h - y > 1) {
+            vline(s, x, y + 1, h - 1, set, col);
+            if (w != x)
+                vline(s, w, y + 1, h - 1, set, col);
+        }
     }
 }
 
@@ -410,8 +1343,22 @@ EXPORT void DrawRect(Surface *s, int x, int y, int w, int h, int col, bool fill)
         b = temp; \
     } while(0)
 
-EXPORT void DrawTri(Surface *s, int x0, int y0, int x1, int y1, int x2, int y2, int col, bool fill) {
-    if (y0 ==  y1 && y0 ==  y2)
+/* As DrawLine but stopping short of (x1, y1), so edges that share a corner only blend it once */
+static void open_line(Surface *s, int x0, int y0, int x1, int y1, const SpanFn *set, int col) {
+    int dx = abs(x1 - x0), sx = x0 < x1 ? 1 : -1;
+    int dy = abs(y1 - y0), sy = y0 < y1 ? 1 : -1;
+    int err = (dx > dy ? dx : -dy) / 2;
+    while (x0 != x1 || y0 != y1) {
+        blend_point(s, x0, y0, set, col);
+        int e2 = err;
+        if (e2 > -dx) { err -= dy; x0 += sx; }
+        if (e2 <  dy) { err += dx; y0 += sy; }
+    }
+}
+
+EXPORT void DrawTri(Surface *s, int x0, int y0, int x1, int y1, int x2, int y2, int col, bool fill, BlendMode mode) {
+    const SpanFn *set = span_for(mode);
+    if (!set || (y0 ==  y1 && y0 ==  y2))
         return;
     if (fill) {
         if (y0 > y1) {
@@ -427,7 +1374,7 @@ EXPORT void DrawTri(Surface *s, int x0, int y0, int x1, int y1, int x2, int y2,
             GRAPHICS_SWAP(y1, y2);
         }
         
-        int total_height = y2 - y0, i, j;
+        int total_height = y2 - y0, i;
         for (i = 0; i < total_height; ++i) {
             bool second_half = i > y1 - y0 || y1 == y0;
             int segment_height = second_half ? y2 - y1 : y1 - y0;
@@ -441,12 +1388,11 @@ EXPORT void DrawTri(Surface *s, int x0, int y0, int x1, int y1, int x2, int y2,
                 GRAPHICS_SWAP(ax, bx);
                 GRAPHICS_SWAP(ay, by);
             }
-            for (j = ax; j <= bx; ++j)
-                BlendPixel(s, j, y0 + i, col);
+            hline(s, y0 + i, ax, bx, set, col);
         }
     } else {
-        DrawLine(s, x0, y0, x1, y1, col);
-        DrawLine(s, x1, y1, x2, y2, col);
-        DrawLine(s, x2, y2, x0, y0, col);
+        open_line(s, x0, y0, x1, y1, set, col);
+        open_line(s, x1, y1, x2, y2, set, col);
+        open_line(s, x2, y2, x0, y0, set, col);
     }
 }
@@ -0,0 +1,441 @@
+/* tiled.c
+ *
+ * Created by George Watson on 26/11/2017.
+ * Copyright © 2013-2021 George Watson. All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * *   Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * *   Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * *   Neither the name of the <organization> nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GEORGE WATSON BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "tiled.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#if defined(__EMSCRIPTEN__)
+#include "emscripten.h"
+#define EXPORT EMSCRIPTEN_KEEPALIVE
+#else
+#define EXPORT
+#endif
+
+#define __MIN(a, b) (((a) < (b)) ? (a) : (b))
+#define __MAX(a, b) (((a) > (b)) ? (a) : (b))
+
+#define TILED_MAGIC 0x4C495453 /* "STIL" */
+#define TILED_VERSION 1
+#define TILED_HEADER 64
+#define DEFAULT_TILE 256
+#define MIN_SLOTS 4
+
+typedef struct {
+    unsigned int magic, version, w, h, tile;
+} TiledHeader;
+
+typedef struct {
+    int tile, prev, next;
+    bool dirty;
+    int *pixels;
+} Slot;
+
+typedef struct {
+#if defined(_WIN32)
+    HANDLE file;
+#else
+    int fd;
+#endif
+    int tiles_x, tiles_y, nslots, head, tail;
+    size_t tile_bytes;
+    int *lookup;
+    Slot *slots;
+} Cache;
+
+static bool tile_io(Cache *c, int index, void *buf, bool write) {
+    uint64_t offset = TILED_HEADER + (uint64_t)index * c->tile_bytes;
+    unsigned char *p = buf;
+    size_t left = c->tile_bytes;
+    while (left) {
+#if defined(_WIN32)
+        OVERLAPPED o;
+        memset(&o, 0, sizeof(o));
+        o.Offset = (DWORD)offset;
+        o.OffsetHigh = (DWORD)(offset >> 32);
+        DWORD n = 0, want = left > 0x40000000 ? 0x40000000 : (DWORD)left;
+        if (!(write ? WriteFile(c->file, p, want, &n, &o) : ReadFile(c->file, p, want, &n, &o)) || !n)
+            return false;
+#else
+        ssize_t n = write ? pwrite(c->fd, p, left, (off_t)offset) : pread(c->fd, p, left, (off_t)offset);
+        if (n <= 0)
+            return false;
+#endif
+        p += n;
+        offset += n;
+        left -= n;
+    }
+    return true;
+}
+
+static void unlink_slot(Cache *c, int s) {
+    Slot *slot = &c->slots[s];
+    if (slot->prev >= 0)
+        c->slots[slot->prev].next = slot->next;
+    else
+        c->head = slot->next;
+    if (slot->next >= 0)
+        c->slots[slot->next].prev = slot->prev;
+    else
+        c->tail = slot->prev;
+}
+
+static void touch_slot(Cache *c, int s) {
+    if (c->head == s)
+        return;
+    unlink_slot(c, s);
+    c->slots[s].prev = -1;
+    c->slots[s].next = c->head;
+    c->slots[c->head].prev = s;
+    c->head = s;
+}
+
+/* Find a tile in the cache, evicting the least recently used one to make room.
+ * When load is false the caller is about to overwrite the whole tile */
+static int *fetch_tile(TiledSurface *t, int tx, int ty, bool load) {
+    Cache *c = t->cache;
+    int index = ty * c->tiles_x + tx, s = c->lookup[index];
+    if (s >= 0) {
+        touch_slot(c, s);
+        return c->slots[s].pixels;
+    }
+
+    s = c->tail;
+    Slot *slot = &c->slots[s];
+    if (slot->tile >= 0) {
+        if (slot->dirty && !tile_io(c, slot->tile, slot->pixels, true))
+            return NULL;
+        c->lookup[slot->tile] = -1;
+        slot->tile = -1;
+    }
+    if (!slot->pixels && !(slot->pixels = malloc(c->tile_bytes)))
+        return NULL;
+    if (load && !tile_io(c, index, slot->pixels, false))
+        return NULL;
+    slot->tile = index;
+    slot->dirty = false;
+    c->lookup[index] = s;
+    touch_slot(c, s);
+    return slot->pixels;
+}
+
+static inline void mark_dirty(TiledSurface *t, int tx, int ty) {
+    Cache *c = t->cache;
+    c->slots[c->lookup[ty * c->tiles_x + tx]].dirty = true;
+}
+
+static bool new_cache(TiledSurface *t, size_t cache_bytes) {
+    Cache *c = t->cache;
+    c->tiles_x = (t->w + t->tile - 1) / t->tile;
+    c->tiles_y = (t->h + t->tile - 1) / t->tile;
+    c->tile_bytes = (size_t)t->tile * t->tile * sizeof(int);
+    size_t n = cache_bytes / c->tile_bytes, tiles = (size_t)c->tiles_x * c->tiles_y;
+    if (n < MIN_SLOTS)
+        n = MIN_SLOTS;
+    if (n > tiles)
+        n = tiles;
+    if (tiles > INT_MAX)
+        return false;
+    c->nslots = (int)n;
+    c->lookup = malloc(tiles * sizeof(int));
+    c->slots = calloc(n, sizeof(Slot));
+    if (!c->lookup || !c->slots)
+        return false;
+    memset(c->lookup, 0xFF, tiles * sizeof(int));
+    for (int i = 0; i < c->nslots; ++i) {
+        c->slots[i].tile = -1;
+        c->slots[i].prev = i - 1;
+        c->slots[i].next = i + 1 < c->nslots ? i + 1 : -1;
+    }
+    c->head = 0;
+    c->tail = c->nslots - 1;
+    return true;
+}
+
+static bool open_tiled(TiledSurface *t, const char *path, bool create, unsigned int w, unsigned int h, unsigned int tile, size_t cache_bytes) {
+    Cache *c = calloc(1, sizeof(Cache));
+    if (!c)
+        return false;
+    t->cache = c;
+    TiledHeader header = { TILED_MAGIC, TILED_VERSION, w, h, tile };
+#if defined(_WIN32)
+    c->file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, create ? CREATE_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (c->file == INVALID_HANDLE_VALUE)
+        goto BAIL;
+#else
+    c->fd = open(path, create ? O_RDWR | O_CREAT | O_TRUNC : O_RDWR, 0644);
+    if (c->fd < 0)
+        goto BAIL;
+#endif
+
+    if (create) {
+        t->w = w;
+        t->h = h;
+        t->tile = tile;
+        if (!new_cache(t, cache_bytes))
+            goto BAIL;
+        uint64_t size = TILED_HEADER + (uint64_t)c->tiles_x * c->tiles_y * c->tile_bytes;
+        unsigned char raw[TILED_HEADER];
+        memset(raw, 0, sizeof(raw));
+        memcpy(raw, &header, sizeof(header));
+#if defined(_WIN32)
+        LARGE_INTEGER end;
+        DWORD n;
+        end.QuadPart = (LONGLONG)size;
+        if (!SetFilePointerEx(c->file, end, NULL, FILE_BEGIN) || !SetEndOfFile(c->file))
+            goto BAIL;
+        end.QuadPart = 0;
+        if (!SetFilePointerEx(c->file, end, NULL, FILE_BEGIN) || !WriteFile(c->file, raw, sizeof(raw), &n, NULL) || n != sizeof(raw))
+            goto BAIL;
+#else
+        if (ftruncate(c->fd, (off_t)size) || pwrite(c->fd, raw, sizeof(raw), 0) != (ssize_t)sizeof(raw))
+            goto BAIL;
+#endif
+    } else {
+#if defined(_WIN32)
+        DWORD n;
+        if (!ReadFile(c->file, &header, sizeof(header), &n, NULL) || n != sizeof(header))
+            goto BAIL;
+#else
+        if (pread(c->fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header))
+            goto BAIL;
+#endif
+        if (header.magic != TILED_MAGIC || header.version != TILED_VERSION || !header.w || !header.h ||
+            header.w > INT_MAX || header.h > INT_MAX || !header.tile || header.tile > 4096)
+            goto BAIL;
+        t->w = header.w;
+        t->h = header.h;
+        t->tile = header.tile;
+        if (!new_cache(t, cache_bytes))
+            goto BAIL;
+    }
+    return true;
+
+BAIL:
+    DestroyTiledSurface(t);
+    return false;
+}
+
+EXPORT bool NewTiledSurface(TiledSurface *t, const char *path, unsigned int w, unsigned int h, unsigned int tile, size_t cache_bytes) {
+    memset(t, 0, sizeof(TiledSurface));
+    if (!tile)
+        tile = DEFAULT_TILE;
+    if (!w || !h || w > INT_MAX || h > INT_MAX || tile > 4096)
+        return false;
+    return open_tiled(t, path, true, w, h, tile, cache_bytes);
+}
+
+EXPORT bool OpenTiledSurface(TiledSurface *t, const char *path, size_t cache_bytes) {
+    memset(t, 0, sizeof(TiledSurface));
+    return open_tiled(t, path, false, 0, 0, 0, cache_bytes);
+}
+
+EXPORT bool FlushTiledSurface(TiledSurface *t) {
+    Cache *c = t->cache;
+    bool ret = true;
+    if (!c || !c->slots)
+        return false;
+    for (int i = 0; i < c->nslots; ++i) {
+        Slot *slot = &c->slots[i];
+        if (slot->tile >= 0 && slot->dirty) {
+            if (tile_io(c, slot->tile, slot->pixels, true))
+                slot->dirty = false;
+            else
+                ret = false;
+        }
+    }
+    return ret;
+}
+
+EXPORT void DestroyTiledSurface(TiledSurface *t) {
+    Cache *c = t->cache;
+    if (!c)
+        return;
+    if (c->slots) {
+        FlushTiledSurface(t);
+        for (int i = 0; i < c->nslots; ++i)
+            free(c->slots[i].pixels);
+        free(c->slots);
+    }
+    free(c->lookup);
+#if defined(_WIN32)
+    if (c->file && c->file != INVALID_HANDLE_VALUE)
+        CloseHandle(c->file);
+#else
+    if (c->fd >= 0)
+        close(c->fd);
+#endif
+    free(c);
+    memset(t, 0, sizeof(TiledSurface));
+}
+
+EXPORT int GetTiledPixel(TiledSurface *t, int x, int y) {
+    if (x < 0 || y < 0 || x >= t->w || y >= t->h)
+        return 0;
+    int *p = fetch_tile(t, x / t->tile, y / t->tile, true);
+    return p ? p[(y % t->tile) * t->tile + x % t->tile] : 0;
+}
+
+EXPORT void SetTiledPixel(TiledSurface *t, int x, int y, int col) {
+    if (x < 0 || y < 0 || x >= t->w || y >= t->h)
+        return;
+    int *p = fetch_tile(t, x / t->tile, y / t->tile, true);
+    if (p) {
+        p[(y % t->tile) * t->tile + x % t->tile] = col;
+        mark_dirty(t, x / t->tile, y / t->tile);
+    }
+}
+
+typedef enum {
+    TILE_READ,
+    TILE_WRITE,
+    TILE_PASTE
+} TileOp;
+
+/* Walk the tiles under the rectangle (x, y, s->w, s->h), clipped to the image, copying or blending against s */
+static bool each_tile(TiledSurface *t, Surface *s, int x, int y, TileOp op) {
+    int T = t->tile;
+    int x0 = __MAX(x, 0), y0 = __MAX(y, 0);
+    int x1 = (int)__MIN((int64_t)x + s->w, t->w), y1 = (int)__MIN((int64_t)y + s->h, t->h);
+    if (x0 >= x1 || y0 >= y1)
+        return true;
+    for (int ty = y0 / T; ty * T < y1; ++ty)
+        for (int tx = x0 / T; tx * T < x1; ++tx) {
+            int ox = tx * T, oy = ty * T;
+            int ix0 = __MAX(x0, ox), iy0 = __MAX(y0, oy);
+            int ix1 = __MIN(x1, ox + T), iy1 = __MIN(y1, oy + T);
+            // No need to read a tile back in when every pixel of it inside the image is replaced
+            bool whole = op == TILE_WRITE && ix0 == ox && iy0 == oy && ix1 == __MIN(ox + T, t->w) && iy1 == __MIN(oy + T, t->h);
+            int *p = fetch_tile(t, tx, ty, !whole);
+            if (!p)
+                return false;
+            switch (op) {
+                case TILE_READ:
+                    for (int yy = iy0; yy < iy1; ++yy) {
+                        const int *row = p + (yy - oy) * T + (ix0 - ox);
+                        if (s->format == SURFACE_ARGB)
+                            memcpy(s->buf + (size_t)(yy - y) * s->w + (ix0 - x), row, (ix1 - ix0) * sizeof(int));
+                        else
+                            for (int xx = ix0; xx < ix1; ++xx)
+                                SetPixel(s, xx - x, yy - y, row[xx - ix0]);
+                    }
+                    break;
+                case TILE_WRITE:
+                    for (int yy = iy0; yy < iy1; ++yy) {
+                        int *row = p + (yy - oy) * T + (ix0 - ox);
+                        if (s->format == SURFACE_ARGB)
+                            memcpy(row, s->buf + (size_t)(yy - y) * s->w + (ix0 - x), (ix1 - ix0) * sizeof(int));
+                        else
+                            for (int xx = ix0; xx < ix1; ++xx)
+                                row[xx - ix0] = GetPixel(s, xx - x, yy - y);
+                    }
+                    mark_dirty(t, tx, ty);
+                    break;
+                case TILE_PASTE: {
+                    Surface tile = { p, T, T, SURFACE_ARGB, NULL, 0, SURFACE_ACCESS_NORMAL, NULL };
+                    PasteSurfaceClip(&tile, s, ix0 - ox, iy0 - oy, ix0 - x, iy0 - y, ix1 - ix0, iy1 - iy0, BLEND_OVER);
+                    mark_dirty(t, tx, ty);
+                    break;
+                }
+            }
+        }
+    return true;
+}
+
+EXPORT bool ReadTiledRegion(TiledSurface *t, int x, int y, Surface *dst) {
+    return each_tile(t, dst, x, y, TILE_READ);
+}
+
+EXPORT bool WriteTiledRegion(TiledSurface *t, Surface *src, int x, int y) {
+    return each_tile(t, src, x, y, TILE_WRITE);
+}
+
+EXPORT bool PasteTiledSurface(TiledSurface *t, Surface *src, int x, int y) {
+    return each_tile(t, src, x, y, TILE_PASTE);
+}
+
+EXPORT bool ScaleTiledRegion(TiledSurface *t, int x, int y, int w, int h, Surface *dst) {
+    if (w <= 0 || h <= 0 || dst->w <= 0 || dst->h <= 0)
+        return false;
+    int T = t->tile, *xs = malloc(((size_t)dst->w + dst->h) * sizeof(int)), *ys = xs + dst->w;
+    if (!xs)
+        return false;
+    for (int i = 0; i < dst->w; ++i)
+        xs[i] = (int)(x + (int64_t)i * w / dst->w);
+    for (int i = 0; i < dst->h; ++i)
+        ys[i] = (int)(y + (int64_t)i * h / dst->h);
+
+    // Source coordinates only grow with the destination ones, so each tile covers a contiguous block of dst
+    bool ret = true;
+    int i0 = 0;
+    while (i0 < dst->h && ys[i0] < 0)
+        i0++;
+    while (ret && i0 < dst->h && ys[i0] < t->h) {
+        int ty = ys[i0] / T, i1 = i0;
+        while (i1 < dst->h && ys[i1] < t->h && ys[i1] / T == ty)
+            i1++;
+        int j0 = 0;
+        while (j0 < dst->w && xs[j0] < 0)
+            j0++;
+        while (j0 < dst->w && xs[j0] < t->w) {
+            int tx = xs[j0] / T, j1 = j0;
+            while (j1 < dst->w && xs[j1] < t->w && xs[j1] / T == tx)
+                j1++;
+            int *p = fetch_tile(t, tx, ty, true);
+            if (!p) {
+                ret = false;
+                break;
+            }
+            for (int i = i0; i < i1; ++i) {
+                const int *row = p + (ys[i] - ty * T) * T;
+                if (dst->format == SURFACE_ARGB) {
+                    int *out = dst->buf + (size_t)i * dst->w;
+                    for (int j = j0; j < j1; ++j)
+                        out[j] = row[xs[j] - tx * T];
+                } else
+                    for (int j = j0; j < j1; ++j)
+                        SetPixel(dst, j, i, row[xs[j] - tx * T]);
+            }
+            j0 = j1;
+        }
+        i0 = i1;
+    }
+    free(xs);
+    return ret;
+}
@@ -6,6 +6,7 @@
 #include <math.h>
 #include <time.h>
 #include <ctype.h>
+#include <stdint.h>
 #if !defined(WINDOW_WINDOWS)
 #include <unistd.h>
 #endif
@@ -20,6 +21,14 @@
 #define WINDOW_NO_WINDOW
 #endif
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define WINDOW_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define WINDOW_NEON
+#include <arm_neon.h>
+#endif
+
 #if defined(WINDOW_MALLOC) && defined(WINDOW_FREE) && (defined(WINDOW_REALLOC) || defined(WINDOW_REALLOC_SIZED))
 #elif !defined(WINDOW_MALLOC) && !defined(WINDOW_FREE) && !defined(WINDOW_REALLOC) && !defined(WINDOW_REALLOC_SIZED)
 #else
@@ -41,8 +50,10 @@
         (x) = NULL;         \
     }
 
+#if defined(WINDOW_KEYCODES)
 static short keycodes[512];
 static bool keycodes_init = false;
+#endif
 
 void SetWindowUserdata(Window *s, void *p) {
     s->parent = p;
@@ -68,12 +79,154 @@ void SetWindowCallbacks(XMAP_SCREEN_CB Window *window) {
 XMAP_SCREEN_CB
 #undef X
 
-#define CBCALL(x, ...)                                  \
-    do {                                                \
-        if (e_window && e_window->x)                    \
-            e_window->x(e_window->parent, __VA_ARGS__); \
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define RING_LOAD(p) ((unsigned int)_InterlockedCompareExchange((volatile long *)(p), 0, 0))
+#define RING_STORE(p, v) _InterlockedExchange((volatile long *)(p), (long)(v))
+#else
+#define RING_LOAD(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define RING_STORE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#endif
+
+// Single producer, single consumer ring behind SetWindowEventQueue. Only the thread in PollEvents writes head and only the thread in NextEvent writes tail, each on its own cache line
+typedef struct {
+    unsigned int head;
+    char pad[60];
+    unsigned int tail;
+    unsigned int mask;
+    Event events[];
+} event_ring_t;
+
+static void destroy_event_queue(Window *s) {
+    WINDOW_SAFE_FREE(s->events);
+}
+
+bool SetWindowEventQueue(Window *s, int capacity) {
+    destroy_event_queue(s);
+    if (capacity <= 0)
+        return true;
+    if (capacity > 1 << 24)
+        return false;
+    unsigned int n = 1;
+    while (n < (unsigned int)capacity)
+        n <<= 1;
+    event_ring_t *r = WINDOW_MALLOC(sizeof(event_ring_t) + n * sizeof(Event));
+    if (!r)
+        return false;
+    memset(r, 0, sizeof(event_ring_t));
+    r->mask = n - 1;
+    s->events = r;
+    return true;
+}
+
+bool NextEvent(Window *s, Event *e) {
+    event_ring_t *r = (event_ring_t *)s->events;
+    if (!r)
+        return false;
+    unsigned int tail = r->tail;
+    if (tail == RING_LOAD(&r->head))
+        return false;
+    *e = r->events[tail & r->mask];
+    RING_STORE(&r->tail, tail + 1);
+    return true;
+}
+
+// A full queue drops the event rather than overwrite one the consumer may be reading
+static void push_event(Window *s, Event *e) {
+    event_ring_t *r = (event_ring_t *)s->events;
+    unsigned int head = r->head;
+    if (head - RING_LOAD(&r->tail) > r->mask)
+        return;
+    r->events[head & r->mask] = *e;
+    RING_STORE(&r->head, head + 1);
+}
+
+// One per callback, named so CBCALL can paste them from the callback field. They queue the event then pass it on, so the arguments are only evaluated once
+static void call_Keyboard_callback(Window *s, Key key, Mod mod, bool down) {
+    if (s->events) {
+        Event e = {EVENT_KEYBOARD, mod};
+        e.data.keyboard.key = key;
+        e.data.keyboard.down = down;
+        push_event(s, &e);
+    }
+    if (s->Keyboard_callback)
+        s->Keyboard_callback(s->parent, key, mod, down);
+}
+
+static void call_MouseButton_callback(Window *s, Button button, Mod mod, bool down) {
+    if (s->events) {
+        Event e = {EVENT_MOUSE_BUTTON, mod};
+        e.data.button.button = button;
+        e.data.button.down = down;
+        push_event(s, &e);
+    }
+    if (s->MouseButton_callback)
+        s->MouseButton_callback(s->parent, button, mod, down);
+}
+
+static void call_MouseMove_callback(Window *s, int x, int y, int dx, int dy) {
+    if (s->events) {
+        Event e = {EVENT_MOUSE_MOVE};
+        e.data.move.x = x;
+        e.data.move.y = y;
+        e.data.move.dx = dx;
+        e.data.move.dy = dy;
+        push_event(s, &e);
+    }
+    if (s->MouseMove_callback)
+        s->MouseMove_callback(s->parent, x, y, dx, dy);
+}
+
+static void call_Scroll_callback(Window *s, Mod mod, float dx, float dy) {
+    if (s->events) {
+        Event e = {EVENT_SCROLL, mod};
+        e.data.scroll.dx = dx;
+        e.data.scroll.dy = dy;
+        push_event(s, &e);
+    }
+    if (s->Scroll_callback)
+        s->Scroll_callback(s->parent, mod, dx, dy);
+}
+
+static void call_Focus_callback(Window *s, bool focused) {
+    if (s->events) {
+        Event e = {EVENT_FOCUS};
+        e.data.focus.focused = focused;
+        push_event(s, &e);
+    }
+    if (s->Focus_callback)
+        s->Focus_callback(s->parent, focused);
+}
+
+static void call_Resize_callback(Window *s, int w, int h) {
+    if (s->events) {
+        Event e = {EVENT_RESIZE};
+        e.data.resize.w = w;
+        e.data.resize.h = h;
+        push_event(s, &e);
+    }
+    if (s->Resize_callback)
+        s->Resize_callback(s->parent, w, h);
+}
+
+#define CBCALL(x, ...)                       \
+    do {                                     \
+        if (e_window)                        \
+            call_##x(e_window, __VA_ARGS__); \
     } while (0)
 
+// Closed takes no arguments, so it can't go through CBCALL
+static void window_closed(Window *s) {
+    if (!s)
+        return;
+    if (s->events) {
+        Event e = {EVENT_CLOSED};
+        push_event(s, &e);
+    }
+    if (s->Closed_callback)
+        s->Closed_callback(s->parent);
+}
+
 // Taken from: https://stackoverflow.com/a/1911632
 #if _MSC_VER
 #define STRINGISE_IMPL(x) #x
@@ -120,6 +273,419 @@ XMAP_SCREEN_CB
         return head;                                                             \
     }
 
+#if defined(WINDOW_MAP)
+// Open addressing map from a native window handle to its Window, so event dispatch doesn't walk the window list. Handles are never 0, which marks an empty slot
+typedef struct {
+    uintptr_t key;
+    Window *value;
+} window_slot_t;
+
+typedef struct {
+    window_slot_t *slots;
+    size_t cap, count;
+} window_map_t;
+
+static size_t window_map_slot(window_map_t *m, uintptr_t key) {
+    return (size_t)(((uint64_t)key * 0x9E3779B97F4A7C15ull) >> 32) & (m->cap - 1);
+}
+
+static Window *window_map_get(window_map_t *m, uintptr_t key) {
+    if (!m->count)
+        return NULL;
+    for (size_t i = window_map_slot(m, key);; i = (i + 1) & (m->cap - 1)) {
+        if (m->slots[i].key == key)
+            return m->slots[i].value;
+        if (!m->slots[i].key)
+            return NULL;
+    }
+}
+
+static bool window_map_put(window_map_t *m, uintptr_t key, Window *value) {
+    // Kept at most half full so probes stay short
+    if ((m->count + 1) * 2 > m->cap) {
+        window_map_t grown = {NULL, m->cap ? m->cap * 2 : 16, 0};
+        if (!(grown.slots = WINDOW_MALLOC(grown.cap * sizeof(window_slot_t))))
+            return false;
+        memset(grown.slots, 0, grown.cap * sizeof(window_slot_t));
+        for (size_t i = 0; i < m->cap; ++i)
+            if (m->slots[i].key)
+                window_map_put(&grown, m->slots[i].key, m->slots[i].value);
+        WINDOW_SAFE_FREE(m->slots);
+        *m = grown;
+    }
+    size_t i = window_map_slot(m, key);
+    while (m->slots[i].key && m->slots[i].key != key)
+        i = (i + 1) & (m->cap - 1);
+    if (!m->slots[i].key)
+        m->count++;
+    m->slots[i].key = key;
+    m->slots[i].value = value;
+    return true;
+}
+
+static void window_map_remove(window_map_t *m, uintptr_t key) {
+    if (!m->count)
+        return;
+    size_t i = window_map_slot(m, key);
+    while (m->slots[i].key != key) {
+        if (!m->slots[i].key)
+            return;
+        i = (i + 1) & (m->cap - 1);
+    }
+    // Shift later entries of the probe run back, so lookups never stop at the hole
+    for (size_t j = (i + 1) & (m->cap - 1); m->slots[j].key; j = (j + 1) & (m->cap - 1)) {
+        size_t home = window_map_slot(m, m->slots[j].key);
+        if (((j - home) & (m->cap - 1)) >= ((j - i) & (m->cap - 1))) {
+            m->slots[i] = m->slots[j];
+            i = j;
+        }
+    }
+    m->slots[i].key = 0;
+    m->slots[i].value = NULL;
+    m->count--;
+}
+
+static void window_map_clear(window_map_t *m) {
+    WINDOW_SAFE_FREE(m->slots);
+    m->cap = m->count = 0;
+}
+#endif
+
+// Surfaces that aren't ARGB are expanded into a per-window scratch surface. Empty surfaces have nothing to present, so every Flush returns early on them
+static Surface *flush_surface(Surface *b, Surface *scratch) {
+    if (!b || !b->buf || b->w <= 0 || b->h <= 0)
+        return NULL;
+    if (b->format == SURFACE_ARGB)
+        return b;
+    return ExpandSurface(b, scratch) ? scratch : NULL;
+}
+
+#define MAX_BACKBUFFERS 3
+
+// Swap chain of window-sized ARGB surfaces for LockBackbuffer/Present. A backend can set create/destroy to allocate the buffers itself
+typedef struct {
+    Surface buffers[MAX_BACKBUFFERS];
+    int count, index;
+    bool locked;
+    bool (*create)(void *ctx, int i, int w, int h);
+    void (*destroy)(void *ctx, int i);
+    void *ctx;
+} backbuffers_t;
+
+static void destroy_backbuffer(backbuffers_t *b, int i) {
+    if (b->destroy)
+        b->destroy(b->ctx, i);
+    else if (b->buffers[i].buf)
+        DestroySurface(&b->buffers[i]);
+}
+
+static void destroy_backbuffers(backbuffers_t *b) {
+    for (int i = 0; i < MAX_BACKBUFFERS; ++i)
+        destroy_backbuffer(b, i);
+    b->index = 0;
+    b->locked = false;
+}
+
+static bool set_backbuffer_count(backbuffers_t *b, int n) {
+    if (n < 1 || n > MAX_BACKBUFFERS)
+        return false;
+    destroy_backbuffers(b);
+    b->count = n;
+    return true;
+}
+
+// Buffers are (re)allocated here, so a resize takes effect on the next lock
+static Surface *lock_backbuffer(backbuffers_t *b, int w, int h) {
+    if (!b->count)
+        b->count = 2;
+    Surface *s = &b->buffers[b->index];
+    if (s->w != w || s->h != h || !s->buf) {
+        for (int i = 0; i < b->count; ++i) {
+            Surface *t = &b->buffers[i];
+            if (t->buf && t->w == w && t->h == h)
+                continue;
+            destroy_backbuffer(b, i);
+            if (!(b->create ? b->create(b->ctx, i, w, h) : NewSurface(t, w, h)))
+                return NULL;
+        }
+    }
+    b->locked = true;
+    return s;
+}
+
+// Returns the locked buffer to show and moves on to the next one
+static Surface *present_backbuffer(backbuffers_t *b) {
+    if (!b->locked)
+        return NULL;
+    Surface *s = &b->buffers[b->index];
+    b->index = (b->index + 1) % b->count;
+    b->locked = false;
+    return s;
+}
+
+#define MAX_DAMAGE_RECTS 16
+
+static long long rect_area(SurfaceRect *r) {
+    return (long long)r->w * r->h;
+}
+
+static SurfaceRect rect_union(SurfaceRect *a, SurfaceRect *b) {
+    int x = a->x < b->x ? a->x : b->x, y = a->y < b->y ? a->y : b->y;
+    int r = a->x + a->w > b->x + b->w ? a->x + a->w : b->x + b->w;
+    int d = a->y + a->h > b->y + b->h ? a->y + a->h : b->y + b->h;
+    return (SurfaceRect){x, y, r - x, d - y};
+}
+
+static bool rects_touch(SurfaceRect *a, SurfaceRect *b) {
+    return a->x <= b->x + b->w && b->x <= a->x + a->w && a->y <= b->y + b->h && b->y <= a->y + a->h;
+}
+
+// Clip damage to a w*h window and merge it into at most MAX_DAMAGE_RECTS rects. Overlapping or touching rects are merged, then the pair whose union wastes the fewest pixels until there's room. Returns the number of rects, or -1 when the damage covers most of the window and one full upload is cheaper
+static int coalesce_damage(SurfaceRect *rects, int count, int w, int h, SurfaceRect *out) {
+    int n = 0;
+    for (int i = 0; i < count; ++i) {
+        SurfaceRect r = rects[i];
+        if (r.x < 0) {
+            r.w += r.x;
+            r.x = 0;
+        }
+        if (r.y < 0) {
+            r.h += r.y;
+            r.y = 0;
+        }
+        if (r.x + r.w > w)
+            r.w = w - r.x;
+        if (r.y + r.h > h)
+            r.h = h - r.y;
+        if (r.w <= 0 || r.h <= 0)
+            continue;
+        // A merged rect can now reach others, so keep absorbing until nothing touches it
+        for (int j = 0; j < n; ++j)
+            if (rects_touch(&r, &out[j])) {
+                r = rect_union(&r, &out[j]);
+                out[j] = out[--n];
+                j = -1;
+            }
+        if (n == MAX_DAMAGE_RECTS) {
+            int best_a = 0, best_b = 1;
+            long long best = -1;
+            for (int a = 0; a < n; ++a)
+                for (int b = a + 1; b <= n; ++b) {
+                    SurfaceRect *rb = b == n ? &r : &out[b];
+                    SurfaceRect u = rect_union(&out[a], rb);
+                    long long waste = rect_area(&u) - rect_area(&out[a]) - rect_area(rb);
+                    if (best < 0 || waste < best) {
+                        best = waste;
+                        best_a = a;
+                        best_b = b;
+                    }
+                }
+            if (best_b == n) {
+                r = rect_union(&out[best_a], &r);
+                out[best_a] = out[--n];
+            } else {
+                out[best_a] = rect_union(&out[best_a], &out[best_b]);
+                out[best_b] = out[--n];
+            }
+        }
+        out[n++] = r;
+    }
+    long long area = 0;
+    for (int i = 0; i < n; ++i)
+        area += rect_area(&out[i]);
+    return area * 4 >= (long long)w * h * 3 ? -1 : n;
+}
+
+// Where a sw*sh frame lands in a dw*dh window. Integer scaling falls back to letterbox when the window is smaller than the frame
+static SurfaceRect scale_view(ScaleMode mode, int sw, int sh, int dw, int dh, int *factor) {
+    SurfaceRect r = {0, 0, dw, dh};
+    int k = dw / sw < dh / sh ? dw / sw : dh / sh;
+    *factor = 0;
+    if (mode == SCALE_INTEGER && k >= 1) {
+        *factor = k;
+        r.w = sw * k;
+        r.h = sh * k;
+    } else if (mode != SCALE_STRETCH) {
+        if ((long long)sw * dh <= (long long)dw * sh)
+            r.w = (int)((long long)sw * dh / sh);
+        else
+            r.h = (int)((long long)sh * dw / sw);
+    }
+    if (r.w < 1)
+        r.w = 1;
+    if (r.h < 1)
+        r.h = 1;
+    r.x = (dw - r.w) / 2;
+    r.y = (dh - r.h) / 2;
+    return r;
+}
+
+// Cached state for presenting a frame in a window of another size. The column and row tables and the output buffer are only rebuilt when a size changes, and buffers only grow so resizing back and forth doesn't reallocate
+typedef struct {
+    ScaleMode mode;
+    int src_w, src_h, dst_w, dst_h, factor;
+    SurfaceRect view;
+    int *cols, *rows, cols_cap, rows_cap;
+    int *buf;
+    size_t buf_cap;
+    Surface out;
+} scaler_t;
+
+static void destroy_scaler(scaler_t *sc) {
+    WINDOW_SAFE_FREE(sc->cols);
+    WINDOW_SAFE_FREE(sc->rows);
+    WINDOW_SAFE_FREE(sc->buf);
+    ScaleMode mode = sc->mode;
+    memset(sc, 0, sizeof(scaler_t));
+    sc->mode = mode;
+}
+
+static bool grow_ints(int **p, int *cap, int n) {
+    if (n <= *cap)
+        return true;
+    int *tmp = WINDOW_REALLOC(*p, (size_t)n * sizeof(int));
+    if (!tmp)
+        return false;
+    *p = tmp;
+    *cap = n;
+    return true;
+}
+
+static bool set_scaler_layout(scaler_t *sc, int sw, int sh, int dw, int dh) {
+    if (sw <= 0 || sh <= 0 || dw <= 0 || dh <= 0)
+        return false;
+    if (sc->src_w == sw && sc->src_h == sh && sc->dst_w == dw && sc->dst_h == dh)
+        return true;
+    sc->src_w = 0;
+    SurfaceRect v = scale_view(sc->mode, sw, sh, dw, dh, &sc->factor);
+    if (!sc->factor) {
+        if (!grow_ints(&sc->cols, &sc->cols_cap, v.w) || !grow_ints(&sc->rows, &sc->rows_cap, v.h))
+            return false;
+        // 16.16 steps, the same sampling the backends always used. The rounding up can step past the last pixel of very narrow sources
+        int x_ratio = (int)(((long long)sw << 16) / v.w) + 1;
+        int y_ratio = (int)(((long long)sh << 16) / v.h) + 1;
+        for (int i = 0; i < v.w; ++i) {
+            int x = (int)(((long long)i * x_ratio) >> 16);
+            sc->cols[i] = x < sw ? x : sw - 1;
+        }
+        for (int i = 0; i < v.h; ++i) {
+            int y = (int)(((long long)i * y_ratio) >> 16);
+            sc->rows[i] = y < sh ? y : sh - 1;
+        }
+    }
+    sc->view = v;
+    sc->src_w = sw;
+    sc->src_h = sh;
+    sc->dst_w = dw;
+    sc->dst_h = dh;
+    return true;
+}
+
+// Widen a row by repeating every pixel k times
+static void replicate_row(const int *src, int *dst, int n, int k) {
+    int i = 0;
+#if defined(WINDOW_SSE2)
+    if (k == 2)
+        for (; i + 4 <= n; i += 4, dst += 8) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+            _mm_storeu_si128((__m128i*)dst, _mm_unpacklo_epi32(v, v));
+            _mm_storeu_si128((__m128i*)(dst + 4), _mm_unpackhi_epi32(v, v));
+        }
+    else if (k >= 4)
+        for (; i < n; ++i, dst += k) {
+            __m128i v = _mm_set1_epi32(src[i]);
+            int j = 0;
+            for (; j + 4 <= k; j += 4)
+                _mm_storeu_si128((__m128i*)(dst + j), v);
+            for (; j < k; ++j)
+                dst[j] = src[i];
+        }
+#elif defined(WINDOW_NEON)
+    if (k == 2)
+        for (; i + 4 <= n; i += 4, dst += 8) {
+            int32x4_t v = vld1q_s32(src + i);
+            int32x4x2_t z = vzipq_s32(v, v);
+            vst1q_s32(dst, z.val[0]);
+            vst1q_s32(dst + 4, z.val[1]);
+        }
+    else if (k >= 4)
+        for (; i < n; ++i, dst += k) {
+            int32x4_t v = vdupq_n_s32(src[i]);
+            int j = 0;
+            for (; j + 4 <= k; j += 4)
+                vst1q_s32(dst + j, v);
+            for (; j < k; ++j)
+                dst[j] = src[i];
+        }
+#endif
+    for (; i < n; ++i)
+        for (int j = 0; j < k; ++j)
+            *dst++ = src[i];
+}
+
+static void fill_bar(int *d, int n) {
+    for (int i = 0; i < n; ++i)
+        d[i] = (int)0xFF000000;
+}
+
+// Draw a frame into a dst_w*dst_h buffer with a pitch in pixels, the bars around the view are filled with opaque black
+static void scale_rows(scaler_t *sc, Surface *src, int *dst, int pitch) {
+    SurfaceRect v = sc->view;
+    size_t row = (size_t)v.w * sizeof(int);
+    for (int y = 0; y < sc->dst_h; ++y) {
+        int *d = dst + (size_t)y * pitch;
+        if (y < v.y || y >= v.y + v.h) {
+            fill_bar(d, sc->dst_w);
+            continue;
+        }
+        fill_bar(d, v.x);
+        fill_bar(d + v.x + v.w, sc->dst_w - v.x - v.w);
+        d += v.x;
+        int i = y - v.y;
+        if (sc->factor) {
+            // Each source row is widened once and copied down for the rest of its k rows
+            if (i % sc->factor)
+                memcpy(d, d - pitch, row);
+            else
+                replicate_row(src->buf + (size_t)(i / sc->factor) * src->w, d, src->w, sc->factor);
+        } else if (i && sc->rows[i] == sc->rows[i - 1])
+            memcpy(d, d - pitch, row);
+        else {
+            const int *s = src->buf + (size_t)sc->rows[i] * src->w;
+            for (int x = 0; x < v.w; ++x)
+                d[x] = s[sc->cols[x]];
+        }
+    }
+}
+
+#if defined(WINDOW_SCALE_FRAME)
+// Scale a frame into the scaler's own window-sized buffer
+static Surface *scale_frame(scaler_t *sc, Surface *src, int dw, int dh) {
+    if (!set_scaler_layout(sc, src->w, src->h, dw, dh))
+        return NULL;
+    size_t n = (size_t)dw * dh;
+    if (n > sc->buf_cap) {
+        int *tmp = WINDOW_REALLOC(sc->buf, n * sizeof(int));
+        if (!tmp)
+            return NULL;
+        sc->buf = tmp;
+        sc->buf_cap = n;
+    }
+    scale_rows(sc, src, sc->buf, dw);
+    memset(&sc->out, 0, sizeof(Surface));
+    sc->out.buf = sc->buf;
+    sc->out.w = dw;
+    sc->out.h = dh;
+    sc->out.format = SURFACE_ARGB;
+    return &sc->out;
+}
+#endif
+
+static void set_scale_mode(scaler_t *sc, ScaleMode mode) {
+    sc->mode = mode;
+    sc->src_w = 0;
+}
+
 static void (*__error_callback)(WindowError, const char *, const char *, const char *, int) = NULL;
 
 void SetWindowErrorCallback(void (*cb)(WindowError, const char *, const char *, const char *, int)) {
@@ -141,3 +707,190 @@ static void ThrowWindowError(WindowError type, const char *file, const char *fun
         return;
     }
 }
+
+#if defined(WINDOW_PRESENTER)
+#if defined(WINDOW_WINDOWS)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+typedef HANDLE thread_t;
+typedef CRITICAL_SECTION mutex_t;
+typedef CONDITION_VARIABLE cond_t;
+#define mutex_init(m) InitializeCriticalSection(m)
+#define mutex_destroy(m) DeleteCriticalSection(m)
+#define mutex_lock(m) EnterCriticalSection(m)
+#define mutex_unlock(m) LeaveCriticalSection(m)
+#define cond_init(c) InitializeConditionVariable(c)
+#define cond_destroy(c)
+#define cond_wait(c, m) SleepConditionVariableCS(c, m, INFINITE)
+#define cond_signal(c) WakeConditionVariable(c)
+#define cond_broadcast(c) WakeAllConditionVariable(c)
+#else
+#include <pthread.h>
+typedef pthread_t thread_t;
+typedef pthread_mutex_t mutex_t;
+typedef pthread_cond_t cond_t;
+#define mutex_init(m) pthread_mutex_init(m, NULL)
+#define mutex_destroy(m) pthread_mutex_destroy(m)
+#define mutex_lock(m) pthread_mutex_lock(m)
+#define mutex_unlock(m) pthread_mutex_unlock(m)
+#define cond_init(c) pthread_cond_init(c, NULL)
+#define cond_destroy(c) pthread_cond_destroy(c)
+#define cond_wait(c, m) pthread_cond_wait(c, m)
+#define cond_signal(c) pthread_cond_signal(c)
+#define cond_broadcast(c) pthread_cond_broadcast(c)
+#endif
+
+#define MAX_PRESENT_FRAMES 8
+
+// Frame queue drained by a presenter thread. A slot is free, queued, or owned by whoever is filling or showing it
+typedef struct {
+    PresentPolicy policy;
+    thread_t thread;
+    mutex_t lock, busy;
+    cond_t queued, freed;
+    Surface frames[MAX_PRESENT_FRAMES];
+    int count, queue[MAX_PRESENT_FRAMES], head, length, free[MAX_PRESENT_FRAMES], free_count;
+    bool quit;
+    void (*present)(void *userdata, Surface *frame);
+    void *userdata;
+} presenter_t;
+
+static void presenter_loop(presenter_t *p) {
+    mutex_lock(&p->lock);
+    for (;;) {
+        while (!p->length && !p->quit)
+            cond_wait(&p->queued, &p->lock);
+        if (!p->length)
+            break;
+        int i = p->queue[p->head];
+        p->head = (p->head + 1) % p->count;
+        p->length--;
+        mutex_unlock(&p->lock);
+
+        mutex_lock(&p->busy);
+        p->present(p->userdata, &p->frames[i]);
+        mutex_unlock(&p->busy);
+
+        mutex_lock(&p->lock);
+        p->free[p->free_count++] = i;
+        cond_broadcast(&p->freed);
+    }
+    mutex_unlock(&p->lock);
+}
+
+#if defined(WINDOW_WINDOWS)
+static DWORD WINAPI presenter_thread(LPVOID arg) {
+    presenter_loop((presenter_t*)arg);
+    return 0;
+}
+#else
+static void *presenter_thread(void *arg) {
+    presenter_loop((presenter_t*)arg);
+    return NULL;
+}
+#endif
+
+// Queued frames are shown before the thread exits
+static void stop_presenter(presenter_t *p) {
+    if (p->policy == PRESENT_SYNC)
+        return;
+    mutex_lock(&p->lock);
+    p->quit = true;
+    cond_signal(&p->queued);
+    mutex_unlock(&p->lock);
+#if defined(WINDOW_WINDOWS)
+    WaitForSingleObject(p->thread, INFINITE);
+    CloseHandle(p->thread);
+#else
+    pthread_join(p->thread, NULL);
+#endif
+    for (int i = 0; i < MAX_PRESENT_FRAMES; ++i)
+        if (p->frames[i].buf)
+            DestroySurface(&p->frames[i]);
+    mutex_destroy(&p->lock);
+    mutex_destroy(&p->busy);
+    cond_destroy(&p->queued);
+    cond_destroy(&p->freed);
+    p->policy = PRESENT_SYNC;
+}
+
+static bool start_presenter(presenter_t *p, PresentPolicy policy, int frames, void (*present)(void*, Surface*), void *userdata) {
+    stop_presenter(p);
+    if (policy == PRESENT_SYNC)
+        return true;
+    if (policy != PRESENT_DROP_OLDEST && policy != PRESENT_BLOCK) {
+        WINDOW_ERROR(INVALID_PARAMETERS, "Unknown present policy: %d", policy);
+        return false;
+    }
+    if (frames < 2 || frames > MAX_PRESENT_FRAMES) {
+        WINDOW_ERROR(INVALID_PARAMETERS, "Presenter needs 2 to %d frames, not %d", MAX_PRESENT_FRAMES, frames);
+        return false;
+    }
+    memset(p, 0, sizeof(presenter_t));
+    p->count = p->free_count = frames;
+    for (int i = 0; i < frames; ++i)
+        p->free[i] = i;
+    p->present = present;
+    p->userdata = userdata;
+    mutex_init(&p->lock);
+    mutex_init(&p->busy);
+    cond_init(&p->queued);
+    cond_init(&p->freed);
+#if defined(WINDOW_WINDOWS)
+    bool ok = (p->thread = CreateThread(NULL, 0, presenter_thread, p, 0, NULL)) != NULL;
+#else
+    bool ok = !pthread_create(&p->thread, NULL, presenter_thread, p);
+#endif
+    if (!ok) {
+        mutex_destroy(&p->lock);
+        mutex_destroy(&p->busy);
+        cond_destroy(&p->queued);
+        cond_destroy(&p->freed);
+        WINDOW_ERROR(UNKNOWN_ERROR, "Failed to start presenter thread");
+        return false;
+    }
+    p->policy = policy;
+    return true;
+}
+
+// Copy a frame into a free slot and queue it
+static bool queue_frame(presenter_t *p, Surface *b) {
+    mutex_lock(&p->lock);
+    while (!p->free_count) {
+        if (p->policy == PRESENT_DROP_OLDEST && p->length) {
+            p->free[p->free_count++] = p->queue[p->head];
+            p->head = (p->head + 1) % p->count;
+            p->length--;
+            break;
+        }
+        cond_wait(&p->freed, &p->lock);
+    }
+    int i = p->free[--p->free_count];
+    mutex_unlock(&p->lock);
+
+    Surface *f = &p->frames[i];
+    bool ok = f->buf && f->w == b->w && f->h == b->h ? true : f->buf ? ReuseSurface(f, b->w, b->h) : NewSurface(f, b->w, b->h);
+    if (ok)
+        memcpy(f->buf, b->buf, (size_t)b->w * b->h * sizeof(int));
+
+    mutex_lock(&p->lock);
+    if (ok) {
+        p->queue[(p->head + p->length++) % p->count] = i;
+        cond_signal(&p->queued);
+    } else
+        p->free[p->free_count++] = i;
+    mutex_unlock(&p->lock);
+    return ok;
+}
+
+// Held around anything the presenter thread reads, e.g. resizing the window's buffers
+static void lock_presenter(presenter_t *p) {
+    if (p->policy != PRESENT_SYNC)
+        mutex_lock(&p->busy);
+}
+
+static void unlock_presenter(presenter_t *p) {
+    if (p->policy != PRESENT_SYNC)
+        mutex_unlock(&p->busy);
+}
+#endif
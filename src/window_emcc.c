@@ -1,3 +1,4 @@
+#define WINDOW_KEYCODES
 #include "window-private.c"
 #if !defined(WINDOW_CANVAS_NAME)
 #if defined(WINDOW_CANVAS_ID)
@@ -8,8 +9,13 @@
 #define WINDOW_CANVAS_ID "#" WINDOW_CANVAS_NAME
 #include <emscripten.h>
 #include <emscripten/html5.h>
+#include "convert.h"
 
 static Window *e_window = NULL;
+static Surface expanded;
+static backbuffers_t back;
+static unsigned char *rgba = NULL;
+static size_t rgba_size = 0;
 static int window_w, window_h, canvas_w, canvas_h, canvas_x, canvas_y, cursor_x, cursor_y;
 static bool mouse_in_canvas = true, fullscreen = false;
 
@@ -26,7 +32,7 @@ static EM_BOOL key_callback(int type, const EmscriptenKeyboardEvent *e, void *us
   static Key sym;
   mod = translate_mod(e->ctrlKey, e->shiftKey, e->altKey, e->metaKey);
   sym = translate_key(e->keyCode);
-  CBCALL(keyboard_callback, sym, mod, (type == EMSCRIPTEN_EVENT_KEYDOWN));
+  CBCALL(Keyboard_callback, sym, mod, (type == EMSCRIPTEN_EVENT_KEYDOWN));
 
   switch (sym) {
     case KB_KEY_R: // Reload
@@ -59,17 +65,17 @@ static EM_BOOL mouse_callback(int type, const EmscriptenMouseEvent *e, void *use
   switch (type) {
     case EMSCRIPTEN_EVENT_MOUSEDOWN:
       if (mouse_in_canvas && e->buttons != 0)
-        CBCALL(mouse_button_callback, (Button)(e->Button + 1), translate_mod(e->ctrlKey, e->shiftKey, e->altKey, e->metaKey), true);
+        CBCALL(MouseButton_callback, (Button)(e->Button + 1), translate_mod(e->ctrlKey, e->shiftKey, e->altKey, e->metaKey), true);
       break;
     case EMSCRIPTEN_EVENT_MOUSEUP:
       if (mouse_in_canvas)
-        CBCALL(mouse_button_callback, (Button)(e->Button + 1), translate_mod(e->ctrlKey, e->shiftKey, e->altKey, e->metaKey), false);
+        CBCALL(MouseButton_callback, (Button)(e->Button + 1), translate_mod(e->ctrlKey, e->shiftKey, e->altKey, e->metaKey), false);
       break;
     case EMSCRIPTEN_EVENT_MOUSEMOVE:
       cursor_x = e->clientX;
       cursor_y = e->clientY;
       if (mouse_in_canvas)
-        CBCALL(mouse_move_callback, e->clientX, e->clientY, e->movementX, e->movementY);
+        CBCALL(MouseMove_callback, e->clientX, e->clientY, e->movementX, e->movementY);
       break;
     case EMSCRIPTEN_EVENT_MOUSEENTER:
       mouse_in_canvas = true;
@@ -88,7 +94,7 @@ static EM_BOOL mouse_callback(int type, const EmscriptenMouseEvent *e, void *use
 static EM_BOOL wheel_callback(int type, const EmscriptenWheelEvent *e, void *user_data) {
   if (!mouse_in_canvas)
     return false;
-  CBCALL(scroll_callback, translate_mod(e->mouse.ctrlKey, e->mouse.shiftKey, e->mouse.altKey, e->mouse.metaKey), e->deltaX, e->deltaY);
+  CBCALL(Scroll_callback, translate_mod(e->mouse.ctrlKey, e->mouse.shiftKey, e->mouse.altKey, e->mouse.metaKey), e->deltaX, e->deltaY);
   return true;
 }
 
@@ -110,7 +116,7 @@ static EM_BOOL uievent_callback(int type, const EmscriptenUiEvent *e, void *user
 }
 
 static EM_BOOL focusevent_callback(int type, const EmscriptenFocusEvent *e, void *user_data) {
-  CBCALL(focus_callback, (type == EMSCRIPTEN_EVENT_FOCUS));
+  CBCALL(Focus_callback, (type == EMSCRIPTEN_EVENT_FOCUS));
   return true;
 }
 
@@ -311,6 +317,7 @@ bool NewWindow(Window *s, const char *t, int w, int h, short flags) {
   }
   uievent_callback(0, NULL, NULL);
   
+  s->events = NULL;
   e_window = s;
   return true;
 }
@@ -340,6 +347,7 @@ void GetScreenSize(Window *_, int *w, int *h) {
 }
 
 void DestroyWindow(Window *s) {
+  destroy_event_queue(s);
   memset(s, 0, sizeof(Window));
 }
 
@@ -483,36 +491,80 @@ void PollEvents(void) {
 #endif
 }
 
+// The browser owns the event loop, so there's nothing to block on
+void WaitEvents(void) {
+  PollEvents();
+}
+
+bool WaitEventsTimeout(int ms) {
+  PollEvents();
+  return false;
+}
+
+int GetEventFd(Window *_) {
+  return -1;
+}
+
 void Flush(Window *_, Surface *b) {
+  if (!(b = flush_surface(b, &expanded)))
+    return;
+  size_t sz = (size_t)b->w * b->h * 4;
+  if (sz > rgba_size) {
+    unsigned char *tmp = WINDOW_REALLOC(rgba, sz);
+    if (!tmp)
+      return;
+    rgba = tmp;
+    rgba_size = sz;
+  }
+  ConvertPixels(b->buf, PIXEL_ARGB32, rgba, PIXEL_RGBX8888, (size_t)b->w * b->h);
   EM_ASM({
     var w = $0;
     var h = $1;
-    var buf = $2;
-    var src = buf >> 2;
     var canvas = document.getElementById("canvas");
     var ctx = canvas.getContext("2d");
     var img = ctx.createImageData(w, h);
-    var data = img.data;
-    
-    var i = 0;
-    var j = data.length;
-    while (i < j) {
-      var val = HEAP32[src];
-      data[i  ] = (val >> 16) & 0xFF;
-      data[i+1] = (val >> 8) & 0xFF;
-      data[i+2] = val & 0xFF;
-      data[i+3] = 0xFF;
-      src++;
-      i += 4;
-    }
-
+    img.data.set(HEAPU8.subarray($2, $2 + w * h * 4));
     ctx.putImageData(img, 0, 0);
 #if defined(WINDOW_DEBUG) && defined(WINDOW_EMCC_HTML)
     stats.end();
 #endif
-  }, b->w, b->h, b->buf);
+  }, b->w, b->h, rgba);
+}
+
+void FlushRects(Window *s, Surface *b, SurfaceRect *rects, int count) {
+  if (count)
+    Flush(s, b);
+}
+
+Surface *LockBackbuffer(Window *s) {
+  return lock_backbuffer(&back, s->w, s->h);
+}
+
+// The canvas needs RGBA bytes, so presenting still converts the buffer
+void Present(Window *s) {
+  Surface *b = present_backbuffer(&back);
+  if (b)
+    Flush(s, b);
+}
+
+// The canvas is sized to the surface, so there's nothing to fit
+bool SetWindowScaleMode(Window *_, ScaleMode mode) {
+  return mode == SCALE_STRETCH;
+}
+
+bool SetBackbufferCount(Window *_, int n) {
+  return set_backbuffer_count(&back, n);
+}
+
+// The canvas can only be drawn to from the main thread
+bool SetWindowPresenter(Window *_, PresentPolicy policy, int __) {
+  return policy == PRESENT_SYNC;
 }
 
 void CloseAllWindows(void) {
-  return;
+  if (expanded.buf)
+    DestroySurface(&expanded);
+  destroy_backbuffers(&back);
+  WINDOW_SAFE_FREE(rgba);
+  rgba_size = 0;
 }
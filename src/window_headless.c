@@ -0,0 +1,817 @@
+#define WINDOW_PRESENTER
+#include "window-private.c"
+#include "headless.h"
+#include "convert.h"
+#include <errno.h>
+#if defined(WINDOW_WINDOWS)
+#include <windows.h>
+#include <io.h>
+#define write _write
+#else
+#include <poll.h>
+#include <fcntl.h>
+#endif
+
+#define __MIN(a, b) (((a) < (b)) ? (a) : (b))
+
+unsigned long long TimerTicks(void) {
+#if defined(WINDOW_WINDOWS)
+  LARGE_INTEGER ticks;
+  QueryPerformanceCounter(&ticks);
+  return (unsigned long long)ticks.QuadPart;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+unsigned long long TimerFrequency(void) {
+#if defined(WINDOW_WINDOWS)
+  LARGE_INTEGER freq;
+  QueryPerformanceFrequency(&freq);
+  return (unsigned long long)freq.QuadPart;
+#else
+  return 1000000000ull;
+#endif
+}
+
+typedef enum {
+  INPUT_KEYBOARD,
+  INPUT_MOUSE_BUTTON,
+  INPUT_MOUSE_MOVE,
+  INPUT_SCROLL,
+  INPUT_FOCUS,
+  INPUT_RESIZE,
+  INPUT_CLOSE
+} input_type_t;
+
+struct input_t {
+  input_type_t type;
+  unsigned long frame;
+  int a, b, mod;
+  float dx, dy;
+  bool down;
+};
+
+struct headless_window_t {
+  Surface fb, expanded;
+  scaler_t scaler;
+  backbuffers_t back;
+  presenter_t presenter;
+  bool closed;
+  unsigned long frames, input_frame;
+  struct input_t *input;
+  size_t input_count, input_cap;
+  int cursor_lx, cursor_ly;
+  unsigned long wake_frame;
+  bool wake_armed;
+  void(*frame_cb)(void*, Window*, Surface*, unsigned long);
+  void *frame_ud;
+  int frame_fd;
+  PixelFormat frame_format;
+  char *converted;
+  size_t converted_size;
+  Window *parent;
+};
+
+LINKEDLIST(window, struct headless_window_t);
+static struct window_node_t *windows = NULL;
+static int next_id = 1, cursor_x = 0, cursor_y = 0;
+#if !defined(WINDOW_WINDOWS)
+// Self-pipe that becomes readable when queued input falls due, for WaitEvents and GetEventFd
+static int wake_fds[2] = { -1, -1 };
+#endif
+
+static void open_wake_pipe(void) {
+#if !defined(WINDOW_WINDOWS)
+  if (wake_fds[0] >= 0)
+    return;
+  if (pipe(wake_fds)) {
+    wake_fds[0] = wake_fds[1] = -1;
+    return;
+  }
+  for (int i = 0; i < 2; ++i) {
+    fcntl(wake_fds[i], F_SETFL, fcntl(wake_fds[i], F_GETFL) | O_NONBLOCK);
+    fcntl(wake_fds[i], F_SETFD, FD_CLOEXEC);
+  }
+#endif
+}
+
+static void close_wake_pipe(void) {
+#if !defined(WINDOW_WINDOWS)
+  for (int i = 0; i < 2; ++i)
+    if (wake_fds[i] >= 0) {
+      close(wake_fds[i]);
+      wake_fds[i] = -1;
+    }
+#endif
+}
+
+// A full pipe is already readable, so a failed write loses nothing
+static void wake_waiters(void) {
+#if !defined(WINDOW_WINDOWS)
+  if (wake_fds[1] >= 0)
+    (void)!write(wake_fds[1], "", 1);
+#endif
+}
+
+static void drain_wake_pipe(void) {
+#if !defined(WINDOW_WINDOWS)
+  char buf[64];
+  if (wake_fds[0] >= 0)
+    while (read(wake_fds[0], buf, sizeof(buf)) > 0);
+#endif
+}
+
+// Wake waiters now if the head of the input queue is due, or when the frame count reaches it. Called with the presenter locked
+static void arm_wake(struct headless_window_t *win) {
+  win->wake_armed = false;
+  if (!win->input_count)
+    return;
+  if (win->input[0].frame <= win->frames)
+    wake_waiters();
+  else {
+    win->wake_frame = win->input[0].frame;
+    win->wake_armed = true;
+  }
+}
+
+static void close_headless_window(struct headless_window_t *w) {
+  if (w->closed)
+    return;
+  stop_presenter(&w->presenter);
+  w->closed = true;
+  if (w->fb.buf)
+    DestroySurface(&w->fb);
+  if (w->expanded.buf)
+    DestroySurface(&w->expanded);
+  destroy_backbuffers(&w->back);
+  destroy_scaler(&w->scaler);
+  WINDOW_SAFE_FREE(w->input);
+  WINDOW_SAFE_FREE(w->converted);
+  w->input_count = w->input_cap = 0;
+}
+
+bool NewWindow(Window *s, const char *t, int w, int h, short flags) {
+  if (flags & FULLSCREEN || flags & FULLSCREEN_DESKTOP) {
+    w = WINDOW_HEADLESS_SCREEN_W;
+    h = WINDOW_HEADLESS_SCREEN_H;
+  }
+  if (w <= 0 || h <= 0) {
+    WINDOW_ERROR(INVALID_PARAMETERS, "Invalid window size: %dx%d", w, h);
+    return false;
+  }
+
+  struct headless_window_t *win_data = WINDOW_MALLOC(sizeof(struct headless_window_t));
+  if (!win_data) {
+    WINDOW_ERROR(OUT_OF_MEMEORY, "malloc() failed");
+    return false;
+  }
+  memset(win_data, 0, sizeof(struct headless_window_t));
+  if (!NewSurface(&win_data->fb, w, h)) {
+    WINDOW_FREE(win_data);
+    WINDOW_ERROR(OUT_OF_MEMEORY, "NewSurface() failed");
+    return false;
+  }
+  win_data->frame_fd = -1;
+
+  // Opened before any presenter thread can write to it
+  open_wake_pipe();
+  windows = window_push(windows, win_data);
+  s->w = w;
+  s->h = h;
+  s->id = next_id++;
+  s->window = win_data;
+  s->events = NULL;
+  win_data->parent = s;
+  return true;
+}
+
+void SetWindowIcon(Window *s, Surface *b) {
+  return;
+}
+
+void SetWindowTitle(Window *s, const char *t) {
+  return;
+}
+
+void GetWindowPosition(Window *s, int *x, int *y) {
+  if (x)
+    *x = 0;
+  if (y)
+    *y = 0;
+}
+
+void GetScreenSize(Window *s, int *w, int *h) {
+  if (w)
+    *w = WINDOW_HEADLESS_SCREEN_W;
+  if (h)
+    *h = WINDOW_HEADLESS_SCREEN_H;
+}
+
+void DestroyWindow(Window *s) {
+  struct headless_window_t *win = (struct headless_window_t*)s->window;
+  destroy_event_queue(s);
+  if (!win)
+    return;
+  close_headless_window(win);
+  windows = window_pop(windows, win);
+  WINDOW_SAFE_FREE(win);
+  s->window = NULL;
+}
+
+bool IsWindowClosed(Window *s) {
+  return !s->window || ((struct headless_window_t*)s->window)->closed;
+}
+
+bool AreWindowsClosed(int n, ...) {
+  va_list args;
+  va_start(args, n);
+  bool ret = true;
+  for (int i = 0; i < n; ++i)
+    if (!IsWindowClosed(va_arg(args, Window*))) {
+      ret = false;
+      break;
+    }
+  va_end(args);
+  return ret;
+}
+
+bool AreAllWindowsClosed(void) {
+  return windows == NULL;
+}
+
+void SetCursorLock(Window *s, bool locked) {
+  return;
+}
+
+void SetCursorVisiblity(Window *s, bool show) {
+  return;
+}
+
+void SetCursorIcon(Window *s, Cursor t) {
+  return;
+}
+
+void SetCustomCursorIcon(Window *s, Surface *b) {
+  return;
+}
+
+void GetCursorPosition(int *x, int *y) {
+  if (x)
+    *x = cursor_x;
+  if (y)
+    *y = cursor_y;
+}
+
+void SetCursorPosition(int x, int y) {
+  cursor_x = x;
+  cursor_y = y;
+}
+
+static bool push_input(Window *s, struct input_t *in) {
+  struct headless_window_t *win = (struct headless_window_t*)s->window;
+  if (!win || win->closed)
+    return false;
+  if (win->input_count == win->input_cap) {
+    size_t cap = win->input_cap ? win->input_cap * 2 : 64;
+    struct input_t *tmp = WINDOW_REALLOC(win->input, cap * sizeof(struct input_t));
+    if (!tmp) {
+      WINDOW_ERROR(OUT_OF_MEMEORY, "realloc() failed");
+      return false;
+    }
+    win->input = tmp;
+    win->input_cap = cap;
+  }
+  in->frame = win->input_frame;
+  win->input[win->input_count++] = *in;
+  lock_presenter(&win->presenter);
+  arm_wake(win);
+  unlock_presenter(&win->presenter);
+  return true;
+}
+
+void SetInputFrame(Window *s, unsigned long frame) {
+  struct headless_window_t *win = (struct headless_window_t*)s->window;
+  if (win)
+    win->input_frame = frame;
+}
+
+void InjectKeyboard(Window *s, Key key, Mod mod, bool down) {
+  struct input_t in = { .type = INPUT_KEYBOARD, .a = key, .mod = mod, .down = down };
+  push_input(s, &in);
+}
+
+void InjectMouseButton(Window *s, Button button, Mod mod, bool down) {
+  struct input_t in = { .type = INPUT_MOUSE_BUTTON, .a = button, .mod = mod, .down = down };
+  push_input(s, &in);
+}
+
+void InjectMouseMove(Window *s, int x, int y) {
+  struct input_t in = { .type = INPUT_MOUSE_MOVE, .a = x, .b = y };
+  push_input(s, &in);
+}
+
+void InjectScroll(Window *s, Mod mod, float dx, float dy) {
+  struct input_t in = { .type = INPUT_SCROLL, .mod = mod, .dx = dx, .dy = dy };
+  push_input(s, &in);
+}
+
+void InjectFocus(Window *s, bool focused) {
+  struct input_t in = { .type = INPUT_FOCUS, .down = focused };
+  push_input(s, &in);
+}
+
+void InjectResize(Window *s, int w, int h) {
+  struct input_t in = { .type = INPUT_RESIZE, .a = w, .b = h };
+  push_input(s, &in);
+}
+
+void InjectClose(Window *s) {
+  struct input_t in = { .type = INPUT_CLOSE };
+  push_input(s, &in);
+}
+
+static const struct {
+  const char *name;
+  Key key;
+} key_names[] = {
+  { "space", KB_KEY_SPACE }, { "apostrophe", KB_KEY_APOSTROPHE }, { "comma", KB_KEY_COMMA },
+  { "minus", KB_KEY_MINUS }, { "period", KB_KEY_PERIOD }, { "slash", KB_KEY_SLASH },
+  { "semicolon", KB_KEY_SEMICOLON }, { "equals", KB_KEY_EQUALS }, { "lbracket", KB_KEY_LEFT_BRACKET },
+  { "backslash", KB_KEY_BACKSLASH }, { "rbracket", KB_KEY_RIGHT_BRACKET }, { "grave", KB_KEY_GRAVE_ACCENT },
+  { "escape", KB_KEY_ESCAPE }, { "enter", KB_KEY_ENTER }, { "tab", KB_KEY_TAB },
+  { "backspace", KB_KEY_BACKSPACE }, { "insert", KB_KEY_INSERT }, { "delete", KB_KEY_DELETE },
+  { "right", KB_KEY_RIGHT }, { "left", KB_KEY_LEFT }, { "down", KB_KEY_DOWN }, { "up", KB_KEY_UP },
+  { "pageup", KB_KEY_PAGE_UP }, { "pagedown", KB_KEY_PAGE_DOWN }, { "home", KB_KEY_HOME }, { "end", KB_KEY_END },
+  { "capslock", KB_KEY_CAPS_LOCK }, { "scrolllock", KB_KEY_SCROLL_LOCK }, { "numlock", KB_KEY_NUM_LOCK },
+  { "printscreen", KB_KEY_PRINT_SCREEN }, { "pause", KB_KEY_PAUSE },
+  { "lshift", KB_KEY_LEFT_SHIFT }, { "lctrl", KB_KEY_LEFT_CONTROL }, { "lalt", KB_KEY_LEFT_ALT }, { "lsuper", KB_KEY_LEFT_SUPER },
+  { "rshift", KB_KEY_RIGHT_SHIFT }, { "rctrl", KB_KEY_RIGHT_CONTROL }, { "ralt", KB_KEY_RIGHT_ALT }, { "rsuper", KB_KEY_RIGHT_SUPER },
+  { "menu", KB_KEY_MENU }
+};
+
+static bool parse_key(const char *s, Key *out) {
+  char *end;
+  int n;
+  if (!s[1] && isalnum((unsigned char)s[0])) {
+    *out = (Key)toupper((unsigned char)s[0]);
+    return true;
+  }
+  if (tolower((unsigned char)s[0]) == 'f' && (n = (int)strtol(s + 1, &end, 10)) >= 1 && n <= 25 && !*end) {
+    *out = (Key)(KB_KEY_F1 + n - 1);
+    return true;
+  }
+  for (size_t i = 0; i < sizeof(key_names) / sizeof(key_names[0]); ++i)
+    if (!strcmp(s, key_names[i].name)) {
+      *out = key_names[i].key;
+      return true;
+    }
+  n = (int)strtol(s, &end, 10);
+  if (*end || n < 0 || n > (int)KB_KEY_LAST)
+    return false;
+  *out = (Key)n;
+  return true;
+}
+
+static bool parse_mod(char *s, Mod *out) {
+  static const char *names[] = { "shift", "ctrl", "alt", "super", "caps", "num" };
+  int mod = 0;
+  for (char *tok = strtok(s, "+"); tok; tok = strtok(NULL, "+")) {
+    size_t i = 0;
+    while (i < sizeof(names) / sizeof(names[0]) && strcmp(tok, names[i]))
+      ++i;
+    if (i == sizeof(names) / sizeof(names[0]))
+      return false;
+    mod |= 1 << i;
+  }
+  *out = (Mod)mod;
+  return true;
+}
+
+static bool parse_state(const char *s, bool *down) {
+  if (!strcmp(s, "down") || !strcmp(s, "in"))
+    *down = true;
+  else if (!strcmp(s, "up") || !strcmp(s, "out"))
+    *down = false;
+  else
+    return false;
+  return true;
+}
+
+static bool parse_input_line(Window *s, char *line) {
+  char cmd[16], a[32], b[32], c[64];
+  int n, x, y;
+  float dx, dy;
+  bool down;
+  Key key;
+  Mod mod = 0;
+  if ((n = sscanf(line, "%15s %31s %31s %63s", cmd, a, b, c)) < 1)
+    return true;
+  if (!strcmp(cmd, "frame")) {
+    unsigned long frame;
+    if (n != 2 || sscanf(a, "%lu", &frame) != 1)
+      return false;
+    SetInputFrame(s, frame);
+  } else if (!strcmp(cmd, "key")) {
+    if (n < 3 || !parse_key(a, &key) || !parse_state(b, &down) || (n == 4 && !parse_mod(c, &mod)))
+      return false;
+    InjectKeyboard(s, key, mod, down);
+  } else if (!strcmp(cmd, "button")) {
+    Button button;
+    if (!strcmp(a, "left"))
+      button = MOUSE_LEFT;
+    else if (!strcmp(a, "right"))
+      button = MOUSE_RIGHT;
+    else if (!strcmp(a, "middle"))
+      button = MOUSE_MIDDLE;
+    else if (sscanf(a, "%d", &x) == 1 && x >= 0 && x <= (int)MOUSE_LAST)
+      button = (Button)x;
+    else
+      return false;
+    if (n < 3 || !parse_state(b, &down) || (n == 4 && !parse_mod(c, &mod)))
+      return false;
+    InjectMouseButton(s, button, mod, down);
+  } else if (!strcmp(cmd, "move")) {
+    if (n != 3 || sscanf(a, "%d", &x) != 1 || sscanf(b, "%d", &y) != 1)
+      return false;
+    InjectMouseMove(s, x, y);
+  } else if (!strcmp(cmd, "scroll")) {
+    if (n < 3 || sscanf(a, "%f", &dx) != 1 || sscanf(b, "%f", &dy) != 1 || (n == 4 && !parse_mod(c, &mod)))
+      return false;
+    InjectScroll(s, mod, dx, dy);
+  } else if (!strcmp(cmd, "focus")) {
+    if (n != 2 || !parse_state(a, &down))
+      return false;
+    InjectFocus(s, down);
+  } else if (!strcmp(cmd, "resize")) {
+    if (n != 3 || sscanf(a, "%d", &x) != 1 || sscanf(b, "%d", &y) != 1 || x <= 0 || y <= 0)
+      return false;
+    InjectResize(s, x, y);
+  } else if (!strcmp(cmd, "close")) {
+    if (n != 1)
+      return false;
+    InjectClose(s);
+  } else
+    return false;
+  return true;
+}
+
+bool InjectInputScript(Window *s, const char *script) {
+  struct headless_window_t *win = (struct headless_window_t*)s->window;
+  if (!win || win->closed || !script)
+    return false;
+  size_t queued = win->input_count;
+  unsigned long frame = win->input_frame;
+  char line[256];
+  for (int ln = 1; *script; ++ln) {
+    size_t len = strcspn(script, "\n");
+    if (len >= sizeof(line)) {
+      WINDOW_ERROR(INVALID_PARAMETERS, "Input script line %d is too long", ln);
+      goto fail;
+    }
+    memcpy(line, script, len);
+    line[len] = '\0';
+    line[strcspn(line, "#\r")] = '\0';
+    script += len + (script[len] == '\n');
+    if (!parse_input_line(s, line)) {
+      WINDOW_ERROR(INVALID_PARAMETERS, "Input script line %d: \"%s\"", ln, line);
+      goto fail;
+    }
+  }
+  return true;
+fail:
+  win->input_count = queued;
+  win->input_frame = frame;
+  return false;
+}
+
+static void deliver_input(Window *e_window, struct headless_window_t *e_data, struct input_t *in) {
+  switch (in->type) {
+    case INPUT_KEYBOARD:
+      CBCALL(Keyboard_callback, (Key)in->a, (Mod)in->mod, in->down);
+      break;
+    case INPUT_MOUSE_BUTTON:
+      CBCALL(MouseButton_callback, (Button)in->a, (Mod)in->mod, in->down);
+      break;
+    case INPUT_MOUSE_MOVE: {
+      int dx = in->a - e_data->cursor_lx, dy = in->b - e_data->cursor_ly;
+      e_data->cursor_lx = cursor_x = in->a;
+      e_data->cursor_ly = cursor_y = in->b;
+      CBCALL(MouseMove_callback, in->a, in->b, dx, dy);
+      break;
+    }
+    case INPUT_SCROLL:
+      CBCALL(Scroll_callback, (Mod)in->mod, in->dx, in->dy);
+      break;
+    case INPUT_FOCUS:
+      CBCALL(Focus_callback, in->down);
+      break;
+    case INPUT_RESIZE:
+      if (e_window->w == in->a && e_window->h == in->b)
+        break;
+      lock_presenter(&e_data->presenter);
+      if (!ReuseSurface(&e_data->fb, in->a, in->b)) {
+        unlock_presenter(&e_data->presenter);
+        WINDOW_ERROR(OUT_OF_MEMEORY, "ReuseSurface() failed");
+        break;
+      }
+      e_window->w = in->a;
+      e_window->h = in->b;
+      unlock_presenter(&e_data->presenter);
+      CBCALL(Resize_callback, in->a, in->b);
+      break;
+    case INPUT_CLOSE:
+      // Stays listed until DestroyWindow or CloseAllWindows frees it
+      close_headless_window(e_data);
+      window_closed(e_window);
+      break;
+  }
+}
+
+void PollEvents(void) {
+  struct window_node_t *cursor = windows, *next;
+  drain_wake_pipe();
+  while (cursor) {
+    // Callbacks may close this window or queue more input, so re-read everything after each one
+    next = cursor->next;
+    struct headless_window_t *e_data = cursor->data;
+    Window *e_window = e_data->parent;
+    size_t i = 0;
+    // The presenter thread counts frames
+    lock_presenter(&e_data->presenter);
+    unsigned long frames = e_data->frames;
+    unlock_presenter(&e_data->presenter);
+    while (!e_data->closed && i < e_data->input_count && e_data->input[i].frame <= frames) {
+      struct input_t in = e_data->input[i++];
+      deliver_input(e_window, e_data, &in);
+    }
+    if (!e_data->closed && i) {
+      memmove(e_data->input, e_data->input + i, (e_data->input_count - i) * sizeof(struct input_t));
+      e_data->input_count -= i;
+      lock_presenter(&e_data->presenter);
+      arm_wake(e_data);
+      unlock_presenter(&e_data->presenter);
+    }
+    cursor = next;
+  }
+}
+
+static bool input_due(void) {
+  for (struct window_node_t *cursor = windows; cursor; cursor = cursor->next) {
+    struct headless_window_t *win = cursor->data;
+    if (win->closed || !win->input_count)
+      continue;
+    lock_presenter(&win->presenter);
+    bool due = win->input[0].frame <= win->frames;
+    unlock_presenter(&win->presenter);
+    if (due)
+      return true;
+  }
+  return false;
+}
+
+static void sleep_ms(int ms) {
+#if defined(WINDOW_WINDOWS)
+  Sleep(ms);
+#else
+  struct timespec ts = { ms / 1000, (long)(ms % 1000) * 1000000L };
+  nanosleep(&ts, NULL);
+#endif
+}
+
+// Input only falls due when it's injected or a frame is shown, both of which write to the wake pipe. Without one, check back every millisecond
+static bool wait_headless(int ms) {
+  unsigned long long start = TimerTicks(), freq = TimerFrequency();
+  for (;;) {
+    if (input_due())
+      return true;
+    int left = ms;
+    if (ms >= 0) {
+      unsigned long long elapsed = (TimerTicks() - start) * 1000ull / freq;
+      if (elapsed >= (unsigned long long)ms)
+        return false;
+      left = ms - (int)elapsed;
+    }
+#if !defined(WINDOW_WINDOWS)
+    if (wake_fds[0] >= 0) {
+      struct pollfd p = { wake_fds[0], POLLIN, 0 };
+      if (poll(&p, 1, left) > 0)
+        drain_wake_pipe();
+      continue;
+    }
+#endif
+    sleep_ms(left < 0 || left > 1 ? 1 : left);
+  }
+}
+
+void WaitEvents(void) {
+  wait_headless(-1);
+  PollEvents();
+}
+
+bool WaitEventsTimeout(int ms) {
+  bool ready = wait_headless(ms < 0 ? 0 : ms);
+  PollEvents();
+  return ready;
+}
+
+int GetEventFd(Window *s) {
+#if defined(WINDOW_WINDOWS)
+  return -1;
+#else
+  return wake_fds[0];
+#endif
+}
+
+Surface *GetWindowFramebuffer(Window *s) {
+  struct headless_window_t *win = (struct headless_window_t*)s->window;
+  return win && !win->closed ? &win->fb : NULL;
+}
+
+unsigned long GetWindowFrameCount(Window *s) {
+  struct headless_window_t *win = (struct headless_window_t*)s->window;
+  if (!win)
+    return 0;
+  lock_presenter(&win->presenter);
+  unsigned long frames = win->frames;
+  unlock_presenter(&win->presenter);
+  return frames;
+}
+
+void SetWindowFrameCallback(Window *s, void(*cb)(void*, Window*, Surface*, unsigned long), void *userdata) {
+  struct headless_window_t *win = (struct headless_window_t*)s->window;
+  if (!win)
+    return;
+  win->frame_cb = cb;
+  win->frame_ud = userdata;
+}
+
+bool SetWindowFrameFd(Window *s, int fd, PixelFormat format) {
+  struct headless_window_t *win = (struct headless_window_t*)s->window;
+  if (!win || format < 0 || format >= PIXEL_FORMAT_COUNT)
+    return false;
+  win->frame_fd = fd;
+  win->frame_format = format;
+  return true;
+}
+
+static bool write_all(int fd, const char *p, size_t n) {
+  while (n) {
+    long r = (long)write(fd, p, (unsigned)__MIN(n, 1u << 30));
+    if (r < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    p += r;
+    n -= (size_t)r;
+  }
+  return true;
+}
+
+static void write_frame(struct headless_window_t *win) {
+  Surface *fb = &win->fb;
+  const char *data = (const char*)fb->buf;
+  size_t pitch = (size_t)fb->w * PixelFormatSize(win->frame_format), size = pitch * fb->h;
+  if (win->frame_format != PIXEL_ARGB32) {
+    if (win->converted_size < size) {
+      char *tmp = WINDOW_REALLOC(win->converted, size);
+      if (!tmp) {
+        WINDOW_ERROR(OUT_OF_MEMEORY, "realloc() failed");
+        return;
+      }
+      win->converted = tmp;
+      win->converted_size = size;
+    }
+    ConvertPixelRows(fb->buf, fb->w * 4, PIXEL_ARGB32, win->converted, pitch, win->frame_format, fb->w, fb->h);
+    data = win->converted;
+  }
+  if (!write_all(win->frame_fd, data, size)) {
+    WINDOW_ERROR(UNKNOWN_ERROR, "Writing frame %lu failed: %s", win->frames, strerror(errno));
+    win->frame_fd = -1;
+  }
+}
+
+static void emit_frame(Window *s, struct headless_window_t *win) {
+  unsigned long index = win->frames++;
+  if (win->wake_armed && win->frames >= win->wake_frame) {
+    win->wake_armed = false;
+    wake_waiters();
+  }
+  if (win->frame_fd >= 0)
+    write_frame(win);
+  if (win->frame_cb)
+    win->frame_cb(win->frame_ud, s, &win->fb, index);
+}
+
+static void show_frame(Window *s, struct headless_window_t *win, Surface *b) {
+  if (b->w == win->fb.w && b->h == win->fb.h)
+    memcpy(win->fb.buf, b->buf, (size_t)b->w * b->h * sizeof(int));
+  else if (set_scaler_layout(&win->scaler, b->w, b->h, win->fb.w, win->fb.h))
+    scale_rows(&win->scaler, b, win->fb.buf, win->fb.w);
+  emit_frame(s, win);
+}
+
+void Flush(Window *s, Surface *b) {
+  if (!s)
+    return;
+  struct headless_window_t *win = (struct headless_window_t*)s->window;
+  if (!win || win->closed)
+    return;
+  if (!(b = flush_surface(b, &win->expanded)))
+    return;
+  if (win->presenter.policy != PRESENT_SYNC)
+    queue_frame(&win->presenter, b);
+  else
+    show_frame(s, win, b);
+}
+
+void FlushRects(Window *s, Surface *b, SurfaceRect *rects, int count) {
+  if (!s || !b)
+    return;
+  struct headless_window_t *win = (struct headless_window_t*)s->window;
+  if (!win || win->closed)
+    return;
+  if (win->presenter.policy != PRESENT_SYNC || b->w != win->fb.w || b->h != win->fb.h) {
+    Flush(s, b);
+    return;
+  }
+  SurfaceRect damage[MAX_DAMAGE_RECTS];
+  int n = coalesce_damage(rects, count, b->w, b->h, damage);
+  if (!n || !(b = flush_surface(b, &win->expanded)))
+    return;
+  if (n < 0) {
+    show_frame(s, win, b);
+    return;
+  }
+  for (int i = 0; i < n; ++i)
+    for (int y = damage[i].y; y < damage[i].y + damage[i].h; ++y)
+      memcpy(win->fb.buf + y * b->w + damage[i].x, b->buf + y * b->w + damage[i].x, (size_t)damage[i].w * sizeof(int));
+  emit_frame(s, win);
+}
+
+static void present_frame(void *userdata, Surface *b) {
+  Window *s = (Window*)userdata;
+  show_frame(s, (struct headless_window_t*)s->window, b);
+}
+
+bool SetWindowScaleMode(Window *s, ScaleMode mode) {
+  struct headless_window_t *win = (struct headless_window_t*)s->window;
+  if (!win || win->closed)
+    return false;
+  lock_presenter(&win->presenter);
+  set_scale_mode(&win->scaler, mode);
+  unlock_presenter(&win->presenter);
+  return true;
+}
+
+bool SetWindowPresenter(Window *s, PresentPolicy policy, int frames) {
+  struct headless_window_t *win = (struct headless_window_t*)s->window;
+  return win && !win->closed && start_presenter(&win->presenter, policy, frames, present_frame, s);
+}
+
+Surface *LockBackbuffer(Window *s) {
+  struct headless_window_t *win = (struct headless_window_t*)s->window;
+  if (!win || win->closed)
+    return NULL;
+  return lock_backbuffer(&win->back, s->w, s->h);
+}
+
+void Present(Window *s) {
+  struct headless_window_t *win = (struct headless_window_t*)s->window;
+  if (!win || win->closed)
+    return;
+  Surface *b = present_backbuffer(&win->back), tmp;
+  if (!b)
+    return;
+  if (b->w != win->fb.w || b->h != win->fb.h || win->presenter.policy != PRESENT_SYNC) {
+    Flush(s, b);
+    return;
+  }
+  // The presented buffer becomes the framebuffer and the old framebuffer goes back in the swap chain
+  tmp = win->fb;
+  win->fb = *b;
+  *b = tmp;
+  emit_frame(s, win);
+}
+
+bool SetBackbufferCount(Window *s, int n) {
+  struct headless_window_t *win = (struct headless_window_t*)s->window;
+  return win && !win->closed && set_backbuffer_count(&win->back, n);
+}
+
+void CloseAllWindows(void) {
+  struct window_node_t *tmp = NULL, *cursor = windows;
+  while (cursor) {
+    tmp = cursor->next;
+    close_headless_window(cursor->data);
+    cursor->data->parent->window = NULL;
+    WINDOW_SAFE_FREE(cursor->data);
+    WINDOW_SAFE_FREE(cursor);
+    cursor = tmp;
+  }
+  windows = NULL;
+  close_wake_pipe();
+}
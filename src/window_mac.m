@@ -25,7 +25,10 @@
  * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#define WINDOW_MAP
+#define WINDOW_KEYCODES
 #include "window-private.c"
+#include "convert.h"
 #include <Cocoa/Cocoa.h>
 #include <mach/mach_time.h>
 
@@ -103,20 +106,13 @@ static inline NSImage *create_cocoa_image(Surface *s) {
   if (!nsbir)
     return nil;
   
-  char *rgba = WINDOW_MALLOC(s->w * s->h * 4);
-  int offset = 0, c;
-  for(int i = 0; i < s->h; ++i) {
-    for (int j = 0; j < s->w; j++) {
-      c = GetPixel(s, j, i);
-      rgba[4 * offset]     = r_channel(c);
-      rgba[4 * offset + 1] = g_channel(c);
-      rgba[4 * offset + 2] = b_channel(c);
-      rgba[4 * offset + 3] = a_channel(c);
-      offset++;
-    }
-  }
-  memcpy([nsbir bitmapData], rgba, s->w * s->h * sizeof(char) * 4);
-  WINDOW_SAFE_FREE(rgba);
+  Surface expanded = {0};
+  Surface *argb = flush_surface(s, &expanded);
+  if (!argb)
+    return nil;
+  ConvertPixelRows(argb->buf, argb->w * 4, PIXEL_ARGB32, [nsbir bitmapData], [nsbir bytesPerRow], PIXEL_RGBA8888, argb->w, argb->h);
+  if (expanded.buf)
+    DestroySurface(&expanded);
   
   [nsi addRepresentation:nsbir];
   return nsi;
@@ -124,7 +120,10 @@ static inline NSImage *create_cocoa_image(Surface *s) {
 
 @protocol AppViewDelegate;
 
-@interface AppView : NSView
+@interface AppView : NSView {
+  Surface expanded;
+  backbuffers_t back;
+}
 @property (nonatomic, strong) id<AppViewDelegate> delegate;
 @property (strong) NSTrackingArea *track;
 @property (atomic) Surface *buffer;
@@ -132,6 +131,7 @@ static inline NSImage *create_cocoa_image(Surface *s) {
 @property (nonatomic, strong) NSCursor *cursor;
 @property BOOL custom_cursor;
 @property BOOL cursor_vis;
+@property ScaleMode scale_mode;
 @end
 
 @implementation AppView
@@ -142,6 +142,7 @@ static inline NSImage *create_cocoa_image(Surface *s) {
 @synthesize cursor = _cursor;
 @synthesize custom_cursor = _custom_cursor;
 @synthesize cursor_vis = _cursor_vis;
+@synthesize scale_mode = _scale_mode;
 
 -(id)initWithFrame:(NSRect)frameRect {
   _mouse_in_window = NO;
@@ -175,6 +176,14 @@ static inline NSImage *create_cocoa_image(Surface *s) {
   [super updateTrackingAreas];
 }
 
+-(Surface*)expanded {
+  return &expanded;
+}
+
+-(backbuffers_t*)backbuffers {
+  return &back;
+}
+
 -(BOOL)acceptsFirstResponder {
   return YES;
 }
@@ -282,7 +291,14 @@ static inline NSImage *create_cocoa_image(Surface *s) {
    Not the whole line though, just the `[self frame]` parts. This has caused me an issue for over a month.
    `CGContextDrawImage(ctx, CGRectMake(0, 0, [self frame].size.width, [self frame].size.height), img);` */
   CGSize wh = [self frame].size;
-  CGContextDrawImage(ctx, CGRectMake(0, 0, wh.width, wh.height), img);
+  int k;
+  SurfaceRect v = scale_view(_scale_mode, _buffer->w, _buffer->h, (int)wh.width, (int)wh.height, &k);
+  if (v.w != (int)wh.width || v.h != (int)wh.height) {
+    CGContextSetRGBFillColor(ctx, 0, 0, 0, 1);
+    CGContextFillRect(ctx, CGRectMake(0, 0, wh.width, wh.height));
+  }
+  // Core Graphics puts the origin at the bottom left
+  CGContextDrawImage(ctx, CGRectMake(v.x, wh.height - v.y - v.h, v.w, v.h), img);
   CGColorSpaceRelease(s);
   CGDataProviderRelease(p);
   CGImageRelease(img);
@@ -290,6 +306,9 @@ static inline NSImage *create_cocoa_image(Surface *s) {
 
 -(void)dealloc {
   [_track release];
+  if (expanded.buf)
+    DestroySurface(&expanded);
+  destroy_backbuffers(&back);
   if (_custom_cursor && _cursor)
     [_cursor release];
 #pragma clang diagnostic push
@@ -315,6 +334,7 @@ struct osx_window_t {
 
 LINKEDLIST(window, struct osx_window_t);
 static struct window_node_t *windows = NULL;
+static window_map_t window_map = {0};
 
 @implementation AppDelegate
 @synthesize window = _window;
@@ -396,8 +416,7 @@ static struct window_node_t *windows = NULL;
 
 -(void)windowWillClose:(NSNotification*)notification {
   _closed = YES;
-  if (_parent->Closed_callback)
-    _parent->Closed_callback(_parent->parent);
+  window_closed(_parent);
   [[self view] dealloc];
   
   struct window_node_t *head = windows, *cursor = windows, *prev = NULL;
@@ -415,6 +434,7 @@ static struct window_node_t *windows = NULL;
     break;
   }
   if (cursor) {
+    window_map_remove(&window_map, (uintptr_t)cursor->data->window_id);
     cursor->next = NULL;
     WINDOW_FREE(cursor);
   }
@@ -574,9 +594,12 @@ bool NewWindow(Window *s, const char *t, int w, int h, short flags) {
   }
   
   struct osx_window_t *win_data = WINDOW_MALLOC(sizeof(struct osx_window_t));
+  if (!win_data) {
+    WINDOW_ERROR(OUT_OF_MEMEORY, "malloc() failed");
+    goto FAILED;
+  }
   win_data->delegate = app;
   win_data->window_id = [[app window] windowNumber];
-  windows = window_push(windows, win_data);
   
   memset(s, 0, sizeof(Window));
   s->id = (int)[[app window] windowNumber];
@@ -584,10 +607,24 @@ bool NewWindow(Window *s, const char *t, int w, int h, short flags) {
   s->h  = h;
   s->window = (void*)app;
   [app setParent:s];
+  // Only listed once it can be looked up, so a failure leaves nothing behind
+  if (!window_map_put(&window_map, (uintptr_t)win_data->window_id, s)) {
+    WINDOW_ERROR(OUT_OF_MEMEORY, "window_map_put() failed");
+    goto FAILED;
+  }
+  windows = window_push(windows, win_data);
   
   [NSApp activateIgnoringOtherApps:YES];
   [pool drain];
   return true;
+
+FAILED:
+  [[app view] dealloc];
+  [app dealloc];
+  WINDOW_SAFE_FREE(win_data);
+  memset(s, 0, sizeof(Window));
+  [pool drain];
+  return false;
 }
 
 #define SET_DEFAULT_APP_ICON [NSApp setApplicationIconImage:[NSImage imageNamed:@"NSApplicationIcon"]]
@@ -633,8 +670,10 @@ void GetScreenSize(Window *s, int *w, int *h) {
 void DestroyWindow(Window *s) {
   NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
   AppDelegate *app = (AppDelegate*)s->window;
+  window_map_remove(&window_map, (uintptr_t)s->id);
   [[app view] dealloc];
   [app dealloc];
+  destroy_event_queue(s);
   memset(s, 0, sizeof(Window));
   [pool drain];
 }
@@ -709,16 +748,6 @@ void SetCursorPosition(int x, int y) {
   CGWarpMouseCursorPosition((CGPoint){ x, y });
 }
 
-Window *event_delegate(NSInteger window_id) {
-  struct window_node_t *cursor = windows;
-  while (cursor) {
-    if (cursor->data->window_id == window_id)
-      return [cursor->data->delegate parent];
-    cursor = cursor->next;
-  }
-  return NULL;
-}
-
 void PollEvents() {
   NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
   NSEvent *e = nil;
@@ -726,7 +755,7 @@ void PollEvents() {
                                  untilDate:[NSDate distantPast]
                                     inMode:NSDefaultRunLoopMode
                                    dequeue:YES])) {
-    Window *e_window = event_delegate([e windowNumber]);
+    Window *e_window = window_map_get(&window_map, (uintptr_t)[e windowNumber]);
     if (!e_window) {
       [NSApp sendEvent:e];
       continue;
@@ -767,14 +796,84 @@ void PollEvents() {
   [pool release];
 }
 
+// Peek without dequeuing, PollEvents handles the event
+static bool wait_mac(NSDate *until) {
+  NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+  bool ready = [NSApp nextEventMatchingMask:NSEventMaskAny
+                                  untilDate:until
+                                     inMode:NSDefaultRunLoopMode
+                                    dequeue:NO] != nil;
+  [pool release];
+  return ready;
+}
+
+void WaitEvents(void) {
+  wait_mac([NSDate distantFuture]);
+  PollEvents();
+}
+
+bool WaitEventsTimeout(int ms) {
+  bool ready = wait_mac([NSDate dateWithTimeIntervalSinceNow:(ms < 0 ? 0 : ms) / 1000.0]);
+  PollEvents();
+  return ready;
+}
+
+int GetEventFd(Window *s) {
+  return -1;
+}
+
 void Flush(Window *s, Surface *b) {
   if (!s)
     return;
   AppDelegate *tmp = (AppDelegate*)s->window;
   if (!tmp)
     return;
-  [tmp view].buffer = b;
+  Surface *out = flush_surface(b, [[tmp view] expanded]);
+  if (!out)
+    return;
+  [tmp view].buffer = out;
+  [[tmp view] setNeedsDisplay:YES];
+}
+
+void FlushRects(Window *s, Surface *b, SurfaceRect *rects, int count) {
+  if (count)
+    Flush(s, b);
+}
+
+Surface *LockBackbuffer(Window *s) {
+  AppDelegate *tmp = (AppDelegate*)s->window;
+  if (!tmp)
+    return NULL;
+  return lock_backbuffer([[tmp view] backbuffers], s->w, s->h);
+}
+
+void Present(Window *s) {
+  AppDelegate *tmp = (AppDelegate*)s->window;
+  if (!tmp)
+    return;
+  // drawRect: reads straight from the buffer, so this doesn't copy it
+  Surface *b = present_backbuffer([[tmp view] backbuffers]);
+  if (b)
+    Flush(s, b);
+}
+
+bool SetWindowScaleMode(Window *s, ScaleMode mode) {
+  AppDelegate *tmp = (AppDelegate*)s->window;
+  if (!tmp)
+    return false;
+  [tmp view].scale_mode = mode;
   [[tmp view] setNeedsDisplay:YES];
+  return true;
+}
+
+bool SetBackbufferCount(Window *s, int n) {
+  AppDelegate *tmp = (AppDelegate*)s->window;
+  return tmp && set_backbuffer_count([[tmp view] backbuffers], n);
+}
+
+// Flush only marks the view for redrawing, AppKit draws it later on the main thread
+bool SetWindowPresenter(Window *s, PresentPolicy policy, int frames) {
+  return policy == PRESENT_SYNC;
 }
 
 void CloseAllWindows() {
@@ -786,5 +885,7 @@ void CloseAllWindows() {
     WINDOW_SAFE_FREE(cursor);
     cursor = tmp;
   }
+  windows = NULL;
+  window_map_clear(&window_map);
   [NSApp terminate:nil];
 }
@@ -1,3 +1,4 @@
+#define WINDOW_KEYCODES
 #include "window-private.c"
 #define NOMINMAX
 #define WIN32_LEAN_AND_MEAN
@@ -13,7 +14,9 @@ struct win32_window_t {
   HCURSOR cursor;
   int cursor_lx, cursor_ly;
   bool mouse_inside, cursor_vis, cursor_locked, closed, refresh_tme, custom_icon, custom_cursor;
-  Surface *buffer;
+  Surface *buffer, expanded;
+  backbuffers_t back;
+  ScaleMode scale_mode;
 };
 
 static void close_win32_window(struct win32_window_t *window) {
@@ -25,6 +28,9 @@ static void close_win32_window(struct win32_window_t *window) {
   if (!window->cursor_vis)
     ShowCursor(TRUE);
   WINDOW_FREE(window->bmpinfo);
+  if (window->expanded.buf)
+    DestroySurface(&window->expanded);
+  destroy_backbuffers(&window->back);
   if (window->custom_icon && window->icon)
     DeleteObject(window->icon);
   if (window->custom_cursor && window->cursor)
@@ -96,21 +102,30 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
   e_data = (struct win32_window_t*)e_window->window;
   
   switch (message) {
-    case WM_PAINT:
+    case WM_PAINT: {
       if (!e_data->buffer)
         break;
+      int k;
+      SurfaceRect v = scale_view(e_data->scale_mode, e_data->buffer->w, e_data->buffer->h, e_window->w, e_window->h, &k);
+      // Black out the bars around a letterboxed frame
+      if (v.w != e_window->w || v.h != e_window->h) {
+        PatBlt(e_data->hdc, 0, 0, e_window->w, v.y, BLACKNESS);
+        PatBlt(e_data->hdc, 0, v.y + v.h, e_window->w, e_window->h - v.y - v.h, BLACKNESS);
+        PatBlt(e_data->hdc, 0, v.y, v.x, v.h, BLACKNESS);
+        PatBlt(e_data->hdc, v.x + v.w, v.y, e_window->w - v.x - v.w, v.h, BLACKNESS);
+      }
       e_data->bmpinfo->bmiHeader.biWidth = e_data->buffer->w;
       e_data->bmpinfo->bmiHeader.biHeight = -e_data->buffer->h;
-      StretchDIBits(e_data->hdc, 0, 0, e_window->w, e_window->h, 0, 0, e_data->buffer->w, e_data->buffer->h, e_data->buffer->buf, e_data->bmpinfo, DIB_RGB_COLORS, SRCCOPY);
+      StretchDIBits(e_data->hdc, v.x, v.y, v.w, v.h, 0, 0, e_data->buffer->w, e_data->buffer->h, e_data->buffer->buf, e_data->bmpinfo, DIB_RGB_COLORS, SRCCOPY);
       ValidateRect(hWnd, NULL);
       break;
+    }
     case WM_DESTROY:
     case WM_CLOSE:
       close_win32_window(e_data);
       windows = window_pop(windows, e_data);
       e_data->closed = true;
-      if (e_window && e_window->closed_callback)
-        e_window->closed_callback(e_window->parent);
+      window_closed(e_window);
       break;
     case WM_KEYDOWN:
     case WM_SYSKEYDOWN:
@@ -124,11 +139,11 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
       if (kb_key == KB_KEY_UNKNOWN)
         break;
       if (!kb_action && wParam == VK_SHIFT) {
-        CBCALL(keyboard_callback, KB_KEY_LEFT_SHIFT, translate_mod(), kb_action);
+        CBCALL(Keyboard_callback, KB_KEY_LEFT_SHIFT, translate_mod(), kb_action);
       } else if (wParam == VK_SNAPSHOT) {
-        CBCALL(keyboard_callback, kb_key, translate_mod(), false);
+        CBCALL(Keyboard_callback, kb_key, translate_mod(), false);
       } else {
-        CBCALL(keyboard_callback, kb_key, translate_mod(), kb_action);
+        CBCALL(Keyboard_callback, kb_key, translate_mod(), kb_action);
       }
       break;
     }
@@ -177,14 +192,14 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
         if (message == WM_XBUTTONDOWN)
           m_action = 1;
       }
-      CBCALL(mouse_button_callback, (Button)m_button, translate_mod(), m_action);
+      CBCALL(MouseButton_callback, (Button)m_button, translate_mod(), m_action);
       break;
     }
     case WM_MOUSEWHEEL:
-      CBCALL(scroll_callback, translate_mod(), 0.f, (SHORT)HIWORD(wParam) / (float)WHEEL_DELTA);
+      CBCALL(Scroll_callback, translate_mod(), 0.f, (SHORT)HIWORD(wParam) / (float)WHEEL_DELTA);
       break;
     case WM_MOUSEHWHEEL:
-      CBCALL(scroll_callback, translate_mod(), -((SHORT)HIWORD(wParam) / (float)WHEEL_DELTA), 0.f);
+      CBCALL(Scroll_callback, translate_mod(), -((SHORT)HIWORD(wParam) / (float)WHEEL_DELTA), 0.f);
       break;
     case WM_MOUSEMOVE: {
       if (e_data->refresh_tme) {
@@ -197,7 +212,7 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
       static int cx, cy;
       cx = ((int)(short)LOWORD(lParam));
       cy = ((int)(short)HIWORD(lParam));
-      CBCALL(mouse_move_callback, cx, cy, cx - e_data->cursor_lx, cy - e_data->cursor_ly);
+      CBCALL(MouseMove_callback, cx, cy, cx - e_data->cursor_lx, cy - e_data->cursor_ly);
       e_data->cursor_lx = cx;
       e_data->cursor_ly = cy;
       break;
@@ -220,17 +235,17 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
     case WM_SIZE:
       e_window->w = LOWORD(lParam);
       e_window->h = HIWORD(lParam);
-      CBCALL(resize_callback, e_window->w, e_window->h);
+      CBCALL(Resize_callback, e_window->w, e_window->h);
       break;
     case WM_SETFOCUS:
       if (e_data->cursor_locked)
         clip_win32_cursor(e_data->hwnd);
-      CBCALL(focus_callback, true);
+      CBCALL(Focus_callback, true);
       break;
     case WM_KILLFOCUS:
       if (e_data->cursor_locked)
         ClipCursor(NULL);
-      CBCALL(focus_callback, false);
+      CBCALL(Focus_callback, false);
       break;
     default:
       break;
@@ -379,6 +394,7 @@ bool NewWindow(Window *s, const char *t, int w, int h, short flags) {
     WINDOW_ERROR(OUT_OF_MEMEORY, "malloc() failed");
     return false;
   }
+  memset(win_data, 0, sizeof(struct win32_window_t));
 
   RECT rect = {0};
   long WindowFlag = WS_OVERLAPPED | WS_CAPTION | WS_SYSMENU | WS_MINIMIZEBOX | WS_MAXIMIZEBOX;
@@ -506,6 +522,7 @@ bool NewWindow(Window *s, const char *t, int w, int h, short flags) {
   s->h = rect.bottom;
   s->id = window_id++;
   s->window = win_data;
+  s->events = NULL;
 
   return true;
 }
@@ -568,6 +585,7 @@ void DestroyWindow(Window *s) {
   struct win32_window_t *win = (struct win32_window_t*)s->window;
   close_win32_window(win);
   WINDOW_SAFE_FREE(win);
+  destroy_event_queue(s);
   s->window = NULL;
 }
 
@@ -713,17 +731,74 @@ void PollEvents() {
   }
 }
 
+void WaitEvents(void) {
+  WaitMessage();
+  PollEvents();
+}
+
+bool WaitEventsTimeout(int ms) {
+  bool ready = MsgWaitForMultipleObjects(0, NULL, FALSE, ms < 0 ? 0 : (DWORD)ms, QS_ALLINPUT) == WAIT_OBJECT_0;
+  PollEvents();
+  return ready;
+}
+
+// Windows has no descriptor for the message queue
+int GetEventFd(Window *s) {
+  return -1;
+}
+
 void Flush(Window *s, Surface *b) {
   if (!s)
     return;
   struct win32_window_t *tmp = (struct win32_window_t*)s->window;
   if (!tmp || tmp->closed)
     return;
-  tmp->buffer = b;
+  if (!(tmp->buffer = flush_surface(b, &tmp->expanded)))
+    return;
   InvalidateRect(tmp->hwnd, NULL, TRUE);
   SendMessage(tmp->hwnd, WM_PAINT, 0, 0);
 }
 
+void FlushRects(Window *s, Surface *b, SurfaceRect *rects, int count) {
+  if (count)
+    Flush(s, b);
+}
+
+Surface *LockBackbuffer(Window *s) {
+  struct win32_window_t *tmp = (struct win32_window_t*)s->window;
+  if (!tmp || tmp->closed)
+    return NULL;
+  return lock_backbuffer(&tmp->back, s->w, s->h);
+}
+
+void Present(Window *s) {
+  struct win32_window_t *tmp = (struct win32_window_t*)s->window;
+  if (!tmp || tmp->closed)
+    return;
+  // WM_PAINT blits straight from the buffer, so this doesn't copy it
+  Surface *b = present_backbuffer(&tmp->back);
+  if (b)
+    Flush(s, b);
+}
+
+bool SetWindowScaleMode(Window *s, ScaleMode mode) {
+  struct win32_window_t *tmp = (struct win32_window_t*)s->window;
+  if (!tmp || tmp->closed)
+    return false;
+  tmp->scale_mode = mode;
+  return true;
+}
+
+bool SetBackbufferCount(Window *s, int n) {
+  struct win32_window_t *tmp = (struct win32_window_t*)s->window;
+  return tmp && !tmp->closed && set_backbuffer_count(&tmp->back, n);
+}
+
+// Painting has to happen on the thread that owns the window
+bool SetWindowPresenter(Window *s, PresentPolicy policy, int frames) {
+  return policy == PRESENT_SYNC;
+}
+
 void CloseAllWindows() {
   struct window_node_t *tmp = NULL, *cursor = windows;
   while (cursor) {
@@ -1,4 +1,13 @@
+#define WINDOW_PRESENTER
+#define WINDOW_MAP
+#define WINDOW_SCALE_FRAME
+#define WINDOW_KEYCODES
+#include "window-private.c"
+#include "convert.h"
 #pragma message WARN("TODO: X11 support not yet fully implemented")
+// Xlib's Window and Cursor types collide with ours, so they are renamed while the headers are parsed
+#define Window X11Window
+#define Cursor X11Cursor
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
 #include <X11/XKBlib.h>
@@ -9,36 +18,300 @@
 #if defined(WINDOW_HAS_X11VMEXT)
 #include <X11/extensions/xf86vmode.h>
 #endif
+// MIT-SHM needs -lXext, define WINDOW_NO_XSHM to build without it
+#if !defined(WINDOW_NO_XSHM)
+#include <X11/extensions/XShm.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#endif
+#undef Window
+#undef Cursor
+#include <poll.h>
+#include <errno.h>
+
+unsigned long long TimerTicks(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+unsigned long long TimerFrequency(void) {
+  return 1000000000ull;
+}
 
 static Display *display = None;
 static int screen = None;
-static Window root_window = None;
-static Cursor empty_cursor = None;
+static X11Window root_window = None;
+static X11Cursor empty_cursor = None;
+static window_map_t window_map = {0};
+#if !defined(WINDOW_NO_XSHM)
+static bool shm_available = false, shm_error = false;
+static int shm_completion = 0;
+#endif
+
+// An XImage, backed by a shared memory segment when MIT-SHM is available. It's put through the connection it was made on
+struct nix_image_t {
+  XImage *img;
+  Display *dpy;
+#if !defined(WINDOW_NO_XSHM)
+  XShmSegmentInfo shm;
+  bool use_shm, pending;
+  size_t size;
+#endif
+};
 
 struct nix_window_t {
-  Window window;
+  X11Window window;
   Atom wm_del;
-  GC gc;
-  XImage *img;
-  Cursor cursor;
+  Display *dpy;
+  struct nix_image_t image, back_img[MAX_BACKBUFFERS];
+  backbuffers_t back;
+  presenter_t presenter;
+  X11Cursor cursor;
   bool mouse_inside, cursor_locked, cursor_vis, closed;
-  int depth, cursor_lx, cursor_ly;
-  Surface scaler;
+  int depth, bpp, cursor_lx, cursor_ly;
+  PixelFormat format;
+  char *converted;
+  size_t converted_size;
+  Surface expanded;
+  scaler_t scaler;
   Window *parent;
 };
 
+#if !defined(WINDOW_NO_XSHM)
+static Bool is_shm_completion(Display *d, XEvent *e, XPointer arg) {
+  return e->type == shm_completion && ((XShmCompletionEvent*)e)->shmseg == ((struct nix_image_t*)arg)->shm.shmseg;
+}
+
+// The server reads the segment asynchronously, so it can't be touched until the last put completes
+static void wait_image(struct nix_image_t *im) {
+  XEvent e;
+  if (!im->pending)
+    return;
+  XIfEvent(im->dpy, &e, is_shm_completion, (XPointer)im);
+  im->pending = false;
+}
+
+// A presenter's frames complete on its own connection, and the image belongs to its thread
+static void shm_completed(struct nix_window_t *w, XShmCompletionEvent *e) {
+  if (w->presenter.policy == PRESENT_SYNC && w->image.use_shm && w->image.shm.shmseg == e->shmseg)
+    w->image.pending = false;
+  for (int i = 0; i < MAX_BACKBUFFERS; ++i)
+    if (w->back_img[i].use_shm && w->back_img[i].shm.shmseg == e->shmseg)
+      w->back_img[i].pending = false;
+}
+
+static int shm_error_handler(Display *d, XErrorEvent *e) {
+  shm_error = true;
+  return 0;
+}
+
+// XShmAttach fails asynchronously (e.g. on a remote display), so trap the error and sync. The error handler is process wide, so presenter threads take turns
+static bool attach_shm(Display *d, XShmSegmentInfo *shm) {
+  static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+  pthread_mutex_lock(&lock);
+  int (*old)(Display*, XErrorEvent*) = XSetErrorHandler(shm_error_handler);
+  shm_error = false;
+  XShmAttach(d, shm);
+  XSync(d, False);
+  XSetErrorHandler(old);
+  bool ok = !shm_error;
+  pthread_mutex_unlock(&lock);
+  return ok;
+}
+
+// The segment is at least reserve bytes, so a growing window can reuse it
+static bool create_shm_image(struct nix_window_t *w, Display *d, struct nix_image_t *im, int width, int height, size_t reserve) {
+  if (!(im->img = XShmCreateImage(d, DefaultVisual(d, DefaultScreen(d)), w->depth, ZPixmap, NULL, &im->shm, width, height)))
+    return false;
+  im->dpy = d;
+  im->size = (size_t)im->img->bytes_per_line * height;
+  if (im->size < reserve)
+    im->size = reserve;
+  im->shm.shmid = shmget(IPC_PRIVATE, im->size, IPC_CREAT | 0600);
+  if (im->shm.shmid < 0)
+    goto fail;
+  im->shm.shmaddr = im->img->data = shmat(im->shm.shmid, NULL, 0);
+  im->shm.readOnly = False;
+  if (im->shm.shmaddr == (char*)-1) {
+    shmctl(im->shm.shmid, IPC_RMID, NULL);
+    goto fail;
+  }
+  bool attached = attach_shm(d, &im->shm);
+  // Mark the segment for removal now, it lives until both sides detach
+  shmctl(im->shm.shmid, IPC_RMID, NULL);
+  if (!attached) {
+    shm_available = false;
+    shmdt(im->shm.shmaddr);
+    goto fail;
+  }
+  im->use_shm = true;
+  return true;
+fail:
+  im->img->data = NULL;
+  XDestroyImage(im->img);
+  im->img = NULL;
+  return false;
+}
+#endif
+
+static void destroy_nix_image(struct nix_image_t *im) {
+  if (!im->img)
+    return;
+#if !defined(WINDOW_NO_XSHM)
+  if (im->use_shm) {
+    wait_image(im);
+    XShmDetach(im->dpy, &im->shm);
+    im->img->data = NULL;
+    XDestroyImage(im->img);
+    shmdt(im->shm.shmaddr);
+    im->use_shm = false;
+    im->img = NULL;
+    return;
+  }
+#endif
+  im->img->data = NULL;
+  XDestroyImage(im->img);
+  im->img = NULL;
+}
+
+// Backbuffers live in their own shared segments when the visual is ARGB32, so Present is a single XShmPutImage
+static void destroy_nix_backbuffer(void *ctx, int i) {
+  struct nix_window_t *w = (struct nix_window_t*)ctx;
+  if (w->back_img[i].img) {
+    destroy_nix_image(&w->back_img[i]);
+    memset(&w->back.buffers[i], 0, sizeof(Surface));
+  } else if (w->back.buffers[i].buf)
+    DestroySurface(&w->back.buffers[i]);
+}
+
+static bool create_nix_backbuffer(void *ctx, int i, int width, int height) {
+  struct nix_window_t *w = (struct nix_window_t*)ctx;
+#if !defined(WINDOW_NO_XSHM)
+  struct nix_image_t *im = &w->back_img[i];
+  if (shm_available && w->format == PIXEL_ARGB32 && create_shm_image(w, display, im, width, height, 0)) {
+    if (im->img->bytes_per_line == width * 4) {
+      Surface *b = &w->back.buffers[i];
+      memset(b, 0, sizeof(Surface));
+      b->buf = (int*)im->img->data;
+      b->w = width;
+      b->h = height;
+      b->format = SURFACE_ARGB;
+      return true;
+    }
+    destroy_nix_image(im);
+  }
+#endif
+  return NewSurface(&w->back.buffers[i], width, height);
+}
+
+// Frames are uploaded through w->dpy. A presenter thread gets a connection of its own, so its waits never read events meant for the event loop. The window's image is remade on the new connection by the next upload
+static bool set_upload_display(struct nix_window_t *w, bool own) {
+  Display *d = display;
+  if (!own && w->dpy == display)
+    return true;
+  if (own && !(d = XOpenDisplay(DisplayString(display)))) {
+    WINDOW_ERROR(NIX_WINDOW_CREATION_FAILED, "XOpenDisplay() failed");
+    return false;
+  }
+  destroy_nix_image(&w->image);
+  if (w->dpy != display)
+    XCloseDisplay(w->dpy);
+  w->dpy = d;
+  return true;
+}
+
 static void close_nix_window(struct nix_window_t *w) {
   if (w->closed)
     return;
+  stop_presenter(&w->presenter);
   w->closed = true;
-  if (w->scaler.buf)
-    surface_destroy(&w->scaler);
-  w->img->data = NULL;
-  XDestroyImage(w->img);
+  destroy_scaler(&w->scaler);
+  if (w->expanded.buf)
+    DestroySurface(&w->expanded);
+  WINDOW_SAFE_FREE(w->converted);
+  destroy_backbuffers(&w->back);
+  set_upload_display(w, false);
+  destroy_nix_image(&w->image);
+  window_map_remove(&window_map, (uintptr_t)w->window);
   XDestroyWindow(display, w->window);
   XFlush(display);
 }
 
+// Work out which converter layout matches the visual, ARGB32 means no conversion
+static bool visual_pixel_format(Visual *v, int bpp, PixelFormat *out) {
+  static const union { int i; char c; } host = { 1 };
+  bool lsb = ImageByteOrder(display) == LSBFirst, rgb = v->red_mask == 0xFF0000 && v->green_mask == 0xFF00 && v->blue_mask == 0xFF;
+  switch (bpp) {
+    case 32:
+      if (rgb) {
+        *out = lsb == (bool)host.c ? PIXEL_ARGB32 : lsb ? PIXEL_BGRA8888 : PIXEL_ARGB8888;
+        return true;
+      }
+      if (lsb && v->red_mask == 0xFF && v->green_mask == 0xFF00 && v->blue_mask == 0xFF0000) {
+        *out = PIXEL_RGBA8888;
+        return true;
+      }
+      break;
+    case 24:
+      if (rgb) {
+        *out = lsb ? PIXEL_BGR888 : PIXEL_RGB888;
+        return true;
+      }
+      break;
+    case 16:
+      if (lsb == (bool)host.c && v->red_mask == 0xF800 && v->green_mask == 0x07E0 && v->blue_mask == 0x001F) {
+        *out = PIXEL_RGB565;
+        return true;
+      }
+      break;
+  }
+  return false;
+}
+
+// Only runs when the window size has changed since the last upload, so a burst of ConfigureNotify events during a drag rebuilds the image once. The XImage header is cheap to remake, the shared segment and conversion buffer are kept while they're big enough and grow by half again when they aren't
+static bool create_nix_image(struct nix_window_t *w, int width, int height) {
+  struct nix_image_t *im = &w->image;
+#if !defined(WINDOW_NO_XSHM)
+  size_t reserve = 0;
+  if (im->use_shm) {
+    wait_image(im);
+    XImage *img = XShmCreateImage(w->dpy, DefaultVisual(w->dpy, DefaultScreen(w->dpy)), w->depth, ZPixmap, NULL, &im->shm, width, height);
+    if (img && (size_t)img->bytes_per_line * height <= im->size) {
+      img->data = im->shm.shmaddr;
+      im->img->data = NULL;
+      XDestroyImage(im->img);
+      im->img = img;
+      return true;
+    }
+    if (img) {
+      reserve = (size_t)img->bytes_per_line * height;
+      reserve += reserve / 2;
+      XDestroyImage(img);
+    }
+  }
+#endif
+  destroy_nix_image(im);
+#if !defined(WINDOW_NO_XSHM)
+  // Frames are converted straight into the shared segment
+  if (shm_available && create_shm_image(w, w->dpy, im, width, height, reserve))
+    return true;
+#endif
+  if (!(im->img = XCreateImage(w->dpy, DefaultVisual(w->dpy, DefaultScreen(w->dpy)), w->depth, ZPixmap, 0, NULL, width, height, 32, 0)))
+    return false;
+  im->dpy = w->dpy;
+  size_t size = (size_t)im->img->bytes_per_line * height;
+  if (w->format != PIXEL_ARGB32 && size > w->converted_size) {
+    size_t want = w->converted ? size + size / 2 : size;
+    char *tmp = WINDOW_REALLOC(w->converted, want);
+    if (!tmp)
+      return false;
+    w->converted = tmp;
+    w->converted_size = want;
+  }
+  return true;
+}
+
 LINKEDLIST(window, struct nix_window_t);
 static struct window_node_t *windows = NULL;
 
@@ -260,12 +533,12 @@ static int translate_mod_ex(int key, int state, int is_pressed) {
 }
 
 static void get_cursor_pos(int *x, int *y) {
-  Window in_win, in_child_win;
+  X11Window in_win, in_child_win;
   Atom type_prop;
-  int root_x, root_y, child_x, child_y;
-  unsigned int mask, format;
+  int root_x, root_y, child_x, child_y, format;
+  unsigned int mask;
   unsigned long n, sz;
-  Window *props;
+  X11Window *props;
   XGetWindowProperty(display, root_window, XInternAtom(display, "_NET_ACTIVE_WINDOW", True), 0, 1, False, AnyPropertyType, &type_prop, &format, &n, &sz, (unsigned char**)&props);
   XQueryPointer(display, props[0], &in_win, &in_child_win, &root_x, &root_y, &child_x, &child_y, &mask);
   XFree(props);
@@ -285,12 +558,18 @@ struct Hints {
 
 bool NewWindow(Window *s, const char *t, int w, int h, short flags) {
   if (!keycodes_init) {
+    // Presenter threads have connections of their own, but Xlib's global state is still shared
+    XInitThreads();
     if (!(display = XOpenDisplay(NULL))) {
       WINDOW_ERROR(NIX_WINDOW_CREATION_FAILED, "XOpenDisplay() failed");
       return false;
     }
     root_window = DefaultRootWindow(display);
     screen = DefaultScreen(display);
+#if !defined(WINDOW_NO_XSHM)
+    if ((shm_available = XShmQueryExtension(display)))
+      shm_completion = XShmGetEventBase(display) + ShmCompletion;
+#endif
 
     memset(keycodes, -1, sizeof(keycodes));
     for (int i = 0; i < 512; ++i)
@@ -318,6 +597,11 @@ bool NewWindow(Window *s, const char *t, int w, int h, short flags) {
     WINDOW_ERROR(OUT_OF_MEMEORY, "malloc() failed");
     return false;
   }
+  memset(win_data, 0, sizeof(struct nix_window_t));
+  win_data->back.create = create_nix_backbuffer;
+  win_data->back.destroy = destroy_nix_backbuffer;
+  win_data->back.ctx = win_data;
+  win_data->dpy = display;
 
   int screen_w = DisplayWidth(display, screen);
   int screen_h = DisplayHeight(display, screen);
@@ -338,7 +622,7 @@ bool NewWindow(Window *s, const char *t, int w, int h, short flags) {
   int format_c = 0;
   XPixmapFormatValues *formats = XListPixmapFormats(display, &format_c);
   int depth = DefaultDepth(display, screen);
-  int depth_c;
+  int depth_c = 0;
   for (int i = 0; i < format_c; ++i)
     if (depth == formats[i].depth) {
       depth_c = formats[i].bits_per_pixel;
@@ -346,10 +630,12 @@ bool NewWindow(Window *s, const char *t, int w, int h, short flags) {
     }
   XFree(formats);
 
-  if (depth_c != 32) {
-    WINDOW_ERROR(NIX_WINDOW_CREATION_FAILED, "Invalid display depth: %d", depth_c);
+  if (!visual_pixel_format(visual, depth_c, &win_data->format)) {
+    WINDOW_FREE(win_data);
+    WINDOW_ERROR(NIX_WINDOW_CREATION_FAILED, "Unsupported display format: %d bpp", depth_c);
     return false;
   }
+  win_data->bpp = depth_c;
 
   XSetWindowAttributes swa;
   swa.override_redirect = True;
@@ -357,6 +643,7 @@ bool NewWindow(Window *s, const char *t, int w, int h, short flags) {
   swa.background_pixel = BlackPixel(display, screen);
   swa.backing_store = NotUseful;
   if (!(win_data->window = XCreateWindow(display, root_window, x, y, w, h, 0, depth, InputOutput, visual, CWBackPixel | CWBorderPixel | CWBackingStore, &swa))) {
+    WINDOW_FREE(win_data);
     WINDOW_ERROR(NIX_WINDOW_CREATION_FAILED, "XCreateWindow() failed");
     return false;
   }
@@ -420,22 +707,34 @@ bool NewWindow(Window *s, const char *t, int w, int h, short flags) {
   XClearWindow(display, win_data->window);
   XMapRaised(display, win_data->window);
   XFlush(display);
-  win_data->gc = DefaultGC(display, screen);
   win_data->cursor = XCreateFontCursor(display, XC_left_ptr);
   get_cursor_pos(&win_data->cursor_lx, &win_data->cursor_ly);
-  win_data->img = XCreateImage(display, CopyFromParent, depth, ZPixmap, 0, NULL, w, h, 32, w * 4);
   win_data->depth = depth;
-  memset(&win_data->scaler, 0, sizeof(Surface));
+  if (!create_nix_image(win_data, w, h)) {
+    WINDOW_ERROR(OUT_OF_MEMEORY, "XCreateImage() failed");
+    goto FAILED;
+  }
   win_data->closed = false;
 
+  if (!window_map_put(&window_map, (uintptr_t)win_data->window, s)) {
+    WINDOW_ERROR(OUT_OF_MEMEORY, "window_map_put() failed");
+    goto FAILED;
+  }
   windows = window_push(windows, win_data);
   s->w = w;
   s->h = h;
   s->id = (int)win_data->window;
   s->window = win_data;
+  s->events = NULL;
   win_data->parent = s;
 
   return true;
+
+FAILED:
+  XFreeCursor(display, win_data->cursor);
+  close_nix_window(win_data);
+  WINDOW_FREE(win_data);
+  return false;
 }
 
 void SetWindowIcon(Window *w, Surface *b) {
@@ -451,7 +750,7 @@ void GetWindowPosition(Window *w, int *x, int *y) {
   struct nix_window_t *win = (struct nix_window_t*)w->window;
   static int wx, wy;
   static XWindowAttributes xwa;
-  static Window child;
+  static X11Window child;
   XTranslateCoordinates(display, win->window, root_window, 0, 0, &wx, &wy, &child);
   XGetWindowAttributes(display, win->window, &xwa);
   if (x)
@@ -470,7 +769,9 @@ void GetScreenSize(Window *s, int *w, int *h) {
 void DestroyWindow(Window *w) {
   struct nix_window_t *win = (struct nix_window_t*)w->window;
   close_nix_window(win);
+  windows = window_pop(windows, win);
   WINDOW_SAFE_FREE(win);
+  destroy_event_queue(w);
   w->window = NULL;
 }
 
@@ -497,11 +798,11 @@ bool AreAllWindowsClosed() {
   return windows == NULL;
 }
 
-void ToggleCursorLock(Window *w, bool lock) {
+void SetCursorLock(Window *w, bool lock) {
   return;
 }
 
-void ToggleCursorVisiblity(Window *w, bool visible) {
+void SetCursorVisiblity(Window *w, bool visible) {
   return;
 }
 
@@ -521,58 +822,58 @@ void SetCursorPosition(int x, int y) {
   return;
 }
 
-Window *event_window(Window w) {
-  struct window_node_t *cursor = windows;
-  while (cursor) {
-    if (cursor->data->window == w)
-      return cursor->data->parent;
-    cursor = cursor->next;
-  }
-  return NULL;
-}
-
 void PollEvents() {
   static XEvent e;
   static Window *e_window = NULL;
   static struct nix_window_t *e_data = NULL;
   while (XPending(display)) {
     XNextEvent(display, &e);
-    if (!(e_window = event_window(e.xclient.window)))
+    if (!(e_window = window_map_get(&window_map, (uintptr_t)e.xany.window)))
       continue;
     if (!(e_data = (struct nix_window_t*)e_window->window))
       continue;
     if (e_data->closed)
       continue;
+#if !defined(WINDOW_NO_XSHM)
+    if (shm_available && e.type == shm_completion) {
+      shm_completed(e_data, (XShmCompletionEvent*)&e);
+      continue;
+    }
+#endif
     switch (e.type) {
       case KeyPress:
       case KeyRelease: {
         static bool pressed = false;
         pressed = e.type == KeyPress;
-        CBCALL(keyboard_callback, translate_key(e.xkey.keycode), translate_mod_ex(e.xkey.keycode, e.xkey.state, pressed), pressed);
+        CBCALL(Keyboard_callback, translate_key(e.xkey.keycode), translate_mod_ex(e.xkey.keycode, e.xkey.state, pressed), pressed);
         break;
       }
       case ButtonPress:
       case ButtonRelease:
-        switch (e.xbutton.Button) {
+        switch (e.xbutton.button) {
           case Button1:
+            CBCALL(MouseButton_callback, MOUSE_LEFT, translate_mod(e.xkey.state), e.type == ButtonPress);
+            break;
           case Button2:
+            CBCALL(MouseButton_callback, MOUSE_MIDDLE, translate_mod(e.xkey.state), e.type == ButtonPress);
+            break;
           case Button3:
-            CBCALL(mouse_button_callback, (Button)e.xbutton.Button, translate_mod(e.xkey.state), e.type == ButtonPress);
+            CBCALL(MouseButton_callback, MOUSE_RIGHT, translate_mod(e.xkey.state), e.type == ButtonPress);
             break;
           case Button4:
-            CBCALL(scroll_callback, translate_mod(e.xkey.state), 0.f, 1.f);
+            CBCALL(Scroll_callback, translate_mod(e.xkey.state), 0.f, 1.f);
             break;
           case Button5:
-            CBCALL(scroll_callback, translate_mod(e.xkey.state), 0.f, -1.f);
+            CBCALL(Scroll_callback, translate_mod(e.xkey.state), 0.f, -1.f);
             break;
           case Button6:
-            CBCALL(scroll_callback, translate_mod(e.xkey.state), 1.f, 0.f);
+            CBCALL(Scroll_callback, translate_mod(e.xkey.state), 1.f, 0.f);
             break;
           case Button7:
-            CBCALL(scroll_callback, translate_mod(e.xkey.state), -1.f, 0.f);
+            CBCALL(Scroll_callback, translate_mod(e.xkey.state), -1.f, 0.f);
             break;
           default:
-            CBCALL(mouse_button_callback, (Button)(e.xbutton.Button - 4), translate_mod(e.xkey.state), e.type == ButtonPress);
+            CBCALL(MouseButton_callback, (Button)(e.xbutton.button - 4), translate_mod(e.xkey.state), e.type == ButtonPress);
             break;
         }
         break;
@@ -582,17 +883,12 @@ void PollEvents() {
         h = e.xconfigure.height;
         if (e_window->w == w && e_window->h == h)
           break;
-        CBCALL(resize_callback, w, h);
+        CBCALL(Resize_callback, w, h);
+        // The image is rebuilt by the next upload, not for every event of a drag
+        lock_presenter(&e_data->presenter);
         e_window->w = w;
         e_window->h = h;
-        if (e_data->img) {
-          e_data->img->data = NULL;
-          XDestroyImage(e_data->img);
-        }
-        if (e_data->scaler.buf)
-          surface_destroy(&e_data->scaler);
-        e_data->img = XCreateImage(display, CopyFromParent, e_data->depth, ZPixmap, 0, NULL, w, h, 32, w * 4);
-        surface(&e_data->scaler, w, h);
+        unlock_presenter(&e_data->presenter);
         break;
       }
       case EnterNotify:
@@ -601,13 +897,21 @@ void PollEvents() {
         break;
       case FocusIn:
       case FocusOut:
-        CBCALL(focus_callback, e.type == FocusIn);
+        CBCALL(Focus_callback, e.type == FocusIn);
         break;
       case MotionNotify: {
         static int cx = 0, cy = 0;
+        // Skip to the last of a run of motion events, one callback with the whole delta. Anything in between keeps its order
+        while (XPending(display)) {
+          XEvent next;
+          XPeekEvent(display, &next);
+          if (next.type != MotionNotify || next.xmotion.window != e.xmotion.window)
+            break;
+          XNextEvent(display, &e);
+        }
         cx = e.xmotion.x;
         cy = e.xmotion.y;
-        CBCALL(mouse_move_callback, cx, cy, cx - e_data->cursor_lx, cy - e_data->cursor_ly);
+        CBCALL(MouseMove_callback, cx, cy, cx - e_data->cursor_lx, cy - e_data->cursor_ly);
         e_data->cursor_lx = cx;
         e_data->cursor_ly = cy;
         break;
@@ -617,37 +921,233 @@ void PollEvents() {
           break;
         close_nix_window(e_data);
         windows = window_pop(windows, e_data);
-        if (e_window && e_window->closed_callback)
-          e_window->closed_callback(e_window->parent);
+        window_closed(e_window);
         break;
     }
   }
 }
 
+// XPending flushes requests and reads whatever is on the socket first, so poll only sleeps when Xlib's queue is empty
+static bool wait_x11(int ms) {
+  if (!display)
+    return false;
+  if (XPending(display))
+    return true;
+  struct pollfd p = { ConnectionNumber(display), POLLIN, 0 };
+  unsigned long long end = TimerTicks() + (unsigned long long)(ms > 0 ? ms : 0) * 1000000ull;
+  for (;;) {
+    int left = ms;
+    if (ms > 0) {
+      unsigned long long now = TimerTicks();
+      left = now >= end ? 0 : (int)((end - now + 999999) / 1000000);
+    }
+    int r = poll(&p, 1, left);
+    if (r < 0 && errno != EINTR)
+      return false;
+    // Whatever woke us may have been a reply rather than an event
+    if (r > 0 && XPending(display))
+      return true;
+    if (!r)
+      return false;
+  }
+}
+
+void WaitEvents(void) {
+  wait_x11(-1);
+  PollEvents();
+}
+
+bool WaitEventsTimeout(int ms) {
+  bool ready = wait_x11(ms < 0 ? 0 : ms);
+  PollEvents();
+  return ready;
+}
+
+int GetEventFd(Window *s) {
+  return display ? ConnectionNumber(display) : -1;
+}
+
+static void put_nix_image(struct nix_window_t *w, struct nix_image_t *im, SurfaceRect *rects, int count) {
+  GC gc = DefaultGC(im->dpy, DefaultScreen(im->dpy));
+#if !defined(WINDOW_NO_XSHM)
+  if (im->use_shm) {
+    // Requests are handled in order, so only the last put needs to report completion
+    for (int i = 0; i < count; ++i)
+      XShmPutImage(im->dpy, w->window, gc, im->img, rects[i].x, rects[i].y, rects[i].x, rects[i].y, rects[i].w, rects[i].h, i == count - 1);
+    im->pending = true;
+    XFlush(im->dpy);
+    return;
+  }
+#endif
+  for (int i = 0; i < count; ++i)
+    XPutImage(im->dpy, w->window, gc, im->img, rects[i].x, rects[i].y, rects[i].x, rects[i].y, rects[i].w, rects[i].h);
+  XFlush(im->dpy);
+}
+
+static void convert_nix_rects(struct nix_window_t *tmp, Surface *b, char *dst, SurfaceRect *rects, int count) {
+  int pitch = tmp->image.img->bytes_per_line, bytes = tmp->image.img->bits_per_pixel / 8;
+  for (int i = 0; i < count; ++i) {
+    SurfaceRect *r = &rects[i];
+    ConvertPixelRows(b->buf + r->y * b->w + r->x, b->w * 4, PIXEL_ARGB32, dst + r->y * pitch + r->x * bytes, pitch, tmp->format, r->w, r->h);
+  }
+}
+
+// Only the damaged rects are converted and sent, or the whole frame when rects is NULL
+static void upload_nix(Window *w, struct nix_window_t *tmp, Surface *b, SurfaceRect *rects, int count) {
+  SurfaceRect full = {0, 0, w->w, w->h};
+  XImage *img = tmp->image.img;
+  if (!img || img->width != w->w || img->height != w->h) {
+    if (!create_nix_image(tmp, w->w, w->h))
+      return;
+    img = tmp->image.img;
+    rects = NULL;
+  }
+  bool scaled = b->w != w->w || b->h != w->h;
+  if (scaled)
+    rects = NULL;
+  if (!rects) {
+    rects = &full;
+    count = 1;
+  }
+#if !defined(WINDOW_NO_XSHM)
+  if (tmp->image.use_shm) {
+    wait_image(&tmp->image);
+    // An ARGB32 segment can be scaled into directly
+    if (scaled && tmp->format == PIXEL_ARGB32) {
+      if (!set_scaler_layout(&tmp->scaler, b->w, b->h, w->w, w->h))
+        return;
+      scale_rows(&tmp->scaler, b, (int*)img->data, img->bytes_per_line / 4);
+    } else {
+      if (scaled && !(b = scale_frame(&tmp->scaler, b, w->w, w->h)))
+        return;
+      convert_nix_rects(tmp, b, img->data, rects, count);
+    }
+    put_nix_image(tmp, &tmp->image, rects, count);
+    return;
+  }
+#endif
+  if (scaled && !(b = scale_frame(&tmp->scaler, b, w->w, w->h)))
+    return;
+  if (tmp->format == PIXEL_ARGB32)
+    img->data = (char*)b->buf;
+  else {
+    convert_nix_rects(tmp, b, tmp->converted, rects, count);
+    img->data = tmp->converted;
+  }
+  put_nix_image(tmp, &tmp->image, rects, count);
+}
+
 void Flush(Window *w, Surface *b) {
   if (!w)
     return;
   struct nix_window_t *tmp = (struct nix_window_t*)w->window;
   if (!tmp || tmp->closed)
     return;
-  if (b->w != w->w || b->h != w->h) {
-    __resize(b, &tmp->scaler);
-    tmp->img->data = (char*)tmp->scaler.buf;
+  if (!(b = flush_surface(b, &tmp->expanded)))
+    return;
+  if (tmp->presenter.policy != PRESENT_SYNC)
+    queue_frame(&tmp->presenter, b);
+  else
+    upload_nix(w, tmp, b, NULL, 0);
+}
+
+void FlushRects(Window *w, Surface *b, SurfaceRect *rects, int count) {
+  if (!w || !b)
+    return;
+  struct nix_window_t *tmp = (struct nix_window_t*)w->window;
+  if (!tmp || tmp->closed)
+    return;
+  // Queued frames replace each other, so damage can't be tracked across them
+  if (tmp->presenter.policy != PRESENT_SYNC || b->w != w->w || b->h != w->h) {
+    Flush(w, b);
+    return;
+  }
+  SurfaceRect damage[MAX_DAMAGE_RECTS];
+  int n = coalesce_damage(rects, count, w->w, w->h, damage);
+  if (!n || !(b = flush_surface(b, &tmp->expanded)))
+    return;
+  upload_nix(w, tmp, b, n < 0 ? NULL : damage, n);
+}
+
+static void present_nix(void *userdata, Surface *b) {
+  Window *w = (Window*)userdata;
+  upload_nix(w, (struct nix_window_t*)w->window, b, NULL, 0);
+}
+
+bool SetWindowScaleMode(Window *w, ScaleMode mode) {
+  struct nix_window_t *tmp = (struct nix_window_t*)w->window;
+  if (!tmp || tmp->closed)
+    return false;
+  lock_presenter(&tmp->presenter);
+  set_scale_mode(&tmp->scaler, mode);
+  unlock_presenter(&tmp->presenter);
+  return true;
+}
+
+bool SetWindowPresenter(Window *w, PresentPolicy policy, int frames) {
+  struct nix_window_t *tmp = (struct nix_window_t*)w->window;
+  if (!tmp || tmp->closed)
+    return false;
+  stop_presenter(&tmp->presenter);
+#if !defined(WINDOW_NO_XSHM)
+  wait_image(&tmp->image);
+  for (int i = 0; i < MAX_BACKBUFFERS; ++i)
+    wait_image(&tmp->back_img[i]);
+#endif
+  if (!set_upload_display(tmp, policy != PRESENT_SYNC))
+    return false;
+  if (start_presenter(&tmp->presenter, policy, frames, present_nix, w))
+    return true;
+  set_upload_display(tmp, false);
+  return false;
+}
+
+Surface *LockBackbuffer(Window *w) {
+  struct nix_window_t *tmp = (struct nix_window_t*)w->window;
+  if (!tmp || tmp->closed)
+    return NULL;
+  Surface *s = lock_backbuffer(&tmp->back, w->w, w->h);
+#if !defined(WINDOW_NO_XSHM)
+  if (s)
+    wait_image(&tmp->back_img[tmp->back.index]);
+#endif
+  return s;
+}
+
+void Present(Window *w) {
+  struct nix_window_t *tmp = (struct nix_window_t*)w->window;
+  if (!tmp || tmp->closed)
+    return;
+  Surface *s = present_backbuffer(&tmp->back);
+  if (!s)
+    return;
+  struct nix_image_t *im = &tmp->back_img[s - tmp->back.buffers];
+  // Without a shared segment of its own (or after a resize) the buffer goes through Flush, which is still copy free for ARGB32 visuals
+  if (im->img && s->w == w->w && s->h == w->h && tmp->presenter.policy == PRESENT_SYNC) {
+    SurfaceRect full = {0, 0, s->w, s->h};
+    put_nix_image(tmp, im, &full, 1);
   } else
-    tmp->img->data = (char*)b->buf;
-  XPutImage(display, tmp->window, tmp->gc, tmp->img, 0, 0, 0, 0, w->w, w->h);
-  XFlush(display);
+    Flush(w, s);
+}
+
+bool SetBackbufferCount(Window *w, int n) {
+  struct nix_window_t *tmp = (struct nix_window_t*)w->window;
+  if (!tmp || tmp->closed)
+    return false;
+  return set_backbuffer_count(&tmp->back, n);
 }
 
 void CloseAllWindows() {
   struct window_node_t *tmp = NULL, *cursor = windows;
   while (cursor) {
     tmp = cursor->next;
-    close_nix_window(tmp->data);
+    close_nix_window(cursor->data);
     WINDOW_SAFE_FREE(cursor->data);
     WINDOW_SAFE_FREE(cursor);
     cursor = tmp;
   }
+  windows = NULL;
+  window_map_clear(&window_map);
   if (display)
     XCloseDisplay(display);
 }
@@ -0,0 +1,1227 @@
+/* golden.c
+ *
+ * Renders deterministic scenes through the drawing functions in surface.h,
+ * flushes each one through the headless window backend and compares the
+ * presented frame with a reference image. Scenes for the filters, LUTs and
+ * tiled surfaces also check results against scalar references and draw a
+ * green or red square for each check. A frame whose hash matches the one
+ * recorded in reference/hashes.txt passes without decoding the reference,
+ * anything else is diffed against reference/<name>.png and passes if it is
+ * within the scene's tolerance. Failed frames are saved as
+ * reference/<name>.actual.png. Render and flush times are recorded per scene.
+ *
+ * Usage: golden [-u] [-d dir] [-o timings.json] [-f name-filter] [-n runs]
+ *   -u  Write new reference images and hashes instead of comparing
+ */
+
+#include "surface.h"
+#include "image.h"
+#include "hash.h"
+#include "headless.h"
+#include "filter.h"
+#include "lut.h"
+#include "tiled.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+
+#define SIZE 128
+#define MAX_SCENES 64
+#define MAX_RUNS 64
+
+typedef struct {
+    const char *name;
+    void (*draw)(Surface *s, Window *w);
+    /* Surface format and window size, 0 for ARGB and the surface size */
+    SurfaceFormat format;
+    int win_w, win_h;
+    /* Largest channel difference and share of differing pixels allowed */
+    int max_delta;
+    double max_differing;
+} Scene;
+
+typedef struct {
+    const char *name;
+    bool passed, exact;
+    SurfaceMetrics metrics;
+    double render_min, render_p50, flush_min, flush_p50;
+} Result;
+
+static double now_ns(void) {
+    return (double)TimerTicks() * 1e9 / (double)TimerFrequency();
+}
+
+static void gradient(Surface *s, unsigned int alpha) {
+    for (int y = 0; y < s->h; ++y)
+        for (int x = 0; x < s->w; ++x)
+            s->buf[y * s->w + x] = rgba(x * 255 / (s->w - 1), y * 255 / (s->h - 1), (x ^ y) & 0xFF, alpha);
+}
+
+static void checker(Surface *s, int cell) {
+    for (int y = 0; y < s->h; ++y)
+        for (int x = 0; x < s->w; ++x)
+            s->buf[y * s->w + x] = (x / cell + y / cell) & 1 ? rgb(200, 200, 200) : rgb(90, 90, 90);
+}
+
+/* Direct checks show up in the frame as green (passed) or red (failed) squares, five to a row */
+static void check_mark(Surface *s, int i, bool ok) {
+    DrawRect(s, 8 + i % 5 * 24, 8 + i / 5 * 24, 16, 16, ok ? rgb(0, 255, 0) : rgb(255, 0, 0), true, BLEND_OVER);
+}
+
+/* Largest channel difference between two surfaces, 256 if they can't be compared */
+static int surface_delta(Surface *a, Surface *b) {
+    SurfaceMetrics m;
+    return CompareSurfaces(a, b, &m) ? m.max_delta : 256;
+}
+
+static void draw_fill(Surface *s, Window *w) {
+    FillSurface(s, rgb(40, 80, 120));
+}
+
+static void draw_clear(Surface *s, Window *w) {
+    FillSurface(s, rgb(255, 255, 255));
+    ClearSurface(s);
+    for (int i = 0; i < SIZE; ++i)
+        SetPixel(s, i, i, rgb(255, 255, 255));
+}
+
+static void draw_pixels(Surface *s, Window *w) {
+    for (int y = 0; y < SIZE; ++y)
+        for (int x = 0; x < SIZE; ++x)
+            SetPixel(s, x, y, rgb(x * 2, y * 2, 128));
+    for (int y = 0; y < SIZE; y += 2)
+        for (int x = 0; x < SIZE; ++x)
+            BlendPixel(s, x, y, rgba(255, 255, 0, x * 2));
+    /* Copy a block through GetPixel, partly off the edge */
+    for (int y = 0; y < 32; ++y)
+        for (int x = 0; x < 32; ++x)
+            SetPixel(s, x + 112, y + 8, GetPixel(s, x, y));
+}
+
+static void draw_flood(Surface *s, Window *w) {
+    FillSurface(s, rgb(20, 20, 20));
+    DrawRect(s, 8, 8, 112, 112, rgb(255, 255, 255), false, BLEND_OVER);
+    DrawCircle(s, 64, 64, 40, rgb(255, 255, 255), false, BLEND_OVER);
+    DrawLine(s, 8, 8, 119, 119, rgb(255, 255, 255), BLEND_OVER);
+    FloodSurface(s, 100, 30, rgb(200, 40, 40));
+    FloodSurface(s, 30, 100, rgb(40, 200, 40));
+    FloodSurface(s, 64, 50, rgb(40, 40, 200));
+    FloodSurface(s, 0, 0, rgb(90, 90, 0));
+}
+
+static void draw_lines(Surface *s, Window *w) {
+    checker(s, 16);
+    for (int i = 0; i < 48; ++i) {
+        int x = i * SIZE / 24, y = 0;
+        if (i >= 24) {
+            x = SIZE - 1;
+            y = (i - 24) * SIZE / 24;
+        }
+        DrawLine(s, 64, 64, x, y, rgba(i * 5, 255 - i * 5, 128, i & 1 ? 255 : 128), (BlendMode)(i % 3 == 0 ? BLEND_OVER : i % 3 == 1 ? BLEND_ADD : BLEND_MULTIPLY));
+    }
+    DrawLine(s, -20, 100, 150, 100, rgb(255, 0, 0), BLEND_OVER);
+    DrawLine(s, 110, -20, 110, 150, rgba(0, 0, 255, 160), BLEND_OVER);
+    DrawLine(s, 0, 127, 127, 90, rgb(255, 255, 255), BLEND_DIFFERENCE);
+}
+
+static void draw_circles(Surface *s, Window *w) {
+    checker(s, 8);
+    for (int i = 0; i < 16; ++i) {
+        int x = (i % 4) * 32 + 16, y = (i / 4) * 32 + 16;
+        DrawCircle(s, x, y, 4 + i % 12, rgba(255 - i * 12, i * 16, 200, i & 1 ? 255 : 150), i & 2, (BlendMode)(i % 6));
+    }
+    DrawCircle(s, 0, 0, 50, rgba(255, 0, 255, 100), true, BLEND_OVER);
+    DrawCircle(s, 128, 128, 30, rgb(0, 255, 255), false, BLEND_OVER);
+}
+
+static void draw_rects(Surface *s, Window *w) {
+    gradient(s, 255);
+    DrawRect(s, -10, -10, 50, 50, rgb(255, 255, 255), true, BLEND_OVER);
+    DrawRect(s, 30, 30, 60, 40, rgba(0, 0, 0, 128), true, BLEND_OVER);
+    DrawRect(s, 60, 60, 80, 80, rgba(255, 0, 0, 200), true, BLEND_ADD);
+    DrawRect(s, 10, 80, 40, 40, rgb(0, 255, 0), false, BLEND_OVER);
+    DrawRect(s, 90, 5, 30, 50, rgb(128, 128, 128), true, BLEND_MULTIPLY);
+    DrawRect(s, 5, 60, 118, 10, rgb(255, 255, 255), true, BLEND_DIFFERENCE);
+}
+
+static void draw_tris(Surface *s, Window *w) {
+    FillSurface(s, rgb(30, 30, 60));
+    DrawTri(s, 64, 4, 124, 120, 4, 120, rgb(200, 120, 40), true, BLEND_OVER);
+    DrawTri(s, 10, 10, 60, 30, 20, 70, rgba(40, 200, 200, 140), true, BLEND_OVER);
+    DrawTri(s, -30, 90, 70, 127, 40, 150, rgba(255, 255, 255, 200), true, BLEND_SCREEN);
+    DrawTri(s, 100, 10, 120, 60, 80, 40, rgb(255, 255, 0), false, BLEND_OVER);
+    DrawTri(s, 64, 64, 64, 64, 64, 64, rgb(255, 0, 0), true, BLEND_OVER);
+}
+
+static void draw_blend_modes(Surface *s, Window *w) {
+    Surface src, dst;
+    NewSurface(&src, 32, 32);
+    NewSurface(&dst, 32, 32);
+    gradient(&src, 255);
+    for (int y = 0; y < 32; ++y)
+        for (int x = 0; x < 32; ++x) {
+            int dx = x - 16, dy = y - 16, d = dx * dx + dy * dy;
+            src.buf[y * 32 + x] = rgba(255 - x * 8, y * 8, 160, d >= 256 ? 0 : 255 - d);
+        }
+    FillSurface(s, rgb(0, 0, 0));
+    for (int m = 0; m < BLEND_MODE_COUNT; ++m) {
+        gradient(&dst, m & 1 ? 255 : 192);
+        PasteSurface(&dst, &src, 0, 0, (BlendMode)m);
+        PasteSurface(s, &dst, (m % 4) * 32, (m / 4) * 32, BLEND_SRC);
+    }
+    DestroySurface(&src);
+    DestroySurface(&dst);
+}
+
+static void draw_paste_clip(Surface *s, Window *w) {
+    Surface src;
+    NewSurface(&src, 64, 64);
+    gradient(&src, 200);
+    checker(s, 8);
+    PasteSurfaceClip(s, &src, 0, 0, 16, 16, 32, 32, BLEND_OVER);
+    PasteSurfaceClip(s, &src, 80, 10, 0, 0, 64, 20, BLEND_ADD);
+    PasteSurfaceClip(s, &src, -20, 90, 10, 10, 54, 54, BLEND_OVER);
+    PasteSurfaceClip(s, &src, 100, 100, 0, 0, 64, 64, BLEND_SRC);
+    PasteSurface(s, &src, 40, 40, BLEND_MULTIPLY);
+    DestroySurface(&src);
+}
+
+static void draw_fill_mask(Surface *s, Window *w) {
+    Surface mask;
+    NewSurfaceFormat(&mask, 64, 64, SURFACE_A8);
+    unsigned char *m = (unsigned char*)mask.buf;
+    for (int y = 0; y < 64; ++y)
+        for (int x = 0; x < 64; ++x) {
+            int dx = x - 32, dy = y - 32;
+            m[y * 64 + x] = dx * dx + dy * dy < 900 ? (unsigned char)(x * 4) : 0;
+        }
+    gradient(s, 255);
+    FillMask(s, &mask, 0, 0, rgb(255, 255, 255), BLEND_OVER);
+    FillMask(s, &mask, 64, 0, rgba(255, 0, 0, 160), BLEND_ADD);
+    FillMask(s, &mask, 0, 64, rgb(0, 0, 0), BLEND_SRC);
+    FillMask(s, &mask, 80, 80, rgb(0, 255, 0), BLEND_MULTIPLY);
+    DestroySurface(&mask);
+}
+
+static void draw_clip_mask(Surface *s, Window *w) {
+    Surface mask, src;
+    ClipMask a, b;
+    unsigned char bits[16 * 128];
+    NewSurfaceFormat(&mask, 96, 96, SURFACE_A8);
+    unsigned char *m = (unsigned char*)mask.buf;
+    for (int y = 0; y < 96; ++y)
+        for (int x = 0; x < 96; ++x) {
+            int dx = x - 48, dy = y - 48, d = dx * dx + dy * dy;
+            m[y * 96 + x] = d < 1600 ? 255 : d < 2304 ? (unsigned char)((2304 - d) * 255 / 704) : 0;
+        }
+    for (int y = 0; y < 128; ++y)
+        for (int i = 0; i < 16; ++i)
+            bits[y * 16 + i] = (y / 8) & 1 ? 0xF0 : 0x0F;
+    NewSurface(&src, SIZE, SIZE);
+    gradient(&src, 255);
+    checker(s, 8);
+
+    NewClipMask(&a, &mask, 16, 16);
+    SetSurfaceClip(s, &a);
+    PasteSurface(s, &src, 0, 0, BLEND_OVER);
+    DrawRect(s, 0, 50, 128, 20, rgba(0, 0, 0, 160), true, BLEND_OVER);
+    SetSurfaceClip(s, NULL);
+
+    NewClipMaskBits(&b, bits, 16, 128, 128, 0, 0);
+    SetSurfaceClip(s, &b);
+    for (int i = 0; i < SIZE; i += 8)
+        DrawLine(s, i, 0, SIZE - 1 - i, SIZE - 1, rgb(255, 255, 0), BLEND_OVER);
+    DrawCircle(s, 100, 100, 20, rgb(255, 0, 0), true, BLEND_OVER);
+    for (int y = 0; y < 16; ++y)
+        for (int x = 0; x < 16; ++x)
+            BlendPixel(s, x, y, rgba(0, 0, 255, 200));
+    SetSurfaceClip(s, NULL);
+
+    DestroyClipMask(&a);
+    DestroyClipMask(&b);
+    DestroySurface(&mask);
+    DestroySurface(&src);
+}
+
+static void draw_scale(Surface *s, Window *w) {
+    Surface src, up, down;
+    NewSurface(&src, 37, 23);
+    gradient(&src, 255);
+    DrawLine(&src, 0, 0, 36, 22, rgb(255, 255, 255), BLEND_OVER);
+    ScaleSurface(&src, 128, 96, &up);
+    ScaleSurface(&up, 50, 30, &down);
+    FillSurface(s, rgb(0, 0, 0));
+    PasteSurface(s, &up, 0, 0, BLEND_SRC);
+    PasteSurface(s, &down, 70, 96, BLEND_SRC);
+    DestroySurface(&src);
+    DestroySurface(&up);
+    DestroySurface(&down);
+}
+
+static void draw_rotate(Surface *s, Window *w) {
+    Surface src, out;
+    NewSurface(&src, 64, 48);
+    gradient(&src, 255);
+    DrawRect(&src, 0, 0, 64, 48, rgb(255, 255, 255), false, BLEND_OVER);
+    checker(s, 16);
+    RotateSurface(&src, 30.f, &out);
+    PasteSurface(s, &out, (SIZE - out.w) / 2, (SIZE - out.h) / 2, BLEND_OVER);
+    DestroySurface(&out);
+    RotateSurface(&src, 90.f, &out);
+    PasteSurface(s, &out, 0, 0, BLEND_OVER);
+    DestroySurface(&out);
+    DestroySurface(&src);
+}
+
+static int passthru_fn(int x, int y, int col) {
+    return rgb(r_channel(col) ^ (x * 3), g_channel(col) ^ (y * 5), (x * y) & 0xFF);
+}
+
+static void draw_passthru(Surface *s, Window *w) {
+    gradient(s, 255);
+    PassthruSurface(s, passthru_fn);
+}
+
+static void draw_formats(Surface *s, Window *w) {
+    static const SurfaceFormat formats[] = { SURFACE_RGB565, SURFACE_L8, SURFACE_A8, SURFACE_INDEXED8 };
+    Surface src, conv, back;
+    Palette pal;
+    InitPalette(&pal, NULL, 0);
+    NewSurface(&src, 64, 64);
+    gradient(&src, 255);
+    DrawCircle(&src, 32, 32, 20, rgba(255, 255, 255, 128), true, BLEND_OVER);
+    for (int i = 0; i < 4; ++i) {
+        if (!ConvertSurface(&src, formats[i], &conv))
+            continue;
+        if (conv.format == SURFACE_INDEXED8)
+            conv.palette = &pal;
+        memset(&back, 0, sizeof(back));
+        if (ExpandSurface(&conv, &back)) {
+            PasteSurface(s, &back, (i & 1) * 64, (i / 2) * 64, BLEND_SRC);
+            DestroySurface(&back);
+        }
+        DestroySurface(&conv);
+    }
+    DestroySurface(&src);
+}
+
+static Palette flush_palette;
+
+/* Flushed as an indexed surface, so the backend expands it */
+static void draw_indexed_flush(Surface *s, Window *w) {
+    InitPalette(&flush_palette, NULL, 0);
+    s->palette = &flush_palette;
+    unsigned char *p = (unsigned char*)s->buf;
+    for (int y = 0; y < SIZE; ++y)
+        for (int x = 0; x < SIZE; ++x)
+            p[y * SIZE + x] = (unsigned char)((x / 8 + (y / 8) * 16) & 0xFF);
+}
+
+/* Flushed to a window of a different size, so the backend scales it */
+static void draw_flush_scaled(Surface *s, Window *w) {
+    gradient(s, 255);
+    DrawCircle(s, 64, 64, 50, rgb(255, 255, 255), false, BLEND_OVER);
+    DrawLine(s, 0, 64, 127, 64, rgb(255, 0, 0), BLEND_OVER);
+}
+
+/* Scaled by whole pixels, centred in a window with room for 2x */
+static void draw_scale_integer(Surface *s, Window *w) {
+    SetWindowScaleMode(w, SCALE_INTEGER);
+    draw_flush_scaled(s, w);
+}
+
+/* Fitted to a wider window with bars at the sides */
+static void draw_scale_letterbox(Surface *s, Window *w) {
+    SetWindowScaleMode(w, SCALE_LETTERBOX);
+    draw_flush_scaled(s, w);
+}
+
+/* Only the damaged rects reach the window, the unlisted change must not show */
+static void draw_flush_rects(Surface *s, Window *w) {
+    gradient(s, 255);
+    Flush(w, s);
+    SurfaceRect damage[] = { { 8, 8, 16, 16 }, { 20, 20, 16, 16 }, { 100, 90, 30, 60 }, { -10, 60, 20, 8 } };
+    for (int i = 0; i < 4; ++i)
+        DrawRect(s, damage[i].x, damage[i].y, damage[i].w, damage[i].h, rgb(255, 255, 0), true, BLEND_OVER);
+    DrawRect(s, 60, 60, 16, 16, rgb(255, 0, 255), true, BLEND_OVER);
+    FlushRects(w, s, damage, 4);
+    /* The frame is flushed again after drawing, so hand it what the window shows */
+    memcpy(s->buf, GetWindowFramebuffer(w)->buf, (size_t)s->w * s->h * sizeof(int));
+}
+
+/* Four frames through a three-buffer swap chain, each band copied from the frame the window showed.
+ * The fourth lock must come back round to the first buffer */
+static void draw_backbuffer(Surface *s, Window *w) {
+    Surface *first = NULL;
+    FillSurface(s, rgb(0, 0, 0));
+    if (!SetBackbufferCount(w, 3))
+        return;
+    for (int i = 0; i < 4; ++i) {
+        Surface *b = LockBackbuffer(w);
+        if (!b || b->w != SIZE || b->h != SIZE)
+            return;
+        if (!i)
+            first = b;
+        bool wrapped = i < 3 || b == first;
+        FillSurface(b, rgb(40 + i * 50, 60, 200 - i * 40));
+        DrawCircle(b, 16 + i * 32, 64, 12, rgb(255, 255, 255), true, BLEND_OVER);
+        DrawRect(b, i * 32 + 8, 100, 16, 16, wrapped ? rgb(0, 255, 0) : rgb(255, 0, 0), true, BLEND_OVER);
+        Present(w);
+        Surface *fb = GetWindowFramebuffer(w);
+        for (int y = 0; y < SIZE; ++y)
+            memcpy(s->buf + y * SIZE + i * 32, fb->buf + y * SIZE + i * 32, 32 * sizeof(int));
+    }
+    SetBackbufferCount(w, 2);
+}
+
+static Surface *present_target;
+static unsigned long present_base;
+
+/* Runs on the presenter thread, sampling each shown frame into its own band of the target */
+static void present_band(void *p, Window *w, Surface *frame, unsigned long index) {
+    int y0 = (int)(index - present_base) * 12;
+    for (int y = y0; y < y0 + 12 && y < present_target->h; ++y)
+        for (int x = 0; x < SIZE; ++x)
+            present_target->buf[y * SIZE + x] = frame->buf[(y * frame->h / SIZE) * frame->w + x * frame->w / SIZE];
+}
+
+static void present_frame(Surface *f, int i) {
+    gradient(f, 255);
+    DrawRect(f, i * 12, 0, 12, SIZE, rgb(255, 255, 255), true, BLEND_OVER);
+}
+
+/* Frames queued to a presenter thread, with a resize while it runs. Blocking must show every frame in
+ * order, and dropping must still show the newest once switched back to sync */
+static void draw_presenter(Surface *s, Window *w) {
+    Surface f;
+    FillSurface(s, rgb(0, 0, 0));
+    if (!NewSurface(&f, SIZE, SIZE))
+        return;
+    present_target = s;
+    present_base = GetWindowFrameCount(w);
+    SetWindowFrameCallback(w, present_band, NULL);
+    if (!SetWindowPresenter(w, PRESENT_BLOCK, 3))
+        goto BAIL;
+    for (int i = 0; i < 6; ++i) {
+        present_frame(&f, i);
+        Flush(w, &f);
+    }
+    /* Let the queue drain first so which frames are shown at which size doesn't depend on timing */
+    while (GetWindowFrameCount(w) < present_base + 6)
+        ;
+    InjectResize(w, 96, 64);
+    PollEvents();
+    for (int i = 6; i < 10; ++i) {
+        present_frame(&f, i);
+        Flush(w, &f);
+    }
+    SetWindowPresenter(w, PRESENT_SYNC, 0);
+    SetWindowFrameCallback(w, NULL, NULL);
+    InjectResize(w, SIZE, SIZE);
+    PollEvents();
+
+    if (!SetWindowPresenter(w, PRESENT_DROP_OLDEST, 2))
+        goto BAIL;
+    for (int i = 0; i < 8; ++i) {
+        present_frame(&f, i);
+        Flush(w, &f);
+    }
+    SetWindowPresenter(w, PRESENT_SYNC, 0);
+    memcpy(s->buf + 120 * SIZE, GetWindowFramebuffer(w)->buf + 120 * SIZE, 8 * SIZE * sizeof(int));
+BAIL:
+    SetWindowFrameCallback(w, NULL, NULL);
+    DestroySurface(&f);
+}
+
+static Surface *input_target;
+
+static void input_button(void *p, Button b, Mod m, bool down) {
+    int x, y;
+    GetCursorPosition(&x, &y);
+    if (down)
+        DrawCircle(input_target, x, y, b == MOUSE_LEFT ? 10 : 5, m & KB_MOD_SHIFT ? rgb(255, 0, 0) : rgb(0, 255, 0), true, BLEND_OVER);
+}
+
+static void input_move(void *p, int x, int y, int dx, int dy) {
+    DrawLine(input_target, x - dx, y - dy, x, y, rgba(255, 255, 255, 180), BLEND_OVER);
+}
+
+static void input_key(void *p, Key k, Mod m, bool down) {
+    if (down && k >= KB_KEY_A && k <= KB_KEY_Z)
+        DrawRect(input_target, (k - KB_KEY_A) * 4, 120, 4, 8, rgb(255, 255, 0), true, BLEND_OVER);
+}
+
+/* Scripted input drives the callbacks, which draw onto the surface */
+static void draw_input(Surface *s, Window *w) {
+    static const char script[] =
+        "move 10 10\n"
+        "button left down\nbutton left up\n"
+        "move 60 40\nmove 100 20\n"
+        "button right down shift\nbutton right up\n"
+        "move 64 100\n"
+        "button left down\n"
+        "key h down\nkey e down\nkey l down\nkey l down\nkey o down\n";
+    FillSurface(s, rgb(20, 20, 40));
+    input_target = s;
+    SetWindowCallbacks(input_key, input_button, input_move, NULL, NULL, NULL, NULL, w);
+    InjectMouseMove(w, 0, 0);
+    PollEvents();
+    InjectInputScript(w, script);
+    PollEvents();
+    SetWindowCallbacks(NULL, NULL, NULL, NULL, NULL, NULL, NULL, w);
+}
+
+/* The same script drained through the event queue instead, so it must draw the same picture */
+static void draw_input_queue(Surface *s, Window *w) {
+    static const char script[] =
+        "move 10 10\n"
+        "button left down\nbutton left up\n"
+        "move 60 40\nmove 100 20\n"
+        "button right down shift\nbutton right up\n"
+        "move 64 100\n"
+        "button left down\n"
+        "key h down\nkey e down\nkey l down\nkey l down\nkey o down\n";
+    FillSurface(s, rgb(20, 20, 40));
+    input_target = s;
+    SetWindowEventQueue(w, 32);
+    InjectMouseMove(w, 0, 0);
+    InjectInputScript(w, script);
+    PollEvents();
+    Event e;
+    int x = 0, y = 0;
+    while (NextEvent(w, &e))
+        switch (e.type) {
+            case EVENT_MOUSE_MOVE:
+                x = e.data.move.x;
+                y = e.data.move.y;
+                input_move(NULL, x, y, e.data.move.dx, e.data.move.dy);
+                break;
+            case EVENT_MOUSE_BUTTON:
+                if (e.data.button.down)
+                    DrawCircle(s, x, y, e.data.button.button == MOUSE_LEFT ? 10 : 5, e.mod & KB_MOD_SHIFT ? rgb(255, 0, 0) : rgb(0, 255, 0), true, BLEND_OVER);
+                break;
+            case EVENT_KEYBOARD:
+                input_key(NULL, e.data.keyboard.key, e.mod, e.data.keyboard.down);
+                break;
+            default:
+                break;
+        }
+    SetWindowEventQueue(w, 0);
+}
+
+static int wait_keys;
+
+static void wait_key(void *p, Key k, Mod m, bool down) {
+    if (down) {
+        DrawRect(input_target, 8 + wait_keys * 24, 64, 16, 16, rgb(255, 255, 0), true, BLEND_OVER);
+        ++wait_keys;
+    }
+}
+
+/* Input held back by SetInputFrame mustn't wake WaitEventsTimeout until its frame is reached, by Flush
+ * directly or by a presenter thread showing it */
+static void draw_wait_input(Surface *s, Window *w) {
+    FillSurface(s, rgb(20, 20, 40));
+    input_target = s;
+    wait_keys = 0;
+    SetWindowCallbacks(wait_key, NULL, NULL, NULL, NULL, NULL, NULL, w);
+    SetInputFrame(w, GetWindowFrameCount(w) + 2);
+    InjectKeyboard(w, KB_KEY_A, 0, true);
+    check_mark(s, 0, !WaitEventsTimeout(0) && !wait_keys);
+    Flush(w, s);
+    check_mark(s, 1, !WaitEventsTimeout(1) && !wait_keys);
+    Flush(w, s);
+    check_mark(s, 2, WaitEventsTimeout(1000) && wait_keys == 1);
+
+    if (SetWindowPresenter(w, PRESENT_BLOCK, 2)) {
+        SetInputFrame(w, GetWindowFrameCount(w) + 1);
+        InjectKeyboard(w, KB_KEY_B, 0, true);
+        Flush(w, s);
+        check_mark(s, 3, WaitEventsTimeout(5000) && wait_keys == 2);
+        SetWindowPresenter(w, PRESENT_SYNC, 0);
+    }
+    SetInputFrame(w, 0);
+    SetWindowCallbacks(NULL, NULL, NULL, NULL, NULL, NULL, NULL, w);
+}
+
+/* One pass of a symmetric 1D filter with taps k[0..r], edges extended and each channel rounded, the way
+ * BlurSurface does every box and Gaussian pass */
+static void ref_pass(Surface *s, const double *k, int r, bool vertical) {
+    Surface tmp;
+    if (!CopySurface(s, &tmp))
+        return;
+    int n = vertical ? s->h : s->w;
+    for (int y = 0; y < s->h; ++y)
+        for (int x = 0; x < s->w; ++x) {
+            int at = vertical ? y : x, c = 0;
+            for (int ch = 0; ch < 32; ch += 8) {
+                double acc = 0.;
+                for (int i = -r; i <= r; ++i) {
+                    int j = at + i < 0 ? 0 : at + i >= n ? n - 1 : at + i;
+                    acc += k[abs(i)] * ((tmp.buf[vertical ? j * s->w + x : y * s->w + j] >> ch) & 0xFF);
+                }
+                c |= (int)(acc + .5) << ch;
+            }
+            s->buf[y * s->w + x] = c;
+        }
+    DestroySurface(&tmp);
+}
+
+static void ref_blur(Surface *s, const double *k, int r) {
+    ref_pass(s, k, r, false);
+    ref_pass(s, k, r, true);
+}
+
+static void ref_box(Surface *s, int r) {
+    double k[64];
+    for (int i = 0; i <= r; ++i)
+        k[i] = 1. / (2 * r + 1);
+    ref_blur(s, k, r);
+}
+
+/* Three boxes whose variances add up to the Gaussian's, the standard widths for a box approximation */
+static void ref_triple_box(Surface *s, int radius) {
+    double sigma = radius / 3., ideal = sqrt(12. * sigma * sigma / 3. + 1.);
+    int wl = (int)floor(ideal);
+    if (!(wl % 2))
+        wl--;
+    int m = (int)round((12. * sigma * sigma - 3 * wl * wl - 12 * wl - 9) / (-4. * wl - 4));
+    for (int i = 0; i < 3; ++i)
+        if (((i < m ? wl : wl + 2) - 1) / 2 > 0)
+            ref_box(s, ((i < m ? wl : wl + 2) - 1) / 2);
+}
+
+static void ref_gaussian(Surface *s, int radius) {
+    double k[64], sigma = radius / 3., sum = 0.;
+    for (int i = 0; i <= radius; ++i) {
+        k[i] = exp(-(double)(i * i) / (2. * sigma * sigma));
+        sum += i ? 2. * k[i] : k[i];
+    }
+    for (int i = 0; i <= radius; ++i)
+        k[i] /= sum;
+    ref_blur(s, k, radius);
+}
+
+/* Each blur mode against a scalar reference, then a half transparent surface, which mustn't pick up dark fringes */
+static void draw_blur(Surface *s, Window *w) {
+    static const struct {
+        BlurMode mode;
+        int radius;
+        void (*ref)(Surface*, int);
+    } modes[] = {
+        { BLUR_BOX, 5, ref_box },
+        { BLUR_TRIPLE_BOX, 9, ref_triple_box },
+        { BLUR_GAUSSIAN, 6, ref_gaussian }
+    };
+    bool ok[4] = { false, false, false, false };
+    gradient(s, 255);
+    for (int i = 0; i < 3; ++i) {
+        Surface got, want;
+        if (!CopySurface(s, &got))
+            return;
+        if (!CopySurface(s, &want)) {
+            DestroySurface(&got);
+            return;
+        }
+        ok[i] = BlurSurface(&got, modes[i].radius, modes[i].mode);
+        modes[i].ref(&want, modes[i].radius);
+        ok[i] = ok[i] && surface_delta(&got, &want) <= 1;
+        DestroySurface(&got);
+        DestroySurface(&want);
+    }
+    BlurSurface(s, 9, BLUR_TRIPLE_BOX);
+
+    Surface half;
+    if (!NewSurface(&half, SIZE, SIZE))
+        return;
+    DrawRect(&half, SIZE / 2, 0, SIZE / 2, SIZE, rgb(255, 0, 0), true, BLEND_SRC);
+    ok[3] = BlurSurface(&half, 8, BLUR_GAUSSIAN);
+    for (int i = 0; ok[3] && i < SIZE * SIZE; ++i) {
+        int c = half.buf[i];
+        ok[3] = a_channel(c) < 16 || (r_channel(c) >= 250 && g_channel(c) <= 2 && b_channel(c) <= 2);
+    }
+    PasteSurface(s, &half, 0, SIZE / 2, BLEND_OVER);
+    DestroySurface(&half);
+    for (int i = 0; i < 4; ++i)
+        check_mark(s, i, ok[i]);
+}
+
+/* Direct 2D convolution of a view with extended edges, what every ConvolveView path should match */
+static void ref_convolve(const SurfaceView *src, Surface *dst, const Kernel *k) {
+    int r = k->size / 2;
+    double scale = k->divisor != 0.f ? 1. / k->divisor : 1.;
+    for (int y = 0; y < src->h; ++y)
+        for (int x = 0; x < src->w; ++x) {
+            int center = src->buf[y * src->stride + x], c = 0;
+            for (int ch = 0; ch < 32; ch += 8) {
+                if (ch == 24 && !k->alpha) {
+                    c |= center & 0xFF000000;
+                    continue;
+                }
+                double acc = 0.;
+                for (int ky = 0; ky < k->size; ++ky)
+                    for (int kx = 0; kx < k->size; ++kx) {
+                        int sx = x + kx - r, sy = y + ky - r;
+                        sx = sx < 0 ? 0 : sx >= src->w ? src->w - 1 : sx;
+                        sy = sy < 0 ? 0 : sy >= src->h ? src->h - 1 : sy;
+                        acc += k->weights[ky * k->size + kx] * ((src->buf[sy * src->stride + sx] >> ch) & 0xFF);
+                    }
+                int v = (int)floor(acc * scale + k->bias + .5);
+                c |= (v < 0 ? 0 : v > 255 ? 255 : v) << ch;
+            }
+            dst->buf[y * dst->w + x] = c;
+        }
+}
+
+static bool check_convolve(Surface *src, const Kernel *k) {
+    Surface got, want;
+    SurfaceView v;
+    if (!CopySurface(src, &got))
+        return false;
+    if (!NewSurface(&want, src->w, src->h)) {
+        DestroySurface(&got);
+        return false;
+    }
+    bool ok = ConvolveSurface(&got, k);
+    GetSurfaceView(src, 0, 0, src->w, src->h, &v);
+    ref_convolve(&v, &want, k);
+    ok = ok && surface_delta(&got, &want) <= 1;
+    DestroySurface(&got);
+    DestroySurface(&want);
+    return ok;
+}
+
+/* Integer 3x3 and 5x5 kernels, a separable 7x7 and a general 7x7, each against the direct sum, on a source
+ * with varying alpha and larger than one tile. Then a view in the middle of a surface into a view of another */
+static void draw_convolve(Surface *s, Window *w) {
+    static const float taps[7] = { .1f, .25f, .5f, 1.f, .5f, .25f, .1f };
+    float outer[49], ring[49];
+    for (int y = 0; y < 7; ++y)
+        for (int x = 0; x < 7; ++x) {
+            int d = (x - 3) * (x - 3) + (y - 3) * (y - 3);
+            outer[y * 7 + x] = taps[y] * taps[x];
+            ring[y * 7 + x] = d >= 4 && d <= 9 ? .5f : d < 4 ? -.25f : 0.f;
+        }
+    Kernel kernels[6], separable = { 7, outer, 7.29f, 0.f, true }, general = { 7, ring, 9.f, 16.f, false };
+    PresetKernel(KERNEL_SHARPEN, &kernels[0]);
+    PresetKernel(KERNEL_SOBEL_X, &kernels[1]);
+    PresetKernel(KERNEL_GAUSSIAN5, &kernels[2]);
+    kernels[3] = separable;
+    kernels[4] = general;
+    PresetKernel(KERNEL_EMBOSS, &kernels[5]);
+
+    Surface src;
+    if (!NewSurface(&src, SIZE + 8, SIZE - 8))
+        return;
+    gradient(&src, 255);
+    for (int y = 0; y < src.h; ++y)
+        for (int x = 0; x < src.w; ++x)
+            src.buf[y * src.w + x] = rgba_a(src.buf[y * src.w + x], 64 + y);
+    bool ok[6];
+    for (int i = 0; i < 5; ++i)
+        ok[i] = check_convolve(&src, &kernels[i]);
+
+    Surface want;
+    SurfaceView in, out, ref;
+    FillSurface(s, rgb(30, 30, 30));
+    ok[5] = NewSurface(&want, 80, 60);
+    if (ok[5]) {
+        GetSurfaceView(&src, 20, 30, 80, 60, &in);
+        GetSurfaceView(s, 40, 60, 80, 60, &out);
+        ok[5] = ConvolveView(&out, &in, &kernels[5]);
+        ref_convolve(&in, &want, &kernels[5]);
+        GetSurfaceView(&want, 0, 0, 80, 60, &ref);
+        for (int y = 0; ok[5] && y < 60; ++y)
+            for (int x = 0; ok[5] && x < 80; ++x) {
+                int a = out.buf[y * out.stride + x], b = ref.buf[y * ref.stride + x];
+                for (int ch = 0; ch < 32; ch += 8)
+                    ok[5] = ok[5] && abs(((a >> ch) & 0xFF) - ((b >> ch) & 0xFF)) <= 1;
+            }
+        DestroySurface(&want);
+    }
+    DestroySurface(&src);
+
+    /* The rest of the frame is the general kernel over an opaque gradient */
+    Surface left;
+    if (NewSurface(&left, 40, SIZE)) {
+        gradient(&left, 255);
+        ConvolveSurface(&left, &general);
+        PasteSurface(s, &left, 0, 0, BLEND_SRC);
+        DestroySurface(&left);
+    }
+    for (int i = 0; i < 6; ++i)
+        check_mark(s, i, ok[i]);
+}
+
+/* Sums, means and variances of rectangles, some hanging off the edges, against adding up the pixels */
+static bool check_summed_area(Surface *src, bool wide) {
+    SummedAreaTable t;
+    if (!NewSummedAreaTable(&t, src, true))
+        return false;
+    bool ok = t.wide == wide;
+    unsigned int seed = 12345;
+    for (int n = 0; ok && n < 48; ++n) {
+        int r[4];
+        for (int i = 0; i < 4; ++i) {
+            seed = seed * 1103515245u + 12345u;
+            r[i] = (int)((seed >> 8) % (unsigned int)(i & 1 ? src->h + 40 : src->w + 40)) - (i < 2 ? 20 : 0);
+        }
+        int x0 = r[0] < 0 ? 0 : r[0], y0 = r[1] < 0 ? 0 : r[1];
+        int x1 = r[0] + r[2] > src->w ? src->w : r[0] + r[2], y1 = r[1] + r[3] > src->h ? src->h : r[1] + r[3];
+        uint64_t want[4] = { 0, 0, 0, 0 }, got[4];
+        double sq[4] = { 0., 0., 0., 0. };
+        for (int y = y0; y < y1; ++y)
+            for (int x = x0; x < x1; ++x) {
+                int c = src->buf[y * src->w + x], ch[4] = { r_channel(c), g_channel(c), b_channel(c), a_channel(c) };
+                for (int i = 0; i < 4; ++i) {
+                    want[i] += ch[i];
+                    sq[i] += (double)ch[i] * ch[i];
+                }
+            }
+        int64_t count = x0 < x1 && y0 < y1 ? (int64_t)(x1 - x0) * (y1 - y0) : 0;
+        float mean[4], variance[4];
+        ok = SummedAreaSum(&t, r[0], r[1], r[2], r[3], got) == count;
+        ok = ok && SummedAreaVariance(&t, r[0], r[1], r[2], r[3], mean, variance) == (count > 0);
+        for (int i = 0; ok && count && i < 4; ++i) {
+            double m = (double)want[i] / count, v = sq[i] / count - m * m;
+            ok = got[i] == want[i] && fabs(mean[i] - m) < 1e-3 && fabs(variance[i] - v) <= .01 + v * 1e-4;
+        }
+        if (ok && count) {
+            int c = SummedAreaMean(&t, r[0], r[1], r[2], r[3]);
+            ok = r_channel(c) == (want[0] + count / 2) / count && a_channel(c) == (want[3] + count / 2) / count;
+        }
+    }
+    DestroySummedAreaTable(&t);
+    return ok;
+}
+
+/* A narrow (32-bit) table, and one big and bright enough that its squares need 64 bits. The frame is a
+ * 9x9 box filter made from one table */
+static void draw_summed_area(Surface *s, Window *w) {
+    bool ok[3] = { false, false, false };
+    Surface big;
+    gradient(s, 200);
+    ok[0] = check_summed_area(s, false);
+    if (NewSurface(&big, 300, 260)) {
+        for (int y = 0; y < big.h; ++y)
+            for (int x = 0; x < big.w; ++x)
+                big.buf[y * big.w + x] = rgba(255 - ((x ^ y) & 15), 250 - (x & 7), 255 - (y & 31), 255 - ((x + y) & 3));
+        ok[1] = check_summed_area(&big, true);
+        DestroySurface(&big);
+    }
+
+    SummedAreaTable t;
+    Surface src;
+    if (!CopySurface(s, &src))
+        return;
+    if (NewSummedAreaTable(&t, &src, false)) {
+        float v[4];
+        uint64_t sum[4];
+        ok[2] = !SummedAreaVariance(&t, 0, 0, 8, 8, NULL, v) && !SummedAreaSum(&t, SIZE, 0, 8, 8, sum) && !SummedAreaMean(&t, -8, -8, 8, 8);
+        for (int y = 0; y < SIZE; ++y)
+            for (int x = 0; x < SIZE; ++x)
+                s->buf[y * SIZE + x] = SummedAreaMean(&t, x - 4, y - 4, 9, 9);
+        DestroySummedAreaTable(&t);
+    }
+    DestroySurface(&src);
+    for (int i = 0; i < 3; ++i)
+        check_mark(s, i, ok[i]);
+}
+
+/* Grade a copy of src and compare it with the expected surface */
+static bool check_lut(Surface *src, Surface *want, const Lut *curves, const Lut *cube, LutInterpolation interp) {
+    Surface got;
+    if (!CopySurface(src, &got))
+        return false;
+    bool ok = ApplyLut(&got, curves, cube, interp) && surface_delta(&got, want) <= 1;
+    DestroySurface(&got);
+    return ok;
+}
+
+/* Fill a cube from a function of the point's red, green and blue */
+static void fill_cube(Lut *l, void (*fn)(const float *in, float *out)) {
+    for (int b = 0; b < l->size; ++b)
+        for (int g = 0; g < l->size; ++g)
+            for (int r = 0; r < l->size; ++r) {
+                float in[3] = { (float)r / (l->size - 1), (float)g / (l->size - 1), (float)b / (l->size - 1) };
+                fn(in, l->table + 4 * ((b * l->size + g) * l->size + r));
+            }
+}
+
+static void rotate_invert(const float *in, float *out) {
+    out[0] = 1.f - in[2];
+    out[1] = in[0];
+    out[2] = in[1];
+}
+
+static void warm(const float *in, float *out) {
+    out[0] = sqrtf(in[0]);
+    out[1] = in[1] * (.5f + .5f * in[0]);
+    out[2] = in[2] * in[2];
+}
+
+/* Both interpolations must leave colours alone through an identity cube and agree with each other, and both
+ * are exact for an affine cube. Then curves, and a cube loaded from a .cube file. The frame is a non-linear
+ * grade, tetrahedral on the left and trilinear on the right */
+static void draw_lut(Surface *s, Window *w) {
+    bool ok[6] = { false, false, false, false, false, false };
+    Lut cube, curves, loaded;
+    Surface src, want;
+    gradient(s, 200);
+    if (!CopySurface(s, &src))
+        return;
+    if (!CopySurface(s, &want)) {
+        DestroySurface(&src);
+        return;
+    }
+    if (NewLut(&cube, LUT_3D, 17)) {
+        ok[0] = check_lut(&src, &want, NULL, &cube, LUT_TRILINEAR);
+        ok[1] = check_lut(&src, &want, NULL, &cube, LUT_TETRAHEDRAL);
+        Surface tri;
+        if (CopySurface(&src, &tri)) {
+            ok[2] = ApplyLut(&tri, NULL, &cube, LUT_TRILINEAR) && ApplyLut(s, NULL, &cube, LUT_TETRAHEDRAL) && surface_delta(&tri, s) <= 1;
+            DestroySurface(&tri);
+        }
+        fill_cube(&cube, rotate_invert);
+        for (int i = 0; i < SIZE * SIZE; ++i) {
+            int c = src.buf[i];
+            want.buf[i] = rgba(255 - b_channel(c), r_channel(c), g_channel(c), a_channel(c));
+        }
+        ok[3] = check_lut(&src, &want, NULL, &cube, LUT_TRILINEAR) && check_lut(&src, &want, NULL, &cube, LUT_TETRAHEDRAL);
+        DestroyLut(&cube);
+    }
+    if (NewLut(&curves, LUT_1D, 2) && NewLut(&cube, LUT_3D, 2)) {
+        for (int i = 0; i < 3; ++i) {
+            curves.table[i] = 1.f;
+            curves.table[4 + i] = 0.f;
+        }
+        for (int i = 0; i < SIZE * SIZE; ++i) {
+            int c = src.buf[i];
+            want.buf[i] = rgba(255 - r_channel(c), 255 - g_channel(c), 255 - b_channel(c), a_channel(c));
+        }
+        ok[4] = check_lut(&src, &want, &curves, NULL, LUT_TRILINEAR) && check_lut(&src, &want, &curves, &cube, LUT_TETRAHEDRAL);
+        DestroyLut(&curves);
+        DestroyLut(&cube);
+    }
+
+    FILE *fh = fopen("golden_lut.cube", "w");
+    if (fh) {
+        fputs("TITLE \"invert\"\n# comment\nLUT_3D_SIZE 2\nDOMAIN_MIN 0 0 0\nDOMAIN_MAX 1 1 1\n", fh);
+        for (int i = 0; i < 8; ++i)
+            fprintf(fh, "%d.0 %d.0 %d.0\n", !(i & 1), !(i & 2), !(i & 4));
+        fclose(fh);
+        if (LoadCubeLut(&loaded, "golden_lut.cube")) {
+            ok[5] = loaded.type == LUT_3D && loaded.size == 2 && check_lut(&src, &want, NULL, &loaded, LUT_TRILINEAR);
+            DestroyLut(&loaded);
+        }
+        remove("golden_lut.cube");
+    }
+
+    if (NewLut(&cube, LUT_3D, 9)) {
+        Surface right;
+        fill_cube(&cube, warm);
+        PasteSurface(s, &src, 0, 0, BLEND_SRC);
+        ApplyLut(s, NULL, &cube, LUT_TETRAHEDRAL);
+        if (NewSurface(&right, SIZE / 2, SIZE)) {
+            PasteSurface(&right, &src, -SIZE / 2, 0, BLEND_SRC);
+            ApplyLut(&right, NULL, &cube, LUT_TRILINEAR);
+            PasteSurface(s, &right, SIZE / 2, 0, BLEND_SRC);
+            DestroySurface(&right);
+        }
+        DestroyLut(&cube);
+    }
+    DestroySurface(&src);
+    DestroySurface(&want);
+    for (int i = 0; i < 6; ++i)
+        check_mark(s, i, ok[i]);
+}
+
+static bool tiled_matches(TiledSurface *t, Surface *want) {
+    Surface got;
+    if (!NewSurface(&got, want->w, want->h))
+        return false;
+    bool ok = ReadTiledRegion(t, 0, 0, &got) && surface_delta(&got, want) == 0;
+    DestroySurface(&got);
+    return ok;
+}
+
+/* A tiled image of uneven 16 pixel tiles with the smallest cache, so nearly every access evicts a tile.
+ * It's written, read back, closed and reopened, and tiles nothing touched must stay transparent. The
+ * frame is the reopened image scaled down */
+static void draw_tiled(Surface *s, Window *w) {
+    static const char *path = "golden_tiled.tmp";
+    bool ok[5] = { false, false, false, false, false };
+    TiledSurface t;
+    Surface src, want, sprite;
+    if (!NewSurface(&src, 160, 120))
+        return;
+    if (!NewSurface(&want, 200, 150)) {
+        DestroySurface(&src);
+        return;
+    }
+    gradient(&src, 255);
+    PasteSurface(&want, &src, 8, 8, BLEND_SRC);
+    if (NewTiledSurface(&t, path, 200, 150, 16, 0)) {
+        ok[0] = WriteTiledRegion(&t, &src, 8, 8) && tiled_matches(&t, &want);
+        ok[1] = true;
+        for (int i = 0; i < 200; ++i) {
+            int x = i * 37 % 200, y = i * 53 % 150, c = rgba(i, 255 - i, i * 7 & 0xFF, 255);
+            SetTiledPixel(&t, x, y, c);
+            want.buf[y * 200 + x] = c;
+        }
+        for (int i = 0; i < 200; ++i)
+            ok[1] = ok[1] && GetTiledPixel(&t, i * 37 % 200, i * 53 % 150) == want.buf[i * 53 % 150 * 200 + i * 37 % 200];
+        ok[1] = ok[1] && !GetTiledPixel(&t, 200, 0) && !GetTiledPixel(&t, -1, 10);
+        DestroyTiledSurface(&t);
+    }
+    if (OpenTiledSurface(&t, path, 0)) {
+        ok[2] = t.w == 200 && t.h == 150 && t.tile == 16 && tiled_matches(&t, &want);
+        ok[3] = !GetTiledPixel(&t, 199, 149) && !GetTiledPixel(&t, 0, 149) && !GetTiledPixel(&t, 199, 0);
+        if (NewSurface(&sprite, 40, 40)) {
+            DrawCircle(&sprite, 20, 20, 18, rgba(40, 40, 255, 160), true, BLEND_SRC);
+            ok[4] = PasteTiledSurface(&t, &sprite, 170, 120) && PasteSurface(&want, &sprite, 170, 120, BLEND_OVER) && tiled_matches(&t, &want);
+            DestroySurface(&sprite);
+        }
+        ScaleTiledRegion(&t, 0, 0, 200, 150, s);
+        DestroyTiledSurface(&t);
+    }
+    remove(path);
+    DestroySurface(&src);
+    DestroySurface(&want);
+    for (int i = 0; i < 5; ++i)
+        check_mark(s, i, ok[i]);
+}
+
+static const Scene scenes[] = {
+    { "fill", draw_fill, SURFACE_ARGB, 0, 0, 0, 0. },
+    { "clear", draw_clear, SURFACE_ARGB, 0, 0, 0, 0. },
+    { "pixels", draw_pixels, SURFACE_ARGB, 0, 0, 1, .01 },
+    { "flood", draw_flood, SURFACE_ARGB, 0, 0, 0, 0. },
+    { "lines", draw_lines, SURFACE_ARGB, 0, 0, 2, .01 },
+    { "circles", draw_circles, SURFACE_ARGB, 0, 0, 2, .01 },
+    { "rects", draw_rects, SURFACE_ARGB, 0, 0, 2, .01 },
+    { "tris", draw_tris, SURFACE_ARGB, 0, 0, 2, .01 },
+    { "blend_modes", draw_blend_modes, SURFACE_ARGB, 0, 0, 2, .02 },
+    { "paste_clip", draw_paste_clip, SURFACE_ARGB, 0, 0, 2, .01 },
+    { "fill_mask", draw_fill_mask, SURFACE_ARGB, 0, 0, 2, .01 },
+    { "clip_mask", draw_clip_mask, SURFACE_ARGB, 0, 0, 2, .01 },
+    { "scale", draw_scale, SURFACE_ARGB, 0, 0, 0, 0. },
+    { "rotate", draw_rotate, SURFACE_ARGB, 0, 0, 4, .02 },
+    { "passthru", draw_passthru, SURFACE_ARGB, 0, 0, 0, 0. },
+    { "formats", draw_formats, SURFACE_ARGB, 0, 0, 2, .01 },
+    { "indexed_flush", draw_indexed_flush, SURFACE_INDEXED8, 0, 0, 0, 0. },
+    { "flush_scaled", draw_flush_scaled, SURFACE_ARGB, 200, 150, 0, 0. },
+    { "flush_rects", draw_flush_rects, SURFACE_ARGB, 0, 0, 0, 0. },
+    { "scale_integer", draw_scale_integer, SURFACE_ARGB, 300, 270, 0, 0. },
+    { "scale_letterbox", draw_scale_letterbox, SURFACE_ARGB, 200, 150, 0, 0. },
+    { "input", draw_input, SURFACE_ARGB, 0, 0, 2, .01 },
+    { "input_queue", draw_input_queue, SURFACE_ARGB, 0, 0, 2, .01 },
+    { "backbuffer", draw_backbuffer, SURFACE_ARGB, 0, 0, 0, 0. },
+    { "presenter", draw_presenter, SURFACE_ARGB, 0, 0, 0, 0. },
+    { "wait_input", draw_wait_input, SURFACE_ARGB, 0, 0, 0, 0. },
+    { "blur", draw_blur, SURFACE_ARGB, 0, 0, 2, .05 },
+    { "convolve", draw_convolve, SURFACE_ARGB, 0, 0, 2, .05 },
+    { "summed_area", draw_summed_area, SURFACE_ARGB, 0, 0, 0, 0. },
+    { "lut", draw_lut, SURFACE_ARGB, 0, 0, 2, .05 },
+    { "tiled", draw_tiled, SURFACE_ARGB, 0, 0, 0, 0. }
+};
+
+/* reference/hashes.txt holds one "name hash" pair per line */
+static struct {
+    char name[64];
+    unsigned long long hash;
+} hashes[MAX_SCENES];
+static int hash_count;
+
+static void load_hashes(const char *path) {
+    FILE *fh = fopen(path, "r");
+    if (!fh)
+        return;
+    while (hash_count < MAX_SCENES && fscanf(fh, "%63s %llx", hashes[hash_count].name, &hashes[hash_count].hash) == 2)
+        ++hash_count;
+    fclose(fh);
+}
+
+static bool find_hash(const char *name, unsigned long long *hash) {
+    for (int i = 0; i < hash_count; ++i)
+        if (!strcmp(hashes[i].name, name)) {
+            *hash = hashes[i].hash;
+            return true;
+        }
+    return false;
+}
+
+static void set_hash(const char *name, unsigned long long hash) {
+    for (int i = 0; i < hash_count; ++i)
+        if (!strcmp(hashes[i].name, name)) {
+            hashes[i].hash = hash;
+            return;
+        }
+    if (hash_count == MAX_SCENES)
+        return;
+    snprintf(hashes[hash_count].name, sizeof(hashes[hash_count].name), "%s", name);
+    hashes[hash_count++].hash = hash;
+}
+
+static bool save_hashes(const char *path) {
+    FILE *fh = fopen(path, "w");
+    if (!fh)
+        return false;
+    for (int i = 0; i < hash_count; ++i)
+        fprintf(fh, "%s %016llx\n", hashes[i].name, hashes[i].hash);
+    fclose(fh);
+    return true;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/* Render and flush a scene, keeping a copy of the last presented frame */
+static bool render(const Scene *sc, int runs, Surface *frame, Result *r) {
+    double render_ns[MAX_RUNS], flush_ns[MAX_RUNS];
+    Window win;
+    Surface s;
+    memset(&win, 0, sizeof(win));
+    if (!NewWindow(&win, sc->name, sc->win_w ? sc->win_w : SIZE, sc->win_h ? sc->win_h : SIZE, DEFAULT_FLAGS))
+        return false;
+    for (int i = 0; i < runs; ++i) {
+        if (!NewSurfaceFormat(&s, SIZE, SIZE, sc->format)) {
+            DestroyWindow(&win);
+            return false;
+        }
+        double t0 = now_ns();
+        sc->draw(&s, &win);
+        double t1 = now_ns();
+        Flush(&win, &s);
+        double t2 = now_ns();
+        render_ns[i] = t1 - t0;
+        flush_ns[i] = t2 - t1;
+        DestroySurface(&s);
+    }
+    bool ok = CopySurface(GetWindowFramebuffer(&win), frame);
+    DestroyWindow(&win);
+    qsort(render_ns, runs, sizeof(double), compare_doubles);
+    qsort(flush_ns, runs, sizeof(double), compare_doubles);
+    r->render_min = render_ns[0];
+    r->render_p50 = render_ns[runs / 2];
+    r->flush_min = flush_ns[0];
+    r->flush_p50 = flush_ns[runs / 2];
+    return ok;
+}
+
+static bool check(const Scene *sc, const char *dir, bool update, Surface *frame, Result *r) {
+    char path[512];
+    unsigned long long hash = HashSurface(frame), expected;
+    snprintf(path, sizeof(path), "%s/%s.png", dir, sc->name);
+    r->exact = true;
+    memset(&r->metrics, 0, sizeof(SurfaceMetrics));
+    if (update) {
+        set_hash(sc->name, hash);
+        return SaveSurface(frame, path);
+    }
+    if (find_hash(sc->name, &expected) && expected == hash)
+        return true;
+
+    Surface ref;
+    if (!LoadSurface(&ref, path)) {
+        fprintf(stderr, "%s: can't load reference %s\n", sc->name, path);
+        return false;
+    }
+    r->exact = false;
+    bool ok = CompareSurfaces(frame, &ref, &r->metrics) && r->metrics.max_delta <= sc->max_delta &&
+              r->metrics.differing <= sc->max_differing * frame->w * frame->h;
+    r->exact = ok && !r->metrics.differing;
+    DestroySurface(&ref);
+    if (!ok) {
+        snprintf(path, sizeof(path), "%s/%s.actual.png", dir, sc->name);
+        SaveSurface(frame, path);
+    }
+    return ok;
+}
+
+static void write_json(FILE *fh, const Result *results, int count, int runs) {
+    char stamp[32];
+    time_t t = time(NULL);
+    strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%SZ", gmtime(&t));
+    fprintf(fh, "{\n  \"version\": 1,\n  \"timestamp\": \"%s\",\n  \"runs\": %d,\n  \"results\": [\n", stamp, runs);
+    for (int i = 0; i < count; ++i) {
+        const Result *r = &results[i];
+        fprintf(fh, "    {\"name\": \"%s\", \"passed\": %s, \"exact\": %s, \"max_delta\": %d, \"differing\": %zu, "
+                "\"render_ns\": {\"min\": %.0f, \"p50\": %.0f}, \"flush_ns\": {\"min\": %.0f, \"p50\": %.0f}}%s\n",
+                r->name, r->passed ? "true" : "false", r->exact ? "true" : "false", r->metrics.max_delta, r->metrics.differing,
+                r->render_min, r->render_p50, r->flush_min, r->flush_p50, i + 1 < count ? "," : "");
+    }
+    fprintf(fh, "  ]\n}\n");
+}
+
+int main(int argc, const char *argv[]) {
+    const char *dir = "reference", *out = "timings.json", *filter = NULL;
+    bool update = false;
+    int runs = 5;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "-u"))
+            update = true;
+        else if (!strcmp(argv[i], "-d") && i + 1 < argc)
+            dir = argv[++i];
+        else if (!strcmp(argv[i], "-o") && i + 1 < argc)
+            out = argv[++i];
+        else if (!strcmp(argv[i], "-f") && i + 1 < argc)
+            filter = argv[++i];
+        else if (!strcmp(argv[i], "-n") && i + 1 < argc && (runs = atoi(argv[++i])) >= 1 && runs <= MAX_RUNS)
+            continue;
+        else {
+            fprintf(stderr, "usage: %s [-u] [-d dir] [-o timings.json] [-f name-filter] [-n runs (1-%d)]\n", argv[0], MAX_RUNS);
+            return 1;
+        }
+    }
+
+    char path[512];
+    snprintf(path, sizeof(path), "%s/hashes.txt", dir);
+    load_hashes(path);
+
+    Result results[MAX_SCENES];
+    int count = 0, failures = 0;
+    printf("%-14s %-6s %10s %10s %12s %12s\n", "scene", "result", "max delta", "differing", "render us", "flush us");
+    for (size_t i = 0; i < sizeof(scenes) / sizeof(scenes[0]); ++i) {
+        const Scene *sc = &scenes[i];
+        if (filter && !strstr(sc->name, filter))
+            continue;
+        Result *r = &results[count++];
+        Surface frame;
+        memset(r, 0, sizeof(Result));
+        r->name = sc->name;
+        if (!render(sc, runs, &frame, r)) {
+            fprintf(stderr, "%s: failed to render\n", sc->name);
+            ++failures;
+            continue;
+        }
+        r->passed = check(sc, dir, update, &frame, r);
+        DestroySurface(&frame);
+        if (!r->passed)
+            ++failures;
+        printf("%-14s %-6s %10d %10zu %12.1f %12.1f\n", sc->name, update ? "saved" : !r->passed ? "FAIL" : r->exact ? "exact" : "close",
+               r->metrics.max_delta, r->metrics.differing, r->render_p50 / 1e3, r->flush_p50 / 1e3);
+    }
+    CloseAllWindows();
+
+    if (update && !save_hashes(path)) {
+        fprintf(stderr, "can't write %s\n", path);
+        ++failures;
+    }
+    if (out && *out) {
+        FILE *fh = strcmp(out, "-") ? fopen(out, "w") : stdout;
+        if (fh) {
+            write_json(fh, results, count, runs);
+            if (fh != stdout)
+                fclose(fh);
+        } else
+            fprintf(stderr, "can't open %s\n", out);
+    }
+    printf("%d scenes, %d failed\n", count, failures);
+    return failures ? 1 : 0;
+}
@@ -2,22 +2,25 @@
 echo "Running $# tests..."
 
 count=0
-successes=0
 failures=0
 for exe in "$@"
 do
-    ((count++))
-    printf " * #$count ($exe)..."
-    if [ $? = 0 ]; then
-        echo "[SUCCESS]"
-        ((successes++))
+    count=$((count + 1))
+    echo " * #$count ($exe)..."
+    start=$(date +%s)
+    ./"$exe"
+    status=$?
+    elapsed=$(($(date +%s) - start))
+    if [ $status -eq 0 ]; then
+        echo "[SUCCESS] $exe (${elapsed}s)"
     else
-        echo "[FAILED]"
-        ((failures++))
+        echo "[FAILED] $exe exited with $status (${elapsed}s)"
+        failures=$((failures + 1))
     fi
 done
-if [ $failures = 0 ]; then
+if [ $failures -eq 0 ]; then
     echo "ALL TESTS COMPLETED SUCCESSFULLY"
 else
-    echo "#$count tests run, $failures failed"
+    echo "$count tests run, $failures failed"
+    exit 1
 fi